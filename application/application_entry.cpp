@@ -23,6 +23,8 @@
 #include "application.hpp"
 #include "filesystem.hpp"
 #include "path_utils.hpp"
+#include "async_logger.hpp"
+#include "environment.hpp"
 
 //#define USE_FP_EXCEPTIONS
 #ifdef USE_FP_EXCEPTIONS
@@ -55,6 +57,25 @@ void application_setup_default_filesystem(const char *default_asset_directory)
 	if (filesystem)
 		Filesystem::setup_default_filesystem(filesystem, default_asset_directory);
 }
+
+// GRANITE_ASYNC_LOGGING=1 moves log output to a background thread, =binary also defers formatting.
+// GRANITE_LOG_RATE_LIMIT=N allows at most N messages per second from any one call site.
+static std::unique_ptr<Util::AsyncLogger> create_async_logger()
+{
+	std::string mode;
+	if (!Util::get_environment("GRANITE_ASYNC_LOGGING", mode) || mode.empty() || mode == "0")
+		return {};
+
+	Util::AsyncLoggerOptions options;
+	if (mode == "binary")
+		options.mode = Util::AsyncLoggerOptions::Mode::Binary;
+	options.rate_limit_messages = Util::get_environment_uint("GRANITE_LOG_RATE_LIMIT", 0);
+
+	std::unique_ptr<Util::AsyncLogger> logger(new Util::AsyncLogger(options));
+	logger->install_exit_handlers();
+	Util::set_global_logging_interface(logger.get());
+	return logger;
+}
 }
 
 #ifdef USE_WINMAIN
@@ -85,6 +106,8 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+	auto async_logger = Granite::create_async_logger();
+
 #ifdef APPLICATION_ENTRY_HEADLESS
 	int ret = Granite::application_main_headless(Granite::query_application_interface,
 												 Granite::application_create,
@@ -95,6 +118,7 @@ int main(int argc, char *argv[])
 	                                    argc, argv);
 #endif
 
+	Util::set_global_logging_interface(nullptr);
 	return ret;
 }
 
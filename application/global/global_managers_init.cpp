@@ -119,7 +119,8 @@ struct FactoryImplementation : Factory
 	PhysicsSystemInterface *create_physics_system() override
 	{
 #ifdef HAVE_GRANITE_PHYSICS
-		return new PhysicsSystem;
+		// Only used with GRANITE_BULLET_MULTITHREADED. iterate() must then run on the main thread.
+		return new PhysicsSystem(GRANITE_THREAD_GROUP());
 #else
 		return nullptr;
 #endif
@@ -102,6 +102,10 @@ void main()
 
     #if defined(VARIANT_BIT_4) && VARIANT_BIT_4
         color = vec4(1.0, 1.0, 1.0, color.r);
+    #elif defined(VARIANT_BIT_6) && VARIANT_BIT_6
+        // Distance field with the edge at 0.5. Keep the edge about a pixel wide at any scale.
+        mediump float edge_width = 0.7 * fwidth(color.r);
+        color = vec4(1.0, 1.0, 1.0, smoothstep(0.5 - edge_width, 0.5 + edge_width, color.r));
     #endif
 
     #if defined(ALPHA_TEST)
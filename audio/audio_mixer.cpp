@@ -367,6 +367,10 @@ void Mixer::dispose_dead_streams()
 			stream_generation[bit + 32 * i] = 0;
 		});
 	}
+
+	for (auto *stream : mixer_streams)
+		if (stream)
+			stream->non_critical_update();
 }
 
 Util::LockFreeMessageQueue &Mixer::get_message_queue()
@@ -53,6 +53,12 @@ public:
 
 	virtual void install_message_queue(StreamID id, Util::LockFreeMessageQueue *queue);
 
+	// Called regularly from a non-critical thread through Mixer::dispose_dead_streams().
+	// Runs concurrently with accumulate_samples(), so anything touched by both must be synchronized.
+	virtual void non_critical_update()
+	{
+	}
+
 	// The first call made by mixer.
 	// The stream can adjust its output mixer output rate and number of channels
 	// to match the mixer.
@@ -104,6 +110,7 @@ public:
 	void kill_stream(StreamID id);
 
 	// Garbage collection. Should be called regularly from a non-critical thread.
+	// Live streams also get their non_critical_update() called from here.
 	void dispose_dead_streams();
 
 	// Atomically sets stream parameters, such as gain and panning.
@@ -46,6 +46,12 @@ public:
 			source->install_message_queue(id, queue);
 	}
 
+	void non_critical_update() override
+	{
+		if (source)
+			source->non_critical_update();
+	}
+
 	float get_sample_rate() const override
 	{
 		return sample_rate;
@@ -63,7 +69,7 @@ private:
 	size_t max_num_frames = 0;
 
 	std::vector<float> input_buffer[Backend::MaxAudioChannels];
-	std::unique_ptr<DSP::SincResampler> resamplers[Backend::MaxAudioChannels];
+	std::unique_ptr<DSP::SincResampler> resampler;
 };
 }
 }
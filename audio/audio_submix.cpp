@@ -0,0 +1,173 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "audio_submix.hpp"
+#include "dsp/dsp.hpp"
+#include "thread_name.hpp"
+#include <algorithm>
+#include <chrono>
+
+namespace Granite
+{
+namespace Audio
+{
+SubMixStream::SubMixStream()
+	: SubMixStream(SubMixOptions{})
+{
+}
+
+SubMixStream::SubMixStream(const SubMixOptions &options_)
+	: options(options_)
+{
+	worker_dead = false;
+	underruns = 0;
+	if (options.render_ahead_blocks < 2)
+		options.render_ahead_blocks = 2;
+}
+
+SubMixStream::~SubMixStream()
+{
+	stop_worker();
+}
+
+void SubMixStream::stop_worker()
+{
+	if (!worker.joinable())
+		return;
+
+	worker_dead.store(true, std::memory_order_release);
+	worker.join();
+	worker_dead.store(false, std::memory_order_relaxed);
+}
+
+bool SubMixStream::setup(float mixer_output_rate, unsigned mixer_channels, size_t max_num_frames)
+{
+	stop_worker();
+
+	sample_rate = mixer_output_rate;
+	num_channels = mixer_channels;
+	block_frames = max_num_frames;
+
+	for (auto &buffer : mix_buffer)
+		buffer.clear();
+	for (unsigned c = 0; c < num_channels; c++)
+		mix_buffer[c].resize(block_frames);
+
+	mixer.set_backend_parameters(sample_rate, num_channels, block_frames);
+	mixer.on_backend_start();
+
+	if (options.render_ahead)
+	{
+		size_t ring_frames = options.render_ahead_blocks * block_frames;
+		ring.reset(ring_frames * num_channels);
+		write_buffer.resize(block_frames * num_channels);
+		read_buffer.resize(block_frames * num_channels);
+
+		// Play cursors on the bus should not count frames which are still sitting in the ring.
+		mixer.set_latency_usec(uint32_t(1e6 * double(ring_frames) / double(sample_rate)));
+		worker = std::thread(&SubMixStream::render_ahead_loop, this);
+	}
+
+	return true;
+}
+
+void SubMixStream::render_ahead_loop()
+{
+	Util::set_current_thread_name("audio-submix");
+
+	float *mix_channels[Backend::MaxAudioChannels];
+	for (unsigned c = 0; c < num_channels; c++)
+		mix_channels[c] = mix_buffer[c].data();
+
+	const size_t block_samples = block_frames * num_channels;
+
+	// Waking us up could make a syscall in the mixer callback, so poll instead.
+	// The ring holds at least two blocks, and a quarter block leaves plenty of time to refill it.
+	const auto poll_interval = std::chrono::microseconds(
+			std::min<int64_t>(1000, int64_t(0.25e6 * double(block_frames) / double(sample_rate))));
+
+	while (!worker_dead.load(std::memory_order_acquire))
+	{
+		if (ring.write_avail() < block_samples)
+		{
+			std::this_thread::sleep_for(poll_interval);
+			continue;
+		}
+
+		mixer.mix_samples(mix_channels, block_frames);
+
+		if (num_channels == 2)
+		{
+			DSP::interleave_stereo_f32(write_buffer.data(), mix_channels[0], mix_channels[1], block_frames);
+		}
+		else
+		{
+			for (size_t i = 0; i < block_frames; i++)
+				for (unsigned c = 0; c < num_channels; c++)
+					write_buffer[i * num_channels + c] = mix_channels[c][i];
+		}
+
+		ring.write_and_move(write_buffer.data(), block_samples);
+	}
+}
+
+size_t SubMixStream::accumulate_samples(float *const *channels, const float *gain, size_t num_frames) noexcept
+{
+	if (!options.render_ahead)
+	{
+		float *mix_channels[Backend::MaxAudioChannels];
+		for (unsigned c = 0; c < num_channels; c++)
+			mix_channels[c] = mix_buffer[c].data();
+
+		mixer.mix_samples(mix_channels, num_frames);
+
+		for (unsigned c = 0; c < num_channels; c++)
+			DSP::accumulate_channel(channels[c], mix_channels[c], gain[c], num_frames);
+		return num_frames;
+	}
+
+	size_t read_frames = std::min<size_t>(ring.read_avail() / num_channels, num_frames);
+	if (read_frames)
+	{
+		ring.read_and_move(read_buffer.data(), read_frames * num_channels);
+
+		if (num_channels == 2)
+		{
+			DSP::accumulate_channel_deinterleave_stereo(channels[0], channels[1], read_buffer.data(),
+			                                            gain, read_frames);
+		}
+		else
+		{
+			for (size_t i = 0; i < read_frames; i++)
+				for (unsigned c = 0; c < num_channels; c++)
+					channels[c][i] += read_buffer[i * num_channels + c] * gain[c];
+		}
+	}
+
+	// The bus never ends by itself, pad with silence.
+	if (read_frames < num_frames)
+		underruns.fetch_add(1, std::memory_order_relaxed);
+
+	return num_frames;
+}
+}
+}
@@ -0,0 +1,106 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "audio_mixer.hpp"
+#include <atomic>
+#include <thread>
+
+namespace Granite
+{
+namespace Audio
+{
+struct SubMixOptions
+{
+	// Mix the bus ahead of time on a dedicated thread.
+	// The mixer callback then only has to copy out of a ring buffer.
+	// Voices on the bus get render_ahead_blocks * max_num_frames of extra latency.
+	bool render_ahead = false;
+	unsigned render_ahead_blocks = 4;
+};
+
+// A mixer stream which owns a mixer of its own.
+// Adding buses to the top-level mixer raises the voice limit from MaxSources to MaxSources * MaxSources.
+// Voices are added through get_mixer() after the bus itself has been added to a mixer.
+class SubMixStream final : public MixerStream
+{
+public:
+	SubMixStream();
+	explicit SubMixStream(const SubMixOptions &options);
+	~SubMixStream();
+
+	bool setup(float mixer_output_rate, unsigned mixer_channels, size_t max_num_frames) override;
+	size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept override;
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return sample_rate;
+	}
+
+	// Pumps dispose_dead_streams() on the bus along with the top-level mixer.
+	void non_critical_update() override
+	{
+		mixer.dispose_dead_streams();
+	}
+
+	// Same threading rules as the top-level mixer.
+	// Its dispose_dead_streams() runs whenever the top-level mixer's does.
+	Mixer &get_mixer()
+	{
+		return mixer;
+	}
+
+	// Number of callbacks which had to be padded with silence because the render-ahead thread fell behind.
+	uint64_t get_underrun_count() const
+	{
+		return underruns.load(std::memory_order_relaxed);
+	}
+
+private:
+	Mixer mixer;
+	SubMixOptions options;
+	float sample_rate = 0.0f;
+	unsigned num_channels = 0;
+	size_t block_frames = 0;
+
+	std::vector<float> mix_buffer[Backend::MaxAudioChannels];
+
+	// Interleaved frames, written by the render-ahead thread and read by the mixer callback.
+	Util::LockFreeRingBuffer<float> ring;
+	std::vector<float> write_buffer;
+	std::vector<float> read_buffer;
+
+	std::thread worker;
+	std::atomic_bool worker_dead;
+	std::atomic_uint64_t underruns;
+
+	void render_ahead_loop();
+	void stop_worker();
+};
+}
+}
@@ -0,0 +1,173 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#define NOMINMAX
+#include "decode_ahead_stream.hpp"
+#include "dsp/dsp.hpp"
+#include <algorithm>
+
+namespace Granite
+{
+namespace Audio
+{
+bool DecodeAheadStream::init(std::unique_ptr<PCMDecoder> decoder_, bool looping_, float ahead_seconds)
+{
+	decoder = std::move(decoder_);
+	looping = looping_;
+	end_of_stream.store(false, std::memory_order_relaxed);
+	cancel_decode.store(false, std::memory_order_relaxed);
+
+	sample_rate = decoder->get_sample_rate();
+	num_input_channels = decoder->get_num_channels();
+	if (num_input_channels < 1 || num_input_channels > Backend::MaxAudioChannels)
+		return false;
+
+	ring_frames = std::max<size_t>(size_t(ahead_seconds * sample_rate), 4 * 1024);
+	ring.reset(ring_frames * num_input_channels);
+
+	// Fill up front here, since we're not on the mixer thread and playback should not start with silence.
+	decode_ahead();
+	return true;
+}
+
+bool DecodeAheadStream::setup(float, unsigned mixer_channels, size_t num_frames)
+{
+	num_mixer_channels = mixer_channels;
+	if (num_mixer_channels != num_input_channels && num_input_channels != 1)
+		return false;
+
+	read_buffer.resize(num_frames * num_input_channels);
+	return true;
+}
+
+void DecodeAheadStream::decode_ahead() noexcept
+{
+	constexpr size_t BlockFrames = 512;
+	float block[Backend::MaxAudioChannels][BlockFrames];
+	float interleaved[Backend::MaxAudioChannels * BlockFrames];
+	float *block_channels[Backend::MaxAudioChannels];
+	for (unsigned c = 0; c < num_input_channels; c++)
+		block_channels[c] = block[c];
+
+	bool rewound = false;
+	while (!cancel_decode.load(std::memory_order_relaxed) &&
+	       ring.write_avail() >= BlockFrames * num_input_channels)
+	{
+		int ret = decoder->decode(block_channels, unsigned(BlockFrames));
+
+		if (ret == 0 && looping && !rewound)
+		{
+			decoder->rewind();
+			rewound = true;
+			continue;
+		}
+
+		if (ret <= 0)
+		{
+			end_of_stream.store(true, std::memory_order_release);
+			break;
+		}
+
+		rewound = false;
+		size_t frames = size_t(ret);
+
+		if (num_input_channels == 1)
+		{
+			ring.write_and_move(block[0], frames);
+			continue;
+		}
+
+		for (size_t i = 0; i < frames; i++)
+			for (unsigned c = 0; c < num_input_channels; c++)
+				interleaved[i * num_input_channels + c] = block[c][i];
+		ring.write_and_move(interleaved, frames * num_input_channels);
+	}
+}
+
+void DecodeAheadStream::non_critical_update()
+{
+	if (end_of_stream.load(std::memory_order_relaxed))
+		return;
+
+	if (decode_task && !decode_task->poll())
+		return;
+	decode_task.reset();
+
+	// Refill once half the ring has been played back.
+	if (ring.write_avail() < (ring_frames / 2) * num_input_channels)
+		return;
+
+	auto *group = GRANITE_THREAD_GROUP();
+	if (!group)
+	{
+		decode_ahead();
+		return;
+	}
+
+	decode_task = group->create_task([this]() {
+		decode_ahead();
+	});
+	decode_task->set_task_class(TaskClass::Background);
+	decode_task->set_desc("audio-decode-ahead");
+	decode_task->flush();
+}
+
+size_t DecodeAheadStream::accumulate_samples(float *const *channels, const float *gains, size_t num_frames) noexcept
+{
+	// Check before reading, so that an empty ring after end of stream really means we are done.
+	bool eos = end_of_stream.load(std::memory_order_acquire);
+
+	size_t frames = std::min(ring.read_avail() / num_input_channels, num_frames);
+	if (frames)
+	{
+		ring.read_and_move(read_buffer.data(), frames * num_input_channels);
+
+		if (num_input_channels == 1)
+		{
+			for (unsigned c = 0; c < num_mixer_channels; c++)
+				DSP::accumulate_channel(channels[c], read_buffer.data(), gains[c], frames);
+		}
+		else if (num_input_channels == 2)
+		{
+			DSP::accumulate_channel_deinterleave_stereo(channels[0], channels[1], read_buffer.data(), gains, frames);
+		}
+		else
+		{
+			for (size_t i = 0; i < frames; i++)
+				for (unsigned c = 0; c < num_mixer_channels; c++)
+					channels[c][i] += read_buffer[i * num_input_channels + c] * gains[c];
+		}
+	}
+
+	// If decoding fell behind, pad with silence rather than ending the stream.
+	return eos ? frames : num_frames;
+}
+
+DecodeAheadStream::~DecodeAheadStream()
+{
+	cancel_decode.store(true, std::memory_order_relaxed);
+	if (decode_task)
+		decode_task->wait();
+}
+}
+}
@@ -0,0 +1,93 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "audio_mixer.hpp"
+#include "message_queue.hpp"
+#include "thread_group.hpp"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace Granite
+{
+namespace Audio
+{
+// Source of planar PCM for DecodeAheadStream. Only ever called from one thread at a time.
+class PCMDecoder
+{
+public:
+	virtual ~PCMDecoder() = default;
+
+	virtual float get_sample_rate() const = 0;
+	virtual unsigned get_num_channels() const = 0;
+
+	// Returns the number of frames decoded, 0 at end of stream, or negative on error.
+	virtual int decode(float **channels, unsigned num_frames) = 0;
+	virtual void rewind() = 0;
+};
+
+// Keeps a ring of decoded audio ahead of playback, refilled by a background task.
+// The mixer thread only copies out of the ring, and pads with silence if decoding falls behind.
+class DecodeAheadStream : public MixerStream
+{
+public:
+	~DecodeAheadStream();
+	bool init(std::unique_ptr<PCMDecoder> decoder, bool looping, float ahead_seconds);
+
+	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override;
+	void non_critical_update() override;
+	bool setup(float mixer_output_rate, unsigned mixer_channels, size_t num_frames) override;
+
+	float get_sample_rate() const override
+	{
+		return sample_rate;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_mixer_channels;
+	}
+
+private:
+	void decode_ahead() noexcept;
+
+	std::unique_ptr<PCMDecoder> decoder;
+
+	float sample_rate = 0.0f;
+	unsigned num_input_channels = 0;
+	unsigned num_mixer_channels = 0;
+	bool looping = false;
+
+	// Interleaved frames. Written by whoever runs decode_ahead(), of which there is only ever one at a time.
+	Util::LockFreeRingBuffer<float> ring;
+	size_t ring_frames = 0;
+	std::vector<float> read_buffer;
+
+	TaskGroupHandle decode_task;
+	std::atomic_bool end_of_stream;
+	std::atomic_bool cancel_decode;
+};
+}
+}
@@ -0,0 +1,139 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#define NOMINMAX
+#include "decoded_pcm.hpp"
+#include "dsp/sinc_resampler.hpp"
+#include "global_managers.hpp"
+#include "thread_group.hpp"
+#include <algorithm>
+
+namespace Granite
+{
+namespace Audio
+{
+DecodedPCMHandle resample_pcm(const DecodedPCM &pcm, float sample_rate)
+{
+	auto resampled = Util::make_handle<DecodedPCM>();
+	resampled->sample_rate = sample_rate;
+	resampled->num_channels = pcm.num_channels;
+	resampled->num_frames = size_t(double(pcm.num_frames) * sample_rate / pcm.sample_rate);
+
+	DSP::SincResampler resampler(sample_rate, pcm.sample_rate, DSP::SincResampler::Quality::Medium, pcm.num_channels);
+	size_t needed_input = resampler.get_maximum_input_for_output_frames(resampled->num_frames);
+
+	std::vector<float> input[Backend::MaxAudioChannels];
+	const float *input_ptrs[Backend::MaxAudioChannels];
+	float *output_ptrs[Backend::MaxAudioChannels];
+	for (unsigned c = 0; c < pcm.num_channels; c++)
+	{
+		input[c].assign(pcm.channels[c].begin(), pcm.channels[c].end());
+		input[c].resize(std::max(needed_input, pcm.num_frames));
+		resampled->channels[c].resize(resampled->num_frames);
+		input_ptrs[c] = input[c].data();
+		output_ptrs[c] = resampled->channels[c].data();
+	}
+
+	resampler.process_output_frames(output_ptrs, input_ptrs, resampled->num_frames);
+
+	return resampled;
+}
+
+DecodedPCMCache::DecodedPCMCache()
+{
+	set_budget(DefaultBudget);
+}
+
+uint64_t DecodedPCMCache::get_key(const std::string &path, float sample_rate)
+{
+	Util::Hasher h;
+	h.string(path);
+	h.f32(sample_rate);
+	return h.get();
+}
+
+DecodedPCMHandle DecodedPCMCache::find(uint64_t key)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	auto *entry = lru.find_and_mark_as_recent(key);
+	return entry ? *entry : DecodedPCMHandle{};
+}
+
+DecodedPCMHandle DecodedPCMCache::insert(uint64_t key, DecodedPCMHandle pcm)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	if (!is_cacheable_locked(pcm->get_size()))
+		return pcm;
+
+	auto *existing = lru.find_and_mark_as_recent(key);
+	if (existing)
+		return *existing;
+
+	*lru.allocate(key, pcm->get_size()) = pcm;
+	lru.prune();
+	return pcm;
+}
+
+DecodedPCMHandle DecodedPCMCache::find_resampled(uint64_t key, const DecodedPCMHandle &pcm, float sample_rate)
+{
+	auto *group = GRANITE_THREAD_GROUP();
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		auto *entry = lru.find_and_mark_as_recent(key);
+		if (entry)
+			return *entry;
+
+		size_t resampled_size = size_t(double(pcm->get_size()) * sample_rate / pcm->sample_rate);
+		if (!group || !is_cacheable_locked(resampled_size) || pending_resamples.count(key))
+			return {};
+		pending_resamples.insert(key);
+	}
+
+	// The handle keeps the source clip alive even if it is evicted meanwhile.
+	auto task = group->create_task([this, key, pcm, sample_rate]() {
+		insert(key, resample_pcm(*pcm, sample_rate));
+		std::lock_guard<std::mutex> holder{lock};
+		pending_resamples.erase(key);
+	});
+	task->set_task_class(TaskClass::Background);
+	task->set_desc("pcm-resample");
+	task->flush();
+	return {};
+}
+
+bool DecodedPCMCache::is_cacheable(size_t size)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	return is_cacheable_locked(size);
+}
+
+void DecodedPCMCache::set_budget(size_t budget_)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	budget = budget_;
+	lru.set_total_cost(budget);
+	lru.prune();
+}
+}
+}
@@ -0,0 +1,96 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "audio_interface.hpp"
+#include "lru_cache.hpp"
+#include "intrusive.hpp"
+#include "hash.hpp"
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace Granite
+{
+namespace Audio
+{
+struct DecodedPCM : Util::ThreadSafeIntrusivePtrEnabled<DecodedPCM>
+{
+	std::vector<float> channels[Backend::MaxAudioChannels];
+	size_t num_frames = 0;
+	unsigned num_channels = 0;
+	float sample_rate = 0.0f;
+
+	size_t get_size() const
+	{
+		return num_frames * num_channels * sizeof(float);
+	}
+};
+using DecodedPCMHandle = Util::IntrusivePtr<DecodedPCM>;
+
+// Resamples with the same quality as the mixer's real-time resampler,
+// so cached and uncached playback sound the same.
+DecodedPCMHandle resample_pcm(const DecodedPCM &pcm, float sample_rate);
+
+// Decoded clips which outlive their streams, so playing the same sound effect again is just a mix.
+// Entries are keyed by path and sample rate. A clip is kept at its own rate (keyed as rate 0),
+// and at the mixer rate when that differs, which lets streams skip the real-time resampler.
+class DecodedPCMCache
+{
+public:
+	enum { DefaultBudget = 32 * 1024 * 1024 };
+
+	DecodedPCMCache();
+
+	static uint64_t get_key(const std::string &path, float sample_rate);
+
+	DecodedPCMHandle find(uint64_t key);
+
+	// Returns the clip which ended up in the cache, which is an existing one if another thread got there first.
+	DecodedPCMHandle insert(uint64_t key, DecodedPCMHandle pcm);
+
+	// Returns pcm resampled to sample_rate if that is cached already.
+	// Otherwise, starts resampling it into the cache on a background task and returns nullptr,
+	// so the caller never waits for the resampler. Nothing is started if the result would not be cached,
+	// if the same key is already being resampled, or if there is no thread group.
+	DecodedPCMHandle find_resampled(uint64_t key, const DecodedPCMHandle &pcm, float sample_rate);
+
+	bool is_cacheable(size_t size);
+	void set_budget(size_t budget);
+
+private:
+	std::mutex lock;
+	Util::LRUCache<DecodedPCMHandle> lru;
+	std::unordered_set<uint64_t> pending_resamples;
+	size_t budget = 0;
+
+	// Long clips would just push everything else out, and should be streamed anyway.
+	bool is_cacheable_locked(size_t size) const
+	{
+		return size <= budget / 4;
+	}
+};
+}
+}
@@ -100,6 +100,12 @@ public:
 			source->install_message_queue(id, queue);
 	}
 
+	void non_critical_update() override
+	{
+		if (source)
+			source->non_critical_update();
+	}
+
 	bool setup(float mixer_output_rate, unsigned mixer_channels, size_t) override
 	{
 		if (!source->setup(mixer_output_rate, mixer_channels, block_size))
@@ -0,0 +1,479 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define NOMINMAX
+#include "convolution_reverb.hpp"
+#include "dsp/dsp.hpp"
+#include "fft.h"
+#include "bitops.hpp"
+#include "thread_name.hpp"
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+namespace Granite
+{
+namespace Audio
+{
+namespace DSP
+{
+// Uniformly partitioned overlap-save convolution of one segment of the impulse response.
+// Every process() call consumes one partition worth of input and produces as much output.
+// muFFT needs aligned data, so buffers use its raw alloc/free.
+class PartitionedConvolver
+{
+public:
+	~PartitionedConvolver()
+	{
+		mufft_free_plan_1d(forward);
+		mufft_free_plan_1d(inverse);
+		mufft_free(filter_spectra);
+		mufft_free(delay_lines);
+		mufft_free(windows);
+		mufft_free(accum);
+		mufft_free(time_domain);
+	}
+
+	bool init(unsigned block_frames_, unsigned num_channels_,
+	          const std::vector<float> *impulse, unsigned impulse_channels_,
+	          size_t offset, size_t frames)
+	{
+		block_frames = block_frames_;
+		fft_frames = 2 * block_frames;
+		num_channels = num_channels_;
+		impulse_channels = impulse_channels_;
+		num_bins = block_frames + 1;
+		// Keeps every spectrum 64 byte aligned.
+		spectrum_stride = (2 * num_bins + 15) & ~15u;
+		num_partitions = unsigned((frames + block_frames - 1) / block_frames);
+
+		forward = mufft_create_plan_1d_r2c(fft_frames, MUFFT_FLAG_CPU_ANY);
+		inverse = mufft_create_plan_1d_c2r(fft_frames, MUFFT_FLAG_CPU_ANY);
+		if (!forward || !inverse)
+			return false;
+
+		filter_spectra = allocate_float(size_t(impulse_channels) * num_partitions * spectrum_stride);
+		delay_lines = allocate_float(size_t(num_channels) * num_partitions * spectrum_stride);
+		windows = allocate_float(size_t(num_channels) * fft_frames);
+		accum = allocate_float(spectrum_stride);
+		time_domain = allocate_float(fft_frames);
+		if (!filter_spectra || !delay_lines || !windows || !accum || !time_domain)
+			return false;
+
+		// The inverse FFT is unnormalized, fold that into the filter.
+		const float scale = 1.0f / float(fft_frames);
+		for (unsigned c = 0; c < impulse_channels; c++)
+		{
+			for (unsigned p = 0; p < num_partitions; p++)
+			{
+				size_t start = offset + size_t(p) * block_frames;
+				size_t count = std::min<size_t>(block_frames, offset + frames - start);
+				memset(time_domain, 0, fft_frames * sizeof(float));
+				for (size_t i = 0; i < count; i++)
+					time_domain[i] = impulse[c][start + i] * scale;
+				mufft_execute_plan_1d(forward, get_filter(c, p), time_domain);
+			}
+		}
+
+		return true;
+	}
+
+	void process(float * const *output, const float * const *input) noexcept
+	{
+		for (unsigned c = 0; c < num_channels; c++)
+		{
+			// Overlap-save, the FFT window is the previous block followed by the new one.
+			float *window = windows + size_t(c) * fft_frames;
+			memmove(window, window + block_frames, block_frames * sizeof(float));
+			memcpy(window + block_frames, input[c], block_frames * sizeof(float));
+			mufft_execute_plan_1d(forward, get_delay_line(c, delay_line_index), window);
+
+			// Frequency-domain delay line, the newest input spectrum meets the first partition.
+			memset(accum, 0, spectrum_stride * sizeof(float));
+			const unsigned filter_channel = impulse_channels == 1 ? 0 : c;
+			unsigned index = delay_line_index;
+			for (unsigned p = 0; p < num_partitions; p++)
+			{
+				complex_multiply_accumulate(accum, get_delay_line(c, index), get_filter(filter_channel, p), num_bins);
+				index = index ? index - 1 : num_partitions - 1;
+			}
+
+			// Only the second half is free of circular wrap-around.
+			mufft_execute_plan_1d(inverse, time_domain, accum);
+			memcpy(output[c], time_domain + block_frames, block_frames * sizeof(float));
+		}
+
+		delay_line_index = (delay_line_index + 1) % num_partitions;
+		silent_blocks = 0;
+	}
+
+	// Feeds count blocks of silence without producing output, for blocks whose input was dropped.
+	void process_silence(uint32_t count) noexcept
+	{
+		// Once every window and delay line is zero, further silence changes nothing.
+		count = std::min(count, num_partitions + 1);
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			for (unsigned c = 0; c < num_channels; c++)
+			{
+				float *window = windows + size_t(c) * fft_frames;
+				memmove(window, window + block_frames, block_frames * sizeof(float));
+				memset(window + block_frames, 0, block_frames * sizeof(float));
+
+				// After one silent block the whole window is zero, and so is its spectrum.
+				if (silent_blocks)
+					memset(get_delay_line(c, delay_line_index), 0, spectrum_stride * sizeof(float));
+				else
+					mufft_execute_plan_1d(forward, get_delay_line(c, delay_line_index), window);
+			}
+
+			delay_line_index = (delay_line_index + 1) % num_partitions;
+			silent_blocks++;
+		}
+	}
+
+private:
+	mufft_plan_1d *forward = nullptr;
+	mufft_plan_1d *inverse = nullptr;
+	unsigned block_frames = 0;
+	unsigned fft_frames = 0;
+	unsigned num_bins = 0;
+	unsigned spectrum_stride = 0;
+	unsigned num_partitions = 0;
+	unsigned num_channels = 0;
+	unsigned impulse_channels = 0;
+	unsigned delay_line_index = 0;
+	unsigned silent_blocks = 0;
+
+	float *filter_spectra = nullptr;
+	float *delay_lines = nullptr;
+	float *windows = nullptr;
+	float *accum = nullptr;
+	float *time_domain = nullptr;
+
+	static float *allocate_float(size_t count)
+	{
+		return static_cast<float *>(mufft_calloc(count * sizeof(float)));
+	}
+
+	float *get_filter(unsigned channel, unsigned partition) const
+	{
+		return filter_spectra + (size_t(channel) * num_partitions + partition) * spectrum_stride;
+	}
+
+	float *get_delay_line(unsigned channel, unsigned partition) const
+	{
+		return delay_lines + (size_t(channel) * num_partitions + partition) * spectrum_stride;
+	}
+};
+
+ConvolutionReverbStream::ConvolutionReverbStream(MixerStream *source_, const float * const *impulse_,
+                                                 unsigned impulse_channels_, size_t impulse_frames_,
+                                                 const ConvolutionReverbOptions &options_)
+	: source(source_), options(options_), impulse_channels(impulse_channels_), impulse_frames(impulse_frames_)
+{
+	worker_dead = false;
+	submitted_tail_blocks = 0;
+	completed_tail_blocks = 0;
+	late_tail_blocks = 0;
+
+	for (unsigned c = 0; c < impulse_channels; c++)
+		impulse[c].assign(impulse_[c], impulse_[c] + impulse_frames);
+}
+
+ConvolutionReverbStream::~ConvolutionReverbStream()
+{
+	stop_worker();
+	if (source)
+		source->dispose();
+}
+
+void ConvolutionReverbStream::stop_worker()
+{
+	if (!worker.joinable())
+		return;
+
+	worker_dead.store(true, std::memory_order_release);
+	worker.join();
+	worker_dead.store(false, std::memory_order_relaxed);
+}
+
+bool ConvolutionReverbStream::setup(float mixer_output_rate, unsigned mixer_channels, size_t max_num_frames)
+{
+	stop_worker();
+
+	if (!impulse_frames || impulse_channels == 0 || impulse_channels > Backend::MaxAudioChannels)
+		return false;
+
+	if (options.head_block_frames)
+		head_frames = Util::next_pow2(options.head_block_frames);
+	else
+		head_frames = Util::next_pow2(unsigned(std::max<size_t>(max_num_frames, 32)));
+
+	if (options.tail_block_frames)
+		tail_frames = std::max(Util::next_pow2(options.tail_block_frames), 2 * head_frames);
+	else
+		tail_frames = 16 * head_frames;
+
+	if (!source->setup(mixer_output_rate, mixer_channels, head_frames))
+		return false;
+
+	num_channels = source->get_num_channels();
+	sample_rate = source->get_sample_rate();
+	if (impulse_channels != 1 && impulse_channels != num_channels)
+		return false;
+
+	size_t head_length = std::min<size_t>(impulse_frames, 2 * tail_frames);
+	head.reset(new PartitionedConvolver);
+	if (!head->init(head_frames, num_channels, impulse, impulse_channels, 0, head_length))
+		return false;
+
+	tail.reset();
+	if (impulse_frames > head_length)
+	{
+		tail.reset(new PartitionedConvolver);
+		if (!tail->init(tail_frames, num_channels, impulse, impulse_channels,
+		                head_length, impulse_frames - head_length))
+		{
+			return false;
+		}
+	}
+
+	for (unsigned c = 0; c < Backend::MaxAudioChannels; c++)
+	{
+		source_block[c].clear();
+		wet_block[c].clear();
+		out_block[c].clear();
+		for (unsigned i = 0; i < 2; i++)
+		{
+			tail_input[i][c].clear();
+			tail_output[i][c].clear();
+		}
+	}
+
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		source_block[c].resize(head_frames);
+		wet_block[c].resize(head_frames);
+		out_block[c].resize(head_frames);
+		if (tail)
+		{
+			for (unsigned i = 0; i < 2; i++)
+			{
+				tail_input[i][c].resize(tail_frames);
+				tail_output[i][c].resize(tail_frames);
+			}
+		}
+	}
+
+	current_read = head_frames;
+	source_done = false;
+	ring_out_frames = 0;
+	tail_fill = 0;
+	tail_block = 0;
+	tail_gathering = true;
+	tail_output_active = false;
+	processed_tail_blocks = 0;
+	submitted_tail_blocks.store(0, std::memory_order_relaxed);
+	completed_tail_blocks.store(0, std::memory_order_relaxed);
+
+	if (tail && options.background_tail)
+		worker = std::thread(&ConvolutionReverbStream::tail_worker_loop, this);
+
+	return true;
+}
+
+void ConvolutionReverbStream::run_tail_job(uint32_t block) noexcept
+{
+	// Blocks the callback dropped are silence as far as the convolver is concerned,
+	// so the tail stays aligned with the head.
+	tail->process_silence(block - processed_tail_blocks);
+	processed_tail_blocks = block + 1;
+
+	float *outputs[Backend::MaxAudioChannels];
+	const float *inputs[Backend::MaxAudioChannels];
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		outputs[c] = tail_output[block & 1][c].data();
+		inputs[c] = tail_input[block & 1][c].data();
+	}
+	tail->process(outputs, inputs);
+}
+
+void ConvolutionReverbStream::tail_worker_loop()
+{
+	Util::set_current_thread_name("audio-reverb");
+
+	while (!worker_dead.load(std::memory_order_acquire))
+	{
+		uint32_t submitted = submitted_tail_blocks.load(std::memory_order_acquire);
+		if (submitted == completed_tail_blocks.load(std::memory_order_relaxed))
+		{
+			// Waking us up could make a syscall in the mixer callback, so just poll.
+			// A tail block is far longer than this, so the delay does not matter.
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		run_tail_job(submitted - 1);
+		completed_tail_blocks.store(submitted, std::memory_order_release);
+	}
+}
+
+void ConvolutionReverbStream::wait_for_tail() const
+{
+	while (completed_tail_blocks.load(std::memory_order_acquire) != submitted_tail_blocks.load(std::memory_order_relaxed))
+		std::this_thread::yield();
+}
+
+void ConvolutionReverbStream::end_tail_block() noexcept
+{
+	const uint32_t block = tail_block;
+	const uint32_t submitted = submitted_tail_blocks.load(std::memory_order_relaxed);
+	const bool idle = completed_tail_blocks.load(std::memory_order_acquire) == submitted;
+
+	// The output of block - 1 is due now, and plays while block + 1 gathers.
+	// It had a whole tail block to complete, so if it is not there the machine cannot keep up.
+	// Never wait for it, drop it instead.
+	tail_output_active = idle && submitted == block && block != 0;
+	if (!tail_output_active && block != 0)
+		late_tail_blocks.fetch_add(1, std::memory_order_relaxed);
+
+	// At most one job is in flight, so a job never shares buffers with the block being gathered.
+	// If the worker is still busy, this block's input is dropped.
+	bool gather_next;
+	if (tail_gathering && idle)
+	{
+		if (worker.joinable())
+		{
+			submitted_tail_blocks.store(block + 1, std::memory_order_release);
+		}
+		else
+		{
+			run_tail_job(block);
+			submitted_tail_blocks.store(block + 1, std::memory_order_relaxed);
+			completed_tail_blocks.store(block + 1, std::memory_order_relaxed);
+		}
+		gather_next = true;
+	}
+	else
+	{
+		// The job in flight, if any, is submitted - 1. It still reads the input buffer of its parity.
+		gather_next = idle || ((submitted - 1) & 1) != ((block + 1) & 1);
+	}
+
+	tail_block = block + 1;
+	tail_gathering = gather_next;
+}
+
+bool ConvolutionReverbStream::render_block() noexcept
+{
+	if (source_done)
+	{
+		if (!ring_out_frames)
+			return false;
+		ring_out_frames -= std::min<size_t>(ring_out_frames, head_frames);
+	}
+
+	float *source_channels[Backend::MaxAudioChannels];
+	float *wet_channels[Backend::MaxAudioChannels];
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		source_channels[c] = source_block[c].data();
+		wet_channels[c] = wet_block[c].data();
+		memset(source_channels[c], 0, head_frames * sizeof(float));
+	}
+
+	if (!source_done)
+	{
+		float gains[Backend::MaxAudioChannels];
+		for (auto &g : gains)
+			g = 1.0f;
+
+		if (source->accumulate_samples(source_channels, gains, head_frames) < head_frames)
+		{
+			source_done = true;
+			ring_out_frames = impulse_frames;
+		}
+	}
+
+	head->process(wet_channels, source_channels);
+
+	if (tail)
+	{
+		// While block N gathers its input, block N - 1 is in flight and block N - 2 is being played back.
+		// N and N - 2 share the same index, but one is an input and the other an output.
+		const uint32_t stage = tail_block & 1;
+		for (unsigned c = 0; c < num_channels; c++)
+		{
+			if (tail_gathering)
+				memcpy(tail_input[stage][c].data() + tail_fill, source_channels[c], head_frames * sizeof(float));
+			if (tail_output_active)
+			{
+				accumulate_channel_nogain(wet_channels[c],
+				                          tail_output[stage][c].data() + tail_fill,
+				                          head_frames);
+			}
+		}
+
+		tail_fill += head_frames;
+		if (tail_fill == tail_frames)
+		{
+			tail_fill = 0;
+			end_tail_block();
+		}
+	}
+
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		replace_channel(out_block[c].data(), source_channels[c], options.dry_gain, head_frames);
+		accumulate_channel(out_block[c].data(), wet_channels[c], options.wet_gain, head_frames);
+	}
+
+	current_read = 0;
+	return true;
+}
+
+size_t ConvolutionReverbStream::accumulate_samples(float * const *channels, const float *gain,
+                                                   size_t num_frames) noexcept
+{
+	size_t ret = 0;
+
+	while (ret < num_frames)
+	{
+		if (current_read == head_frames && !render_block())
+			break;
+
+		size_t to_read = std::min<size_t>(num_frames - ret, head_frames - current_read);
+		for (unsigned c = 0; c < num_channels; c++)
+			accumulate_channel(channels[c] + ret, out_block[c].data() + current_read, gain[c], to_read);
+
+		current_read += to_read;
+		ret += to_read;
+	}
+
+	return ret;
+}
+}
+}
+}
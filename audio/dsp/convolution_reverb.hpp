@@ -0,0 +1,151 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "audio_mixer.hpp"
+#include <memory>
+#include <atomic>
+#include <thread>
+
+namespace Granite
+{
+namespace Audio
+{
+namespace DSP
+{
+struct ConvolutionReverbOptions
+{
+	// Partition size for the head of the impulse response, which is convolved in the mixer callback.
+	// 0 picks the mixer's callback size rounded up to a power of two.
+	unsigned head_block_frames = 0;
+
+	// Partition size for the tail. 0 picks 16 head partitions.
+	// The head covers the first two tail partitions, so the tail has a whole partition of time to compute.
+	unsigned tail_block_frames = 0;
+
+	// Convolve tail partitions on a dedicated thread instead of in the callback which completes a tail block.
+	bool background_tail = true;
+
+	float dry_gain = 1.0f;
+	float wet_gain = 1.0f;
+};
+
+class PartitionedConvolver;
+
+// Non-uniformly partitioned overlap-save convolution with long impulse responses, e.g. 2 - 4 seconds of reverb.
+// The impulse response is either mono and shared by all channels, or has one channel per source channel.
+// No latency is added, and the stream keeps ringing out for the length of the impulse response after the source ends.
+class ConvolutionReverbStream final : public MixerStream
+{
+public:
+	ConvolutionReverbStream(MixerStream *source, const float * const *impulse, unsigned impulse_channels,
+	                        size_t impulse_frames, const ConvolutionReverbOptions &options = {});
+	~ConvolutionReverbStream() override;
+
+	bool setup(float mixer_output_rate, unsigned mixer_channels, size_t max_num_frames) override;
+	size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept override;
+
+	void install_message_queue(StreamID id, Util::LockFreeMessageQueue *queue) override
+	{
+		MixerStream::install_message_queue(id, queue);
+		if (source)
+			source->install_message_queue(id, queue);
+	}
+
+	void non_critical_update() override
+	{
+		if (source)
+			source->non_critical_update();
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return sample_rate;
+	}
+
+	// Number of tail blocks played without their tail because the tail thread fell behind.
+	// The mixer callback never waits for the tail thread. Instead it drops late output,
+	// and drops input while the thread is still busy with an older block.
+	uint64_t get_late_tail_count() const
+	{
+		return late_tail_blocks.load(std::memory_order_relaxed);
+	}
+
+	// Blocks until the tail thread has finished everything submitted so far.
+	// For offline rendering, where nothing should be dropped. Never call it from the mixer callback.
+	void wait_for_tail() const;
+
+private:
+	MixerStream *source;
+	ConvolutionReverbOptions options;
+	std::vector<float> impulse[Backend::MaxAudioChannels];
+	unsigned impulse_channels;
+	size_t impulse_frames;
+
+	float sample_rate = 0.0f;
+	unsigned num_channels = 0;
+	unsigned head_frames = 0;
+	unsigned tail_frames = 0;
+
+	std::unique_ptr<PartitionedConvolver> head;
+	std::unique_ptr<PartitionedConvolver> tail;
+
+	std::vector<float> source_block[Backend::MaxAudioChannels];
+	std::vector<float> wet_block[Backend::MaxAudioChannels];
+	std::vector<float> out_block[Backend::MaxAudioChannels];
+	size_t current_read = 0;
+	bool source_done = false;
+	size_t ring_out_frames = 0;
+
+	// The job for tail block N reads tail_input[N & 1] and writes tail_output[N & 1].
+	// Its output is heard two tail blocks after the input started.
+	std::vector<float> tail_input[2][Backend::MaxAudioChannels];
+	std::vector<float> tail_output[2][Backend::MaxAudioChannels];
+	unsigned tail_fill = 0;
+	uint32_t tail_block = 0;
+	bool tail_gathering = false;
+	bool tail_output_active = false;
+	// Only touched by whoever runs tail jobs.
+	uint32_t processed_tail_blocks = 0;
+
+	std::thread worker;
+	std::atomic_bool worker_dead;
+	// Both count tail blocks, the job in flight is for block submitted - 1.
+	std::atomic_uint32_t submitted_tail_blocks;
+	std::atomic_uint32_t completed_tail_blocks;
+	std::atomic_uint64_t late_tail_blocks;
+
+	bool render_block() noexcept;
+	void end_tail_block() noexcept;
+	void run_tail_job(uint32_t block) noexcept;
+	void tail_worker_loop();
+	void stop_worker();
+};
+}
+}
+}
@@ -37,8 +37,39 @@ static inline void accumulate_channel_deinterleave_stereo(float * __restrict lef
                                                           const float * __restrict gain,
                                                           size_t count) noexcept
 {
-#if defined(__SSE__)
-	size_t rounded_count = count & ~4;
+#if defined(__AVX2__) && defined(__FMA__)
+	size_t rounded_count = count & ~7;
+	__m256 gain_left_splat = _mm256_set1_ps(gain[0]);
+	__m256 gain_right_splat = _mm256_set1_ps(gain[1]);
+	for (size_t i = 0; i < rounded_count; i += 8)
+	{
+		__m256 acc_l = _mm256_loadu_ps(left);
+		__m256 acc_r = _mm256_loadu_ps(right);
+		__m256 in0 = _mm256_loadu_ps(input + 0);
+		__m256 in1 = _mm256_loadu_ps(input + 8);
+		// Shuffles are per 128-bit lane, so the result is L0 L1 L4 L5 | L2 L3 L6 L7. Fix up the order after.
+		__m256 in_l = _mm256_shuffle_ps(in0, in1, _MM_SHUFFLE(2, 0, 2, 0));
+		__m256 in_r = _mm256_shuffle_ps(in0, in1, _MM_SHUFFLE(3, 1, 3, 1));
+		in_l = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(in_l), _MM_SHUFFLE(3, 1, 2, 0)));
+		in_r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(in_r), _MM_SHUFFLE(3, 1, 2, 0)));
+		acc_l = _mm256_fmadd_ps(in_l, gain_left_splat, acc_l);
+		acc_r = _mm256_fmadd_ps(in_r, gain_right_splat, acc_r);
+		_mm256_storeu_ps(left, acc_l);
+		_mm256_storeu_ps(right, acc_r);
+
+		left += 8;
+		right += 8;
+		input += 16;
+	}
+
+	size_t overflow_count = count & 7;
+	for (size_t i = 0; i < overflow_count; i++)
+	{
+		left[i] += input[2 * i + 0] * gain[0];
+		right[i] += input[2 * i + 1] * gain[1];
+	}
+#elif defined(__SSE__)
+	size_t rounded_count = count & ~3;
 	__m128 gain_left_splat = _mm_set1_ps(gain[0]);
 	__m128 gain_right_splat = _mm_set1_ps(gain[1]);
 	for (size_t i = 0; i < rounded_count; i += 4)
@@ -76,7 +107,24 @@ static inline void accumulate_channel_deinterleave_stereo(float * __restrict lef
 
 static inline void accumulate_channel(float * __restrict output, const float * __restrict input, float gain, size_t count) noexcept
 {
-#ifdef __ARM_NEON
+#if defined(__AVX2__) && defined(__FMA__)
+	size_t rounded_count = count & ~7;
+	__m256 gain_splat = _mm256_set1_ps(gain);
+	for (size_t i = 0; i < rounded_count; i += 8)
+	{
+		__m256 acc = _mm256_loadu_ps(output);
+		__m256 in = _mm256_loadu_ps(input);
+		acc = _mm256_fmadd_ps(in, gain_splat, acc);
+		_mm256_storeu_ps(output, acc);
+
+		output += 8;
+		input += 8;
+	}
+
+	size_t overflow_count = count & 7;
+	for (size_t i = 0; i < overflow_count; i++)
+		output[i] += input[i] * gain;
+#elif defined(__ARM_NEON)
 	size_t rounded_count = count & ~3;
 	for (size_t i = 0; i < rounded_count; i += 4)
 	{
@@ -161,7 +209,23 @@ static inline void accumulate_channel_deinterleave_stereo_s16(
 
 static inline void replace_channel(float * __restrict output, const float * __restrict input, float gain, size_t count) noexcept
 {
-#ifdef __ARM_NEON
+#if defined(__AVX__)
+	size_t rounded_count = count & ~7;
+	__m256 gain_splat = _mm256_set1_ps(gain);
+	for (size_t i = 0; i < rounded_count; i += 8)
+	{
+		__m256 in = _mm256_loadu_ps(input);
+		in = _mm256_mul_ps(in, gain_splat);
+		_mm256_storeu_ps(output, in);
+
+		output += 8;
+		input += 8;
+	}
+
+	size_t overflow_count = count & 7;
+	for (size_t i = 0; i < overflow_count; i++)
+		output[i] = input[i] * gain;
+#elif defined(__ARM_NEON)
 	size_t rounded_count = count & ~3;
 	for (size_t i = 0; i < rounded_count; i += 4)
 	{
@@ -200,7 +264,23 @@ static inline void replace_channel(float * __restrict output, const float * __re
 
 static inline void accumulate_channel_nogain(float * __restrict output, const float * __restrict input, size_t count) noexcept
 {
-#ifdef __ARM_NEON
+#if defined(__AVX__)
+	size_t rounded_count = count & ~7;
+	for (size_t i = 0; i < rounded_count; i += 8)
+	{
+		__m256 acc = _mm256_loadu_ps(output);
+		__m256 in = _mm256_loadu_ps(input);
+		acc = _mm256_add_ps(acc, in);
+		_mm256_storeu_ps(output, acc);
+
+		output += 8;
+		input += 8;
+	}
+
+	size_t overflow_count = count & 7;
+	for (size_t i = 0; i < overflow_count; i++)
+		output[i] += input[i];
+#elif defined(__ARM_NEON)
 	size_t rounded_count = count & ~3;
 	for (size_t i = 0; i < rounded_count; i += 4)
 	{
@@ -238,6 +318,81 @@ static inline void accumulate_channel_nogain(float * __restrict output, const fl
 #endif
 }
 
+// Interleaved complex numbers, acc[i] += a[i] * b[i].
+static inline void complex_multiply_accumulate(float * __restrict acc, const float * __restrict a,
+                                               const float * __restrict b, size_t count) noexcept
+{
+#if defined(__AVX2__) && defined(__FMA__)
+	size_t rounded_count = count & ~3;
+	for (size_t i = 0; i < rounded_count; i += 4)
+	{
+		__m256 va = _mm256_loadu_ps(a);
+		__m256 vb = _mm256_loadu_ps(b);
+		__m256 b_re = _mm256_moveldup_ps(vb);
+		__m256 b_im = _mm256_movehdup_ps(vb);
+		__m256 a_swap = _mm256_permute_ps(va, _MM_SHUFFLE(2, 3, 0, 1));
+		// (ar * br - ai * bi, ai * br + ar * bi)
+		__m256 prod = _mm256_fmaddsub_ps(va, b_re, _mm256_mul_ps(a_swap, b_im));
+		_mm256_storeu_ps(acc, _mm256_add_ps(_mm256_loadu_ps(acc), prod));
+
+		acc += 8;
+		a += 8;
+		b += 8;
+	}
+
+	size_t overflow_count = count & 3;
+#elif defined(__ARM_NEON)
+	size_t rounded_count = count & ~3;
+	for (size_t i = 0; i < rounded_count; i += 4)
+	{
+		float32x4x2_t va = vld2q_f32(a);
+		float32x4x2_t vb = vld2q_f32(b);
+		float32x4x2_t vacc = vld2q_f32(acc);
+		vacc.val[0] = vmlaq_f32(vacc.val[0], va.val[0], vb.val[0]);
+		vacc.val[0] = vmlsq_f32(vacc.val[0], va.val[1], vb.val[1]);
+		vacc.val[1] = vmlaq_f32(vacc.val[1], va.val[0], vb.val[1]);
+		vacc.val[1] = vmlaq_f32(vacc.val[1], va.val[1], vb.val[0]);
+		vst2q_f32(acc, vacc);
+
+		acc += 8;
+		a += 8;
+		b += 8;
+	}
+
+	size_t overflow_count = count & 3;
+#elif defined(__SSE3__)
+	size_t rounded_count = count & ~1;
+	for (size_t i = 0; i < rounded_count; i += 2)
+	{
+		__m128 va = _mm_loadu_ps(a);
+		__m128 vb = _mm_loadu_ps(b);
+		__m128 b_re = _mm_moveldup_ps(vb);
+		__m128 b_im = _mm_movehdup_ps(vb);
+		__m128 a_swap = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+		__m128 prod = _mm_addsub_ps(_mm_mul_ps(va, b_re), _mm_mul_ps(a_swap, b_im));
+		_mm_storeu_ps(acc, _mm_add_ps(_mm_loadu_ps(acc), prod));
+
+		acc += 4;
+		a += 4;
+		b += 4;
+	}
+
+	size_t overflow_count = count & 1;
+#else
+	size_t overflow_count = count;
+#endif
+
+	for (size_t i = 0; i < overflow_count; i++)
+	{
+		float ar = a[2 * i + 0];
+		float ai = a[2 * i + 1];
+		float br = b[2 * i + 0];
+		float bi = b[2 * i + 1];
+		acc[2 * i + 0] += ar * br - ai * bi;
+		acc[2 * i + 1] += ar * bi + ai * br;
+	}
+}
+
 static inline void convert_to_mono(float * __restrict output,
                                    const float * __restrict const *input,
                                    unsigned num_channels,
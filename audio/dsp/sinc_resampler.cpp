@@ -95,11 +95,22 @@
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
 
 #ifndef PI
 #define PI 3.14159265359
 #endif
 
+// Builds without -mfma still get the FMA kernel on x86, compiled for FMA separately and picked at runtime.
+#if defined(__SSE__) && !defined(__FMA__) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SINC_RESAMPLER_FMA_DISPATCH 1
+#define SINC_RESAMPLER_FMA_TARGET __attribute__((target("fma")))
+#else
+#define SINC_RESAMPLER_FMA_TARGET
+#endif
+
 namespace Granite
 {
 namespace Audio
@@ -148,12 +159,57 @@ void SincResampler::init_table_kaiser(double cutoff, unsigned phase_count, unsig
 	}
 }
 
-SincResampler::SincResampler(float out_rate, float in_rate, Quality quality)
+// Keeps the precomputed phases well inside L2 even for High quality with long downsampling kernels.
+static constexpr uint32_t MaxExactPhases = 1024;
+static constexpr uint32_t MaxExactElements = 64 * 1024;
+
+void SincResampler::init_exact_table(double cutoff, unsigned phase_count, unsigned num_taps, double beta)
+{
+	// Same kernel as init_table_kaiser(), sampled directly at each output phase.
+	double window_mod = DSP::kaiser_window_function(0.0, beta);
+	double sidelobes = num_taps / 2.0;
+
+	for (unsigned i = 0; i < phase_count; i++)
+	{
+		for (unsigned j = 0; j < num_taps; j++)
+		{
+			double window_phase = (double(j) + double(i) / double(phase_count)) / double(num_taps); /* [0, 1). */
+			window_phase = 2.0 * window_phase - 1.0; /* [-1, 1) */
+			double sinc_phase = sidelobes * window_phase;
+			float val = float(cutoff * DSP::sinc(PI * sinc_phase * cutoff) * DSP::kaiser_window_function(window_phase, beta) / window_mod);
+			exact_phase_table[i * num_taps + j] = val;
+		}
+	}
+}
+
+bool SincResampler::find_integer_ratio(double out_rate, double in_rate, uint32_t &out_phases, uint32_t &in_step)
+{
+	// Look for the shortest period after which the output frames land on the same input phases again.
+	for (uint32_t n = 1; n <= MaxExactPhases; n++)
+	{
+		double step = double(n) * in_rate / out_rate;
+		double rounded = round(step);
+		if (rounded >= 1.0 && rounded < double(UINT32_MAX / 2) && fabs(step - rounded) <= 1e-9 * step)
+		{
+			out_phases = n;
+			in_step = uint32_t(rounded);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+SincResampler::SincResampler(float out_rate, float in_rate, Quality quality, unsigned num_channels)
+	: channels(num_channels)
 {
 	double cutoff;
 	unsigned sidelobes;
 	double kaiser_beta;
 
+	if (channels == 0 || channels > MaxChannels)
+		std::abort();
+
 	switch (quality)
 	{
 	case Quality::Low:
@@ -202,9 +258,19 @@ SincResampler::SincResampler(float out_rate, float in_rate, Quality quality)
 
 	unsigned phase_elems = ((1u << phase_bits) * taps);
 	phase_elems = phase_elems * 2;
-	unsigned elems = phase_elems + 2 * taps;
+	window_stride = 2 * taps;
+	unsigned elems = phase_elems + channels * window_stride;
+
+	uint32_t integer_phases = 0;
+	uint32_t integer_step = 0;
+	unsigned exact_elems = 0;
+	if (find_integer_ratio(out_rate, in_rate, integer_phases, integer_step) &&
+	    uint64_t(integer_phases) * taps <= MaxExactElements)
+	{
+		exact_elems = integer_phases * taps;
+	}
 
-	main_buffer = static_cast<float *>(Util::memalign_calloc(128, sizeof(float) * elems));
+	main_buffer = static_cast<float *>(Util::memalign_calloc(128, sizeof(float) * (elems + exact_elems)));
 	if (!main_buffer)
 		throw std::bad_alloc();
 
@@ -212,13 +278,36 @@ SincResampler::SincResampler(float out_rate, float in_rate, Quality quality)
 	window_buffer = main_buffer + phase_elems;
 
 	init_table_kaiser(cutoff, 1u << phase_bits, taps, kaiser_beta);
-	set_sample_rate_ratio(bandwidth_mod);
+
+	if (exact_elems)
+	{
+		exact_phase_table = main_buffer + elems;
+		exact_ratio = bandwidth_mod;
+		init_exact_table(cutoff, integer_phases, taps, kaiser_beta);
+
+		phases = integer_phases;
+		fixed_ratio = integer_step;
+	}
+	else
+		set_sample_rate_ratio(bandwidth_mod);
 }
 
 void SincResampler::set_sample_rate_ratio(float ratio) noexcept
 {
+	if (exact_phase_table && ratio == exact_ratio)
+		return;
+
+	uint32_t old_phases = phases;
 	phases = 1u << (phase_bits + subphase_bits);
 	fixed_ratio = uint32_t(round(float(phases) / ratio));
+
+	if (exact_phase_table)
+	{
+		// Rescaling onto the finer interpolated grid keeps the phase intact.
+		// Going back would snap time to the coarse grid and glitch, so the precomputed phases are gone for good.
+		time = uint32_t((uint64_t(time) * phases) / old_phases);
+		exact_phase_table = nullptr;
+	}
 }
 
 SincResampler::~SincResampler()
@@ -230,7 +319,7 @@ size_t SincResampler::get_maximum_input_for_output_frames(size_t out_frames) con
 {
 	uint64_t max_start_time = phases - 1;
 	max_start_time += uint64_t(fixed_ratio) * out_frames;
-	max_start_time >>= phase_bits + subphase_bits;
+	max_start_time /= phases;
 	return size_t(max_start_time);
 }
 
@@ -238,7 +327,7 @@ size_t SincResampler::get_current_input_for_output_frames(size_t out_frames) con
 {
 	uint64_t start_time = time;
 	start_time += uint64_t(fixed_ratio) * out_frames;
-	start_time >>= phase_bits + subphase_bits;
+	start_time /= phases;
 	return size_t(start_time);
 }
 
@@ -249,103 +338,229 @@ size_t SincResampler::get_maximum_output_for_input_frames(size_t in_frames) cons
 	return size_t(max_output_time);
 }
 
-template <bool accumulate>
-inline void SincResampler::process(float *output) const noexcept
+#if defined(__SSE__)
+static inline float horizontal_add(__m128 sum) noexcept
 {
-	const float *buffer = window_buffer + ptr;
-	unsigned num_taps = taps;
-	unsigned phase = time >> subphase_bits;
+	sum = _mm_add_ps(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 2, 3)), sum);
+	sum = _mm_add_ss(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)), sum);
+	return _mm_cvtss_f32(sum);
+}
+#endif
 
-	const float *sample_phase_table = phase_table + phase * num_taps * 2;
-	const float *delta_table = sample_phase_table + num_taps;
+#if defined(__FMA__) || defined(SINC_RESAMPLER_FMA_DISPATCH)
+// a * b + c. Only inlined into functions which are themselves compiled for FMA.
+SINC_RESAMPLER_FMA_TARGET static inline __m128 fmadd(__m128 a, __m128 b, __m128 c) noexcept
+{
+	return _mm_fmadd_ps(a, b, c);
+}
+#endif
 
-#ifdef __SSE__
-	__m128 sum = _mm_setzero_ps();
-	__m128 delta = _mm_set1_ps(float(time & subphase_mask) * subphase_mod);
-	for (unsigned i = 0; i < num_taps; i += 4)
+#if defined(SINC_RESAMPLER_FMA_DISPATCH)
+static bool cpu_supports_fma() noexcept
+{
+	// Also checks that the OS saves AVX state, which VEX encoded FMA needs.
+	static const bool supported = __builtin_cpu_supports("fma");
+	return supported;
+}
+#endif
+
+// Filters Channels channels starting at first_channel in one pass over the taps,
+// so the kernel for this output phase is only loaded (and interpolated) once.
+template <unsigned Channels, bool interpolate, bool fma>
+inline void SincResampler::filter_channels(float *results, unsigned first_channel) const noexcept
+{
+	const unsigned num_taps = taps;
+	const float *buffers[Channels];
+	for (unsigned c = 0; c < Channels; c++)
+		buffers[c] = window_buffer + (first_channel + c) * window_stride + ptr;
+
+	const float *sample_phase_table;
+	const float *delta_table = nullptr;
+	float delta = 0.0f;
+
+	if (interpolate)
 	{
-		__m128 buf = _mm_loadu_ps(buffer + i);
-		__m128 deltas = _mm_load_ps(delta_table + i);
-		__m128 _sinc  = _mm_add_ps(_mm_load_ps(sample_phase_table + i), _mm_mul_ps(deltas, delta));
-		sum = _mm_add_ps(sum, _mm_mul_ps(buf, _sinc));
+		unsigned phase = time >> subphase_bits;
+		sample_phase_table = phase_table + phase * num_taps * 2;
+		delta_table = sample_phase_table + num_taps;
+		delta = float(time & subphase_mask) * subphase_mod;
 	}
+	else
+		sample_phase_table = exact_phase_table + time * num_taps;
 
-	// Horizontal add.
-	sum = _mm_add_ps(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 2, 3)), sum);
-	sum = _mm_add_ss(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)), sum);
+#if defined(__FMA__) || defined(SINC_RESAMPLER_FMA_DISPATCH)
+	if (fma)
+	{
+		// Stays at 128 bits on purpose. The window pointer moves one float per input frame, so every window load is
+		// unaligned, and 256-bit loads splitting cache lines measured slower than this for all kernel sizes.
+		// FMA has a longer latency than an add on recent cores, so odd and even groups of taps go to separate
+		// accumulators. With a single dependency chain, long kernels ran slower than with the plain SSE kernel.
+		__m128 sums[Channels];
+		__m128 odd_sums[Channels];
+		for (unsigned c = 0; c < Channels; c++)
+		{
+			sums[c] = _mm_setzero_ps();
+			odd_sums[c] = _mm_setzero_ps();
+		}
 
-	if (accumulate)
-		_mm_store_ss(output, _mm_add_ss(_mm_load_ss(output), sum));
-	else
-		_mm_store_ss(output, sum);
-#elif defined(__ARM_NEON)
-	float delta = float(time & subphase_mask) * subphase_mod;
-	float32x4_t sum = vdupq_n_f32(0.0f);
-	for (unsigned i = 0; i < taps; i += 4)
+		__m128 delta_splat = _mm_set1_ps(delta);
+		unsigned i = 0;
+		for (; i + 8 <= num_taps; i += 8)
+		{
+			__m128 sinc0 = _mm_load_ps(sample_phase_table + i);
+			__m128 sinc1 = _mm_load_ps(sample_phase_table + i + 4);
+			if (interpolate)
+			{
+				sinc0 = fmadd(_mm_load_ps(delta_table + i), delta_splat, sinc0);
+				sinc1 = fmadd(_mm_load_ps(delta_table + i + 4), delta_splat, sinc1);
+			}
+
+			for (unsigned c = 0; c < Channels; c++)
+			{
+				sums[c] = fmadd(_mm_loadu_ps(buffers[c] + i), sinc0, sums[c]);
+				odd_sums[c] = fmadd(_mm_loadu_ps(buffers[c] + i + 4), sinc1, odd_sums[c]);
+			}
+		}
+
+		if (i < num_taps)
+		{
+			__m128 _sinc = _mm_load_ps(sample_phase_table + i);
+			if (interpolate)
+				_sinc = fmadd(_mm_load_ps(delta_table + i), delta_splat, _sinc);
+			for (unsigned c = 0; c < Channels; c++)
+				sums[c] = fmadd(_mm_loadu_ps(buffers[c] + i), _sinc, sums[c]);
+		}
+
+		for (unsigned c = 0; c < Channels; c++)
+			results[c] = horizontal_add(_mm_add_ps(sums[c], odd_sums[c]));
+		return;
+	}
+#endif
+
+#if defined(__SSE__)
+	__m128 sums[Channels];
+	for (unsigned c = 0; c < Channels; c++)
+		sums[c] = _mm_setzero_ps();
+
+	__m128 delta_splat = _mm_set1_ps(delta);
+	for (unsigned i = 0; i < num_taps; i += 4)
 	{
-		float32x4_t _phases = vld1q_f32(phase_table + i);
-		float32x4_t deltas = vld1q_f32(delta_table + i);
-		float32x4_t buf = vld1q_f32(buffer + i);
-		float32x4_t _sinc = vmlaq_n_f32(_phases, deltas, delta);
-		sum = vmlaq_f32(sum, buf, _sinc);
+		__m128 _sinc = _mm_load_ps(sample_phase_table + i);
+		if (interpolate)
+			_sinc = _mm_add_ps(_sinc, _mm_mul_ps(_mm_load_ps(delta_table + i), delta_splat));
+		for (unsigned c = 0; c < Channels; c++)
+			sums[c] = _mm_add_ps(sums[c], _mm_mul_ps(_mm_loadu_ps(buffers[c] + i), _sinc));
 	}
 
-	float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
-	float32x2_t res = vpadd_f32(half, half);
+	for (unsigned c = 0; c < Channels; c++)
+		results[c] = horizontal_add(sums[c]);
+#elif defined(__ARM_NEON)
+	float32x4_t sums[Channels];
+	for (unsigned c = 0; c < Channels; c++)
+		sums[c] = vdupq_n_f32(0.0f);
 
-	if (accumulate)
+	for (unsigned i = 0; i < num_taps; i += 4)
 	{
-		float32x2_t o = vld1_dup_f32(output);
-		res = vadd_f32(o, res);
-		vst1_lane_f32(output, res, 0);
+		float32x4_t _sinc = vld1q_f32(sample_phase_table + i);
+		if (interpolate)
+			_sinc = vmlaq_n_f32(_sinc, vld1q_f32(delta_table + i), delta);
+		for (unsigned c = 0; c < Channels; c++)
+			sums[c] = vmlaq_f32(sums[c], vld1q_f32(buffers[c] + i), _sinc);
+	}
+
+	for (unsigned c = 0; c < Channels; c++)
+	{
+		float32x2_t half = vadd_f32(vget_low_f32(sums[c]), vget_high_f32(sums[c]));
+		results[c] = vget_lane_f32(vpadd_f32(half, half), 0);
 	}
-	else
-		vst1_lane_f32(output, res, 0);
 #else
-	float delta = float(time & subphase_mask) * subphase_mod;
-	float sum = 0.0f;
-	for (unsigned i = 0; i < taps; i++)
+	float sums[Channels] = {};
+	for (unsigned i = 0; i < num_taps; i++)
 	{
-		float sinc_val = phase_table[i] + delta_table[i] * delta;
-		sum += buffer[i] * sinc_val;
+		float sinc_val = sample_phase_table[i];
+		if (interpolate)
+			sinc_val += delta_table[i] * delta;
+		for (unsigned c = 0; c < Channels; c++)
+			sums[c] += buffers[c][i] * sinc_val;
 	}
 
-	if (accumulate)
-		*output += sum;
-	else
-		*output = sum;
+	for (unsigned c = 0; c < Channels; c++)
+		results[c] = sums[c];
 #endif
 }
 
-template <bool accumulate>
-inline size_t SincResampler::process_input(float *output, const float *input, size_t in_frames) noexcept
+// Channels == 0 handles any channel count at runtime.
+template <unsigned Channels, bool interpolate, bool fma>
+inline void SincResampler::filter_frame(float *results) const noexcept
+{
+	if (Channels)
+	{
+		filter_channels<Channels ? Channels : 1, interpolate, fma>(results, 0);
+		return;
+	}
+
+	// Batches of 4 keep all accumulators in registers, even with 8 channels it is only two kernel passes.
+	unsigned c = 0;
+	for (; c + 4 <= channels; c += 4)
+		filter_channels<4, interpolate, fma>(results + c, c);
+	if (c + 2 <= channels)
+	{
+		filter_channels<2, interpolate, fma>(results + c, c);
+		c += 2;
+	}
+	if (c < channels)
+		filter_channels<1, interpolate, fma>(results + c, c);
+}
+
+template <unsigned Channels>
+inline void SincResampler::push_frame(const float * const *inputs, size_t index) noexcept
+{
+	// Push in reverse to make filter more obvious.
+	if (!ptr)
+		ptr = taps;
+	ptr--;
+
+	const unsigned num_channels = Channels ? Channels : channels;
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		float *window = window_buffer + c * window_stride;
+		const float v = inputs[c][index];
+		window[ptr + taps] = v;
+		window[ptr] = v;
+	}
+}
+
+template <bool accumulate, unsigned Channels, bool interpolate, bool fma>
+inline size_t SincResampler::process_input_impl(float * const *outputs, const float * const *inputs,
+                                                size_t in_frames) noexcept
 {
+	const unsigned num_channels = Channels ? Channels : channels;
 	uint32_t ratio = fixed_ratio;
 	size_t rendered_frames = 0;
+	size_t consumed_frames = 0;
+	float frame[MaxChannels];
 
-	while (in_frames)
+	while (consumed_frames < in_frames)
 	{
 		// Drain inputs.
-		while (in_frames && time >= phases)
+		while (consumed_frames < in_frames && time >= phases)
 		{
-			// Push in reverse to make filter more obvious.
-			if (!ptr)
-				ptr = taps;
-			ptr--;
-
-			const float v = *input;
-			window_buffer[ptr + taps] = v;
-			window_buffer[ptr] = v;
+			push_frame<Channels>(inputs, consumed_frames);
+			consumed_frames++;
 			time -= phases;
-			in_frames--;
-			input++;
 		}
 
 		// Pump out samples.
 		while (time < phases)
 		{
-			process<accumulate>(output);
-			output++;
+			filter_frame<Channels, interpolate, fma>(frame);
+			for (unsigned c = 0; c < num_channels; c++)
+			{
+				if (accumulate)
+					outputs[c][rendered_frames] += frame[c];
+				else
+					outputs[c][rendered_frames] = frame[c];
+			}
 			time += ratio;
 			rendered_frames++;
 		}
@@ -354,34 +569,37 @@ inline size_t SincResampler::process_input(float *output, const float *input, si
 	return rendered_frames;
 }
 
-template <bool accumulate>
-inline size_t SincResampler::process_output(float *output, const float *input, size_t out_frames) noexcept
+template <bool accumulate, unsigned Channels, bool interpolate, bool fma>
+inline size_t SincResampler::process_output_impl(float * const *outputs, const float * const *inputs,
+                                                 size_t out_frames) noexcept
 {
+	const unsigned num_channels = Channels ? Channels : channels;
 	uint32_t ratio = fixed_ratio;
+	size_t rendered_frames = 0;
 	size_t consumed_frames = 0;
+	float frame[MaxChannels];
 
-	while (out_frames)
+	while (rendered_frames < out_frames)
 	{
 		// Pump out samples.
-		while (out_frames && time < phases)
+		while (rendered_frames < out_frames && time < phases)
 		{
-			process<accumulate>(output);
-			output++;
-			out_frames--;
+			filter_frame<Channels, interpolate, fma>(frame);
+			for (unsigned c = 0; c < num_channels; c++)
+			{
+				if (accumulate)
+					outputs[c][rendered_frames] += frame[c];
+				else
+					outputs[c][rendered_frames] = frame[c];
+			}
+			rendered_frames++;
 			time += ratio;
 		}
 
 		// Drain inputs.
 		while (time >= phases)
 		{
-			// Push in reverse to make filter more obvious.
-			if (!ptr)
-				ptr = taps;
-			ptr--;
-
-			const float v = input[consumed_frames];
-			window_buffer[ptr + taps] = v;
-			window_buffer[ptr] = v;
+			push_frame<Channels>(inputs, consumed_frames);
 			consumed_frames++;
 			time -= phases;
 		}
@@ -390,24 +608,147 @@ inline size_t SincResampler::process_output(float *output, const float *input, s
 	return consumed_frames;
 }
 
+// Mono and stereo get fully unrolled loops, anything else takes the generic path.
+template <bool accumulate, bool fma>
+inline size_t SincResampler::process_input_kernel(float * const *outputs, const float * const *inputs,
+                                                  size_t in_frames) noexcept
+{
+	if (exact_phase_table)
+	{
+		if (channels == 1)
+			return process_input_impl<accumulate, 1, false, fma>(outputs, inputs, in_frames);
+		else if (channels == 2)
+			return process_input_impl<accumulate, 2, false, fma>(outputs, inputs, in_frames);
+		else
+			return process_input_impl<accumulate, 0, false, fma>(outputs, inputs, in_frames);
+	}
+	else
+	{
+		if (channels == 1)
+			return process_input_impl<accumulate, 1, true, fma>(outputs, inputs, in_frames);
+		else if (channels == 2)
+			return process_input_impl<accumulate, 2, true, fma>(outputs, inputs, in_frames);
+		else
+			return process_input_impl<accumulate, 0, true, fma>(outputs, inputs, in_frames);
+	}
+}
+
+template <bool accumulate, bool fma>
+inline size_t SincResampler::process_output_kernel(float * const *outputs, const float * const *inputs,
+                                                   size_t out_frames) noexcept
+{
+	if (exact_phase_table)
+	{
+		if (channels == 1)
+			return process_output_impl<accumulate, 1, false, fma>(outputs, inputs, out_frames);
+		else if (channels == 2)
+			return process_output_impl<accumulate, 2, false, fma>(outputs, inputs, out_frames);
+		else
+			return process_output_impl<accumulate, 0, false, fma>(outputs, inputs, out_frames);
+	}
+	else
+	{
+		if (channels == 1)
+			return process_output_impl<accumulate, 1, true, fma>(outputs, inputs, out_frames);
+		else if (channels == 2)
+			return process_output_impl<accumulate, 2, true, fma>(outputs, inputs, out_frames);
+		else
+			return process_output_impl<accumulate, 0, true, fma>(outputs, inputs, out_frames);
+	}
+}
+
+#if defined(SINC_RESAMPLER_FMA_DISPATCH)
+// The FMA helpers can only be inlined into functions compiled for FMA,
+// so these pull the entire loop in, and the kernels never go through a call per tap.
+template <bool accumulate>
+__attribute__((target("fma"), flatten))
+size_t SincResampler::process_input_fma(float * const *outputs, const float * const *inputs, size_t in_frames) noexcept
+{
+	return process_input_kernel<accumulate, true>(outputs, inputs, in_frames);
+}
+
+template <bool accumulate>
+__attribute__((target("fma"), flatten))
+size_t SincResampler::process_output_fma(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept
+{
+	return process_output_kernel<accumulate, true>(outputs, inputs, out_frames);
+}
+#endif
+
+template <bool accumulate>
+inline size_t SincResampler::process_input(float * const *outputs, const float * const *inputs, size_t in_frames) noexcept
+{
+#if defined(SINC_RESAMPLER_FMA_DISPATCH)
+	if (cpu_supports_fma())
+		return process_input_fma<accumulate>(outputs, inputs, in_frames);
+	return process_input_kernel<accumulate, false>(outputs, inputs, in_frames);
+#elif defined(__FMA__)
+	return process_input_kernel<accumulate, true>(outputs, inputs, in_frames);
+#else
+	return process_input_kernel<accumulate, false>(outputs, inputs, in_frames);
+#endif
+}
+
+template <bool accumulate>
+inline size_t SincResampler::process_output(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept
+{
+#if defined(SINC_RESAMPLER_FMA_DISPATCH)
+	if (cpu_supports_fma())
+		return process_output_fma<accumulate>(outputs, inputs, out_frames);
+	return process_output_kernel<accumulate, false>(outputs, inputs, out_frames);
+#elif defined(__FMA__)
+	return process_output_kernel<accumulate, true>(outputs, inputs, out_frames);
+#else
+	return process_output_kernel<accumulate, false>(outputs, inputs, out_frames);
+#endif
+}
+
 size_t SincResampler::process_output_frames(float *outputs, const float *inputs, size_t out_frames) noexcept
 {
-	return process_output<false>(outputs, inputs, out_frames);
+	assert(channels == 1);
+	return process_output<false>(&outputs, &inputs, out_frames);
 }
 
 size_t SincResampler::process_input_frames(float *outputs, const float *inputs, size_t in_frames) noexcept
 {
-	return process_input<false>(outputs, inputs, in_frames);
+	assert(channels == 1);
+	return process_input<false>(&outputs, &inputs, in_frames);
 }
 
 size_t SincResampler::process_and_accumulate_output_frames(float *outputs, const float *inputs,
                                                            size_t out_frames) noexcept
 {
-	return process_output<true>(outputs, inputs, out_frames);
+	assert(channels == 1);
+	return process_output<true>(&outputs, &inputs, out_frames);
 }
 
 size_t SincResampler::process_and_accumulate_input_frames(float *outputs, const float *inputs,
                                                           size_t in_frames) noexcept
+{
+	assert(channels == 1);
+	return process_input<true>(&outputs, &inputs, in_frames);
+}
+
+size_t SincResampler::process_output_frames(float * const *outputs, const float * const *inputs,
+                                            size_t out_frames) noexcept
+{
+	return process_output<false>(outputs, inputs, out_frames);
+}
+
+size_t SincResampler::process_input_frames(float * const *outputs, const float * const *inputs,
+                                           size_t in_frames) noexcept
+{
+	return process_input<false>(outputs, inputs, in_frames);
+}
+
+size_t SincResampler::process_and_accumulate_output_frames(float * const *outputs, const float * const *inputs,
+                                                           size_t out_frames) noexcept
+{
+	return process_output<true>(outputs, inputs, out_frames);
+}
+
+size_t SincResampler::process_and_accumulate_input_frames(float * const *outputs, const float * const *inputs,
+                                                          size_t in_frames) noexcept
 {
 	return process_input<true>(outputs, inputs, in_frames);
 }
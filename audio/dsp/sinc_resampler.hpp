@@ -41,14 +41,26 @@ public:
 		Medium,
 		High
 	};
-	SincResampler(float out_rate, float in_rate, Quality quality);
+	enum { MaxChannels = 8 };
+
+	// All channels share one time base and are filtered against the same kernel for every output frame.
+	// If in_rate and out_rate form a ratio of small integers (e.g. 44.1 kHz -> 48 kHz is 147:160),
+	// the kernels for every output phase are precomputed and no per-sample interpolation is needed.
+	SincResampler(float out_rate, float in_rate, Quality quality, unsigned num_channels = 1);
 	~SincResampler();
 
+	// Single-channel interface, only valid for resamplers with one channel.
 	size_t process_and_accumulate_output_frames(float *outputs, const float *inputs, size_t out_frames) noexcept;
 	size_t process_and_accumulate_input_frames(float *outputs, const float *inputs, size_t in_frames) noexcept;
 	size_t process_output_frames(float *outputs, const float *inputs, size_t out_frames) noexcept;
 	size_t process_input_frames(float *outputs, const float *inputs, size_t in_frames) noexcept;
 
+	// One planar buffer per channel.
+	size_t process_and_accumulate_output_frames(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept;
+	size_t process_and_accumulate_input_frames(float * const *outputs, const float * const *inputs, size_t in_frames) noexcept;
+	size_t process_output_frames(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept;
+	size_t process_input_frames(float * const *outputs, const float * const *inputs, size_t in_frames) noexcept;
+
 	void operator=(const SincResampler &) = delete;
 	SincResampler(const SincResampler &) = delete;
 
@@ -56,13 +68,26 @@ public:
 	size_t get_current_input_for_output_frames(size_t out_frames) const noexcept;
 	size_t get_maximum_output_for_input_frames(size_t in_frames) const noexcept;
 
+	// Any ratio other than the one given to the constructor permanently disables the precomputed phases.
 	void set_sample_rate_ratio(float ratio) noexcept;
 
+	unsigned get_num_channels() const noexcept
+	{
+		return channels;
+	}
+
+	bool is_using_exact_phases() const noexcept
+	{
+		return exact_phase_table != nullptr;
+	}
+
 private:
 	unsigned phase_bits = 0;
 	unsigned subphase_bits = 0;
 	unsigned subphase_mask = 0;
 	unsigned taps = 0;
+	unsigned channels = 0;
+	unsigned window_stride = 0;
 	unsigned ptr = 0;
 	uint32_t time = 0;
 	uint32_t fixed_ratio = 0;
@@ -73,14 +98,39 @@ private:
 	float *phase_table = nullptr;
 	float *window_buffer = nullptr;
 
+	// Set while the resampler runs at the constructor's ratio and that ratio is a small integer fraction.
+	// In that mode, phases and fixed_ratio count output phases per input frame instead of 1 << (phase_bits + subphase_bits).
+	float *exact_phase_table = nullptr;
+	float exact_ratio = 0.0f;
+
 	void init_table_kaiser(double cutoff, unsigned phase_count, unsigned num_taps, double beta);
+	void init_exact_table(double cutoff, unsigned phase_count, unsigned num_taps, double beta);
+	static bool find_integer_ratio(double out_rate, double in_rate, uint32_t &out_phases, uint32_t &in_step);
 
+	template <unsigned Channels, bool interpolate, bool fma>
+	inline void filter_channels(float *results, unsigned first_channel) const noexcept;
+	template <unsigned Channels, bool interpolate, bool fma>
+	inline void filter_frame(float *results) const noexcept;
+	template <unsigned Channels>
+	inline void push_frame(const float * const *inputs, size_t index) noexcept;
+
+	template <bool accumulate, unsigned Channels, bool interpolate, bool fma>
+	inline size_t process_output_impl(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept;
+	template <bool accumulate, unsigned Channels, bool interpolate, bool fma>
+	inline size_t process_input_impl(float * const *outputs, const float * const *inputs, size_t in_frames) noexcept;
+	template <bool accumulate, bool fma>
+	inline size_t process_output_kernel(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept;
+	template <bool accumulate, bool fma>
+	inline size_t process_input_kernel(float * const *outputs, const float * const *inputs, size_t in_frames) noexcept;
+	// x86 builds without FMA enabled select these at runtime on CPUs which support it.
+	template <bool accumulate>
+	size_t process_output_fma(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept;
 	template <bool accumulate>
-	inline void process(float *output) const noexcept;
+	size_t process_input_fma(float * const *outputs, const float * const *inputs, size_t in_frames) noexcept;
 	template <bool accumulate>
-	inline size_t process_output(float *outputs, const float *inputs, size_t out_frames) noexcept;
+	inline size_t process_output(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept;
 	template <bool accumulate>
-	inline size_t process_input(float *outputs, const float *inputs, size_t in_frames) noexcept;
+	inline size_t process_input(float * const *outputs, const float * const *inputs, size_t in_frames) noexcept;
 };
 }
 }
@@ -101,6 +101,11 @@ struct ToneFilterStream : MixerStream
 		return source->get_sample_rate();
 	}
 
+	void non_critical_update() override
+	{
+		source->non_critical_update();
+	}
+
 	MixerStream *source = nullptr;
 	ToneFilter filter;
 	std::vector<float> mix_channels[Backend::MaxAudioChannels];
@@ -22,6 +22,8 @@
 
 #define NOMINMAX
 #include "vorbis_stream.hpp"
+#include "decoded_pcm.hpp"
+#include "decode_ahead_stream.hpp"
 #include "filesystem.hpp"
 #include "dsp/dsp.hpp"
 #include "stb_vorbis.h"
@@ -33,6 +35,63 @@ namespace Granite
 {
 namespace Audio
 {
+static DecodedPCMCache decoded_pcm_cache;
+
+static DecodedPCMHandle decode_vorbis_file(const std::string &path)
+{
+	auto mapped = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
+	if (!mapped)
+		return {};
+
+	int error;
+	stb_vorbis *file = stb_vorbis_open_memory(mapped->data<unsigned char>(),
+	                                          int(mapped->get_size()),
+	                                          &error, nullptr);
+	if (!file)
+	{
+		LOGE("Failed to load Vorbis file, error: %d\n", error);
+		return {};
+	}
+
+	auto info = stb_vorbis_get_info(file);
+	if (info.channels < 1 || info.channels > Backend::MaxAudioChannels)
+	{
+		LOGE("Unsupported number of channels in Vorbis file: %d\n", info.channels);
+		stb_vorbis_close(file);
+		return {};
+	}
+
+	auto pcm = Util::make_handle<DecodedPCM>();
+	pcm->sample_rate = float(info.sample_rate);
+	pcm->num_channels = unsigned(info.channels);
+
+	unsigned length = stb_vorbis_stream_length_in_samples(file);
+	for (unsigned c = 0; c < pcm->num_channels; c++)
+		pcm->channels[c].reserve(length);
+
+	float block[Backend::MaxAudioChannels][256];
+	float *mix_channels[Backend::MaxAudioChannels];
+	for (unsigned c = 0; c < pcm->num_channels; c++)
+		mix_channels[c] = block[c];
+
+	int ret;
+	while ((ret = stb_vorbis_get_samples_float(file, int(pcm->num_channels), mix_channels, 256)) > 0)
+		for (unsigned c = 0; c < pcm->num_channels; c++)
+			pcm->channels[c].insert(end(pcm->channels[c]), mix_channels[c], mix_channels[c] + ret);
+
+	stb_vorbis_close(file);
+	if (ret < 0)
+		return {};
+
+	pcm->num_frames = pcm->channels[0].size();
+	return pcm;
+}
+
+void set_decoded_vorbis_cache_budget(size_t bytes)
+{
+	decoded_pcm_cache.set_budget(bytes);
+}
+
 struct VorbisStream : MixerStream
 {
 	~VorbisStream();
@@ -92,7 +151,7 @@ struct DecodedVorbisStream : MixerStream
 
 	float get_sample_rate() const override
 	{
-		return sample_rate;
+		return pcm->sample_rate;
 	}
 
 	unsigned get_num_channels() const override
@@ -100,26 +159,67 @@ struct DecodedVorbisStream : MixerStream
 		return num_mixer_channels;
 	}
 
-	bool setup(float, unsigned mixer_channels_, size_t) override
+	bool setup(float mixer_output_rate, unsigned mixer_channels_, size_t) override
 	{
 		num_mixer_channels = mixer_channels_;
-		if (num_mixer_channels != num_input_channels && num_input_channels != 1)
+		if (num_mixer_channels != pcm->num_channels && pcm->num_channels != 1)
 			return false;
 
+		// Resample once into the cache, rather than having the mixer resample every instance in real time.
+		// On a miss, this instance plays through the mixer's resampler while the cache is filled in the background,
+		// since setup() runs when the stream is added and must not stall on resampling a whole clip.
+		if (pcm->sample_rate != mixer_output_rate)
+		{
+			auto resampled = decoded_pcm_cache.find_resampled(DecodedPCMCache::get_key(path, mixer_output_rate),
+			                                                  pcm, mixer_output_rate);
+			if (resampled)
+				pcm = std::move(resampled);
+		}
+
 		for (unsigned i = 0; i < num_mixer_channels; i++)
-			decoded_audio_ptr[i] = decoded_audio[num_input_channels == 1 ? 0 : i].data();
+			decoded_audio_ptr[i] = pcm->channels[pcm->num_channels == 1 ? 0 : i].data();
 		return true;
 	}
 
-	std::vector<float> decoded_audio[Backend::MaxAudioChannels];
+	std::string path;
+	DecodedPCMHandle pcm;
 	const float *decoded_audio_ptr[Backend::MaxAudioChannels] = {};
 	size_t offset = 0;
-	float sample_rate = 0.0f;
-	unsigned num_input_channels = 0;
 	unsigned num_mixer_channels = 0;
 	bool looping = false;
 };
 
+struct VorbisDecoder : PCMDecoder
+{
+	~VorbisDecoder() override;
+	bool init(const std::string &path);
+
+	float get_sample_rate() const override
+	{
+		return sample_rate;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	int decode(float **channels, unsigned num_frames) override
+	{
+		return stb_vorbis_get_samples_float(file, int(num_channels), channels, int(num_frames));
+	}
+
+	void rewind() override
+	{
+		stb_vorbis_seek_start(file);
+	}
+
+	stb_vorbis *file = nullptr;
+	FileMappingHandle filesystem_mapping;
+	float sample_rate = 0.0f;
+	unsigned num_channels = 0;
+};
+
 bool VorbisStream::init(const std::string &path)
 {
 	filesystem_mapping = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
@@ -146,59 +246,35 @@ bool VorbisStream::init(const std::string &path)
 	return true;
 }
 
-bool DecodedVorbisStream::init(const std::string &path)
+bool DecodedVorbisStream::init(const std::string &path_)
 {
-	auto mapped = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
-	if (!mapped)
-		return false;
-
-	int error;
-	stb_vorbis *file = stb_vorbis_open_memory(mapped->data<unsigned char>(),
-	                                          int(mapped->get_size()),
-	                                          &error, nullptr);
-	if (!file)
-	{
-		LOGE("Failed to load Vorbis file, error: %d\n", error);
-		return false;
-	}
-
-	auto info = stb_vorbis_get_info(file);
-	sample_rate = info.sample_rate;
-	num_input_channels = unsigned(info.channels);
-
-	float block[Backend::MaxAudioChannels][256];
-	float *mix_channels[Backend::MaxAudioChannels];
-	for (unsigned c = 0; c < num_input_channels; c++)
-		mix_channels[c] = block[c];
+	path = path_;
 
-	int ret;
-	while ((ret = stb_vorbis_get_samples_float(file, int(num_input_channels), mix_channels, 256)) > 0)
-		for (unsigned c = 0; c < num_input_channels; c++)
-			decoded_audio[c].insert(end(decoded_audio[c]), mix_channels[c], mix_channels[c] + ret);
+	uint64_t key = DecodedPCMCache::get_key(path, 0.0f);
+	pcm = decoded_pcm_cache.find(key);
+	if (pcm)
+		return true;
 
-	if (ret < 0)
-		goto error;
+	pcm = decode_vorbis_file(path);
+	if (!pcm)
+		return false;
 
-	stb_vorbis_close(file);
+	pcm = decoded_pcm_cache.insert(key, std::move(pcm));
 	return true;
-
-error:
-	stb_vorbis_close(file);
-	return false;
 }
 
 size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const float *gains, size_t num_frames) noexcept
 {
-	size_t to_write = std::min(decoded_audio[0].size() - offset, num_frames);
+	size_t to_write = std::min(pcm->num_frames - offset, num_frames);
 
 	for (unsigned c = 0; c < num_mixer_channels; c++)
 		DSP::accumulate_channel(channels[c], decoded_audio_ptr[c] + offset, gains[c], to_write);
 
 	offset += to_write;
 
-	if (offset >= decoded_audio[0].size())
+	if (offset >= pcm->num_frames)
 	{
-		if (looping)
+		if (looping && pcm->num_frames)
 			offset = 0;
 		else
 			return to_write;
@@ -208,7 +284,7 @@ size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const flo
 	if (spill_to_write)
 	{
 		float *modified_channels[Backend::MaxAudioChannels];
-		for (unsigned c = 0; c < num_input_channels; c++)
+		for (unsigned c = 0; c < num_mixer_channels; c++)
 			modified_channels[c] = channels[c] + to_write;
 
 		return accumulate_samples(modified_channels, gains, spill_to_write) + to_write;
@@ -244,6 +320,34 @@ VorbisStream::~VorbisStream()
 		stb_vorbis_close(file);
 }
 
+bool VorbisDecoder::init(const std::string &path)
+{
+	filesystem_mapping = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
+	if (!filesystem_mapping || filesystem_mapping->get_size() == 0)
+		return false;
+
+	int error;
+	file = stb_vorbis_open_memory(filesystem_mapping->data<unsigned char>(),
+	                              int(filesystem_mapping->get_size()),
+	                              &error, nullptr);
+	if (!file)
+	{
+		LOGE("Failed to load Vorbis file, error: %d\n", error);
+		return false;
+	}
+
+	auto info = stb_vorbis_get_info(file);
+	sample_rate = float(info.sample_rate);
+	num_channels = unsigned(info.channels);
+	return true;
+}
+
+VorbisDecoder::~VorbisDecoder()
+{
+	if (file)
+		stb_vorbis_close(file);
+}
+
 MixerStream *create_vorbis_stream(const std::string &path, bool looping)
 {
 	auto vorbis = new VorbisStream;
@@ -269,5 +373,21 @@ MixerStream *create_decoded_vorbis_stream(const std::string &path, bool looping)
 	vorbis->looping = looping;
 	return vorbis;
 }
+
+MixerStream *create_decode_ahead_vorbis_stream(const std::string &path, bool looping, float ahead_seconds)
+{
+	std::unique_ptr<VorbisDecoder> decoder(new VorbisDecoder);
+	if (!decoder->init(path))
+		return nullptr;
+
+	auto stream = new DecodeAheadStream;
+	if (!stream->init(std::move(decoder), looping, ahead_seconds))
+	{
+		stream->dispose();
+		return nullptr;
+	}
+
+	return stream;
+}
+}
 }
-}
\ No newline at end of file
@@ -30,6 +30,19 @@ namespace Granite
 namespace Audio
 {
 MixerStream *create_vorbis_stream(const std::string &path, bool looping = false);
+
+// Decodes the whole clip up front. Clips are shared between streams through a cache,
+// so repeated sound effects are neither decoded nor resampled again.
 MixerStream *create_decoded_vorbis_stream(const std::string &path, bool looping = false);
+
+// Decodes ahead_seconds ahead of playback on a background ThreadGroup task, so the mixer thread never runs the
+// Vorbis decoder. Meant for long streams like music.
+// Refills are kicked from Mixer::dispose_dead_streams(), which must be called at least every ahead_seconds / 2.
+MixerStream *create_decode_ahead_vorbis_stream(const std::string &path, bool looping = false,
+                                               float ahead_seconds = 1.0f);
+
+// Memory budget for decoded clips in the cache. Clips above a quarter of the budget are not cached.
+// Clips still used by a stream stay alive regardless of the budget.
+void set_decoded_vorbis_cache_budget(size_t bytes);
 }
 }
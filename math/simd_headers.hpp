@@ -34,6 +34,10 @@
 #if defined(_INCLUDED_IMM) && !defined(__AVX__)
 #define __AVX__ 1
 #endif
+// /arch:AVX2 implies FMA, but MSVC does not advertise it.
+#if defined(__AVX2__) && !defined(__FMA__)
+#define __FMA__ 1
+#endif
 
 #elif defined(__AVX__)
 #include <immintrin.h>
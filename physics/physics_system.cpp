@@ -21,10 +21,30 @@
  */
 
 #include "physics_system.hpp"
+#include "thread_group.hpp"
+#include "global_managers.hpp"
+#include "filesystem.hpp"
+#include "path_utils.hpp"
+#include "hash.hpp"
+#include "logging.hpp"
 #include <btBulletDynamicsCommon.h>
 #include <btBulletCollisionCommon.h>
+#include <BulletCollision/BroadphaseCollision/btDbvtBroadphase.h>
+#include <BulletCollision/CollisionDispatch/btCollisionObjectWrapper.h>
 #include <BulletCollision/CollisionDispatch/btGhostObject.h>
 #include <BulletDynamics/Character/btKinematicCharacterController.h>
+#include <LinearMath/btThreads.h>
+#if BT_THREADSAFE
+#include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#endif
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <exception>
+#include <mutex>
+#include <string.h>
+#include <assert.h>
 
 namespace Granite
 {
@@ -58,6 +78,7 @@ struct PhysicsHandle
 	Entity *entity = nullptr;
 	PhysicsSystem::InteractionType type = PhysicsSystem::InteractionType::Ghost;
 	bool copy_transform_from_node = false;
+	unsigned index = 0;
 
 	~PhysicsHandle()
 	{
@@ -118,6 +139,39 @@ void PhysicsSystem::tick_callback(float)
 	new_collision_buffer.clear();
 }
 
+static int convert_interaction_flags(PhysicsSystem::InteractionTypeFlags flags)
+{
+	if (flags == PhysicsSystem::INTERACTION_TYPE_ALL_BITS)
+		return btBroadphaseProxy::AllFilter;
+
+	int mask = 0;
+	if (flags & PhysicsSystem::INTERACTION_TYPE_STATIC_BIT)
+		mask |= btBroadphaseProxy::StaticFilter;
+	if (flags & PhysicsSystem::INTERACTION_TYPE_DYNAMIC_BIT)
+		mask |= btBroadphaseProxy::DefaultFilter;
+	if (flags & PhysicsSystem::INTERACTION_TYPE_INVISIBLE_BIT)
+		mask |= btBroadphaseProxy::SensorTrigger;
+	if (flags & PhysicsSystem::INTERACTION_TYPE_KINEMATIC_BIT)
+		mask |= btBroadphaseProxy::CharacterFilter;
+	return mask;
+}
+
+static RaycastResult build_raycast_result(const btCollisionObject *object,
+                                          const btVector3 &world_pos, const btVector3 &world_normal,
+                                          float t)
+{
+	RaycastResult result = {};
+	if (object)
+	{
+		result.handle = static_cast<PhysicsHandle *>(object->getUserPointer());
+		result.entity = result.handle ? result.handle->entity : nullptr;
+	}
+	result.world_pos = convert(world_pos);
+	result.world_normal = convert(world_normal);
+	result.t = t;
+	return result;
+}
+
 RaycastResult PhysicsSystem::query_closest_hit_ray(const vec3 &from, const vec3 &dir, float t,
                                                    InteractionTypeFlags flags)
 {
@@ -125,54 +179,438 @@ RaycastResult PhysicsSystem::query_closest_hit_ray(const vec3 &from, const vec3
 	btVector3 ray_from_world = convert(from);
 	btVector3 ray_to_world = convert(to);
 	btCollisionWorld::ClosestRayResultCallback cb(ray_from_world, ray_to_world);
-
-	cb.m_collisionFilterMask = 0;
-	if (flags == INTERACTION_TYPE_ALL_BITS)
-		cb.m_collisionFilterMask = btBroadphaseProxy::AllFilter;
-	else
-	{
-		if (flags & INTERACTION_TYPE_STATIC_BIT)
-			cb.m_collisionFilterMask |= btBroadphaseProxy::StaticFilter;
-		if (flags & INTERACTION_TYPE_DYNAMIC_BIT)
-			cb.m_collisionFilterMask |= btBroadphaseProxy::DefaultFilter;
-		if (flags & INTERACTION_TYPE_INVISIBLE_BIT)
-			cb.m_collisionFilterMask |= btBroadphaseProxy::SensorTrigger;
-		if (flags & INTERACTION_TYPE_KINEMATIC_BIT)
-			cb.m_collisionFilterMask |= btBroadphaseProxy::CharacterFilter;
-	}
+	cb.m_collisionFilterMask = convert_interaction_flags(flags);
 
 	world->rayTest(ray_from_world, ray_to_world, cb);
 
 	RaycastResult result = {};
 	if (cb.hasHit())
 	{
-		auto *object = cb.m_collisionObject;
-		if (object)
+		result = build_raycast_result(cb.m_collisionObject, cb.m_hitPointWorld, cb.m_hitNormalWorld,
+		                              cb.m_closestHitFraction * t);
+		//LOGI("Ray hit: %f, %f, %f\n", result.world_pos.x, result.world_pos.y, result.world_pos.z);
+	}
+	return result;
+}
+
+// btCollisionWorld::rayTest() and convexSweepTest() go through btDbvtBroadphase::rayTest(),
+// which shares a traversal stack unless Bullet is built with BT_THREADSAFE.
+// The batched queries traverse the broadphase trees with the re-entrant btDbvt functions instead,
+// and run the per-object tests through the static btCollisionWorld helpers.
+// ICollide::Process() is only virtual when Bullet does not use template policies, so no override here.
+struct BroadphaseRayCollector : btDbvt::ICollide
+{
+	BroadphaseRayCollector(const btTransform &from_, const btTransform &to_,
+	                       btCollisionWorld::RayResultCallback &cb_)
+		: from(from_), to(to_), cb(cb_)
+	{
+	}
+
+	void Process(const btDbvtNode *leaf)
+	{
+		auto *proxy = static_cast<btBroadphaseProxy *>(leaf->data);
+		auto *object = static_cast<btCollisionObject *>(proxy->m_clientObject);
+		if (cb.needsCollision(object->getBroadphaseHandle()))
 		{
-			result.handle = static_cast<PhysicsHandle *>(object->getUserPointer());
-			result.entity = result.handle ? result.handle->entity : nullptr;
+			btCollisionWorld::rayTestSingle(from, to, object, object->getCollisionShape(),
+			                                object->getWorldTransform(), cb);
 		}
-		result.world_pos.x = cb.m_hitPointWorld.x();
-		result.world_pos.y = cb.m_hitPointWorld.y();
-		result.world_pos.z = cb.m_hitPointWorld.z();
-		result.world_normal.x = cb.m_hitNormalWorld.x();
-		result.world_normal.y = cb.m_hitNormalWorld.y();
-		result.world_normal.z = cb.m_hitNormalWorld.z();
-		result.t = cb.m_closestHitFraction * t;
+	}
 
-		//LOGI("Ray hit: %f, %f, %f\n", result.world_pos.x, result.world_pos.y, result.world_pos.z);
+	const btTransform &from;
+	const btTransform &to;
+	btCollisionWorld::RayResultCallback &cb;
+};
+
+struct BroadphaseSweepCollector : btDbvt::ICollide
+{
+	BroadphaseSweepCollector(const btConvexShape *shape_, const btTransform &from_, const btTransform &to_,
+	                         btCollisionWorld::ConvexResultCallback &cb_, btScalar allowed_penetration_)
+		: shape(shape_), from(from_), to(to_), cb(cb_), allowed_penetration(allowed_penetration_)
+	{
 	}
-	return result;
+
+	void Process(const btDbvtNode *leaf)
+	{
+		auto *proxy = static_cast<btBroadphaseProxy *>(leaf->data);
+		auto *object = static_cast<btCollisionObject *>(proxy->m_clientObject);
+		if (cb.needsCollision(object->getBroadphaseHandle()))
+		{
+			btCollisionWorld::objectQuerySingle(shape, from, to, object, object->getCollisionShape(),
+			                                    object->getWorldTransform(), cb, allowed_penetration);
+		}
+	}
+
+	const btConvexShape *shape;
+	const btTransform &from;
+	const btTransform &to;
+	btCollisionWorld::ConvexResultCallback &cb;
+	btScalar allowed_penetration;
+};
+
+// Only reports whether any penetrating contact was found.
+struct OverlapManifoldResult : btManifoldResult
+{
+	OverlapManifoldResult(const btCollisionObjectWrapper *obj0, const btCollisionObjectWrapper *obj1)
+		: btManifoldResult(obj0, obj1)
+	{
+		m_closestPointDistanceThreshold = 0.0f;
+	}
+
+	void addContactPoint(const btVector3 &, const btVector3 &, btScalar depth) override
+	{
+		if (depth <= 0.0f)
+			hit = true;
+	}
+
+	bool hit = false;
+};
+
+// Collision algorithms and their manifolds are allocated from pools owned by the dispatcher,
+// so every concurrent nearphase query needs its own.
+struct PhysicsQueryContext
+{
+	PhysicsQueryContext()
+	{
+		btDefaultCollisionConstructionInfo info;
+		info.m_defaultMaxPersistentManifoldPoolSize = 64;
+		info.m_defaultMaxCollisionAlgorithmPoolSize = 64;
+		config = std::make_unique<btDefaultCollisionConfiguration>(info);
+		dispatcher = std::make_unique<btCollisionDispatcher>(config.get());
+	}
+
+	bool test_contact(btCollisionObject *a, btCollisionObject *b, const btDispatcherInfo &dispatch_info)
+	{
+		btCollisionObjectWrapper wrap_a(nullptr, a->getCollisionShape(), a, a->getWorldTransform(), -1, -1);
+		btCollisionObjectWrapper wrap_b(nullptr, b->getCollisionShape(), b, b->getWorldTransform(), -1, -1);
+
+		auto *algorithm = dispatcher->findAlgorithm(&wrap_a, &wrap_b, nullptr, BT_CLOSEST_POINT_ALGORITHMS);
+		if (!algorithm)
+			return false;
+
+		OverlapManifoldResult result(&wrap_a, &wrap_b);
+		algorithm->processCollision(&wrap_a, &wrap_b, dispatch_info, &result);
+		algorithm->~btCollisionAlgorithm();
+		dispatcher->freeCollisionAlgorithm(algorithm);
+		return result.hit;
+	}
+
+	std::unique_ptr<btDefaultCollisionConfiguration> config;
+	std::unique_ptr<btCollisionDispatcher> dispatcher;
+};
+
+template <typename Func>
+void PhysicsSystem::run_batched_query(unsigned count, ThreadGroup *group, const Func &func)
+{
+	if (!count)
+		return;
+
+	constexpr unsigned MinQueriesPerTask = 32;
+	unsigned num_chunks = 1;
+	if (group)
+	{
+		num_chunks = std::min((count + MinQueriesPerTask - 1) / MinQueriesPerTask,
+		                      2 * group->get_num_threads());
+		num_chunks = std::max(num_chunks, 1u);
+	}
+	unsigned grain_size = (count + num_chunks - 1) / num_chunks;
+	num_chunks = (count + grain_size - 1) / grain_size;
+
+	// Take contexts out of the free list for the duration of the call, so concurrent batches never share one.
+	std::vector<std::unique_ptr<PhysicsQueryContext>> contexts(num_chunks);
+	{
+		std::lock_guard<std::mutex> holder{query_context_lock};
+		for (auto &context : contexts)
+		{
+			if (query_contexts.empty())
+				continue;
+			context = std::move(query_contexts.back());
+			query_contexts.pop_back();
+		}
+	}
+
+	for (auto &context : contexts)
+		if (!context)
+			context.reset(new PhysicsQueryContext);
+
+	struct ContextReturn
+	{
+		PhysicsSystem &system;
+		std::vector<std::unique_ptr<PhysicsQueryContext>> &contexts;
+		~ContextReturn()
+		{
+			std::lock_guard<std::mutex> holder{system.query_context_lock};
+			for (auto &context : contexts)
+				system.query_contexts.push_back(std::move(context));
+		}
+	} context_return = { *this, contexts };
+
+	// Each chunk owns one context. The calling thread works through chunks too,
+	// so a batch issued from within a task of the same group cannot deadlock.
+	parallel_for_range(group, 0, count, grain_size, "physics-batched-query",
+	                   [&](size_t chunk, size_t begin, size_t end) {
+		func(*contexts[chunk], unsigned(begin), unsigned(end));
+	});
+}
+
+void PhysicsSystem::query_closest_hit_rays(const RayQuery *queries, RaycastResult *results, unsigned count,
+                                           ThreadGroup *group)
+{
+	auto *dbvt_broadphase = broadphase.get();
+
+	run_batched_query(count, group, [=](PhysicsQueryContext &, unsigned begin, unsigned end) {
+		for (unsigned i = begin; i < end; i++)
+		{
+			auto &query = queries[i];
+			btVector3 ray_from_world = convert(query.from);
+			btVector3 ray_to_world = convert(query.from + query.dir * query.length);
+			btCollisionWorld::ClosestRayResultCallback cb(ray_from_world, ray_to_world);
+			cb.m_collisionFilterMask = convert_interaction_flags(query.mask);
+
+			btTransform from_trans, to_trans;
+			from_trans.setIdentity();
+			from_trans.setOrigin(ray_from_world);
+			to_trans.setIdentity();
+			to_trans.setOrigin(ray_to_world);
+
+			BroadphaseRayCollector collector(from_trans, to_trans, cb);
+			for (auto &set : dbvt_broadphase->m_sets)
+				btDbvt::rayTest(set.m_root, ray_from_world, ray_to_world, collector);
+
+			if (cb.hasHit())
+			{
+				results[i] = build_raycast_result(cb.m_collisionObject, cb.m_hitPointWorld, cb.m_hitNormalWorld,
+				                                  cb.m_closestHitFraction * query.length);
+			}
+			else
+				results[i] = {};
+		}
+	});
+}
+
+void PhysicsSystem::query_closest_hit_sweeps(const SweepQuery *queries, RaycastResult *results, unsigned count,
+                                             ThreadGroup *group)
+{
+	auto *dbvt_broadphase = broadphase.get();
+	btScalar allowed_penetration = world->getDispatchInfo().m_allowedCcdPenetration;
+
+	run_batched_query(count, group, [=](PhysicsQueryContext &, unsigned begin, unsigned end) {
+		for (unsigned i = begin; i < end; i++)
+		{
+			auto &query = queries[i];
+			results[i] = {};
+
+			// Same shape conventions as create_shape().
+			btSphereShape sphere(query.radius);
+			btBoxShape box(btVector3(query.radius, query.radius, query.radius));
+			btCapsuleShape capsule(query.radius, 0.5f * query.height);
+			btCylinderShape cylinder(btVector3(query.radius, 0.5f * query.height, query.radius));
+			btConeShape cone(query.radius, 0.5f * query.height);
+
+			const btConvexShape *shape = nullptr;
+			switch (query.type)
+			{
+			case MeshType::Sphere:
+				shape = &sphere;
+				break;
+			case MeshType::Cube:
+				shape = &box;
+				break;
+			case MeshType::Capsule:
+				shape = &capsule;
+				break;
+			case MeshType::Cylinder:
+				shape = &cylinder;
+				break;
+			case MeshType::Cone:
+				shape = &cone;
+				break;
+			default:
+				break;
+			}
+
+			if (!shape)
+				continue;
+
+			btVector3 sweep_from_world = convert(query.from);
+			btVector3 sweep_to_world = convert(query.from + query.dir * query.length);
+			btTransform from_trans, to_trans;
+			from_trans.setIdentity();
+			from_trans.setOrigin(sweep_from_world);
+			from_trans.setRotation(convert(query.rotation));
+			to_trans = from_trans;
+			to_trans.setOrigin(sweep_to_world);
+
+			btCollisionWorld::ClosestConvexResultCallback cb(sweep_from_world, sweep_to_world);
+			cb.m_collisionFilterMask = convert_interaction_flags(query.mask);
+
+			// Conservative bounds for the whole sweep.
+			btVector3 lo0, hi0, lo1, hi1;
+			shape->getAabb(from_trans, lo0, hi0);
+			shape->getAabb(to_trans, lo1, hi1);
+			lo0.setMin(lo1);
+			hi0.setMax(hi1);
+			auto volume = btDbvtVolume::FromMM(lo0, hi0);
+
+			BroadphaseSweepCollector collector(shape, from_trans, to_trans, cb, allowed_penetration);
+			for (auto &set : dbvt_broadphase->m_sets)
+				set.collideTV(set.m_root, volume, collector);
+
+			if (cb.hasHit())
+			{
+				results[i] = build_raycast_result(cb.m_hitCollisionObject, cb.m_hitPointWorld, cb.m_hitNormalWorld,
+				                                  cb.m_closestHitFraction * query.length);
+			}
+		}
+	});
+}
+
+void PhysicsSystem::query_overlapping_objects(const OverlapQuery *queries, unsigned *hit_counts, unsigned count,
+                                              ThreadGroup *group)
+{
+	const btDispatcherInfo &dispatch_info = world->getDispatchInfo();
+
+	run_batched_query(count, group, [=, &dispatch_info](PhysicsQueryContext &context, unsigned begin, unsigned end) {
+		for (unsigned i = begin; i < end; i++)
+		{
+			auto &query = queries[i];
+			hit_counts[i] = 0;
+
+			auto *ghost = btPairCachingGhostObject::upcast(query.handle->bt_object);
+			if (!ghost)
+				continue;
+
+			int mask = convert_interaction_flags(query.mask);
+			auto *ghost_proxy = ghost->getBroadphaseHandle();
+			auto &pairs = ghost->getOverlappingPairs();
+			int num_pairs = pairs.size();
+
+			for (int j = 0; j < num_pairs && hit_counts[i] < query.max_hits; j++)
+			{
+				auto *object = pairs[j];
+				auto *proxy = object->getBroadphaseHandle();
+
+				bool response = (ghost_proxy->m_collisionFilterGroup & proxy->m_collisionFilterMask) != 0 &&
+				                (proxy->m_collisionFilterGroup & ghost_proxy->m_collisionFilterMask) != 0 &&
+				                (proxy->m_collisionFilterGroup & mask) != 0;
+
+				if (!response)
+					continue;
+
+				if (query.method == OverlapMethod::Nearphase && !context.test_contact(ghost, object, dispatch_info))
+					continue;
+
+				query.hits[hit_counts[i]++] = static_cast<PhysicsHandle *>(object->getUserPointer());
+			}
+		}
+	});
 }
 
-PhysicsSystem::PhysicsSystem()
+// Runs Bullet's internal parallel loops on the thread group instead of a thread pool of Bullet's own.
+class PhysicsTaskScheduler final : public btITaskScheduler
+{
+public:
+	explicit PhysicsTaskScheduler(ThreadGroup &group_)
+		: btITaskScheduler("Granite"), group(group_)
+	{
+	}
+
+	// Bullet sizes per-thread state and picks grain sizes by this, and indexes the state with
+	// btGetCurrentThreadIndex(), which hands out indices in the order threads first call into it.
+	// Only the workers and the thread which calls iterate() run Bullet's loops, which is why
+	// iterate() has to be called from the thread which created the PhysicsSystem.
+	// Any other thread calling into Bullet first, such as the workers of an earlier thread group,
+	// pushes indices out of range. check_thread_index() catches that in debug builds.
+	int getMaxNumThreads() const override
+	{
+		return getNumThreads();
+	}
+
+	int getNumThreads() const override
+	{
+		return int(std::min(group.get_num_threads() + 1, unsigned(BT_MAX_THREAD_COUNT)));
+	}
+
+	void setNumThreads(int) override
+	{
+	}
+
+	void check_thread_index() const
+	{
+		assert(btGetCurrentThreadIndex() < unsigned(getNumThreads()));
+	}
+
+	void parallelFor(int begin, int end, int grain_size, const btIParallelForBody &body) override
+	{
+		parallel_for_range(&group, size_t(begin), size_t(end), size_t(grain_size), "bullet-parallel-for",
+		                   [this, &body](size_t, size_t chunk_begin, size_t chunk_end) {
+			check_thread_index();
+			body.forLoop(int(chunk_begin), int(chunk_end));
+		});
+	}
+
+	btScalar parallelSum(int begin, int end, int grain_size, const btIParallelSumBody &body) override
+	{
+		// Sum per chunk and reduce in order so the result does not depend on scheduling.
+		grain_size = std::max(grain_size, 1);
+		std::vector<btScalar> sums(size_t(std::max((end - begin + grain_size - 1) / grain_size, 0)));
+		parallel_for_range(&group, size_t(begin), size_t(end), size_t(grain_size), "bullet-parallel-sum",
+		                   [&](size_t chunk, size_t chunk_begin, size_t chunk_end) {
+			check_thread_index();
+			sums[chunk] = body.sumLoop(int(chunk_begin), int(chunk_end));
+		});
+
+		btScalar sum = btScalar(0);
+		for (auto s : sums)
+			sum += s;
+		return sum;
+	}
+
+private:
+	ThreadGroup &group;
+};
+
+PhysicsSystem::PhysicsSystem(ThreadGroup *group)
 {
-	collision_config = std::make_unique<btDefaultCollisionConfiguration>();
-	dispatcher = std::make_unique<btCollisionDispatcher>(collision_config.get());
-	broadphase = std::make_unique<btDbvtBroadphase>();
-	solver = std::make_unique<btSequentialImpulseConstraintSolver>();
-	world = std::make_unique<btDiscreteDynamicsWorld>(dispatcher.get(), broadphase.get(),
-	                                                  solver.get(), collision_config.get());
+#if BT_THREADSAFE
+	if (group)
+	{
+		thread_group = group;
+		creation_thread = std::this_thread::get_id();
+
+		// Has to be in place before the dispatcher is created.
+		task_scheduler = std::make_unique<PhysicsTaskScheduler>(*thread_group);
+		btSetTaskScheduler(task_scheduler.get());
+
+		// The thread group might not be started yet, so size the solver pool for the machine.
+		unsigned num_solvers = std::max(thread_group->get_num_threads(), std::thread::hardware_concurrency()) + 1;
+		num_solvers = std::min(num_solvers, unsigned(BT_MAX_THREAD_COUNT));
+
+		btDefaultCollisionConstructionInfo info;
+		info.m_defaultMaxPersistentManifoldPoolSize = 8192;
+		info.m_defaultMaxCollisionAlgorithmPoolSize = 8192;
+		collision_config = std::make_unique<btDefaultCollisionConfiguration>(info);
+		dispatcher = std::make_unique<btCollisionDispatcherMt>(collision_config.get());
+		broadphase = std::make_unique<btDbvtBroadphase>();
+		auto *solver_pool = new btConstraintSolverPoolMt(int(num_solvers));
+		solver.reset(solver_pool);
+		world = std::make_unique<btDiscreteDynamicsWorldMt>(dispatcher.get(), broadphase.get(),
+		                                                    solver_pool, nullptr, collision_config.get());
+	}
+	else
+#else
+	// Without Bullet's multithreaded world, iterate() stays serial and never waits on the thread group,
+	// so it can be called from anywhere, including a thread group worker.
+	(void)group;
+#endif
+	{
+		collision_config = std::make_unique<btDefaultCollisionConfiguration>();
+		dispatcher = std::make_unique<btCollisionDispatcher>(collision_config.get());
+		broadphase = std::make_unique<btDbvtBroadphase>();
+		solver = std::make_unique<btSequentialImpulseConstraintSolver>();
+		world = std::make_unique<btDiscreteDynamicsWorld>(dispatcher.get(), broadphase.get(),
+		                                                  solver.get(), collision_config.get());
+	}
 
 	world->setGravity(btVector3(0.0f, -9.81f, 0.0f));
 	world->setInternalTickCallback(tick_callback_wrapper, this);
@@ -297,10 +735,81 @@ PhysicsSystem::~PhysicsSystem()
 
 	for (auto *handle : handles)
 		handle_pool.free(handle);
+
+	if (task_scheduler && btGetTaskScheduler() == task_scheduler.get())
+		btSetTaskScheduler(btGetSequentialTaskScheduler());
+}
+
+static void copy_transform_from_node(PhysicsHandle *handle)
+{
+	if (!handle->node || !handle->copy_transform_from_node)
+		return;
+
+	auto *obj = handle->bt_object;
+	auto *ghost = btPairCachingGhostObject::upcast(obj);
+	auto *body = btRigidBody::upcast(obj);
+
+	btTransform t;
+	t.setIdentity();
+	auto &rot = handle->node->transform.rotation;
+	auto &pos = handle->node->transform.translation;
+	t.setOrigin(convert(pos));
+	t.setRotation(convert(rot));
+
+	if (ghost)
+	{
+		ghost->setWorldTransform(t);
+	}
+	else if (body)
+	{
+		if (body->getMotionState())
+			body->getMotionState()->setWorldTransform(t);
+		else
+			body->setWorldTransform(t);
+		body->setCenterOfMassTransform(t);
+	}
+}
+
+static void copy_transform_to_node(PhysicsHandle *handle)
+{
+	if (!handle->node || handle->copy_transform_from_node)
+		return;
+
+	auto *obj = handle->bt_object;
+	auto *ghost = btPairCachingGhostObject::upcast(obj);
+	if (ghost)
+		return;
+
+	auto *body = btRigidBody::upcast(obj);
+	btTransform t;
+	if (body && body->getMotionState())
+		body->getMotionState()->getWorldTransform(t);
+	else
+		t = obj->getWorldTransform();
+
+	auto rot = t.getRotation();
+	auto &transform = handle->node->transform;
+	transform.rotation.x = rot.x();
+	transform.rotation.y = rot.y();
+	transform.rotation.z = rot.z();
+	transform.rotation.w = rot.w();
+
+	auto orig = t.getOrigin();
+	transform.translation.x = orig.x();
+	transform.translation.y = orig.y();
+	transform.translation.z = orig.z();
+
+	handle->node->invalidate_cached_transform();
 }
 
 void PhysicsSystem::iterate(double frame_time)
 {
+	if (task_scheduler)
+	{
+		assert(std::this_thread::get_id() == creation_thread);
+		task_scheduler->check_thread_index();
+	}
+
 	// System which applies forces to objects every iteration.
 	if (forces)
 	{
@@ -320,79 +829,32 @@ void PhysicsSystem::iterate(double frame_time)
 	}
 
 	// Update ghost object locations.
+	// Objects are independent here, but updating the broadphase is not thread-safe.
+	constexpr size_t TransformSyncGrainSize = 256;
+	parallel_for_range(thread_group, 0, handles.size(), TransformSyncGrainSize, "physics-sync-from-nodes",
+	                   [this](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			copy_transform_from_node(handles[i]);
+	});
+
 	for (auto *handle : handles)
 	{
 		if (!handle->node || !handle->copy_transform_from_node)
 			continue;
 
 		auto *obj = handle->bt_object;
-		auto *ghost = btPairCachingGhostObject::upcast(obj);
-		auto *body = btRigidBody::upcast(obj);
-
-		if (ghost)
-		{
-			btTransform t;
-			t.setIdentity();
-			auto &rot = handle->node->transform.rotation;
-			auto &pos = handle->node->transform.translation;
-			t.setOrigin(convert(pos));
-			t.setRotation(convert(rot));
-			ghost->setWorldTransform(t);
-			if (ghost->getBroadphaseHandle())
-				world->updateSingleAabb(ghost);
-		}
-		else if (body)
-		{
-			btTransform t;
-			t.setIdentity();
-			auto &rot = handle->node->transform.rotation;
-			auto &pos = handle->node->transform.translation;
-			t.setOrigin(convert(pos));
-			t.setRotation(convert(rot));
-			if (body->getMotionState())
-				body->getMotionState()->setWorldTransform(t);
-			else
-				body->setWorldTransform(t);
-			body->setCenterOfMassTransform(t);
-			if (body->getBroadphaseHandle())
-				world->updateSingleAabb(body);
-		}
+		if (obj->getBroadphaseHandle() && (btPairCachingGhostObject::upcast(obj) || btRigidBody::upcast(obj)))
+			world->updateSingleAabb(obj);
 	}
 
 	world->stepSimulation(btScalar(frame_time), 20, PHYSICS_TICK);
 
 	// Update node transforms from physics engine.
-	for (auto *handle : handles)
-	{
-		if (!handle->node || handle->copy_transform_from_node)
-			continue;
-
-		auto *obj = handle->bt_object;
-		auto *ghost = btPairCachingGhostObject::upcast(obj);
-		if (ghost)
-			continue;
-
-		auto *body = btRigidBody::upcast(obj);
-		btTransform t;
-		if (body && body->getMotionState())
-			body->getMotionState()->getWorldTransform(t);
-		else
-			t = obj->getWorldTransform();
-
-		auto rot = t.getRotation();
-		auto &transform = handle->node->transform;
-		transform.rotation.x = rot.x();
-		transform.rotation.y = rot.y();
-		transform.rotation.z = rot.z();
-		transform.rotation.w = rot.w();
-
-		auto orig = t.getOrigin();
-		transform.translation.x = orig.x();
-		transform.translation.y = orig.y();
-		transform.translation.z = orig.z();
-
-		handle->node->invalidate_cached_transform();
-	}
+	parallel_for_range(thread_group, 0, handles.size(), TransformSyncGrainSize, "physics-sync-to-nodes",
+	                   [this](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			copy_transform_to_node(handles[i]);
+	});
 }
 
 Entity *PhysicsSystem::get_handle_parent(PhysicsHandle *handle)
@@ -425,15 +887,258 @@ void PhysicsSystem::remove_body(PhysicsHandle *handle)
 	}
 
 	world->removeCollisionObject(obj);
+
+	// Order of handles does not matter, swap with the last one.
+	unsigned index = handle->index;
+	handles[index] = handles.back();
+	handles[index]->index = index;
+	handles.pop_back();
+
 	handle_pool.free(handle);
+}
+
+// The cache file is the quantized node array and subtree headers exactly as btQuantizedBvh keeps them in memory,
+// so a hit is a read-only file mapping which the BVH points straight into.
+// Bullet's own deSerializeInPlace() patches pointers inside the buffer, which does not work with a read-only mapping.
+static constexpr uint32_t CollisionBvhCacheVersion = 1;
+
+struct CollisionBvhCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t endian_marker;
+	uint32_t scalar_size;
+	uint32_t node_size;
+	uint32_t subtree_header_size;
+	uint32_t bullet_version;
+	uint64_t content_hash;
+	double aabb_min[3];
+	double aabb_max[3];
+	double quantization[3];
+	int32_t cur_node_index;
+	int32_t num_subtree_headers;
+	int32_t subtree_header_count;
+	int32_t traversal_mode;
+};
 
-	// TODO: Avoid O(n).
-	auto itr = find(begin(handles), end(handles), handle);
-	if (itr != end(handles))
-		handles.erase(itr);
+static constexpr size_t align_cache_offset(size_t offset)
+{
+	return (offset + 15) & ~size_t(15);
 }
 
-unsigned PhysicsSystem::register_collision_mesh(const CollisionMesh &mesh)
+static void fill_cache_header_compat(CollisionBvhCacheHeader &header)
+{
+	memcpy(header.magic, "GRANBVH", sizeof(header.magic));
+	header.version = CollisionBvhCacheVersion;
+	header.endian_marker = 0x01020304u;
+	header.scalar_size = sizeof(btScalar);
+	header.node_size = sizeof(btQuantizedBvhNode);
+	header.subtree_header_size = sizeof(btBvhSubtreeInfo);
+	header.bullet_version = BT_BULLET_VERSION;
+}
+
+// Number of nodes in the subtree rooted at index, as Bullet's traversal sees it.
+static int get_bvh_subtree_size(const btQuantizedBvhNode &node)
+{
+	return node.isLeafNode() ? 1 : node.getEscapeIndex();
+}
+
+// Traversal trusts escape indices, subtree ranges and triangle indices blindly,
+// so anything a corrupt or truncated cache could get wrong is checked here.
+static bool validate_collision_bvh(const btQuantizedBvhNode *nodes, int num_nodes,
+                                   const btBvhSubtreeInfo *subtrees, int num_subtrees,
+                                   unsigned num_triangles)
+{
+	if (num_nodes == 0)
+		return num_subtrees == 0 && num_triangles == 0;
+
+	// The root covers every node, so recursive traversal cannot end up outside the array.
+	if (get_bvh_subtree_size(nodes[0]) != num_nodes)
+		return false;
+
+	for (int i = 0; i < num_nodes; i++)
+	{
+		auto &node = nodes[i];
+		if (node.isLeafNode())
+		{
+			if (node.getPartId() != 0 || unsigned(node.getTriangleIndex()) >= num_triangles)
+				return false;
+			continue;
+		}
+
+		// An internal node is itself followed by its left and right subtrees, back to back.
+		int size = node.getEscapeIndex();
+		if (size < 3 || size > num_nodes - i)
+			return false;
+
+		int left_size = get_bvh_subtree_size(nodes[i + 1]);
+		if (left_size < 1 || left_size > size - 2)
+			return false;
+
+		int right_size = get_bvh_subtree_size(nodes[i + 1 + left_size]);
+		if (1 + left_size + right_size != size)
+			return false;
+	}
+
+	for (int i = 0; i < num_subtrees; i++)
+	{
+		auto &subtree = subtrees[i];
+		if (subtree.m_rootNodeIndex < 0 || subtree.m_rootNodeIndex >= num_nodes ||
+		    subtree.m_subtreeSize != get_bvh_subtree_size(nodes[subtree.m_rootNodeIndex]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+struct CachedOptimizedBvh : btOptimizedBvh
+{
+	size_t get_serialized_size() const
+	{
+		size_t size = align_cache_offset(sizeof(CollisionBvhCacheHeader));
+		size += align_cache_offset(size_t(m_curNodeIndex) * sizeof(btQuantizedBvhNode));
+		size += size_t(m_SubtreeHeaders.size()) * sizeof(btBvhSubtreeInfo);
+		return size;
+	}
+
+	void serialize(void *buffer, Util::Hash hash) const
+	{
+		CollisionBvhCacheHeader header = {};
+		fill_cache_header_compat(header);
+		header.content_hash = hash;
+		for (int i = 0; i < 3; i++)
+		{
+			header.aabb_min[i] = m_bvhAabbMin[i];
+			header.aabb_max[i] = m_bvhAabbMax[i];
+			header.quantization[i] = m_bvhQuantization[i];
+		}
+		header.cur_node_index = m_curNodeIndex;
+		header.num_subtree_headers = m_SubtreeHeaders.size();
+		header.subtree_header_count = m_subtreeHeaderCount;
+		header.traversal_mode = int32_t(m_traversalMode);
+
+		auto *ptr = static_cast<uint8_t *>(buffer);
+		memcpy(ptr, &header, sizeof(header));
+		ptr += align_cache_offset(sizeof(header));
+
+		size_t node_size = size_t(m_curNodeIndex) * sizeof(btQuantizedBvhNode);
+		if (node_size)
+			memcpy(ptr, &m_quantizedContiguousNodes[0], node_size);
+		ptr += align_cache_offset(node_size);
+
+		if (m_SubtreeHeaders.size())
+			memcpy(ptr, &m_SubtreeHeaders[0], size_t(m_SubtreeHeaders.size()) * sizeof(btBvhSubtreeInfo));
+	}
+
+	bool attach(Granite::FileMappingHandle mapping_, Util::Hash hash, unsigned num_triangles)
+	{
+		size_t size = mapping_->get_size();
+		if (size < sizeof(CollisionBvhCacheHeader))
+			return false;
+
+		auto *bytes = mapping_->data<uint8_t>();
+		CollisionBvhCacheHeader header;
+		memcpy(&header, bytes, sizeof(header));
+
+		CollisionBvhCacheHeader expected = {};
+		fill_cache_header_compat(expected);
+		if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+		    header.version != expected.version ||
+		    header.endian_marker != expected.endian_marker ||
+		    header.scalar_size != expected.scalar_size ||
+		    header.node_size != expected.node_size ||
+		    header.subtree_header_size != expected.subtree_header_size ||
+		    header.bullet_version != expected.bullet_version ||
+		    header.content_hash != hash)
+		{
+			return false;
+		}
+
+		if (header.cur_node_index < 0 || header.num_subtree_headers < 0 ||
+		    header.subtree_header_count != header.num_subtree_headers ||
+		    header.traversal_mode < int32_t(TRAVERSAL_STACKLESS) ||
+		    header.traversal_mode > int32_t(TRAVERSAL_RECURSIVE))
+		{
+			return false;
+		}
+
+		for (int i = 0; i < 3; i++)
+		{
+			if (!std::isfinite(header.aabb_min[i]) || !std::isfinite(header.aabb_max[i]) ||
+			    !std::isfinite(header.quantization[i]) || header.aabb_min[i] > header.aabb_max[i])
+			{
+				return false;
+			}
+		}
+
+		size_t node_offset = align_cache_offset(sizeof(header));
+		size_t node_size = size_t(header.cur_node_index) * sizeof(btQuantizedBvhNode);
+		size_t subtree_offset = node_offset + align_cache_offset(node_size);
+		size_t subtree_size = size_t(header.num_subtree_headers) * sizeof(btBvhSubtreeInfo);
+		if (subtree_offset + subtree_size > size)
+			return false;
+
+		if (!validate_collision_bvh(reinterpret_cast<const btQuantizedBvhNode *>(bytes + node_offset),
+		                            header.cur_node_index,
+		                            reinterpret_cast<const btBvhSubtreeInfo *>(bytes + subtree_offset),
+		                            header.num_subtree_headers, num_triangles))
+		{
+			return false;
+		}
+
+		for (int i = 0; i < 3; i++)
+		{
+			m_bvhAabbMin[i] = btScalar(header.aabb_min[i]);
+			m_bvhAabbMax[i] = btScalar(header.aabb_max[i]);
+			m_bvhQuantization[i] = btScalar(header.quantization[i]);
+		}
+		m_curNodeIndex = header.cur_node_index;
+		m_useQuantization = true;
+		m_traversalMode = btTraversalMode(header.traversal_mode);
+		m_subtreeHeaderCount = header.subtree_header_count;
+
+		// The arrays never write through these pointers for a static mesh, and do not own the memory.
+		m_quantizedContiguousNodes.initializeFromBuffer(
+				const_cast<uint8_t *>(bytes + node_offset), header.cur_node_index, header.cur_node_index);
+		m_SubtreeHeaders.initializeFromBuffer(
+				const_cast<uint8_t *>(bytes + subtree_offset), header.num_subtree_headers, header.num_subtree_headers);
+
+		mapping = std::move(mapping_);
+		return true;
+	}
+
+	Granite::FileMappingHandle mapping;
+};
+
+static Util::Hash hash_collision_mesh(const PhysicsSystem::CollisionMesh &mesh)
+{
+	Util::Hasher h;
+	h.u32(CollisionBvhCacheVersion);
+	h.u32(mesh.num_triangles);
+	h.u32(mesh.num_attributes);
+
+	const vec3 &lo = mesh.aabb.get_minimum();
+	const vec3 &hi = mesh.aabb.get_maximum();
+	for (unsigned i = 0; i < 3; i++)
+	{
+		h.f32(lo[i]);
+		h.f32(hi[i]);
+	}
+
+	auto *indices = reinterpret_cast<const uint8_t *>(mesh.indices);
+	for (unsigned i = 0; i < mesh.num_triangles; i++)
+		h.data(reinterpret_cast<const uint32_t *>(indices + i * mesh.index_stride_triangle), 3 * sizeof(uint32_t));
+
+	auto *positions = reinterpret_cast<const uint8_t *>(mesh.positions);
+	for (unsigned i = 0; i < mesh.num_attributes; i++)
+		h.data(reinterpret_cast<const uint32_t *>(positions + i * mesh.position_stride), 3 * sizeof(float));
+
+	return h.get();
+}
+
+static btTriangleIndexVertexArray *create_index_vertex_array(const PhysicsSystem::CollisionMesh &mesh)
 {
 	static_assert(sizeof(int) == sizeof(uint32_t), "You're on a really weird platform.");
 	auto *index_vertex_array = new btTriangleIndexVertexArray(mesh.num_triangles,
@@ -445,11 +1150,117 @@ unsigned PhysicsSystem::register_collision_mesh(const CollisionMesh &mesh)
 	const vec3 &lo = mesh.aabb.get_minimum();
 	const vec3 &hi = mesh.aabb.get_maximum();
 	index_vertex_array->setPremadeAabb(convert(lo), convert(hi));
-	const bool quantized_aabb_compression = false;
-	auto *shape = new btBvhTriangleMeshShape(index_vertex_array, quantized_aabb_compression);
-	shape->setMargin(mesh.margin);
+	return index_vertex_array;
+}
+
+static std::string get_collision_bvh_cache_path(Util::Hash hash, const std::string &directory)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bvh", static_cast<unsigned long long>(hash));
+	return Path::join(directory, name);
+}
+
+static bool write_collision_bvh_cache(const CachedOptimizedBvh &bvh, Util::Hash hash, const std::string &path)
+{
+	size_t size = bvh.get_serialized_size();
+	auto file = GRANITE_FILESYSTEM()->open_transactional_mapping(path, size);
+	if (!file)
+		return false;
+
+	bvh.serialize(file->mutable_data(), hash);
+	return true;
+}
+
+std::string PhysicsSystem::get_collision_bvh_cache_path(const CollisionMesh &mesh, const std::string &directory)
+{
+	return Granite::get_collision_bvh_cache_path(hash_collision_mesh(mesh), directory);
+}
+
+bool PhysicsSystem::write_collision_bvh_cache(const CollisionMesh &mesh, const std::string &directory)
+{
+	if (mesh.num_triangles >= MaxQuantizedBvhTriangles)
+	{
+		LOGE("Collision mesh has %u triangles, but a quantized BVH supports at most %u.\n",
+		     mesh.num_triangles, unsigned(MaxQuantizedBvhTriangles) - 1);
+		return false;
+	}
+
+	Util::Hash hash = hash_collision_mesh(mesh);
+	std::unique_ptr<btTriangleIndexVertexArray> index_vertex_array(create_index_vertex_array(mesh));
+
+	CachedOptimizedBvh bvh;
+	btVector3 aabb_min, aabb_max;
+	index_vertex_array->getPremadeAabb(&aabb_min, &aabb_max);
+	bvh.build(index_vertex_array.get(), true, aabb_min, aabb_max);
+
+	auto path = Granite::get_collision_bvh_cache_path(hash, directory);
+	if (!Granite::write_collision_bvh_cache(bvh, hash, path))
+	{
+		LOGE("Failed to write collision BVH cache to %s.\n", path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+unsigned PhysicsSystem::register_collision_mesh(const CollisionMesh &mesh)
+{
+	static_assert(MaxQuantizedBvhTriangles == 1u << (31 - MAX_NUM_PARTS_IN_BITS),
+	              "Quantized BVH triangle index range does not match Bullet.");
 
+	auto *index_vertex_array = create_index_vertex_array(mesh);
 	auto index = unsigned(mesh_collision_shapes.size());
+
+	if (mesh.num_triangles >= MaxQuantizedBvhTriangles)
+	{
+		LOGW("Collision mesh has %u triangles, building an unquantized BVH without caching.\n", mesh.num_triangles);
+
+		// The shape builds and owns its BVH here.
+		auto *shape = new btBvhTriangleMeshShape(index_vertex_array, false, true);
+		shape->setMargin(mesh.margin);
+
+		mesh_collision_bvhs.emplace_back();
+		mesh_collision_shapes.emplace_back(shape);
+		index_vertex_arrays.emplace_back(index_vertex_array);
+		return index;
+	}
+
+	// The shape is created without a BVH, and it's either mapped from the cache or built below.
+	auto *shape = new btBvhTriangleMeshShape(index_vertex_array, true, false);
+	auto *bvh = new CachedOptimizedBvh;
+	bool cache_hit = false;
+
+	Util::Hash hash = 0;
+	std::string path;
+	if (!mesh.bvh_cache_directory.empty())
+	{
+		hash = hash_collision_mesh(mesh);
+		path = Granite::get_collision_bvh_cache_path(hash, mesh.bvh_cache_directory);
+
+		FileStat s;
+		if (GRANITE_FILESYSTEM()->stat(path, s) && s.type == PathType::File)
+		{
+			auto mapping = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
+			cache_hit = mapping && bvh->attach(std::move(mapping), hash, mesh.num_triangles);
+			if (!cache_hit)
+				LOGW("Collision BVH cache %s is stale or corrupt, rebuilding.\n", path.c_str());
+		}
+	}
+
+	if (!cache_hit)
+	{
+		btVector3 aabb_min, aabb_max;
+		index_vertex_array->getPremadeAabb(&aabb_min, &aabb_max);
+		bvh->build(index_vertex_array, true, aabb_min, aabb_max);
+
+		if (!path.empty() && !Granite::write_collision_bvh_cache(*bvh, hash, path))
+			LOGW("Failed to write collision BVH cache to %s.\n", path.c_str());
+	}
+
+	shape->setOptimizedBvh(bvh);
+	shape->setMargin(mesh.margin);
+
+	mesh_collision_bvhs.emplace_back(bvh);
 	mesh_collision_shapes.emplace_back(shape);
 	index_vertex_arrays.emplace_back(index_vertex_array);
 	return index;
@@ -493,6 +1304,7 @@ PhysicsHandle *PhysicsSystem::add_shape(Node *node, const MaterialInfo &info, bt
 		handle->bt_object = body;
 		handle->bt_shape = shape;
 		handle->copy_transform_from_node = info.type == InteractionType::Ghost;
+		handle->index = unsigned(handles.size());
 		handles.push_back(handle);
 	}
 	else if (info.type == InteractionType::Kinematic)
@@ -513,6 +1325,7 @@ PhysicsHandle *PhysicsSystem::add_shape(Node *node, const MaterialInfo &info, bt
 		handle->bt_object = body;
 		handle->bt_shape = shape;
 		handle->copy_transform_from_node = true;
+		handle->index = unsigned(handles.size());
 		handles.push_back(handle);
 	}
 	else
@@ -545,6 +1358,7 @@ PhysicsHandle *PhysicsSystem::add_shape(Node *node, const MaterialInfo &info, bt
 		handle->node = node;
 		handle->bt_object = body;
 		handle->bt_shape = shape;
+		handle->index = unsigned(handles.size());
 		handles.push_back(handle);
 	}
 
@@ -28,21 +28,27 @@
 #include "ecs.hpp"
 #include "global_managers_interface.hpp"
 #include <memory>
+#include <mutex>
+#include <thread>
 
 class btDefaultCollisionConfiguration;
 class btCollisionDispatcher;
 struct btDbvtBroadphase;
-class btSequentialImpulseConstraintSolver;
+class btConstraintSolver;
 class btDiscreteDynamicsWorld;
 class btCollisionShape;
 class btBvhTriangleMeshShape;
 class btTriangleIndexVertexArray;
 class btGhostPairCallback;
 class btDynamicsWorld;
+class btOptimizedBvh;
 
 namespace Granite
 {
 struct PhysicsHandle;
+struct PhysicsQueryContext;
+class PhysicsTaskScheduler;
+class ThreadGroup;
 
 struct PhysicsComponent : ComponentBase
 {
@@ -147,7 +153,12 @@ struct RaycastResult
 class PhysicsSystem final : public PhysicsSystemInterface
 {
 public:
-	PhysicsSystem();
+	// The thread group is only used if Bullet is built with BT_THREADSAFE (GRANITE_BULLET_MULTITHREADED).
+	// The world is then stepped with Bullet's multithreaded world and solver pool, Bullet's parallel loops
+	// and the transform sync in iterate() run on the group, and iterate() waits for them.
+	// In that mode iterate() must always be called from the thread which created the PhysicsSystem,
+	// and only one PhysicsSystem may use a given thread group. Otherwise the group is ignored and iterate() is serial.
+	explicit PhysicsSystem(ThreadGroup *group = nullptr);
 	~PhysicsSystem();
 	void set_scene(Scene *scene);
 
@@ -183,10 +194,24 @@ public:
 		AABB aabb = {};
 
 		float margin = 0.1f;
+
+		// If set, the quantized BVH is looked up in this directory by content hash and mapped in place.
+		// On a miss, it is built and written there for the next load.
+		std::string bvh_cache_directory;
 	};
 
+	// Quantized BVH leaves only have 21 bits for the triangle index.
+	// Larger meshes get an unquantized BVH which is never cached.
+	enum { MaxQuantizedBvhTriangles = 1u << 21 };
+
 	unsigned register_collision_mesh(const CollisionMesh &mesh);
 
+	// For offline tooling. Builds the quantized BVH and writes it to the path
+	// register_collision_mesh() will look for in directory.
+	// Fails for meshes with MaxQuantizedBvhTriangles or more triangles.
+	static bool write_collision_bvh_cache(const CollisionMesh &mesh, const std::string &directory);
+	static std::string get_collision_bvh_cache_path(const CollisionMesh &mesh, const std::string &directory);
+
 	enum class MeshType
 	{
 		None,
@@ -255,10 +280,29 @@ public:
 	RaycastResult query_closest_hit_ray(const vec3 &from, const vec3 &dir, float length,
 	                                    InteractionTypeFlags mask = INTERACTION_TYPE_ALL_BITS);
 
-	void add_point_constraint(PhysicsHandle *handle, const vec3 &local_pivot);
-	void add_point_constraint(PhysicsHandle *handle0, PhysicsHandle *handle1,
-	                          const vec3 &local_pivot0, const vec3 &local_pivot1,
-	                          bool skip_collision = false);
+	struct RayQuery
+	{
+		vec3 from;
+		vec3 dir;
+		float length;
+		InteractionTypeFlags mask = INTERACTION_TYPE_ALL_BITS;
+	};
+
+	// Sweeps a convex primitive along dir. ConvexHull and None are not supported and never hit.
+	// Cube uses radius as half-extent. Cylinder, Cone and Capsule are built like ConvexMeshPart shapes,
+	// which is also what add_cylinder() and add_capsule() do. add_cone() passes height to Bullet unscaled,
+	// so its cones are twice as tall as a Cone query with the same height.
+	struct SweepQuery
+	{
+		MeshType type = MeshType::Sphere;
+		vec3 from;
+		vec3 dir;
+		float length;
+		float radius = 1.0f;
+		float height = 1.0f;
+		quat rotation = quat(1.0f, 0.0f, 0.0f, 0.0f);
+		InteractionTypeFlags mask = INTERACTION_TYPE_ALL_BITS;
+	};
 
 	enum class OverlapMethod
 	{
@@ -266,6 +310,35 @@ public:
 		Nearphase
 	};
 
+	// Like get_overlapping_objects(), but writes at most max_hits handles to hits.
+	// Handle must be a ghost or area object.
+	struct OverlapQuery
+	{
+		PhysicsHandle *handle;
+		PhysicsHandle **hits;
+		unsigned max_hits;
+		InteractionTypeFlags mask = INTERACTION_TYPE_ALL_BITS;
+		OverlapMethod method = OverlapMethod::Nearphase;
+	};
+
+	// Batched queries. With a thread group, the batch is split across workers and the calling thread,
+	// and this call returns once all of it is done. Batches may be issued from within tasks of that group.
+	// The collision world is only read, so queries must not run concurrently with iterate()
+	// or with adding and removing bodies. Batches may run concurrently with each other.
+	// Results with a handle of nullptr and t of 0 are misses, as with query_closest_hit_ray().
+	void query_closest_hit_rays(const RayQuery *queries, RaycastResult *results, unsigned count,
+	                            ThreadGroup *group = nullptr);
+	void query_closest_hit_sweeps(const SweepQuery *queries, RaycastResult *results, unsigned count,
+	                              ThreadGroup *group = nullptr);
+	// Writes the number of overlapping objects written for each query to hit_counts.
+	void query_overlapping_objects(const OverlapQuery *queries, unsigned *hit_counts, unsigned count,
+	                               ThreadGroup *group = nullptr);
+
+	void add_point_constraint(PhysicsHandle *handle, const vec3 &local_pivot);
+	void add_point_constraint(PhysicsHandle *handle0, PhysicsHandle *handle1,
+	                          const vec3 &local_pivot0, const vec3 &local_pivot1,
+	                          bool skip_collision = false);
+
 	bool get_overlapping_objects(PhysicsHandle *handle, std::vector<PhysicsHandle *> &other,
 	                             OverlapMethod method = OverlapMethod::Nearphase);
 
@@ -273,20 +346,32 @@ private:
 	std::unique_ptr<btDefaultCollisionConfiguration> collision_config;
 	std::unique_ptr<btCollisionDispatcher> dispatcher;
 	std::unique_ptr<btDbvtBroadphase> broadphase;
-	std::unique_ptr<btSequentialImpulseConstraintSolver> solver;
+	std::unique_ptr<btConstraintSolver> solver;
 	std::unique_ptr<btDiscreteDynamicsWorld> world;
+	std::unique_ptr<PhysicsTaskScheduler> task_scheduler;
+	ThreadGroup *thread_group = nullptr;
+	std::thread::id creation_thread;
 
 	Util::ObjectPool<PhysicsHandle> handle_pool;
 	std::vector<PhysicsHandle *> handles;
 
 	PhysicsHandle *add_shape(Node *node, const MaterialInfo &info, btCollisionShape *shape);
 	std::vector<CollisionEvent> new_collision_buffer;
+	// Null for meshes whose shape owns an unquantized BVH.
+	std::vector<std::unique_ptr<btOptimizedBvh>> mesh_collision_bvhs;
 	std::vector<std::unique_ptr<btBvhTriangleMeshShape>> mesh_collision_shapes;
 	std::vector<std::unique_ptr<btTriangleIndexVertexArray>> index_vertex_arrays;
 	std::unique_ptr<btGhostPairCallback> ghost_callback;
 
 	btCollisionShape *create_shape(const ConvexMeshPart &part);
 	Scene *scene = nullptr;
+
+	// Nearphase overlap tests need a dispatcher of their own per worker.
+	// Free contexts are kept here, and each batched call takes the ones it needs.
+	std::mutex query_context_lock;
+	std::vector<std::unique_ptr<PhysicsQueryContext>> query_contexts;
+	template <typename Func>
+	void run_batched_query(unsigned count, ThreadGroup *group, const Func &func);
 	const ComponentGroupVector<PhysicsComponent, ForceComponent> *forces = nullptr;
 };
 }
@@ -22,10 +22,13 @@
 
 #define NOMINMAX
 #include "flat_renderer.hpp"
+#include "flat_renderer_cache.hpp"
 #include "device.hpp"
 #include "event.hpp"
 #include "sprite.hpp"
+#include <algorithm>
 #include <float.h>
+#include <string.h>
 
 using namespace Vulkan;
 using namespace Util;
@@ -76,14 +79,19 @@ void FlatRenderer::on_module_created(const DeviceShaderModuleReadyEvent &created
 		s.bake_base_defines();
 
 	device = &dev;
+	invalidate_caches();
 }
 
 void FlatRenderer::on_module_destroyed(const DeviceShaderModuleReadyEvent &)
 {
+	// Recorded geometry points to programs and images of the old device.
+	invalidate_caches();
 }
 
 void FlatRenderer::begin()
 {
+	assert(recordings.empty());
+	close_quad_batch();
 	queue.reset();
 	queue.set_shader_suites(suite);
 }
@@ -116,7 +124,7 @@ void FlatRenderer::flush(Vulkan::CommandBuffer &cmd, const vec3 &camera_pos, con
 	global->pos_offset_pixels[2] = -camera_pos.z;
 	global->pos_offset_pixels[3] = 0.0f;
 
-	queue.sort();
+	sort();
 
 	if (opaque_state_cb)
 		opaque_state_cb(cmd);
@@ -137,31 +145,35 @@ void FlatRenderer::flush(Vulkan::CommandBuffer &cmd, const vec3 &camera_pos, con
 	queue.dispatch(Queue::Transparent, cmd, &state);
 }
 
-void FlatRenderer::render_quad(const ImageView *view, unsigned layer, Vulkan::StockSampler sampler,
-                               const vec3 &offset, const vec2 &size, const vec2 &tex_offset, const vec2 &tex_size, const vec4 &color,
-                               DrawPipeline pipeline)
+void FlatRenderer::open_quad_batch(const ImageView *view, Vulkan::StockSampler sampler, DrawPipeline pipeline,
+                                   const ivec4 &clip, bool layered, float z)
 {
-	if (color.w <= 0.0f)
-		return;
 	auto type = pipeline == DrawPipeline::AlphaBlend ? Queue::Transparent : Queue::Opaque;
-	bool layered = view && view->get_create_info().view_type == VK_IMAGE_VIEW_TYPE_2D_ARRAY;
 
-	SpriteRenderInfo sprite;
-	build_scissor(sprite.clip_quad, offset.xy(), offset.xy() + size);
+	// Chunks grow geometrically while the same state keeps coming, so lone quads do not waste memory.
+	// Chunks with equal state sort next to each other and are drawn with one instanced draw.
+	unsigned capacity = QuadBatchMinQuads;
+	if (quad_batch.instances && quad_batch.instances->count == quad_batch.capacity &&
+	    quad_batch.view == view && quad_batch.sampler == sampler && quad_batch.pipeline == pipeline &&
+	    quad_batch.layered == layered && all(equal(quad_batch.clip, clip)))
+	{
+		capacity = std::min<unsigned>(quad_batch.capacity * 2, QuadBatchMaxQuads);
+	}
 
-	auto *quads = queue.allocate_one<QuadData>();
 	auto *instance_data = queue.allocate_one<SpriteInstanceInfo>();
-	instance_data->quads = quads;
-	instance_data->count = 1;
+	instance_data->count = 0;
+
+	SpriteRenderInfo sprite;
+	sprite.clip_quad = clip;
 
 	Hasher h;
 	h.string("quad");
 	h.s32(ecast(pipeline));
 	auto pipe_hash = h.get();
-	h.s32(sprite.clip_quad.x);
-	h.s32(sprite.clip_quad.y);
-	h.s32(sprite.clip_quad.z);
-	h.s32(sprite.clip_quad.w);
+	h.s32(clip.x);
+	h.s32(clip.y);
+	h.s32(clip.z);
+	h.s32(clip.w);
 	h.s32(layered);
 
 	if (view)
@@ -173,11 +185,12 @@ void FlatRenderer::render_quad(const ImageView *view, unsigned layer, Vulkan::St
 	}
 
 	auto instance_key = h.get();
-	auto sorting_key = RenderInfo::get_sprite_sort_key(type, pipe_hash, h.get(), offset.z);
+	auto sorting_key = RenderInfo::get_sprite_sort_key(type, pipe_hash, h.get(), z);
 
 	auto *sprite_data = queue.push<SpriteRenderInfo>(type, instance_key, sorting_key, RenderFunctions::sprite_render, instance_data);
 
-	if (sprite_data)
+	// Without a device there are no programs to resolve, which only matters for CPU-side benchmarking.
+	if (sprite_data && device)
 	{
 		uint32_t flags = 0;
 		if (layered && view)
@@ -199,9 +212,76 @@ void FlatRenderer::render_quad(const ImageView *view, unsigned layer, Vulkan::St
 				                           MESH_ATTRIBUTE_POSITION_BIT |
 				                           MESH_ATTRIBUTE_VERTEX_COLOR_BIT, 0, flags));
 		}
+	}
+
+	if (sprite_data)
 		*sprite_data = sprite;
+
+	// Quads are allocated last so the chunk can grow in place, see render_quad().
+	instance_data->quads = static_cast<QuadData *>(queue.allocate(sizeof(QuadData) * capacity, alignof(QuadData)));
+
+	quad_batch.instances = instance_data;
+	quad_batch.capacity = capacity;
+	quad_batch.view = view;
+	quad_batch.sampler = sampler;
+	quad_batch.pipeline = pipeline;
+	quad_batch.clip = clip;
+	quad_batch.layered = layered;
+	quad_batch.z = z;
+}
+
+void FlatRenderer::close_quad_batch()
+{
+	quad_batch.instances = nullptr;
+}
+
+void FlatRenderer::sort()
+{
+	close_quad_batch();
+	queue.sort();
+}
+
+void FlatRenderer::render_quad(const ImageView *view, unsigned layer, Vulkan::StockSampler sampler,
+                               const vec3 &offset, const vec2 &size, const vec2 &tex_offset, const vec2 &tex_size, const vec4 &color,
+                               DrawPipeline pipeline)
+{
+	if (color.w <= 0.0f)
+		return;
+	bool layered = view && view->get_create_info().view_type == VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+
+	ivec4 clip;
+	build_scissor(clip, offset.xy(), offset.xy() + size);
+
+	// Quads in a batch are drawn in submission order with the sorting key of the first one.
+	// Opaque quads rely on depth testing, but blended quads must share depth to stay correctly sorted.
+	bool append = quad_batch.instances &&
+	              quad_batch.view == view &&
+	              quad_batch.pipeline == pipeline &&
+	              quad_batch.layered == layered &&
+	              (!view || quad_batch.sampler == sampler) &&
+	              all(equal(quad_batch.clip, clip)) &&
+	              (pipeline != DrawPipeline::AlphaBlend || quad_batch.z == offset.z);
+
+	// A full chunk grows in place if nothing was allocated after it, which saves a queue entry.
+	if (append && quad_batch.instances->count == quad_batch.capacity)
+	{
+		unsigned capacity = quad_batch.capacity * 2;
+		append = queue.try_grow(quad_batch.instances->quads, sizeof(QuadData) * quad_batch.capacity,
+		                        sizeof(QuadData) * capacity);
+		if (append)
+			quad_batch.capacity = capacity;
+	}
+
+	if (!append)
+		open_quad_batch(view, sampler, pipeline, clip, layered, offset.z);
+
+	if (any(notEqual(color, last_quad_color)))
+	{
+		last_quad_color = color;
+		last_quad_color_half = floatToHalf(color);
 	}
 
+	auto *quads = &quad_batch.instances->quads[quad_batch.instances->count++];
 	quads->layer = offset.z;
 	quads->array_layer = float(layer);
 	quads->pos_off_x = offset.x;
@@ -212,11 +292,12 @@ void FlatRenderer::render_quad(const ImageView *view, unsigned layer, Vulkan::St
 	quads->tex_off_y = tex_offset.y;
 	quads->tex_scale_x = tex_size.x;
 	quads->tex_scale_y = tex_size.y;
-	quads->color = floatToHalf(color);
+	quads->color = last_quad_color_half;
 	quads->rotation[0] = 1.0f;
 	quads->rotation[1] = 0.0f;
 	quads->rotation[2] = 0.0f;
 	quads->rotation[3] = 1.0f;
+	quads->blend_factor = 0.0f;
 }
 
 void FlatRenderer::render_textured_quad(const ImageView &view,
@@ -226,6 +307,8 @@ void FlatRenderer::render_textured_quad(const ImageView &view,
 {
 	if (color.w <= 0.0f)
 		return;
+	// Views from the resource manager can be released while a recording is alive.
+	mark_unreplayable();
 	render_quad(&view, layer, sampler, offset, size, tex_offset, tex_size, color, pipeline);
 }
 
@@ -254,6 +337,7 @@ void FlatRenderer::render_line_strip(const vec2 *offset, float layer, unsigned c
 {
 	if (color.w <= 0.0f)
 		return;
+	close_quad_batch();
 	auto transparent = color.w < 1.0f;
 	LineStripInfo strip;
 
@@ -307,20 +391,228 @@ void FlatRenderer::render_text(const Font &font, const char *text, const vec3 &o
 {
 	if (color.w <= 0.0f)
 		return;
+	close_quad_batch();
+
+	auto *glyph_cache = recordings.empty() ? nullptr : font.get_glyph_cache();
+	if (glyph_cache)
+	{
+		shelf_capture.clear();
+		glyph_cache->set_shelf_capture(&shelf_capture);
+	}
+
 	font.render_text(queue, text, offset, size,
 	                 scissor_stack.back().offset, scissor_stack.back().size,
 	                 color, alignment, scale);
+
+	if (glyph_cache)
+	{
+		glyph_cache->set_shelf_capture(nullptr);
+		auto &shelves = recordings.back().glyph_shelves;
+		for (auto &shelf : shelf_capture)
+			shelves.push_back({ glyph_cache, shelf });
+	}
 }
 
 void FlatRenderer::push_sprite(const SpriteInfo &info)
 {
+	mark_unreplayable();
+	close_quad_batch();
 	info.sprite->get_sprite_render_info(info.transform, queue);
 }
 
 void FlatRenderer::push_sprites(const SpriteList &visible)
 {
+	mark_unreplayable();
+	close_quad_batch();
 	for (auto &vis : visible)
 		vis.sprite->get_sprite_render_info(vis.transform, queue);
 }
 
+void FlatRendererCache::clear()
+{
+	sprite_batches.clear();
+	quads.clear();
+	line_batches.clear();
+	positions.clear();
+	colors.clear();
+	glyph_shelves.clear();
+	epoch = 0;
+}
+
+void FlatRenderer::invalidate_caches()
+{
+	cache_epoch++;
+}
+
+void FlatRenderer::mark_unreplayable()
+{
+	for (auto &recording : recordings)
+		recording.replayable = false;
+}
+
+void FlatRenderer::begin_recording()
+{
+	close_quad_batch();
+	Recording recording = {};
+	for (unsigned i = 0; i < ecast(Queue::Count); i++)
+		recording.start[i] = queue.get_queue_data(Queue(i)).size();
+	recording.scissor = scissor_stack.back();
+	recording.replayable = true;
+	recordings.push_back(recording);
+}
+
+bool FlatRenderer::end_recording(FlatRendererCache &cache)
+{
+	assert(!recordings.empty());
+	close_quad_batch();
+	auto recording = std::move(recordings.back());
+	recordings.pop_back();
+
+	// Whatever the outer recording captures samples the same shelves.
+	if (!recordings.empty())
+	{
+		auto &outer = recordings.back().glyph_shelves;
+		outer.insert(outer.end(), recording.glyph_shelves.begin(), recording.glyph_shelves.end());
+	}
+
+	cache.clear();
+	if (!recording.replayable)
+		return false;
+
+	for (unsigned i = 0; i < ecast(Queue::Count); i++)
+	{
+		auto &data = queue.get_queue_data(Queue(i)).raw_input;
+		for (size_t j = recording.start[i]; j < data.size(); j++)
+		{
+			auto &entry = data[j];
+			if (entry.render == RenderFunctions::sprite_render)
+			{
+				auto &info = *static_cast<const SpriteRenderInfo *>(entry.render_info);
+				auto &instances = *static_cast<const SpriteInstanceInfo *>(entry.instance_data);
+				if (!info.program)
+				{
+					cache.clear();
+					return false;
+				}
+
+				// Render infos are deduplicated on content, so equal state replayed from different caches batches up.
+				Hasher h;
+				h.string("sprite-replay");
+				h.pointer(info.textures[0]);
+				h.pointer(info.textures[1]);
+				h.pointer(info.program);
+				h.s32(ecast(info.sampler));
+				h.s32(info.clip_quad.x);
+				h.s32(info.clip_quad.y);
+				h.s32(info.clip_quad.z);
+				h.s32(info.clip_quad.w);
+
+				cache.sprite_batches.push_back({ Queue(i), h.get(), entry.sorting_key, info,
+				                                 cache.quads.size(), instances.count });
+				cache.quads.insert(cache.quads.end(), instances.quads, instances.quads + instances.count);
+			}
+			else if (entry.render == RenderFunctions::line_strip_render)
+			{
+				auto &info = *static_cast<const LineStripInfo *>(entry.render_info);
+				auto &lines = *static_cast<const LineInfo *>(entry.instance_data);
+				if (!info.program)
+				{
+					cache.clear();
+					return false;
+				}
+
+				Hasher h;
+				h.string("line-replay");
+				h.pointer(info.program);
+				h.s32(info.clip.x);
+				h.s32(info.clip.y);
+				h.s32(info.clip.z);
+				h.s32(info.clip.w);
+
+				cache.line_batches.push_back({ Queue(i), h.get(), entry.sorting_key, info,
+				                               cache.positions.size(), lines.count });
+				cache.positions.insert(cache.positions.end(), lines.positions, lines.positions + lines.count);
+				cache.colors.insert(cache.colors.end(), lines.colors, lines.colors + lines.count);
+			}
+			else
+			{
+				cache.clear();
+				return false;
+			}
+		}
+	}
+
+	auto &shelves = recording.glyph_shelves;
+	std::sort(shelves.begin(), shelves.end(), [](const FlatRendererGlyphShelf &a, const FlatRendererGlyphShelf &b) {
+		if (a.cache != b.cache)
+			return std::less<const GlyphCache *>()(a.cache, b.cache);
+		if (a.shelf.index != b.shelf.index)
+			return a.shelf.index < b.shelf.index;
+		return a.shelf.generation < b.shelf.generation;
+	});
+	shelves.erase(std::unique(shelves.begin(), shelves.end(), [](const FlatRendererGlyphShelf &a, const FlatRendererGlyphShelf &b) {
+		return a.cache == b.cache && a.shelf == b.shelf;
+	}), shelves.end());
+	cache.glyph_shelves = std::move(shelves);
+
+	cache.scissor_offset = recording.scissor.offset;
+	cache.scissor_size = recording.scissor.size;
+	cache.epoch = cache_epoch;
+	return true;
+}
+
+bool FlatRenderer::replay(const FlatRendererCache &cache)
+{
+	auto &current = scissor_stack.back();
+	if (cache.epoch != cache_epoch ||
+	    any(notEqual(cache.scissor_offset, current.offset)) ||
+	    any(notEqual(cache.scissor_size, current.size)))
+	{
+		return false;
+	}
+
+	// An evicted shelf may already hold other glyphs, so the text has to be laid out again.
+	for (auto &shelf : cache.glyph_shelves)
+		if (!shelf.cache->touch_shelf(shelf.shelf))
+			return false;
+
+	if (!recordings.empty())
+	{
+		auto &outer = recordings.back().glyph_shelves;
+		outer.insert(outer.end(), cache.glyph_shelves.begin(), cache.glyph_shelves.end());
+	}
+
+	close_quad_batch();
+	for (auto &batch : cache.sprite_batches)
+	{
+		auto *quads = static_cast<QuadData *>(queue.allocate(sizeof(QuadData) * batch.count, alignof(QuadData)));
+		memcpy(quads, cache.quads.data() + batch.first_quad, sizeof(QuadData) * batch.count);
+
+		auto *instance_data = queue.allocate_one<SpriteInstanceInfo>();
+		instance_data->quads = quads;
+		instance_data->count = batch.count;
+
+		auto *sprite_data = queue.push<SpriteRenderInfo>(batch.queue, batch.instance_key, batch.sorting_key,
+		                                                 RenderFunctions::sprite_render, instance_data);
+		if (sprite_data)
+			*sprite_data = batch.info;
+	}
+
+	for (auto &batch : cache.line_batches)
+	{
+		auto *lines = queue.allocate_one<LineInfo>();
+		lines->count = batch.count;
+		lines->positions = static_cast<vec3 *>(queue.allocate(sizeof(vec3) * batch.count, alignof(vec3)));
+		lines->colors = static_cast<vec4 *>(queue.allocate(sizeof(vec4) * batch.count, alignof(vec4)));
+		memcpy(lines->positions, cache.positions.data() + batch.first_vertex, sizeof(vec3) * batch.count);
+		memcpy(lines->colors, cache.colors.data() + batch.first_vertex, sizeof(vec4) * batch.count);
+
+		auto *strip_data = queue.push<LineStripInfo>(batch.queue, batch.instance_key, batch.sorting_key,
+		                                             RenderFunctions::line_strip_render, lines);
+		if (strip_data)
+			*strip_data = batch.info;
+	}
+
+	return true;
+}
 }
@@ -70,6 +70,15 @@ struct LineStripInfo
 	ivec4 clip = ivec4(0, 0, 0x4000, 0x4000);
 };
 
+struct FlatRendererGlyphShelf
+{
+	GlyphCache *cache;
+	GlyphShelfReference shelf;
+};
+
+class FlatRendererCache;
+struct SpriteInstanceInfo;
+
 class FlatRenderer : public EventHandler
 {
 public:
@@ -94,12 +103,31 @@ public:
 	                 Font::Alignment alignment = Font::Alignment::TopLeft, float scale = 1.0f);
 
 	void flush(Vulkan::CommandBuffer &cmd, const vec3 &camera_pos, const vec3 &camera_size);
+
+	// The CPU side of flush(). Only useful on its own for benchmarking, flush() calls it.
+	void sort();
+
+	const RenderQueue &get_queue() const
+	{
+		return queue;
+	}
+
 	void render_line_strip(const vec2 *offsets, float layer, unsigned count, const vec4 &color);
 
 	void reset_scissor();
 	void push_scissor(const vec2 &offset, const vec2 &size);
 	void pop_scissor();
 
+	// Captures everything rendered until the matching end_recording(). Recordings can nest.
+	void begin_recording();
+	// Returns false if the geometry cannot be replayed, e.g. it references textures owned by someone else.
+	bool end_recording(FlatRendererCache &cache);
+	// Pushes recorded geometry again. Returns false without pushing anything
+	// if the cache is stale or the scissor differs from when it was recorded.
+	bool replay(const FlatRendererCache &cache);
+	// Call when resources referenced by recorded geometry, like font atlases, are replaced.
+	void invalidate_caches();
+
 	void set_opaque_state_callback(std::function<void (Vulkan::CommandBuffer &)> cb);
 	void set_transparent_state_callback(std::function<void (Vulkan::CommandBuffer &)> cb);
 
@@ -123,6 +151,40 @@ private:
 	};
 	std::vector<Scissor> scissor_stack;
 
+	struct Recording
+	{
+		size_t start[Util::ecast(Queue::Count)];
+		Scissor scissor;
+		std::vector<FlatRendererGlyphShelf> glyph_shelves;
+		bool replayable;
+	};
+	std::vector<Recording> recordings;
+	std::vector<GlyphShelfReference> shelf_capture;
+	uint64_t cache_epoch = 1;
+	void mark_unreplayable();
+
+	// Consecutive quads with matching state are written into one queue entry.
+	enum { QuadBatchMinQuads = 1, QuadBatchMaxQuads = 256 };
+	struct
+	{
+		SpriteInstanceInfo *instances = nullptr;
+		unsigned capacity = 0;
+		const Vulkan::ImageView *view = nullptr;
+		Vulkan::StockSampler sampler = Vulkan::StockSampler::Count;
+		DrawPipeline pipeline = DrawPipeline::Opaque;
+		ivec4 clip = ivec4(0);
+		bool layered = false;
+		float z = 0.0f;
+	} quad_batch;
+
+	// Quads tend to repeat colors, and the half-float conversion is a large part of the cost of a quad.
+	vec4 last_quad_color = vec4(0.0f);
+	u16vec4 last_quad_color_half = u16vec4(0);
+
+	void open_quad_batch(const Vulkan::ImageView *view, Vulkan::StockSampler sampler, DrawPipeline pipeline,
+	                     const ivec4 &clip, bool layered, float z);
+	void close_quad_batch();
+
 	void render_quad(const Vulkan::ImageView *view, unsigned layer, Vulkan::StockSampler sampler,
 	                 const vec3 &offset, const vec2 &size, const vec2 &tex_offset, const vec2 &tex_size, const vec4 &color,
 	                 DrawPipeline pipeline);
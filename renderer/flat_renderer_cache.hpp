@@ -0,0 +1,83 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "sprite.hpp"
+#include "flat_renderer.hpp"
+#include <vector>
+
+namespace Granite
+{
+// Sprites and line strips captured by FlatRenderer::end_recording().
+// FlatRenderer::replay() pushes them into the render queue again with plain copies,
+// so a UI subtree which did not change skips layout and text shaping entirely.
+class FlatRendererCache
+{
+public:
+	void clear();
+
+	bool empty() const
+	{
+		return sprite_batches.empty() && line_batches.empty();
+	}
+
+private:
+	friend class FlatRenderer;
+
+	struct SpriteBatch
+	{
+		Queue queue;
+		Util::Hash instance_key;
+		uint64_t sorting_key;
+		SpriteRenderInfo info;
+		size_t first_quad;
+		unsigned count;
+	};
+
+	struct LineBatch
+	{
+		Queue queue;
+		Util::Hash instance_key;
+		uint64_t sorting_key;
+		LineStripInfo info;
+		size_t first_vertex;
+		unsigned count;
+	};
+
+	std::vector<SpriteBatch> sprite_batches;
+	std::vector<QuadData> quads;
+	std::vector<LineBatch> line_batches;
+	std::vector<vec3> positions;
+	std::vector<vec4> colors;
+
+	// Atlas shelves the recorded text samples from, touched on replay so they are not evicted under it.
+	// Glyph caches must outlive the recording.
+	std::vector<FlatRendererGlyphShelf> glyph_shelves;
+
+	// Clip rectangles are resolved against the scissor at recording time.
+	vec2 scissor_offset = vec2(0.0f);
+	vec2 scissor_size = vec2(0.0f);
+	uint64_t epoch = 0;
+};
+}
@@ -27,6 +27,7 @@
 #include "filesystem.hpp"
 #include "device.hpp"
 #include "sprite.hpp"
+#include "string_helpers.hpp"
 #include <string.h>
 #include <float.h>
 
@@ -40,10 +41,122 @@ struct Font::Baked
 	stbtt_bakedchar chars[128 - 32];
 };
 
+SDFFontAtlas::SDFFontAtlas(const std::string &path, float glyph_height, unsigned spread,
+                           unsigned atlas_size, ThreadGroup *workers)
+	: cache(std::unique_ptr<GlyphRasterizer>(new TrueTypeRasterizer(path, glyph_height, spread)),
+	        atlas_size, atlas_size, workers)
+{
+	EVENT_MANAGER_REGISTER_LATCH(SDFFontAtlas, on_device_created, on_device_destroyed, DeviceCreatedEvent);
+}
+
+bool SDFFontAtlas::begin_frame()
+{
+	if (cache.begin_frame() || (device && !texture))
+	{
+		update_texture();
+		return true;
+	}
+	return false;
+}
+
+const Vulkan::ImageView *SDFFontAtlas::get_view() const
+{
+	return texture ? &texture->get_view() : nullptr;
+}
+
+void SDFFontAtlas::update_texture()
+{
+	if (!device)
+		return;
+
+	// Glyphs only change when they miss, which settles after a few frames,
+	// so recreating the image is simpler than tracking dirty regions. Frames in flight keep the old one alive.
+	ImageCreateInfo info = ImageCreateInfo::immutable_2d_image(cache.get_atlas_width(), cache.get_atlas_height(),
+	                                                           VK_FORMAT_R8_UNORM, false);
+	ImageInitialData initial = {};
+	initial.data = cache.get_atlas_pixels();
+	texture = device->create_image(info, &initial);
+	device->set_name(*texture, "sdf-font");
+}
+
+void SDFFontAtlas::on_device_created(const DeviceCreatedEvent &created)
+{
+	device = &created.get_device();
+	update_texture();
+}
+
+void SDFFontAtlas::on_device_destroyed(const DeviceCreatedEvent &)
+{
+	texture.reset();
+	device = nullptr;
+}
+
 Font::~Font()
 {
 }
 
+Font::Font(std::shared_ptr<SDFFontAtlas> sdf_atlas_, unsigned size)
+	: font_height(size), sdf_atlas(std::move(sdf_atlas_))
+{
+}
+
+// Lays out UTF-8 text from the SDF atlas and optionally emits quads for the glyphs which are resident.
+// Advances do not depend on residency, so the geometry is stable while glyphs stream in.
+vec2 Font::layout_sdf(const char *text, vec2 offset, float scale,
+                      QuadData *quads, unsigned *count, vec2 *min_rect, vec2 *max_rect) const
+{
+	auto &cache = sdf_atlas->get_cache();
+	auto &rasterizer = cache.get_rasterizer();
+	float glyph_scale = float(font_height) * scale / rasterizer.get_pixel_height();
+	float line_height = rasterizer.get_line_height() * glyph_scale;
+
+	vec2 pen = offset + vec2(0.0f, rasterizer.get_ascent() * glyph_scale);
+	float line_start = pen.x;
+	float max_x = pen.x;
+	unsigned lines = 1;
+
+	uint32_t codepoint;
+	while ((codepoint = Util::decode_utf8(text)) != 0)
+	{
+		if (codepoint == '\n')
+		{
+			pen = vec2(line_start, pen.y + line_height);
+			lines++;
+			continue;
+		}
+		else if (codepoint < 32)
+			continue;
+
+		if (quads)
+		{
+			auto *glyph = cache.find_glyph(codepoint);
+			if (glyph && glyph->width)
+			{
+				vec2 lo = pen + vec2(glyph->offset_x, glyph->offset_y) * glyph_scale;
+				vec2 hi = lo + vec2(glyph->width, glyph->height) * glyph_scale;
+
+				auto &quad = quads[(*count)++];
+				quad.pos_off_x = lo.x;
+				quad.pos_off_y = lo.y;
+				quad.pos_scale_x = hi.x - lo.x;
+				quad.pos_scale_y = hi.y - lo.y;
+				quad.tex_off_x = float(glyph->x);
+				quad.tex_off_y = float(glyph->y);
+				quad.tex_scale_x = float(glyph->width);
+				quad.tex_scale_y = float(glyph->height);
+
+				*min_rect = min(*min_rect, lo);
+				*max_rect = max(*max_rect, hi);
+			}
+		}
+
+		pen.x += cache.get_advance(codepoint) * glyph_scale;
+		max_x = muglm::max(max_x, pen.x);
+	}
+
+	return vec2(max_x - offset.x, float(lines) * line_height);
+}
+
 Font::Font(const std::string &path, unsigned size)
 {
 	baked_chars.reset(new Baked);
@@ -86,11 +199,14 @@ Font::Font(const std::string &path, unsigned size)
 	EVENT_MANAGER_REGISTER_LATCH(Font, on_device_created, on_device_destroyed, DeviceCreatedEvent);
 }
 
-vec2 Font::get_text_geometry(const char *text, float) const
+vec2 Font::get_text_geometry(const char *text, float scale) const
 {
 	if (!*text)
 		return vec2(0);
 
+	if (sdf_atlas)
+		return ceil(layout_sdf(text, vec2(0.0f), scale, nullptr, nullptr, nullptr, nullptr));
+
 	vec2 off = vec2(0.0f);
 	off.y += font_height;
 
@@ -178,59 +294,91 @@ void Font::render_text(RenderQueue &queue, const char *text, const vec3 &offset,
 
 	size_t len = strlen(text);
 	SpriteRenderInfo sprite;
-	sprite.textures[0] = &texture->get_view();
-	sprite.sampler = StockSampler::LinearWrap;
+	if (sdf_atlas)
+	{
+		// No image until the device exists.
+		sprite.textures[0] = sdf_atlas->get_view();
+		if (!sprite.textures[0])
+			return;
+		sprite.sampler = StockSampler::LinearClamp;
+	}
+	else
+	{
+		sprite.textures[0] = &texture->get_view();
+		sprite.sampler = StockSampler::LinearWrap;
+	}
 
 	auto *instance_data = queue.allocate_one<SpriteInstanceInfo>();
 	auto *quads = queue.allocate_many<QuadData>(len);
 	instance_data->quads = quads;
 	instance_data->count = 0; // Will be accumulated in the loop.
 
-	vec2 off = offset.xy();
-	off.y += font_height;
-	vec2 cached = off;
-
 	vec2 min_rect = vec2(FLT_MAX);
 	vec2 max_rect = vec2(-FLT_MAX);
 
-	while (*text)
+	if (sdf_atlas)
 	{
-		stbtt_aligned_quad q;
-		if (*text == '\n')
+		layout_sdf(text, offset.xy() + alignment_offset, scale, quads, &instance_data->count, &min_rect, &max_rect);
+		for (unsigned i = 0; i < instance_data->count; i++)
 		{
-			cached.y += font_height;
-			off = cached;
-		}
-		else if (*text >= 32)
-		{
-			stbtt_GetBakedQuad(baked_chars->chars, width, height, *text - 32, &off.x, &off.y, &q, 1);
-
-			q.x0 += alignment_offset.x;
-			q.x1 += alignment_offset.x;
-			q.y0 += alignment_offset.y;
-			q.y1 += alignment_offset.y;
-
-			auto &quad = quads[instance_data->count++];
+			auto &quad = quads[i];
 			quad.color = floatToHalf(color);
 			quad.rotation[0] = 1.0f;
 			quad.rotation[1] = 0.0f;
 			quad.rotation[2] = 0.0f;
 			quad.rotation[3] = 1.0f;
 			quad.layer = offset.z;
-			quad.pos_off_x = q.x0;
-			quad.pos_off_y = q.y0;
-			quad.pos_scale_x = q.x1 - q.x0;
-			quad.pos_scale_y = q.y1 - q.y0;
-			quad.tex_off_x = muglm::round(q.s0 * width);
-			quad.tex_off_y = muglm::round(q.t0 * height);
-			quad.tex_scale_x = muglm::round(q.s1 * width) - quad.tex_off_x;
-			quad.tex_scale_y = muglm::round(q.t1 * height) - quad.tex_off_y;
-
-			max_rect = max(max_rect, vec2(q.x1, q.y1));
-			min_rect = min(min_rect, vec2(q.x0, q.y0));
 		}
-		text++;
 	}
+	else
+	{
+		vec2 off = offset.xy();
+		off.y += font_height;
+		vec2 cached = off;
+
+		while (*text)
+		{
+			stbtt_aligned_quad q;
+			if (*text == '\n')
+			{
+				cached.y += font_height;
+				off = cached;
+			}
+			else if (*text >= 32)
+			{
+				stbtt_GetBakedQuad(baked_chars->chars, width, height, *text - 32, &off.x, &off.y, &q, 1);
+
+				q.x0 += alignment_offset.x;
+				q.x1 += alignment_offset.x;
+				q.y0 += alignment_offset.y;
+				q.y1 += alignment_offset.y;
+
+				auto &quad = quads[instance_data->count++];
+				quad.color = floatToHalf(color);
+				quad.rotation[0] = 1.0f;
+				quad.rotation[1] = 0.0f;
+				quad.rotation[2] = 0.0f;
+				quad.rotation[3] = 1.0f;
+				quad.layer = offset.z;
+				quad.pos_off_x = q.x0;
+				quad.pos_off_y = q.y0;
+				quad.pos_scale_x = q.x1 - q.x0;
+				quad.pos_scale_y = q.y1 - q.y0;
+				quad.tex_off_x = muglm::round(q.s0 * width);
+				quad.tex_off_y = muglm::round(q.t0 * height);
+				quad.tex_scale_x = muglm::round(q.s1 * width) - quad.tex_off_x;
+				quad.tex_scale_y = muglm::round(q.t1 * height) - quad.tex_off_y;
+
+				max_rect = max(max_rect, vec2(q.x1, q.y1));
+				min_rect = min(min_rect, vec2(q.x0, q.y0));
+			}
+			text++;
+		}
+	}
+
+	// Glyphs still on their way into the atlas are left out.
+	if (!instance_data->count)
+		return;
 
 	if (any(lessThan(min_rect, clip_offset)) || any(greaterThan(max_rect, clip_offset + clip_size)))
 		sprite.clip_quad = ivec4(ivec2(clip_offset), ivec2(clip_size));
@@ -259,7 +407,7 @@ void Font::render_text(RenderQueue &queue, const char *text, const vec3 &offset,
 			                           MESH_ATTRIBUTE_POSITION_BIT |
 			                           MESH_ATTRIBUTE_VERTEX_COLOR_BIT,
 			                           MATERIAL_TEXTURE_BASE_COLOR_BIT,
-			                           Sprite::ALPHA_TEXTURE_BIT));
+			                           sdf_atlas ? Sprite::SDF_TEXTURE_BIT : Sprite::ALPHA_TEXTURE_BIT));
 
 		*sprite_data = sprite;
 	}
@@ -25,14 +25,49 @@
 #include "event.hpp"
 #include "render_queue.hpp"
 #include "renderer.hpp"
+#include "glyph_cache.hpp"
 #include <memory>
 
 namespace Granite
 {
+struct QuadData;
+
+// Signed distance field glyph atlas which any number of Fonts of different sizes can share.
+// Glyphs are rasterized once at glyph_height and scaled when rendering.
+class SDFFontAtlas : public EventHandler
+{
+public:
+	SDFFontAtlas(const std::string &path, float glyph_height = 32.0f, unsigned spread = 4,
+	             unsigned atlas_size = 1024, ThreadGroup *workers = nullptr);
+
+	// Call once per frame before rendering text with any Font using this atlas.
+	// Uploads glyphs which finished rasterizing since the last frame.
+	// Returns true if the atlas image was replaced, which invalidates text geometry from earlier frames.
+	bool begin_frame();
+
+	GlyphCache &get_cache()
+	{
+		return cache;
+	}
+
+	const Vulkan::ImageView *get_view() const;
+
+private:
+	GlyphCache cache;
+	Vulkan::Device *device = nullptr;
+	Vulkan::ImageHandle texture;
+	void update_texture();
+	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
+	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
+};
+
 class Font : public EventHandler
 {
 public:
+	// Bakes ASCII glyphs at size pixels into an atlas of its own.
 	Font(const std::string &path, unsigned size);
+	// Renders UTF-8 text at size pixels from a shared distance field atlas.
+	Font(std::shared_ptr<SDFFontAtlas> sdf_atlas, unsigned size);
 	~Font();
 
 	enum class Alignment
@@ -59,6 +94,12 @@ public:
 
 	vec2 get_aligned_offset(Alignment alignment, vec2 text_geometry, vec2 target_geometry) const;
 
+	// The cache behind the shared distance field atlas, or nullptr for baked fonts.
+	GlyphCache *get_glyph_cache() const
+	{
+		return sdf_atlas ? &sdf_atlas->get_cache() : nullptr;
+	}
+
 private:
 	Vulkan::ImageHandle texture;
 	struct Baked;
@@ -69,5 +110,9 @@ private:
 	std::vector<uint8_t> bitmap;
 	unsigned width = 0, height = 0;
 	unsigned font_height = 0;
+
+	std::shared_ptr<SDFFontAtlas> sdf_atlas;
+	vec2 layout_sdf(const char *text, vec2 offset, float scale,
+	                QuadData *quads, unsigned *count, vec2 *min_rect, vec2 *max_rect) const;
 };
 }
\ No newline at end of file
@@ -30,6 +30,7 @@
 #include "rapidjson_wrapper.hpp"
 #include "muglm/matrix_helper.hpp"
 #include "path_utils.hpp"
+#include "thread_group.hpp"
 
 using namespace rapidjson;
 using namespace Granite;
@@ -50,15 +51,20 @@ Parser::Buffer Parser::read_buffer(const std::string &path, uint64_t length)
 	if (!mapped)
 		throw std::runtime_error("Failed to map file.");
 
-	Buffer buf(length);
-	memcpy(buf.data(), mapped, length);
+	Buffer buf;
+	buf.ptr = static_cast<const uint8_t *>(mapped);
+	buf.length = length;
+	buf.mapping = std::move(file);
 	return buf;
 }
 
 Parser::Buffer Parser::read_base64(const char *data, uint64_t length)
 {
-	Buffer buf(length);
-	auto *ptr = buf.data();
+	Buffer buf;
+	buf.owned.resize(length);
+	buf.ptr = buf.owned.data();
+	buf.length = length;
+	auto *ptr = buf.owned.data();
 
 	const auto base64_index = [](char c) -> uint32_t {
 		if (c >= 'A' && c <= 'Z')
@@ -121,7 +127,8 @@ Parser::Buffer Parser::read_base64(const char *data, uint64_t length)
 	return buf;
 }
 
-Parser::Parser(const std::string &path)
+Parser::Parser(const std::string &path, ThreadGroup *workers_)
+	: workers(workers_)
 {
 	std::string json;
 
@@ -177,8 +184,11 @@ Parser::Parser(const std::string &path)
 							"Header error, binary chunk and JSON chunk lengths do not match up with GLB size.");
 
 				// The first buffer in the JSON must be this embedded buffer.
-				Buffer buffer(reinterpret_cast<const uint8_t *>(words),
-				              reinterpret_cast<const uint8_t *>(words) + binary_length);
+				// Keep the mapping alive and refer to it directly rather than copying the chunk.
+				Buffer buffer;
+				buffer.ptr = reinterpret_cast<const uint8_t *>(words);
+				buffer.length = binary_length;
+				buffer.mapping = file;
 				json_buffers.push_back(std::move(buffer));
 			}
 		}
@@ -510,7 +520,7 @@ static VkPrimitiveTopology gltf_topology(const char *top)
 		throw std::logic_error("Unrecognized primitive mode.");
 }
 
-void Parser::extract_attribute(std::vector<float> &attributes, const Accessor &accessor)
+void Parser::extract_attribute(std::vector<float> &attributes, const Accessor &accessor) const
 {
 	if (accessor.type != ScalarType::Float32)
 		throw std::logic_error("Attribute is not Float32.");
@@ -519,6 +529,15 @@ void Parser::extract_attribute(std::vector<float> &attributes, const Accessor &a
 
 	auto &view = json_views[accessor.view];
 	auto &buffer = json_buffers[view.buffer_index];
+
+	if (accessor.stride == sizeof(float))
+	{
+		const auto *data = reinterpret_cast<const float *>(&buffer[view.offset + accessor.offset]);
+		attributes.insert(attributes.end(), data, data + accessor.count);
+		return;
+	}
+
+	attributes.reserve(attributes.size() + accessor.count);
 	for (uint32_t i = 0; i < accessor.count; i++)
 	{
 		uint32_t offset = view.offset + accessor.offset + i * accessor.stride;
@@ -527,7 +546,7 @@ void Parser::extract_attribute(std::vector<float> &attributes, const Accessor &a
 	}
 }
 
-void Parser::extract_attribute(std::vector<vec3> &attributes, const Accessor &accessor)
+void Parser::extract_attribute(std::vector<vec3> &attributes, const Accessor &accessor) const
 {
 	if (accessor.type != ScalarType::Float32)
 		throw std::logic_error("Attribute is not Float32.");
@@ -536,6 +555,7 @@ void Parser::extract_attribute(std::vector<vec3> &attributes, const Accessor &ac
 
 	auto &view = json_views[accessor.view];
 	auto &buffer = json_buffers[view.buffer_index];
+	attributes.reserve(attributes.size() + accessor.count);
 	for (uint32_t i = 0; i < accessor.count; i++)
 	{
 		uint32_t offset = view.offset + accessor.offset + i * accessor.stride;
@@ -544,7 +564,7 @@ void Parser::extract_attribute(std::vector<vec3> &attributes, const Accessor &ac
 	}
 }
 
-void Parser::extract_attribute(std::vector<vec4> &attributes, const Accessor &accessor)
+void Parser::extract_attribute(std::vector<vec4> &attributes, const Accessor &accessor) const
 {
 	if (accessor.type != ScalarType::Float32)
 		throw std::logic_error("Attribute is not Float32.");
@@ -553,6 +573,7 @@ void Parser::extract_attribute(std::vector<vec4> &attributes, const Accessor &ac
 
 	auto &view = json_views[accessor.view];
 	auto &buffer = json_buffers[view.buffer_index];
+	attributes.reserve(attributes.size() + accessor.count);
 	for (uint32_t i = 0; i < accessor.count; i++)
 	{
 		uint32_t offset = view.offset + accessor.offset + i * accessor.stride;
@@ -561,7 +582,7 @@ void Parser::extract_attribute(std::vector<vec4> &attributes, const Accessor &ac
 	}
 }
 
-void Parser::extract_attribute(std::vector<mat4> &attributes, const Accessor &accessor)
+void Parser::extract_attribute(std::vector<mat4> &attributes, const Accessor &accessor) const
 {
 	if (accessor.type != ScalarType::Float32)
 		throw std::logic_error("Attribute is not Float32.");
@@ -570,6 +591,7 @@ void Parser::extract_attribute(std::vector<mat4> &attributes, const Accessor &ac
 
 	auto &view = json_views[accessor.view];
 	auto &buffer = json_buffers[view.buffer_index];
+	attributes.reserve(attributes.size() + accessor.count);
 	for (uint32_t i = 0; i < accessor.count; i++)
 	{
 		uint32_t offset = view.offset + accessor.offset + i * accessor.stride;
@@ -1097,6 +1119,9 @@ void Parser::parse(const std::string &original_path, const std::string &json)
 		nodes.push_back(std::move(node));
 	};
 
+	// Inverse bind matrices are extracted after all skins are parsed, since that part can go wide.
+	std::vector<const Accessor *> inverse_bind_accessors;
+
 	const auto add_skin = [&](const Value &skin) {
 		Util::Hasher hasher;
 
@@ -1164,17 +1189,16 @@ void Parser::parse(const std::string &original_path, const std::string &json)
 		}
 
 		std::vector<mat4> inverse_bind_matrices;
-		inverse_bind_matrices.reserve(joint_transforms.size());
 
 		if (skin.HasMember("inverseBindMatrices"))
 		{
 			uint32_t accessor = skin["inverseBindMatrices"].GetUint();
-			extract_attribute(inverse_bind_matrices, json_accessors[accessor]);
+			inverse_bind_accessors.push_back(&json_accessors[accessor]);
 		}
 		else
 		{
-			for (uint32_t i = 0; i < joints.GetArray().Size(); i++)
-				inverse_bind_matrices.push_back(mat4(1.0f));
+			inverse_bind_matrices.resize(joints.GetArray().Size(), mat4(1.0f));
+			inverse_bind_accessors.push_back(nullptr);
 		}
 
 		auto compat = hasher.get();
@@ -1348,7 +1372,12 @@ void Parser::parse(const std::string &original_path, const std::string &json)
 	if (doc.HasMember("skins"))
 		iterate_elements(doc["skins"], add_skin);
 
-	const auto add_animation = [&](const Value &animation) {
+	parallel_for_range(workers, 0, json_skins.size(), 1, "gltf-skins", [&](size_t i, size_t, size_t) {
+		if (inverse_bind_accessors[i])
+			extract_attribute(json_skins[i].inverse_bind_pose, *inverse_bind_accessors[i]);
+	});
+
+	const auto add_animation = [&](const Value &animation, SceneFormats::Animation &combined_animation) {
 		auto &samplers = animation["samplers"];
 		auto &channels = animation["channels"];
 
@@ -1367,8 +1396,6 @@ void Parser::parse(const std::string &original_path, const std::string &json)
 
 		iterate_elements(samplers, add_sampler);
 
-		SceneFormats::Animation combined_animation;
-
 		for (auto itr = channels.Begin(); itr != channels.End(); ++itr)
 		{
 			auto &sampler = json_samplers[(*itr)["sampler"].GetUint()];
@@ -1462,8 +1489,6 @@ void Parser::parse(const std::string &original_path, const std::string &json)
 			combined_animation.channels.push_back(std::move(channel));
 		}
 		combined_animation.update_length();
-		combined_animation.name = std::move(json_animation_names[animations.size()]);
-		animations.push_back(std::move(combined_animation));
 	};
 
 	if (doc.HasMember("animations"))
@@ -1485,7 +1510,13 @@ void Parser::parse(const std::string &original_path, const std::string &json)
 			json_animation_names.push_back(std::move(name));
 			counter++;
 		}
-		iterate_elements(animation_list, add_animation);
+
+		// Animations only read shared parser state, so each one can be built independently.
+		animations.resize(counter);
+		parallel_for_range(workers, 0, counter, 1, "gltf-animations", [&](size_t i, size_t, size_t) {
+			add_animation(animation_list[rapidjson::SizeType(i)], animations[i]);
+			animations[i].name = std::move(json_animation_names[i]);
+		});
 	}
 
 	if (doc.HasMember("scenes"))
@@ -1512,6 +1543,10 @@ void Parser::parse(const std::string &original_path, const std::string &json)
 
 	if (doc.HasMember("scene"))
 		default_scene_index = doc["scene"].GetUint();
+
+	// Everything has been copied out by now. Don't keep file mappings and decoded base64 around with the parser.
+	json_buffers.clear();
+	json_buffers.shrink_to_fit();
 }
 
 static uint32_t padded_type_size(uint32_t type_size)
@@ -1523,9 +1558,8 @@ static uint32_t padded_type_size(uint32_t type_size)
 		return type_size;
 }
 
-void Parser::build_primitive(const MeshData::AttributeData &prim)
+void Parser::build_primitive(SceneFormats::Mesh &mesh, const MeshData::AttributeData &prim) const
 {
-	SceneFormats::Mesh mesh;
 	mesh.topology = prim.topology;
 	mesh.primitive_restart = prim.primitive_restart;
 	mesh.has_material = prim.has_material;
@@ -1708,6 +1742,12 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 				memcpy(&output[mesh.attribute_layout[i].offset + output_stride * v], weights, sizeof(weights));
 			}
 		}
+		else if (attr.stride == output_stride && mesh.attribute_layout[i].offset == 0 && type_size == output_stride)
+		{
+			// Layout already matches, copy straight out of the mapped buffer in one go.
+			// This is the single copy of the attribute data; the mesh does not alias the mapping.
+			memcpy(output.data(), &buffer[view.offset + attr.offset], size_t(vertex_count) * output_stride);
+		}
 		else
 		{
 			for (uint32_t v = 0; v < vertex_count; v++)
@@ -1741,6 +1781,12 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 				*outdata = uint16_t((*indata == 0xff) ? 0xffff : *indata);
 			}
 		}
+		else if (type_size == 2 && indices.stride == sizeof(uint16_t))
+		{
+			mesh.indices.resize(sizeof(uint16_t) * index_count);
+			mesh.index_type = VK_INDEX_TYPE_UINT16;
+			memcpy(mesh.indices.data(), &buffer[offset], mesh.indices.size());
+		}
 		else if (type_size == 2)
 		{
 			mesh.indices.resize(sizeof(uint16_t) * index_count);
@@ -1763,6 +1809,12 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 				*outdata = uint16_t(*indata);
 			}
 		}
+		else if (indices.stride == sizeof(uint32_t))
+		{
+			mesh.indices.resize(sizeof(uint32_t) * index_count);
+			mesh.index_type = VK_INDEX_TYPE_UINT32;
+			memcpy(mesh.indices.data(), &buffer[offset], mesh.indices.size());
+		}
 		else
 		{
 			mesh.indices.resize(sizeof(uint32_t) * index_count);
@@ -1781,8 +1833,6 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 		mesh_recompute_normals(mesh);
 	if (rebuild_tangents)
 		mesh_recompute_tangents(mesh);
-
-	meshes.push_back(std::move(mesh));
 }
 
 void Parser::build_meshes()
@@ -1791,16 +1841,23 @@ void Parser::build_meshes()
 	uint32_t primitive_count = 0;
 	uint32_t mesh_count = 0;
 
+	std::vector<const MeshData::AttributeData *> primitives;
+
 	for (auto &mesh : json_meshes)
 	{
 		for (auto &prim : mesh.primitives)
 		{
 			mesh_index_to_primitives[mesh_count].push_back(primitive_count);
-			build_primitive(prim);
+			primitives.push_back(&prim);
 			primitive_count++;
 		}
 		mesh_count++;
 	}
+
+	meshes.resize(primitive_count);
+	parallel_for_range(workers, 0, primitive_count, 1, "gltf-meshes", [&](size_t i, size_t, size_t) {
+		build_primitive(meshes[i], *primitives[i]);
+	});
 }
 
 }
@@ -26,6 +26,12 @@
 #include <vector>
 #include "math.hpp"
 #include "scene_formats.hpp"
+#include "filesystem.hpp"
+
+namespace Granite
+{
+class ThreadGroup;
+}
 
 namespace GLTF
 {
@@ -54,7 +60,9 @@ enum class ScalarType
 class Parser
 {
 public:
-	explicit Parser(const std::string &path);
+	// If workers is non-null, meshes, skins and animations are built in parallel.
+	// The calling thread builds alongside the workers, so parsing from within a task of the same group is fine.
+	explicit Parser(const std::string &path, ThreadGroup *workers = nullptr);
 
 	const std::vector<SceneFormats::SceneNodes> &get_scenes() const
 	{
@@ -107,7 +115,39 @@ public:
 	}
 
 private:
-	using Buffer = std::vector<uint8_t>;
+	// Either owns its data (base64 URIs), or refers directly to a read-only file mapping.
+	// External .bin buffers and the GLB BIN chunk are not copied into the parser.
+	// SceneFormats::Mesh owns its attribute and index storage, so vertex data is copied
+	// out of the mapping when meshes are built, and buffers are released once parsing is done.
+	// ptr may point into owned, so a copy would dangle. Moves are fine since the vector keeps its storage.
+	struct Buffer
+	{
+		Buffer() = default;
+		Buffer(Buffer &&) = default;
+		Buffer &operator=(Buffer &&) = default;
+		Buffer(const Buffer &) = delete;
+		Buffer &operator=(const Buffer &) = delete;
+
+		const uint8_t *data() const
+		{
+			return ptr;
+		}
+
+		size_t size() const
+		{
+			return length;
+		}
+
+		const uint8_t &operator[](size_t index) const
+		{
+			return ptr[index];
+		}
+
+		FileMappingHandle mapping;
+		std::vector<uint8_t> owned;
+		const uint8_t *ptr = nullptr;
+		size_t length = 0;
+	};
 
 	struct BufferView
 	{
@@ -191,13 +231,14 @@ private:
 	std::vector<std::vector<uint32_t>> mesh_index_to_primitives;
 	std::vector<SceneFormats::SceneNodes> json_scenes;
 	uint32_t default_scene_index = 0;
+	ThreadGroup *workers = nullptr;
 
 	void build_meshes();
-	void build_primitive(const MeshData::AttributeData &prim);
+	void build_primitive(SceneFormats::Mesh &mesh, const MeshData::AttributeData &prim) const;
 
-	void extract_attribute(std::vector<float> &attributes, const Accessor &accessor);
-	void extract_attribute(std::vector<vec3> &attributes, const Accessor &accessor);
-	void extract_attribute(std::vector<vec4> &attributes, const Accessor &accessor);
-	void extract_attribute(std::vector<mat4> &attributes, const Accessor &accessor);
+	void extract_attribute(std::vector<float> &attributes, const Accessor &accessor) const;
+	void extract_attribute(std::vector<vec3> &attributes, const Accessor &accessor) const;
+	void extract_attribute(std::vector<vec4> &attributes, const Accessor &accessor) const;
+	void extract_attribute(std::vector<mat4> &attributes, const Accessor &accessor) const;
 };
 }
@@ -28,6 +28,7 @@
 #include <vector>
 #include "mikktspace.h"
 #include "meshoptimizer.h"
+#include "thread_group.hpp"
 
 using namespace Util;
 
@@ -115,6 +116,182 @@ static IndexRemapping build_attribute_remap_indices(const Mesh &mesh)
 	return remapped;
 }
 
+template <typename Func>
+static void run_parallel(ThreadGroup &workers, unsigned count, const Func &func)
+{
+	auto group = workers.create_task();
+	group->set_desc("vertex-dedup");
+	for (unsigned i = 0; i < count; i++)
+		group->enqueue_task([&func, i]() { func(i); });
+	group->wait();
+}
+
+// Same result as build_attribute_remap_indices(), but spread over workers.
+// Vertices are partitioned into buckets by hash. Each bucket is deduplicated concurrently while visiting its
+// vertices in source order, so every vertex resolves to the same first occurrence as in the serial path.
+// Unique indices are then assigned with a prefix sum over source order, which makes the remap table
+// bit-identical to the serial version.
+static IndexRemapping build_attribute_remap_indices_parallel(const Mesh &mesh, ThreadGroup &workers)
+{
+	auto attribute_count = unsigned(mesh.positions.size() / mesh.position_stride);
+
+	constexpr unsigned NumBuckets = 256;
+	constexpr unsigned MinVerticesPerChunk = 16 * 1024;
+	unsigned num_chunks = std::min<unsigned>(workers.get_num_threads() * 4,
+	                                         (attribute_count + MinVerticesPerChunk - 1) / MinVerticesPerChunk);
+	num_chunks = std::max<unsigned>(num_chunks, 1);
+	unsigned vertices_per_chunk = (attribute_count + num_chunks - 1) / num_chunks;
+
+	const auto chunk_range = [&](unsigned chunk, unsigned &begin, unsigned &end) {
+		begin = std::min<unsigned>(chunk * vertices_per_chunk, attribute_count);
+		end = std::min<unsigned>(begin + vertices_per_chunk, attribute_count);
+	};
+
+	const auto bucket_for_hash = [](Hash hash) -> unsigned {
+		return unsigned(hash >> 56) & (NumBuckets - 1);
+	};
+
+	std::vector<Hash> hashes(attribute_count);
+	std::vector<unsigned> chunk_bucket_offsets(num_chunks * NumBuckets);
+
+	// Hash all vertices and count how many land in each bucket per chunk.
+	run_parallel(workers, num_chunks, [&](unsigned chunk) {
+		unsigned begin, end;
+		chunk_range(chunk, begin, end);
+		auto *counts = &chunk_bucket_offsets[chunk * NumBuckets];
+
+		for (unsigned i = begin; i < end; i++)
+		{
+			Hasher h;
+			h.data(mesh.positions.data() + i * mesh.position_stride, mesh.position_stride);
+			if (!mesh.attributes.empty())
+				h.data(mesh.attributes.data() + i * mesh.attribute_stride, mesh.attribute_stride);
+			hashes[i] = h.get();
+			counts[bucket_for_hash(hashes[i])]++;
+		}
+	});
+
+	// Bucket-major, chunk-minor prefix sum so that a stable scatter keeps vertices in source order within a bucket.
+	unsigned bucket_offsets[NumBuckets + 1];
+	unsigned offset = 0;
+	for (unsigned bucket = 0; bucket < NumBuckets; bucket++)
+	{
+		bucket_offsets[bucket] = offset;
+		for (unsigned chunk = 0; chunk < num_chunks; chunk++)
+		{
+			unsigned count = chunk_bucket_offsets[chunk * NumBuckets + bucket];
+			chunk_bucket_offsets[chunk * NumBuckets + bucket] = offset;
+			offset += count;
+		}
+	}
+	bucket_offsets[NumBuckets] = offset;
+
+	std::vector<unsigned> bucketed_vertices(attribute_count);
+	run_parallel(workers, num_chunks, [&](unsigned chunk) {
+		unsigned begin, end;
+		chunk_range(chunk, begin, end);
+		auto *offsets = &chunk_bucket_offsets[chunk * NumBuckets];
+		for (unsigned i = begin; i < end; i++)
+			bucketed_vertices[offsets[bucket_for_hash(hashes[i])]++] = i;
+	});
+
+	// Resolve every vertex to the first vertex which shares its hash, or itself if it is unique.
+	std::vector<unsigned> first_occurrence(attribute_count);
+	run_parallel(workers, NumBuckets, [&](unsigned bucket) {
+		std::unordered_map<Hash, unsigned> attribute_remapper;
+		attribute_remapper.reserve(bucket_offsets[bucket + 1] - bucket_offsets[bucket]);
+
+		for (unsigned j = bucket_offsets[bucket]; j < bucket_offsets[bucket + 1]; j++)
+		{
+			unsigned i = bucketed_vertices[j];
+			auto itr = attribute_remapper.find(hashes[i]);
+
+			if (itr != end(attribute_remapper))
+			{
+				unsigned source_index = itr->second;
+				bool match = memcmp(mesh.positions.data() + i * mesh.position_stride,
+				                    mesh.positions.data() + source_index * mesh.position_stride,
+				                    mesh.position_stride) == 0;
+
+				if (match && !mesh.attributes.empty() &&
+				    memcmp(mesh.attributes.data() + i * mesh.attribute_stride,
+				           mesh.attributes.data() + source_index * mesh.attribute_stride,
+				           mesh.attribute_stride) != 0)
+				{
+					match = false;
+				}
+
+				if (!match)
+					LOGW("Hash collision in vertex dedup.\n");
+				first_occurrence[i] = match ? source_index : i;
+			}
+			else
+			{
+				attribute_remapper[hashes[i]] = i;
+				first_occurrence[i] = i;
+			}
+		}
+	});
+
+	// Compact unique vertices in source order.
+	std::vector<unsigned> chunk_unique_offsets(num_chunks);
+	run_parallel(workers, num_chunks, [&](unsigned chunk) {
+		unsigned begin, end;
+		chunk_range(chunk, begin, end);
+		unsigned count = 0;
+		for (unsigned i = begin; i < end; i++)
+			if (first_occurrence[i] == i)
+				count++;
+		chunk_unique_offsets[chunk] = count;
+	});
+
+	unsigned unique_count = 0;
+	for (auto &chunk_offset : chunk_unique_offsets)
+	{
+		unsigned count = chunk_offset;
+		chunk_offset = unique_count;
+		unique_count += count;
+	}
+
+	IndexRemapping remapped;
+	remapped.index_remap.resize(attribute_count);
+	remapped.unique_attrib_to_source_index.resize(unique_count);
+
+	run_parallel(workers, num_chunks, [&](unsigned chunk) {
+		unsigned begin, end;
+		chunk_range(chunk, begin, end);
+		unsigned unique_index = chunk_unique_offsets[chunk];
+		for (unsigned i = begin; i < end; i++)
+		{
+			if (first_occurrence[i] == i)
+			{
+				remapped.index_remap[i] = unique_index;
+				remapped.unique_attrib_to_source_index[unique_index] = i;
+				unique_index++;
+			}
+		}
+	});
+
+	// Duplicates always refer to an earlier unique vertex, which has been assigned by now.
+	run_parallel(workers, num_chunks, [&](unsigned chunk) {
+		unsigned begin, end;
+		chunk_range(chunk, begin, end);
+		for (unsigned i = begin; i < end; i++)
+			if (first_occurrence[i] != i)
+				remapped.index_remap[i] = remapped.index_remap[first_occurrence[i]];
+	});
+
+	return remapped;
+}
+
+static IndexRemapping build_attribute_remap_indices(const Mesh &mesh, ThreadGroup *workers)
+{
+	if (workers && workers->get_num_threads() != 0)
+		return build_attribute_remap_indices_parallel(mesh, *workers);
+	else
+		return build_attribute_remap_indices(mesh);
+}
+
 static std::vector<uint32_t> build_remapped_index_buffer(const Mesh &mesh, const std::vector<uint32_t> &index_remap)
 {
 	assert(mesh.topology == VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST && mesh.index_type == VK_INDEX_TYPE_UINT32);
@@ -336,10 +513,10 @@ bool mesh_canonicalize_indices(SceneFormats::Mesh &mesh)
 	return true;
 }
 
-void mesh_deduplicate_vertices(Mesh &mesh)
+void mesh_deduplicate_vertices(Mesh &mesh, ThreadGroup *workers)
 {
 	mesh_canonicalize_indices(mesh);
-	auto index_remap = build_attribute_remap_indices(mesh);
+	auto index_remap = build_attribute_remap_indices(mesh, workers);
 	auto index_buffer = build_remapped_index_buffer(mesh, index_remap.index_remap);
 	rebuild_new_attributes_remap_src(mesh.positions, mesh.position_stride,
 	                                 mesh.attributes, mesh.attribute_stride,
@@ -356,7 +533,7 @@ bool mesh_optimize_index_buffer(Mesh &mesh, const IndexBufferOptimizeOptions &op
 		return false;
 
 	// Remove redundant indices and rewrite index and attribute buffers.
-	auto index_remap = build_attribute_remap_indices(mesh);
+	auto index_remap = build_attribute_remap_indices(mesh, options.workers);
 	auto index_buffer = build_remapped_index_buffer(mesh, index_remap.index_remap);
 	rebuild_new_attributes_remap_src(mesh.positions, mesh.position_stride,
 	                                 mesh.attributes, mesh.attribute_stride,
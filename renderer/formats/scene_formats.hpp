@@ -33,6 +33,8 @@
 
 namespace Granite
 {
+class ThreadGroup;
+
 namespace SceneFormats
 {
 struct NodeTransform
@@ -255,13 +257,16 @@ bool mesh_renormalize_tangents(Mesh &mesh);
 bool mesh_flip_tangents_w(Mesh &mesh);
 bool extract_collision_mesh(CollisionMesh &collision_mesh, const Mesh &mesh);
 
-void mesh_deduplicate_vertices(Mesh &mesh);
+// If workers is non-null, deduplication is spread over the thread group.
+// The result is identical to the serial path.
+void mesh_deduplicate_vertices(Mesh &mesh, ThreadGroup *workers = nullptr);
 bool mesh_canonicalize_indices(Mesh &mesh);
 
 struct IndexBufferOptimizeOptions
 {
 	bool narrow_index_buffer;
 	bool stripify;
+	ThreadGroup *workers;
 };
 bool mesh_optimize_index_buffer(Mesh &mesh, const IndexBufferOptimizeOptions &options);
 std::unordered_set<uint32_t> build_used_nodes_in_scene(const SceneNodes &scene, const std::vector<Node> &nodes);
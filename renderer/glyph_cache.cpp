@@ -0,0 +1,430 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define NOMINMAX
+#include "stb_truetype.h"
+#include "glyph_cache.hpp"
+#include "filesystem.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+namespace Granite
+{
+struct TrueTypeRasterizer::Impl
+{
+	FileMappingHandle file;
+	stbtt_fontinfo info;
+	float pixel_height;
+	float scale;
+	unsigned spread;
+	float ascent;
+	float line_height;
+};
+
+TrueTypeRasterizer::TrueTypeRasterizer(const std::string &path, float pixel_height, unsigned spread)
+{
+	impl.reset(new Impl);
+	impl->file = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
+	if (!impl->file)
+		throw std::runtime_error("Failed to open font.");
+
+	auto *mapped = impl->file->data<unsigned char>();
+	if (!mapped)
+		throw std::runtime_error("Failed to map font.");
+
+	int offset = stbtt_GetFontOffsetForIndex(mapped, 0);
+	if (offset < 0 || !stbtt_InitFont(&impl->info, mapped, offset))
+		throw std::runtime_error("Failed to parse font.");
+
+	int ascent, descent, line_gap;
+	stbtt_GetFontVMetrics(&impl->info, &ascent, &descent, &line_gap);
+	impl->pixel_height = pixel_height;
+	impl->scale = stbtt_ScaleForPixelHeight(&impl->info, pixel_height);
+	impl->spread = std::max(spread, 1u);
+	impl->ascent = float(ascent) * impl->scale;
+	impl->line_height = float(ascent - descent + line_gap) * impl->scale;
+}
+
+TrueTypeRasterizer::~TrueTypeRasterizer()
+{
+}
+
+float TrueTypeRasterizer::get_pixel_height() const
+{
+	return impl->pixel_height;
+}
+
+float TrueTypeRasterizer::get_ascent() const
+{
+	return impl->ascent;
+}
+
+float TrueTypeRasterizer::get_line_height() const
+{
+	return impl->line_height;
+}
+
+float TrueTypeRasterizer::get_advance(uint32_t codepoint) const
+{
+	int advance, left_side_bearing;
+	int glyph = stbtt_FindGlyphIndex(&impl->info, int(codepoint));
+	stbtt_GetGlyphHMetrics(&impl->info, glyph, &advance, &left_side_bearing);
+	return float(advance) * impl->scale;
+}
+
+void TrueTypeRasterizer::render_sdf(uint32_t codepoint, GlyphBitmap &bitmap) const
+{
+	bitmap = {};
+
+	int glyph = stbtt_FindGlyphIndex(&impl->info, int(codepoint));
+	int width = 0, height = 0, offset_x = 0, offset_y = 0;
+	unsigned char *sdf = stbtt_GetGlyphSDF(&impl->info, impl->scale, glyph, int(impl->spread), 128,
+	                                       128.0f / float(impl->spread),
+	                                       &width, &height, &offset_x, &offset_y);
+	if (!sdf)
+		return;
+
+	bitmap.width = unsigned(width);
+	bitmap.height = unsigned(height);
+	bitmap.offset_x = offset_x;
+	bitmap.offset_y = offset_y;
+	bitmap.pixels.assign(sdf, sdf + width * height);
+	stbtt_FreeSDF(sdf, nullptr);
+}
+
+// Glyphs are rasterized in batches of this many per task.
+static constexpr unsigned GlyphsPerTask = 8;
+// Spacing between glyphs, so bilinear filtering never reaches into a neighbor.
+static constexpr unsigned GlyphGutter = 1;
+// Shelf heights are rounded up to this, so glyphs of similar heights share shelves.
+static constexpr unsigned ShelfHeightAlignment = 4;
+
+GlyphCache::GlyphCache(std::unique_ptr<GlyphRasterizer> rasterizer_, unsigned atlas_width_, unsigned atlas_height_,
+                       ThreadGroup *workers_)
+	: rasterizer(std::move(rasterizer_)), workers(workers_), atlas_width(atlas_width_), atlas_height(atlas_height_)
+{
+	atlas.resize(atlas_width * atlas_height);
+	free_spans.push_back({ 0, atlas_height });
+}
+
+GlyphCache::~GlyphCache()
+{
+	for (auto &task : in_flight)
+		task->wait();
+}
+
+float GlyphCache::get_advance(uint32_t codepoint)
+{
+	auto itr = advances.find(codepoint);
+	if (itr != advances.end())
+		return itr->second;
+
+	float advance = rasterizer->get_advance(codepoint);
+	advances[codepoint] = advance;
+	return advance;
+}
+
+const CachedGlyph *GlyphCache::find_glyph(uint32_t codepoint)
+{
+	auto itr = glyphs.find(codepoint);
+	if (itr == glyphs.end())
+	{
+		stats.misses++;
+		glyphs[codepoint] = { {}, 0, false };
+		requests.push_back(codepoint);
+		return nullptr;
+	}
+
+	if (!itr->second.resident)
+	{
+		stats.misses++;
+		return nullptr;
+	}
+
+	stats.hits++;
+	if (itr->second.glyph.width)
+	{
+		auto &shelf = shelves[itr->second.shelf];
+		shelf.last_used = frame;
+		if (shelf_capture)
+		{
+			GlyphShelfReference ref = { itr->second.shelf, shelf.generation };
+			// Text mostly comes from a handful of shelves, so skipping repeats keeps the list short.
+			if (shelf_capture->empty() || !(shelf_capture->back() == ref))
+				shelf_capture->push_back(ref);
+		}
+	}
+	return &itr->second.glyph;
+}
+
+void GlyphCache::set_shelf_capture(std::vector<GlyphShelfReference> *capture)
+{
+	shelf_capture = capture;
+}
+
+bool GlyphCache::touch_shelf(const GlyphShelfReference &ref)
+{
+	if (ref.index >= shelves.size())
+		return false;
+	auto &shelf = shelves[ref.index];
+	if (!shelf.live || shelf.generation != ref.generation)
+		return false;
+	shelf.last_used = frame;
+	return true;
+}
+
+void GlyphCache::dispatch_requests()
+{
+	if (requests.empty())
+		return;
+
+	if (!workers)
+	{
+		for (auto codepoint : requests)
+		{
+			CompletedGlyph glyph = { codepoint, {} };
+			rasterizer->render_sdf(codepoint, glyph.bitmap);
+			completed.push_back(std::move(glyph));
+		}
+		requests.clear();
+		return;
+	}
+
+	auto task = workers->create_task();
+	task->set_desc("glyph-rasterize");
+	for (size_t i = 0; i < requests.size(); i += GlyphsPerTask)
+	{
+		size_t count = std::min<size_t>(GlyphsPerTask, requests.size() - i);
+		std::vector<uint32_t> batch(requests.begin() + i, requests.begin() + i + count);
+		task->enqueue_task([this, batch]() {
+			std::vector<CompletedGlyph> results(batch.size());
+			for (size_t j = 0; j < batch.size(); j++)
+			{
+				results[j].codepoint = batch[j];
+				rasterizer->render_sdf(batch[j], results[j].bitmap);
+			}
+
+			std::lock_guard<std::mutex> holder{completed_lock};
+			for (auto &result : results)
+				completed.push_back(std::move(result));
+		});
+	}
+	task->flush();
+	in_flight.push_back(std::move(task));
+	requests.clear();
+}
+
+bool GlyphCache::pack_completed()
+{
+	std::vector<CompletedGlyph> glyphs_to_pack;
+	{
+		std::lock_guard<std::mutex> holder{completed_lock};
+		std::swap(glyphs_to_pack, completed);
+	}
+
+	in_flight.erase(std::remove_if(in_flight.begin(), in_flight.end(), [](TaskGroupHandle &task) {
+		return task->poll();
+	}), in_flight.end());
+
+	// Packing tall glyphs first keeps shelves from being opened by the odd short glyph.
+	std::sort(glyphs_to_pack.begin(), glyphs_to_pack.end(), [](const CompletedGlyph &a, const CompletedGlyph &b) {
+		return a.bitmap.height > b.bitmap.height;
+	});
+
+	// Evicting clears texels even when the glyph which needed the room is dropped after all.
+	uint64_t evicted_shelves = stats.evicted_shelves;
+	bool changed = false;
+	for (auto &glyph : glyphs_to_pack)
+		if (pack(glyph.codepoint, glyph.bitmap))
+			changed = true;
+	return changed || stats.evicted_shelves != evicted_shelves;
+}
+
+bool GlyphCache::begin_frame()
+{
+	frame++;
+	dispatch_requests();
+	return pack_completed();
+}
+
+bool GlyphCache::flush()
+{
+	dispatch_requests();
+	for (auto &task : in_flight)
+		task->wait();
+	in_flight.clear();
+	return pack_completed();
+}
+
+bool GlyphCache::allocate_shelf(unsigned height, unsigned &shelf_index)
+{
+	height = std::min((height + ShelfHeightAlignment - 1) & ~(ShelfHeightAlignment - 1), atlas_height);
+
+	for (auto itr = free_spans.begin(); itr != free_spans.end(); ++itr)
+	{
+		if (itr->height < height)
+			continue;
+
+		Shelf shelf = { itr->y, height, 0, frame, ++shelf_generation, {}, true };
+		itr->y += height;
+		itr->height -= height;
+		if (!itr->height)
+			free_spans.erase(itr);
+
+		auto dead = std::find_if(shelves.begin(), shelves.end(), [](const Shelf &s) { return !s.live; });
+		if (dead != shelves.end())
+		{
+			shelf_index = unsigned(dead - shelves.begin());
+			*dead = std::move(shelf);
+		}
+		else
+		{
+			shelf_index = unsigned(shelves.size());
+			shelves.push_back(std::move(shelf));
+		}
+		return true;
+	}
+
+	return false;
+}
+
+bool GlyphCache::evict_shelf()
+{
+	Shelf *victim = nullptr;
+	for (auto &shelf : shelves)
+		if (shelf.live && shelf.last_used + 1 < frame && (!victim || shelf.last_used < victim->last_used))
+			victim = &shelf;
+
+	if (!victim)
+		return false;
+
+	for (auto codepoint : victim->codepoints)
+		glyphs.erase(codepoint);
+	stats.evicted_glyphs += victim->codepoints.size();
+	stats.resident_glyphs -= unsigned(victim->codepoints.size());
+	stats.evicted_shelves++;
+
+	// Stale texels would bleed into new glyphs through the gutters.
+	memset(atlas.data() + victim->y * atlas_width, 0, victim->height * atlas_width);
+
+	free_spans.push_back({ victim->y, victim->height });
+	victim->live = false;
+	victim->codepoints.clear();
+
+	std::sort(free_spans.begin(), free_spans.end(), [](const Span &a, const Span &b) { return a.y < b.y; });
+	size_t merged = 0;
+	for (size_t i = 1; i < free_spans.size(); i++)
+	{
+		if (free_spans[merged].y + free_spans[merged].height == free_spans[i].y)
+			free_spans[merged].height += free_spans[i].height;
+		else
+			free_spans[++merged] = free_spans[i];
+	}
+	free_spans.resize(merged + 1);
+	return true;
+}
+
+bool GlyphCache::allocate(unsigned width, unsigned height, unsigned &x, unsigned &y, unsigned &shelf_index)
+{
+	if (width > atlas_width || height > atlas_height)
+		return false;
+
+	for (;;)
+	{
+		// Best fit among the open shelves, but do not waste tall shelves on short glyphs.
+		Shelf *best = nullptr;
+		for (auto &shelf : shelves)
+		{
+			if (!shelf.live || shelf.height < height || shelf.x + width > atlas_width)
+				continue;
+			if (shelf.height > height + height / 2 + ShelfHeightAlignment)
+				continue;
+			if (!best || shelf.height < best->height)
+				best = &shelf;
+		}
+
+		if (best)
+		{
+			shelf_index = unsigned(best - shelves.data());
+			break;
+		}
+
+		if (allocate_shelf(height, shelf_index))
+			break;
+
+		if (!evict_shelf())
+			return false;
+	}
+
+	auto &shelf = shelves[shelf_index];
+	x = shelf.x;
+	y = shelf.y;
+	shelf.x += width;
+	shelf.last_used = frame;
+	return true;
+}
+
+bool GlyphCache::pack(uint32_t codepoint, const GlyphBitmap &bitmap)
+{
+	stats.rasterized++;
+
+	auto itr = glyphs.find(codepoint);
+	if (itr == glyphs.end())
+		return false;
+	auto &entry = itr->second;
+
+	entry.glyph.offset_x = int16_t(bitmap.offset_x);
+	entry.glyph.offset_y = int16_t(bitmap.offset_y);
+
+	if (!bitmap.width || !bitmap.height)
+	{
+		entry.glyph.width = 0;
+		entry.glyph.height = 0;
+		entry.resident = true;
+		return false;
+	}
+
+	unsigned x, y, shelf_index;
+	if (!allocate(bitmap.width + GlyphGutter, bitmap.height + GlyphGutter, x, y, shelf_index))
+	{
+		// Let a later frame ask for it again, there might be room by then.
+		stats.dropped++;
+		glyphs.erase(itr);
+		return false;
+	}
+
+	// Evictions only remove resident glyphs, so the entry is still valid.
+	for (unsigned row = 0; row < bitmap.height; row++)
+		memcpy(atlas.data() + (y + row) * atlas_width + x, bitmap.pixels.data() + row * bitmap.width, bitmap.width);
+
+	entry.glyph.x = uint16_t(x);
+	entry.glyph.y = uint16_t(y);
+	entry.glyph.width = uint16_t(bitmap.width);
+	entry.glyph.height = uint16_t(bitmap.height);
+	entry.shelf = shelf_index;
+	entry.resident = true;
+	shelves[shelf_index].codepoints.push_back(codepoint);
+	stats.resident_glyphs++;
+	return true;
+}
+}
@@ -0,0 +1,234 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "thread_group.hpp"
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Granite
+{
+struct GlyphBitmap
+{
+	std::vector<uint8_t> pixels;
+	unsigned width = 0;
+	unsigned height = 0;
+	// Top-left corner relative to the pen position on the baseline, in pixels.
+	int offset_x = 0;
+	int offset_y = 0;
+};
+
+// Produces signed distance field glyphs at a fixed pixel height.
+// All queries must be thread-safe, render_sdf() is called from worker threads.
+class GlyphRasterizer
+{
+public:
+	virtual ~GlyphRasterizer() = default;
+
+	virtual float get_pixel_height() const = 0;
+	virtual float get_ascent() const = 0;
+	virtual float get_line_height() const = 0;
+	virtual float get_advance(uint32_t codepoint) const = 0;
+
+	// 8-bit distance field with the edge at 128 and spread pixels of distance on either side.
+	// Glyphs without an outline, like spaces, come back as an empty bitmap.
+	virtual void render_sdf(uint32_t codepoint, GlyphBitmap &bitmap) const = 0;
+};
+
+class TrueTypeRasterizer final : public GlyphRasterizer
+{
+public:
+	TrueTypeRasterizer(const std::string &path, float pixel_height, unsigned spread);
+	~TrueTypeRasterizer() override;
+
+	float get_pixel_height() const override;
+	float get_ascent() const override;
+	float get_line_height() const override;
+	float get_advance(uint32_t codepoint) const override;
+	void render_sdf(uint32_t codepoint, GlyphBitmap &bitmap) const override;
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> impl;
+};
+
+struct CachedGlyph
+{
+	// Rectangle in the atlas. Empty for glyphs without an outline.
+	uint16_t x, y, width, height;
+	// Top-left corner relative to the pen position, in pixels at the rasterizer's height.
+	int16_t offset_x, offset_y;
+};
+
+struct GlyphCacheStatistics
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t rasterized = 0;
+	uint64_t evicted_glyphs = 0;
+	uint64_t evicted_shelves = 0;
+	// Glyphs which did not fit, even after evicting everything the last frame did not use.
+	uint64_t dropped = 0;
+	unsigned resident_glyphs = 0;
+
+	double get_hit_rate() const
+	{
+		uint64_t total = hits + misses;
+		return total ? double(hits) / double(total) : 1.0;
+	}
+};
+
+// Identifies one placement of a shelf, so references to a shelf which was evicted and reused can be told apart.
+struct GlyphShelfReference
+{
+	unsigned index;
+	uint64_t generation;
+
+	bool operator==(const GlyphShelfReference &other) const
+	{
+		return index == other.index && generation == other.generation;
+	}
+};
+
+// Lazily filled glyph atlas for one font.
+// Glyphs are rasterized on worker threads and packed into shelves, rows of glyphs sharing a height.
+// When the atlas is full, whole shelves are evicted in least recently used order,
+// but never a shelf which was used in the current or the previous frame.
+// Apart from rasterization, the cache must only be used from one thread.
+class GlyphCache
+{
+public:
+	GlyphCache(std::unique_ptr<GlyphRasterizer> rasterizer, unsigned atlas_width, unsigned atlas_height,
+	           ThreadGroup *workers = nullptr);
+	~GlyphCache();
+
+	GlyphCache(const GlyphCache &) = delete;
+	void operator=(const GlyphCache &) = delete;
+
+	const GlyphRasterizer &get_rasterizer() const
+	{
+		return *rasterizer;
+	}
+
+	// In pixels at the rasterizer's height. Never waits for rasterization, so layout is stable
+	// while glyphs are still on their way into the atlas.
+	float get_advance(uint32_t codepoint);
+
+	// Returns the glyph if it is in the atlas and marks it as used in this frame.
+	// Otherwise it is queued for rasterization and nullptr is returned.
+	const CachedGlyph *find_glyph(uint32_t codepoint);
+
+	// While set, find_glyph() appends the shelf of every glyph with texels it returns,
+	// so geometry built from those glyphs can keep them alive with touch_shelf() when it is reused.
+	void set_shelf_capture(std::vector<GlyphShelfReference> *capture);
+
+	// Marks a shelf as used in this frame like find_glyph() does.
+	// Returns false if the shelf was evicted since it was captured.
+	bool touch_shelf(const GlyphShelfReference &shelf);
+
+	// Call once per frame before any find_glyph(). Starts rasterizing the glyphs missed since the last call
+	// and packs the ones which have finished. Returns true if atlas pixels changed.
+	bool begin_frame();
+
+	// Rasterizes and packs every glyph missed so far before returning.
+	bool flush();
+
+	const uint8_t *get_atlas_pixels() const
+	{
+		return atlas.data();
+	}
+
+	unsigned get_atlas_width() const
+	{
+		return atlas_width;
+	}
+
+	unsigned get_atlas_height() const
+	{
+		return atlas_height;
+	}
+
+	const GlyphCacheStatistics &get_statistics() const
+	{
+		return stats;
+	}
+
+private:
+	std::unique_ptr<GlyphRasterizer> rasterizer;
+	ThreadGroup *workers;
+	unsigned atlas_width, atlas_height;
+	std::vector<uint8_t> atlas;
+	uint64_t frame = 2;
+	uint64_t shelf_generation = 0;
+	std::vector<GlyphShelfReference> *shelf_capture = nullptr;
+
+	struct Entry
+	{
+		CachedGlyph glyph;
+		unsigned shelf;
+		bool resident;
+	};
+	std::unordered_map<uint32_t, Entry> glyphs;
+	std::unordered_map<uint32_t, float> advances;
+	std::vector<uint32_t> requests;
+
+	struct CompletedGlyph
+	{
+		uint32_t codepoint;
+		GlyphBitmap bitmap;
+	};
+	std::mutex completed_lock;
+	std::vector<CompletedGlyph> completed;
+	std::vector<TaskGroupHandle> in_flight;
+
+	struct Shelf
+	{
+		unsigned y, height;
+		unsigned x;
+		uint64_t last_used;
+		uint64_t generation;
+		std::vector<uint32_t> codepoints;
+		bool live;
+	};
+
+	struct Span
+	{
+		unsigned y, height;
+	};
+
+	std::vector<Shelf> shelves;
+	std::vector<Span> free_spans;
+	GlyphCacheStatistics stats;
+
+	void dispatch_requests();
+	bool pack_completed();
+	bool pack(uint32_t codepoint, const GlyphBitmap &bitmap);
+	bool allocate(unsigned width, unsigned height, unsigned &x, unsigned &y, unsigned &shelf_index);
+	bool allocate_shelf(unsigned height, unsigned &shelf_index);
+	bool evict_shelf();
+};
+}
@@ -1703,6 +1703,34 @@ void LightClusterer::update_bindless_range_buffer_gpu(Vulkan::CommandBuffer &cmd
 	update_bindless_range_buffer_gpu(cmd, *bindless.range_buffer, bindless.volume_index_range);
 }
 
+void LightClusterer::build_cluster_bindless_cpu(LightBinner &binner, ThreadGroup *workers) const
+{
+	uint32_t count = bindless.parameters.num_lights;
+	std::vector<LightBinningVolume> volumes;
+	volumes.reserve(count);
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		if (bindless_light_is_point(i))
+		{
+			volumes.push_back(LightBinningVolume::point(bindless.transforms.lights[i].position,
+			                                            1.0f / bindless.transforms.lights[i].inv_radius));
+		}
+		else
+			volumes.push_back(LightBinningVolume::spot_from_model(bindless.transforms.model[i]));
+	}
+
+	LightBinnerParameters params;
+	params.transform = bindless.parameters.transform;
+	params.camera_position = bindless.parameters.camera_base;
+	params.camera_front = bindless.parameters.camera_front;
+	params.z_far = context->get_render_parameters().z_far;
+	params.resolution_x = resolution_x;
+	params.resolution_y = resolution_y;
+	params.resolution_z = resolution_z;
+	binner.build(params, volumes.data(), count, workers);
+}
+
 static vec2 decal_z_range(const RenderContext &context, const mat4 &transform)
 {
 	float lo = std::numeric_limits<float>::infinity();
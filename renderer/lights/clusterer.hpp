@@ -23,6 +23,7 @@
 #pragma once
 
 #include "lights.hpp"
+#include "light_binner.hpp"
 #include "render_components.hpp"
 #include "event.hpp"
 #include "shader_manager.hpp"
@@ -80,6 +81,10 @@ public:
 	VkDescriptorSet get_cluster_bindless_set() const;
 	bool clusterer_is_bindless() const;
 
+	// Runs the bindless Z-binning and tile bitmask build for the current frame's local lights on the CPU.
+	// Light indices match the GPU buffers. Only valid in bindless mode, after refresh().
+	void build_cluster_bindless_cpu(LightBinner &binner, ThreadGroup *workers = nullptr) const;
+
 	void set_enable_volumetric_diffuse(bool enable);
 	bool clusterer_has_volumetric_diffuse() const;
 	const ClustererParametersVolumetric &get_cluster_volumetric_diffuse_data() const;
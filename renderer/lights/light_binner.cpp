@@ -0,0 +1,446 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "light_binner.hpp"
+#include "thread_group.hpp"
+#include "simd_headers.hpp"
+#include "muglm/matrix_helper.hpp"
+#include "bitops.hpp"
+#include <algorithm>
+#include <atomic>
+#include <float.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LIGHT_BINNER_SSE2 1
+#endif
+
+namespace Granite
+{
+// Number of floats per light in the SoA layout.
+enum { SoAPosX, SoAPosY, SoAPosZ, SoARadius, SoABaseX, SoABaseY, SoABaseZ, SoABaseRadius, SoAAxisX, SoAAxisY, SoAAxisZ, SoACount };
+
+LightBinningVolume LightBinningVolume::point(const vec3 &center, float radius)
+{
+	return { center, radius, vec3(0.0f), 0.0f };
+}
+
+LightBinningVolume LightBinningVolume::spot(const vec3 &apex, const vec3 &direction, float range, float base_radius)
+{
+	return { apex, 0.0f, normalize(direction) * range, base_radius };
+}
+
+LightBinningVolume LightBinningVolume::spot_from_model(const mat4 &model)
+{
+	// The pyramid's base is at model[3] - model[2], with half-extents model[0] and model[1].
+	return { model[3].xyz(), 0.0f, -model[2].xyz(), length(model[0].xyz()) };
+}
+
+// The boundary between cells (index - 1) and index along one screen axis, as a normalized world space plane.
+// The plane is positive on the side of cell index.
+static vec4 compute_boundary_plane(const mat4 &transform, unsigned axis, unsigned index, unsigned resolution)
+{
+	float uv = float(index) / float(resolution);
+	vec4 plane;
+	for (unsigned i = 0; i < 4; i++)
+		plane[i] = transform[i][axis] - uv * transform[i][3];
+	return plane / length(plane.xyz());
+}
+
+void LightBinner::build_soa(const LightBinningVolume *lights)
+{
+	size_t padded = num_lights_32 * 32;
+	soa.resize(padded * SoACount);
+	volumes.assign(lights, lights + num_lights);
+
+	auto *data = soa.data();
+	for (unsigned i = 0; i < num_lights; i++)
+	{
+		auto &light = lights[i];
+		float height = length(light.axis);
+		vec3 base = light.position + light.axis;
+		vec3 axis = height > 0.0f ? light.axis / height : vec3(0.0f);
+
+		data[SoAPosX * padded + i] = light.position.x;
+		data[SoAPosY * padded + i] = light.position.y;
+		data[SoAPosZ * padded + i] = light.position.z;
+		data[SoARadius * padded + i] = light.radius;
+		data[SoABaseX * padded + i] = base.x;
+		data[SoABaseY * padded + i] = base.y;
+		data[SoABaseZ * padded + i] = base.z;
+		data[SoABaseRadius * padded + i] = height > 0.0f ? light.base_radius : 0.0f;
+		data[SoAAxisX * padded + i] = axis.x;
+		data[SoAAxisY * padded + i] = axis.y;
+		data[SoAAxisZ * padded + i] = axis.z;
+	}
+
+	// Padding lights reach infinitely far behind every plane, so they never pass a test.
+	for (size_t i = num_lights; i < padded; i++)
+	{
+		for (unsigned j = 0; j < SoACount; j++)
+			data[j * padded + i] = 0.0f;
+		data[SoARadius * padded + i] = -FLT_MAX;
+		data[SoABaseRadius * padded + i] = -FLT_MAX;
+	}
+}
+
+int LightBinner::get_z_slice(float z) const
+{
+	return int(z * (float(params.resolution_z) / params.z_far));
+}
+
+void LightBinner::build_z_ranges()
+{
+	light_ranges.resize(num_lights);
+	slice_ranges.resize(params.resolution_z);
+	std::fill(slice_ranges.begin(), slice_ranges.end(), uvec2(~0u, 0u));
+
+	float z_scale = float(params.resolution_z) / params.z_far;
+	float z_max = float(params.resolution_z - 1);
+
+	for (unsigned i = 0; i < num_lights; i++)
+	{
+		auto &light = volumes[i];
+		vec3 base = light.position + light.axis;
+		float height = length(light.axis);
+		float z_pos = dot(light.position - params.camera_position, params.camera_front);
+		float z_base = dot(base - params.camera_position, params.camera_front);
+		float axis_z = height > 0.0f ? dot(light.axis, params.camera_front) / height : 0.0f;
+		float base_extent = height > 0.0f ? light.base_radius * muglm::sqrt(muglm::max(1.0f - axis_z * axis_z, 0.0f)) : 0.0f;
+
+		vec2 range(muglm::min(z_pos - light.radius, z_base - base_extent),
+		           muglm::max(z_pos + light.radius, z_base + base_extent));
+
+		// Same rounding as LightClusterer::compute_uint_range().
+		range *= z_scale;
+		if (range.y < 0.0f)
+		{
+			light_ranges[i] = uvec2(~0u, 0u);
+			continue;
+		}
+
+		range.x = muglm::clamp(range.x, 0.0f, z_max + 1.0f);
+		range.y = muglm::min(range.y, z_max);
+		uvec2 urange(range);
+		light_ranges[i] = urange;
+
+		for (unsigned z = urange.x; z <= urange.y; z++)
+		{
+			if (slice_ranges[z].x == ~0u)
+				slice_ranges[z].x = i;
+			slice_ranges[z].y = i;
+		}
+	}
+}
+
+// For each cell along an axis, sets the bit of every light in the chunk which is on the positive side of
+// the cell's lower boundary and on the negative side of its upper boundary.
+// Each light is tested against the convex hull of its sphere and cone:
+// extending furthest along the plane normal n is max(n.p + r, n.b + rb * sqrt(1 - (n.u)^2)),
+// where p is the center or apex, b the center of the cone's base, rb its radius and u its axis.
+void LightBinner::build_axis_bitmask(uint32_t *bitmask, const vec4 *planes, unsigned resolution, unsigned chunk) const
+{
+	size_t padded = num_lights_32 * 32;
+	const float *data = soa.data() + chunk * 32;
+
+	uint32_t prev_above = 0;
+	for (unsigned boundary = 0; boundary <= resolution; boundary++)
+	{
+		auto &plane = planes[boundary];
+		uint32_t above = 0;
+		uint32_t below = 0;
+
+#ifdef LIGHT_BINNER_SSE2
+		__m128 nx = _mm_set1_ps(plane.x);
+		__m128 ny = _mm_set1_ps(plane.y);
+		__m128 nz = _mm_set1_ps(plane.z);
+		__m128 nw = _mm_set1_ps(plane.w);
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 zero = _mm_setzero_ps();
+
+		for (unsigned i = 0; i < 32; i += 4)
+		{
+#define LOAD(x) _mm_loadu_ps(data + SoA##x * padded + i)
+			__m128 dp = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, LOAD(PosX)), _mm_mul_ps(ny, LOAD(PosY))),
+			                       _mm_add_ps(_mm_mul_ps(nz, LOAD(PosZ)), nw));
+			__m128 db = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, LOAD(BaseX)), _mm_mul_ps(ny, LOAD(BaseY))),
+			                       _mm_add_ps(_mm_mul_ps(nz, LOAD(BaseZ)), nw));
+			__m128 nu = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, LOAD(AxisX)), _mm_mul_ps(ny, LOAD(AxisY))),
+			                       _mm_mul_ps(nz, LOAD(AxisZ)));
+			__m128 s = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(nu, nu)), zero));
+			s = _mm_mul_ps(s, LOAD(BaseRadius));
+			__m128 r = LOAD(Radius);
+#undef LOAD
+
+			__m128 hi = _mm_max_ps(_mm_add_ps(dp, r), _mm_add_ps(db, s));
+			__m128 lo = _mm_min_ps(_mm_sub_ps(dp, r), _mm_sub_ps(db, s));
+			above |= uint32_t(_mm_movemask_ps(_mm_cmpge_ps(hi, zero))) << i;
+			below |= uint32_t(_mm_movemask_ps(_mm_cmple_ps(lo, zero))) << i;
+		}
+#else
+		for (unsigned i = 0; i < 32; i++)
+		{
+			float dp = plane.x * data[SoAPosX * padded + i] + plane.y * data[SoAPosY * padded + i] +
+			           plane.z * data[SoAPosZ * padded + i] + plane.w;
+			float db = plane.x * data[SoABaseX * padded + i] + plane.y * data[SoABaseY * padded + i] +
+			           plane.z * data[SoABaseZ * padded + i] + plane.w;
+			float nu = plane.x * data[SoAAxisX * padded + i] + plane.y * data[SoAAxisY * padded + i] +
+			           plane.z * data[SoAAxisZ * padded + i];
+			float s = muglm::sqrt(muglm::max(1.0f - nu * nu, 0.0f)) * data[SoABaseRadius * padded + i];
+			float r = data[SoARadius * padded + i];
+
+			if (muglm::max(dp + r, db + s) >= 0.0f)
+				above |= 1u << i;
+			if (muglm::min(dp - r, db - s) <= 0.0f)
+				below |= 1u << i;
+		}
+#endif
+
+		if (boundary != 0)
+			bitmask[(boundary - 1) * num_lights_32 + chunk] = prev_above & below;
+		prev_above = above;
+	}
+}
+
+void LightBinner::build(const LightBinnerParameters &params_, const LightBinningVolume *lights, unsigned count,
+                        ThreadGroup *workers)
+{
+	params = params_;
+	num_lights = count;
+	num_lights_32 = (count + 31) / 32;
+
+	build_soa(lights);
+	build_z_ranges();
+
+	column_planes.resize(params.resolution_x + 1);
+	row_planes.resize(params.resolution_y + 1);
+	for (unsigned i = 0; i <= params.resolution_x; i++)
+		column_planes[i] = compute_boundary_plane(params.transform, 0, i, params.resolution_x);
+	for (unsigned i = 0; i <= params.resolution_y; i++)
+		row_planes[i] = compute_boundary_plane(params.transform, 1, i, params.resolution_y);
+
+	// A tile's side planes split into a column pair and a row pair, and each plane is tested on its own,
+	// so a light touches tile (x, y) exactly when it touches column x and row y.
+	// This takes (resolution_x + resolution_y) plane tests per light instead of one per tile.
+	column_bitmask.resize(params.resolution_x * num_lights_32);
+	row_bitmask.resize(params.resolution_y * num_lights_32);
+	parallel_for_range(workers, 0, num_lights_32, 4, "light-binner-planes", [&](size_t, size_t begin, size_t end) {
+		for (unsigned chunk = begin; chunk < end; chunk++)
+		{
+			build_axis_bitmask(column_bitmask.data(), column_planes.data(), params.resolution_x, chunk);
+			build_axis_bitmask(row_bitmask.data(), row_planes.data(), params.resolution_y, chunk);
+		}
+	});
+
+	tile_bitmask.resize(params.resolution_x * params.resolution_y * num_lights_32);
+	parallel_for_range(workers, 0, params.resolution_y, 4, "light-binner-tiles", [&](size_t, size_t begin, size_t end) {
+		for (unsigned y = begin; y < end; y++)
+		{
+			const uint32_t *row = row_bitmask.data() + y * num_lights_32;
+			for (unsigned x = 0; x < params.resolution_x; x++)
+			{
+				const uint32_t *column = column_bitmask.data() + x * num_lights_32;
+				uint32_t *tile = tile_bitmask.data() + (y * params.resolution_x + x) * num_lights_32;
+				unsigned i = 0;
+#ifdef LIGHT_BINNER_SSE2
+				for (; i + 4 <= num_lights_32; i += 4)
+				{
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(column + i));
+					_mm_storeu_si128(reinterpret_cast<__m128i *>(tile + i), _mm_and_si128(a, b));
+				}
+#endif
+				for (; i < num_lights_32; i++)
+					tile[i] = row[i] & column[i];
+			}
+		}
+	});
+}
+
+bool LightBinner::light_contains_point(unsigned index, const vec3 &pos) const
+{
+	auto &light = volumes[index];
+	vec3 d = pos - light.position;
+	float dist2 = dot(d, d);
+	if (dist2 <= light.radius * light.radius)
+		return true;
+
+	float height2 = dot(light.axis, light.axis);
+	if (height2 <= 0.0f)
+		return false;
+
+	// Distance along the axis in units of the height.
+	float t = dot(d, light.axis) / height2;
+	if (t < 0.0f || t > 1.0f)
+		return false;
+
+	float perp2 = dist2 - t * t * height2;
+	float max_perp = t * light.base_radius;
+	return perp2 <= max_perp * max_perp;
+}
+
+bool LightBinner::light_touches_aabb(unsigned index, const AABB &aabb) const
+{
+	auto &light = volumes[index];
+	vec3 lo = aabb.get_minimum();
+	vec3 hi = aabb.get_maximum();
+
+	float height = length(light.axis);
+	if (height <= 0.0f)
+	{
+		vec3 d = clamp(light.position, lo, hi) - light.position;
+		return dot(d, d) <= light.radius * light.radius;
+	}
+
+	// Compare the extents of the cone's hull with the box along each axis.
+	vec3 axis = light.axis / height;
+	vec3 base = light.position + light.axis;
+	for (unsigned i = 0; i < 3; i++)
+	{
+		float extent = light.base_radius * muglm::sqrt(muglm::max(1.0f - axis[i] * axis[i], 0.0f));
+		float light_lo = muglm::min(light.position[i] - light.radius, base[i] - extent);
+		float light_hi = muglm::max(light.position[i] + light.radius, base[i] + extent);
+		if (light_lo > hi[i] || light_hi < lo[i])
+			return false;
+	}
+
+	return true;
+}
+
+void LightBinner::query_point(const vec3 &pos, std::vector<uint32_t> &indices) const
+{
+	indices.clear();
+
+	vec4 clip = params.transform * vec4(pos, 1.0f);
+	float z = dot(pos - params.camera_position, params.camera_front);
+	int z_index = get_z_slice(z);
+
+	// Outside the clustered volume, every light has to be considered.
+	if (clip.w <= 0.0f || z < 0.0f || z_index >= int(params.resolution_z))
+	{
+		for (unsigned i = 0; i < num_lights; i++)
+			if (light_contains_point(i, pos))
+				indices.push_back(i);
+		return;
+	}
+
+	vec2 uv = clip.xy() / clip.w;
+	if (uv.x < 0.0f || uv.y < 0.0f || uv.x >= 1.0f || uv.y >= 1.0f)
+	{
+		for (unsigned i = 0; i < num_lights; i++)
+			if (light_contains_point(i, pos))
+				indices.push_back(i);
+		return;
+	}
+
+	unsigned x = muglm::min(unsigned(uv.x * float(params.resolution_x)), params.resolution_x - 1);
+	unsigned y = muglm::min(unsigned(uv.y * float(params.resolution_y)), params.resolution_y - 1);
+	uvec2 range = slice_ranges[z_index];
+	if (range.x > range.y)
+		return;
+
+	const uint32_t *tile = tile_bitmask.data() + (y * params.resolution_x + x) * num_lights_32;
+	for (unsigned i = range.x >> 5; i <= range.y >> 5; i++)
+	{
+		uint32_t mask = tile[i];
+		while (mask)
+		{
+			unsigned index = 32 * i + unsigned(Util::trailing_zeroes(mask));
+			mask &= mask - 1;
+			if (index >= range.x && index <= range.y && light_contains_point(index, pos))
+				indices.push_back(index);
+		}
+	}
+}
+
+void LightBinner::query_aabb(const AABB &aabb, std::vector<uint32_t> &indices) const
+{
+	indices.clear();
+
+	vec2 uv_lo(FLT_MAX);
+	vec2 uv_hi(-FLT_MAX);
+	float z_lo = FLT_MAX;
+	float z_hi = -FLT_MAX;
+	bool inside = true;
+
+	for (unsigned i = 0; i < 8 && inside; i++)
+	{
+		vec3 corner = aabb.get_corner(i);
+		vec4 clip = params.transform * vec4(corner, 1.0f);
+		if (clip.w <= 0.0f)
+		{
+			inside = false;
+			break;
+		}
+
+		vec2 uv = clip.xy() / clip.w;
+		uv_lo = min(uv_lo, uv);
+		uv_hi = max(uv_hi, uv);
+		float z = dot(corner - params.camera_position, params.camera_front);
+		z_lo = muglm::min(z_lo, z);
+		z_hi = muglm::max(z_hi, z);
+	}
+
+	// Boxes which leave the clustered volume fall back to testing every light.
+	inside = inside && all(greaterThanEqual(uv_lo, vec2(0.0f))) && all(lessThan(uv_hi, vec2(1.0f))) &&
+	         z_lo >= 0.0f && get_z_slice(z_hi) < int(params.resolution_z);
+
+	if (!inside)
+	{
+		for (unsigned i = 0; i < num_lights; i++)
+			if (light_touches_aabb(i, aabb))
+				indices.push_back(i);
+		return;
+	}
+
+	unsigned x_lo = unsigned(uv_lo.x * float(params.resolution_x));
+	unsigned y_lo = unsigned(uv_lo.y * float(params.resolution_y));
+	unsigned x_hi = muglm::min(unsigned(uv_hi.x * float(params.resolution_x)), params.resolution_x - 1);
+	unsigned y_hi = muglm::min(unsigned(uv_hi.y * float(params.resolution_y)), params.resolution_y - 1);
+	unsigned slice_lo = unsigned(get_z_slice(z_lo));
+	unsigned slice_hi = unsigned(get_z_slice(z_hi));
+
+	std::vector<uint32_t> mask(num_lights_32);
+	for (unsigned y = y_lo; y <= y_hi; y++)
+	{
+		for (unsigned x = x_lo; x <= x_hi; x++)
+		{
+			const uint32_t *tile = tile_bitmask.data() + (y * params.resolution_x + x) * num_lights_32;
+			for (unsigned i = 0; i < num_lights_32; i++)
+				mask[i] |= tile[i];
+		}
+	}
+
+	for (unsigned i = 0; i < num_lights_32; i++)
+	{
+		uint32_t bits = mask[i];
+		while (bits)
+		{
+			unsigned index = 32 * i + unsigned(Util::trailing_zeroes(bits));
+			bits &= bits - 1;
+			auto &range = light_ranges[index];
+			if (range.x <= slice_hi && range.y >= slice_lo && range.x <= range.y && light_touches_aabb(index, aabb))
+				indices.push_back(index);
+		}
+	}
+}
+}
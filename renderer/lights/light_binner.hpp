@@ -0,0 +1,142 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "math.hpp"
+#include "aabb.hpp"
+#include <vector>
+#include <stdint.h>
+
+namespace Granite
+{
+class ThreadGroup;
+
+// Bounding volume of a positional light as seen by the binner.
+// Point lights are spheres, spot lights are cones.
+struct LightBinningVolume
+{
+	// Center of a point light, apex of a spot light.
+	vec3 position;
+	// Sphere radius, 0 for spot lights.
+	float radius;
+	// Cone axis scaled to the cone's height, 0 for point lights.
+	vec3 axis;
+	// Radius of the cone's base, 0 for point lights.
+	float base_radius;
+
+	static LightBinningVolume point(const vec3 &center, float radius);
+	static LightBinningVolume spot(const vec3 &apex, const vec3 &direction, float range, float base_radius);
+
+	// From the bounding pyramid the clusterer keeps in ClustererBindlessTransforms::model.
+	// The cone is inscribed in the pyramid.
+	static LightBinningVolume spot_from_model(const mat4 &model);
+};
+
+struct LightBinnerParameters
+{
+	// Maps world space to cluster UV, with (0, 0) being the top-left corner of the screen.
+	// Same as ClustererParametersBindless::transform.
+	mat4 transform;
+	vec3 camera_position;
+	vec3 camera_front;
+	float z_far = 1.0f;
+	unsigned resolution_x = 64;
+	unsigned resolution_y = 32;
+	unsigned resolution_z = 64;
+};
+
+// CPU implementation of the bindless clusterer's binning.
+// Outputs use the same layout as the GPU buffers, so results can be compared directly:
+// a light index range for every Z slice and a light bitmask for every 2D tile.
+// The CPU tests the light volumes themselves, which the GPU's bounding pyramids and projected
+// sphere bounds enclose, so any light the CPU bins into a cluster is binned there on the GPU as well.
+class LightBinner
+{
+public:
+	void build(const LightBinnerParameters &params, const LightBinningVolume *lights, unsigned count,
+	           ThreadGroup *workers = nullptr);
+
+	const LightBinnerParameters &get_parameters() const
+	{
+		return params;
+	}
+
+	unsigned get_num_lights() const
+	{
+		return num_lights;
+	}
+
+	unsigned get_num_lights_32() const
+	{
+		return num_lights_32;
+	}
+
+	// resolution_z entries of [lo, hi] light indices, (~0u, 0) for empty slices.
+	const uvec2 *get_z_ranges() const
+	{
+		return slice_ranges.data();
+	}
+
+	// resolution_x * resolution_y * num_lights_32 words, tile (x, y) starting at (y * resolution_x + x) * num_lights_32.
+	const uint32_t *get_tile_bitmask() const
+	{
+		return tile_bitmask.data();
+	}
+
+	// Z slices covered by each light, in the same form as LightClusterer::compute_uint_range().
+	const uvec2 *get_light_z_ranges() const
+	{
+		return light_ranges.data();
+	}
+
+	// Lights whose volume contains pos.
+	void query_point(const vec3 &pos, std::vector<uint32_t> &indices) const;
+
+	// Lights which might touch the box. Conservative, intended for coarse queries like audio occlusion regions.
+	void query_aabb(const AABB &aabb, std::vector<uint32_t> &indices) const;
+
+private:
+	LightBinnerParameters params;
+	unsigned num_lights = 0;
+	unsigned num_lights_32 = 0;
+
+	// Light volumes in SoA form, padded to a multiple of 32 with lights which touch nothing.
+	std::vector<float> soa;
+	std::vector<LightBinningVolume> volumes;
+
+	std::vector<vec4> column_planes;
+	std::vector<vec4> row_planes;
+	std::vector<uvec2> light_ranges;
+	std::vector<uvec2> slice_ranges;
+	std::vector<uint32_t> column_bitmask;
+	std::vector<uint32_t> row_bitmask;
+	std::vector<uint32_t> tile_bitmask;
+
+	void build_soa(const LightBinningVolume *lights);
+	void build_z_ranges();
+	void build_axis_bitmask(uint32_t *bitmask, const vec4 *planes, unsigned resolution, unsigned chunk) const;
+	int get_z_slice(float z) const;
+	bool light_touches_aabb(unsigned index, const AABB &aabb) const;
+	bool light_contains_point(unsigned index, const vec3 &pos) const;
+};
+}
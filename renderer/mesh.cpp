@@ -34,7 +34,7 @@ namespace Granite
 Hash StaticMesh::get_instance_key() const
 {
 	Hasher h;
-	h.u64(vbo_position->get_cookie());
+	h.u64(get_position_cookie());
 	h.u32(position_stride);
 	h.u32(topology);
 	h.u32(primitive_restart);
@@ -190,7 +190,7 @@ void skinned_mesh_render(CommandBuffer &cmd, const RenderQueueData *infos, unsig
 }
 }
 
-void StaticMesh::fill_render_info(Vulkan::ResourceManager &resource_manager, StaticMeshInfo &info) const
+void StaticMesh::fill_render_info(const Vulkan::ResourceManager *resource_manager, StaticMeshInfo &info) const
 {
 	info.vbo_attributes = vbo_attributes.get();
 	info.vbo_position = vbo_position.get();
@@ -220,8 +220,8 @@ void StaticMesh::fill_render_info(Vulkan::ResourceManager &resource_manager, Sta
 	memcpy(info.attributes, attributes, sizeof(attributes));
 	for (unsigned i = 0; i < ecast(TextureKind::Count); i++)
 	{
-		info.views[i] = resource_manager.get_image_view(material.textures[i]);
-		VK_ASSERT(!material.textures[i] || info.views[i]);
+		info.views[i] = resource_manager ? resource_manager->get_image_view(material.textures[i]) : nullptr;
+		VK_ASSERT(!resource_manager || !material.textures[i] || info.views[i]);
 	}
 }
 
@@ -230,6 +230,12 @@ void StaticMesh::bake()
 	cached_hash = get_instance_key();
 }
 
+uint64_t StaticMesh::get_position_cookie() const
+{
+	// Meshes which were never uploaded, e.g. in CPU-only benchmarks, are identified by their address instead.
+	return vbo_position ? vbo_position->get_cookie() : uint64_t(reinterpret_cast<uintptr_t>(this));
+}
+
 static Queue material_to_queue(const Material &mat)
 {
 	if (mat.get_info().pipeline == DrawPipeline::AlphaBlend)
@@ -256,7 +262,7 @@ void StaticMesh::get_render_info(const RenderContext &context, const RenderInfoC
 	auto pipe_hash = h.get();
 
 	h.u64(material.get_hash());
-	h.u64(vbo_position->get_cookie());
+	h.u64(get_position_cookie());
 
 	auto instance_key = get_baked_instance_key();
 	auto sorting_key = RenderInfo::get_sort_key(context, type, pipe_hash, h.get(), transform->get_aabb().get_center());
@@ -283,10 +289,11 @@ void StaticMesh::get_render_info(const RenderContext &context, const RenderInfoC
 		if (type == Queue::OpaqueEmissive)
 			textures |= MATERIAL_EMISSIVE_BIT;
 
-		fill_render_info(queue.get_resource_manager(), *mesh_info);
-		mesh_info->program = queue.get_shader_suites()[ecast(RenderableType::Mesh)].get_program(VariantSignatureKey::build(
+		fill_render_info(queue.has_device() ? &queue.get_resource_manager() : nullptr, *mesh_info);
+		auto *suites = queue.get_shader_suites();
+		mesh_info->program = suites ? suites[ecast(RenderableType::Mesh)].get_program(VariantSignatureKey::build(
 				material.get_info().pipeline, attrs,
-				textures, material.shader_variant));
+				textures, material.shader_variant)) : nullptr;
 	}
 }
 
@@ -324,7 +331,7 @@ void SkinnedMesh::get_render_info(const RenderContext &context, const RenderInfo
 	auto pipe_hash = h.get();
 
 	h.u64(material.get_hash());
-	h.u64(vbo_position->get_cookie());
+	h.u64(get_position_cookie());
 
 	auto instance_key = get_baked_instance_key() ^ 1;
 	auto sorting_key = RenderInfo::get_sort_key(context, type, pipe_hash, h.get(), transform->get_aabb().get_center());
@@ -353,11 +360,12 @@ void SkinnedMesh::get_render_info(const RenderContext &context, const RenderInfo
 
 	if (mesh_info)
 	{
-		fill_render_info(queue.get_resource_manager(), *mesh_info);
-		mesh_info->program = queue.get_shader_suites()[ecast(RenderableType::Mesh)].get_program(
+		fill_render_info(queue.has_device() ? &queue.get_resource_manager() : nullptr, *mesh_info);
+		auto *suites = queue.get_shader_suites();
+		mesh_info->program = suites ? suites[ecast(RenderableType::Mesh)].get_program(
 				VariantSignatureKey::build(
 						material.get_info().pipeline, attrs,
-						textures, material.shader_variant));
+						textures, material.shader_variant)) : nullptr;
 	}
 }
 
@@ -182,7 +182,8 @@ struct StaticMesh : AbstractRenderable
 
 protected:
 	void reset();
-	void fill_render_info(Vulkan::ResourceManager &resource_manager, StaticMeshInfo &info) const;
+	void fill_render_info(const Vulkan::ResourceManager *resource_manager, StaticMeshInfo &info) const;
+	uint64_t get_position_cookie() const;
 	Util::Hash cached_hash = 0;
 
 private:
@@ -55,6 +55,8 @@ ImportedSkinnedMesh::ImportedSkinnedMesh(const Mesh &mesh_, const MaterialInfo &
 
 	static_aabb = mesh.static_aabb;
 
+	// Render infos can be pushed before there is a device, uploading bakes again.
+	bake();
 	EVENT_MANAGER_REGISTER_LATCH(ImportedSkinnedMesh, on_device_created, on_device_destroyed, DeviceCreatedEvent);
 }
 
@@ -110,6 +112,8 @@ ImportedMesh::ImportedMesh(const Mesh &mesh_, const MaterialInfo &info)
 
 	static_aabb = mesh.static_aabb;
 
+	// Render infos can be pushed before there is a device, uploading bakes again.
+	bake();
 	EVENT_MANAGER_REGISTER_LATCH(ImportedMesh, on_device_created, on_device_destroyed, DeviceCreatedEvent);
 }
 
@@ -0,0 +1,587 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "occlusion_culler.hpp"
+#include "scene_formats.hpp"
+#include "thread_group.hpp"
+#include <algorithm>
+#include <atomic>
+#include <float.h>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_CULLER_SSE2 1
+#endif
+
+namespace Granite
+{
+// Occluders are set up in chunks of about this many triangles, so a few large meshes still spread over the workers.
+static constexpr unsigned TrianglesPerChunk = 4096;
+
+static void transform_positions(vec4 *clip, const vec4 *positions, size_t count, const mat4 &mvp)
+{
+#ifdef OCCLUSION_CULLER_SSE2
+	__m128 c0 = _mm_loadu_ps(mvp[0].data);
+	__m128 c1 = _mm_loadu_ps(mvp[1].data);
+	__m128 c2 = _mm_loadu_ps(mvp[2].data);
+	__m128 c3 = _mm_loadu_ps(mvp[3].data);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		__m128 p = _mm_loadu_ps(positions[i].data);
+		__m128 x = _mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0));
+		__m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+		__m128 z = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2));
+		__m128 r = _mm_add_ps(_mm_mul_ps(c0, x), _mm_mul_ps(c1, y));
+		r = _mm_add_ps(r, _mm_mul_ps(c2, z));
+		r = _mm_add_ps(r, c3);
+		_mm_storeu_ps(clip[i].data, r);
+	}
+#else
+	for (size_t i = 0; i < count; i++)
+	{
+		auto &p = positions[i];
+		clip[i] = mvp[0] * p.x + mvp[1] * p.y + mvp[2] * p.z + mvp[3];
+	}
+#endif
+}
+
+void OcclusionCuller::begin(const OcclusionCullerParameters &params_)
+{
+	params = params_;
+	tiles_x = std::max((params.width + TileWidth - 1) / TileWidth, 1u);
+	tiles_y = std::max((params.height + TileHeight - 1) / TileHeight, 1u);
+	width = tiles_x * TileWidth;
+	height = tiles_y * TileHeight;
+	blocks_x = width / BlockSize;
+
+	depth.resize(width * height);
+	block_max_depth.resize(blocks_x * (height / BlockSize));
+	occluders.clear();
+	num_triangles = 0;
+	num_rasterized_polygons = 0;
+}
+
+void OcclusionCuller::add_occluder(const SceneFormats::CollisionMesh &mesh, const mat4 &model, bool double_sided)
+{
+	occluders.push_back({ &mesh, params.view_projection * model, double_sided });
+	num_triangles += unsigned(mesh.indices.size() / 3);
+}
+
+// Quads are usually stored as two consecutive triangles sharing an edge. Only pixels entirely inside a polygon
+// are covered, so rasterizing them separately would leave a gap along the diagonal.
+// Merges them into a convex quad with the winding of the first triangle if they are coplanar.
+static bool merge_quad(const SceneFormats::CollisionMesh &mesh, const uint32_t *t0, const uint32_t *t1, uint32_t *quad)
+{
+	for (unsigned i = 0; i < 3; i++)
+	{
+		for (unsigned j = 0; j < 3; j++)
+		{
+			if (t0[i] != t1[(j + 1) % 3] || t0[(i + 1) % 3] != t1[j])
+				continue;
+
+			quad[0] = t0[i];
+			quad[1] = t1[(j + 2) % 3];
+			quad[2] = t0[(i + 1) % 3];
+			quad[3] = t0[(i + 2) % 3];
+
+			vec3 p[4];
+			for (unsigned k = 0; k < 4; k++)
+				p[k] = mesh.positions[quad[k]].xyz();
+
+			vec3 n = cross(p[2] - p[0], p[3] - p[0]);
+			vec3 d = p[1] - p[0];
+			float nd = dot(n, d);
+			if (nd * nd > 1e-10f * dot(n, n) * dot(d, d))
+				return false;
+
+			for (unsigned k = 0; k < 4; k++)
+				if (!(dot(cross(p[(k + 1) % 4] - p[k], p[(k + 2) % 4] - p[(k + 1) % 4]), n) > 0.0f))
+					return false;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void OcclusionCuller::bin_polygon(Chunk &chunk, const vec3 *in, unsigned count, bool double_sided)
+{
+	vec3 v[4];
+	std::copy(in, in + count, v);
+
+	// Front faces are counter-clockwise in the framebuffer like the GPU pipeline's default,
+	// which is a negative area here since Y points down.
+	float area = 0.0f;
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto &p = v[i];
+		auto &q = v[(i + 1) % count];
+		area += (p.x - v[0].x) * (q.y - v[0].y) - (q.x - v[0].x) * (p.y - v[0].y);
+	}
+
+	if (!std::isfinite(area))
+		return;
+
+	if (area < 0.0f)
+	{
+		std::reverse(v + 1, v + count);
+		area = -area;
+	}
+	else if (!double_sided || area == 0.0f)
+		return;
+
+	float min_x = v[0].x, max_x = v[0].x;
+	float min_y = v[0].y, max_y = v[0].y;
+	float min_z = v[0].z;
+	for (unsigned i = 1; i < count; i++)
+	{
+		min_x = std::min(min_x, v[i].x);
+		max_x = std::max(max_x, v[i].x);
+		min_y = std::min(min_y, v[i].y);
+		max_y = std::max(max_y, v[i].y);
+		min_z = std::min(min_z, v[i].z);
+	}
+
+	// Occluders are rasterized inner-conservatively, so only pixels entirely inside the bounding box.
+	// Clamp in floating point first, coordinates of clipped triangles can be far outside the screen.
+	Polygon poly;
+	poly.min_x = int(std::ceil(std::max(min_x, 0.0f)));
+	poly.max_x = int(std::floor(std::min(max_x, float(width)))) - 1;
+	poly.min_y = int(std::ceil(std::max(min_y, 0.0f)));
+	poly.max_y = int(std::floor(std::min(max_y, float(height)))) - 1;
+	if (poly.min_x > poly.max_x || poly.min_y > poly.max_y)
+		return;
+
+	for (unsigned i = 0; i < 4; i++)
+	{
+		// Triangles repeat their last edge.
+		auto &p = v[std::min(i, count - 1)];
+		auto &q = v[(std::min(i, count - 1) + 1) % count];
+		poly.edge_a[i] = p.y - q.y;
+		poly.edge_b[i] = q.x - p.x;
+		// Evaluated at the pixel center, this is the smallest value of the edge function anywhere in the pixel.
+		// A pixel passes all edges only if the polygon covers it entirely.
+		poly.edge_c[i] = -(poly.edge_a[i] * p.x + poly.edge_b[i] * p.y) -
+		                 0.5f * (std::abs(poly.edge_a[i]) + std::abs(poly.edge_b[i]));
+	}
+
+	// Depth from the largest triangle of the fan, the polygon is planar.
+	auto &a = v[0];
+	unsigned best = 1;
+	float best_area = 0.0f;
+	for (unsigned i = 1; i + 1 < count; i++)
+	{
+		float tri_area = (v[i].x - a.x) * (v[i + 1].y - a.y) - (v[i + 1].x - a.x) * (v[i].y - a.y);
+		if (tri_area > best_area)
+		{
+			best = i;
+			best_area = tri_area;
+		}
+	}
+
+	if (!(best_area > 0.0f))
+		return;
+
+	auto &b = v[best];
+	auto &c = v[best + 1];
+	float inv_area = 1.0f / best_area;
+	float dzdx = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) * inv_area;
+	float dzdy = ((b.x - a.x) * (c.z - a.z) - (c.x - a.x) * (b.z - a.z)) * inv_area;
+	poly.z_a = dzdx;
+	poly.z_b = dzdy;
+	// Likewise, the farthest depth of the plane within the pixel rather than the depth at its center.
+	poly.z_c = a.z - dzdx * a.x - dzdy * a.y + 0.5f * (std::abs(dzdx) + std::abs(dzdy));
+	// The plane equation loses precision for long, thin triangles. Never let it pull depth closer than the polygon.
+	poly.min_z = min_z;
+
+	auto index = uint32_t(chunk.polygons.size());
+	chunk.polygons.push_back(poly);
+
+	unsigned tile_x0 = unsigned(poly.min_x) / TileWidth;
+	unsigned tile_x1 = unsigned(poly.max_x) / TileWidth;
+	unsigned tile_y0 = unsigned(poly.min_y) / TileHeight;
+	unsigned tile_y1 = unsigned(poly.max_y) / TileHeight;
+	for (unsigned y = tile_y0; y <= tile_y1; y++)
+		for (unsigned x = tile_x0; x <= tile_x1; x++)
+			chunk.bins[y * tiles_x + x].push_back(index);
+}
+
+void OcclusionCuller::setup_polygon(Chunk &chunk, const vec4 *const *in, unsigned count, bool double_sided)
+{
+	// Entirely outside one of the frustum planes.
+	unsigned outside = 0x3f;
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto &p = *in[i];
+		unsigned mask = 0;
+		if (p.x > p.w)
+			mask |= 1;
+		if (p.x < -p.w)
+			mask |= 2;
+		if (p.y > p.w)
+			mask |= 4;
+		if (p.y < -p.w)
+			mask |= 8;
+		if (p.z > p.w)
+			mask |= 16;
+		if (p.z < 0.0f)
+			mask |= 32;
+		outside &= mask;
+	}
+
+	if (outside)
+		return;
+
+	// The other planes are handled by clamping to the screen, only the near plane needs clipping.
+	vec4 out[5];
+	unsigned clipped_count = 0;
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto &p = *in[i];
+		auto &q = *in[(i + 1) % count];
+		if (p.z >= 0.0f)
+			out[clipped_count++] = p;
+		if ((p.z >= 0.0f) != (q.z >= 0.0f))
+			out[clipped_count++] = mix(p, q, p.z / (p.z - q.z));
+	}
+
+	if (clipped_count < 3)
+		return;
+
+	vec3 screen[5];
+	for (unsigned i = 0; i < clipped_count; i++)
+	{
+		if (!(out[i].w > 0.0f))
+			return;
+		float inv_w = 1.0f / out[i].w;
+		screen[i] = vec3((out[i].x * inv_w * 0.5f + 0.5f) * float(width),
+		                 (out[i].y * inv_w * 0.5f + 0.5f) * float(height),
+		                 out[i].z * inv_w);
+	}
+
+	// A quad clipped by the near plane can become a pentagon.
+	bin_polygon(chunk, screen, std::min(clipped_count, 4u), double_sided);
+	if (clipped_count == 5)
+	{
+		const vec3 rest[3] = { screen[0], screen[3], screen[4] };
+		bin_polygon(chunk, rest, 3, double_sided);
+	}
+}
+
+void OcclusionCuller::setup_chunk(Chunk &chunk)
+{
+	chunk.polygons.clear();
+	chunk.polygon_mesh = nullptr;
+	chunk.bins.resize(tiles_x * tiles_y);
+	for (auto &bin : chunk.bins)
+		bin.clear();
+
+	for (unsigned i = chunk.begin; i < chunk.end; i++)
+	{
+		auto &occluder = occluders[i];
+		auto &mesh = *occluder.mesh;
+		chunk.clip.resize(mesh.positions.size());
+		transform_positions(chunk.clip.data(), mesh.positions.data(), mesh.positions.size(), occluder.mvp);
+
+		// Occluders often share a mesh, so only look for quads again when it changes.
+		if (chunk.polygon_mesh != &mesh)
+		{
+			chunk.polygon_mesh = &mesh;
+			chunk.polygon_indices.clear();
+			chunk.polygon_counts.clear();
+
+			size_t count = mesh.indices.size() / 3;
+			for (size_t tri = 0; tri < count; tri++)
+			{
+				const uint32_t *indices = &mesh.indices[3 * tri];
+				uint32_t quad[4];
+				if (tri + 1 < count && merge_quad(mesh, indices, indices + 3, quad))
+				{
+					chunk.polygon_indices.insert(chunk.polygon_indices.end(), quad, quad + 4);
+					chunk.polygon_counts.push_back(4);
+					tri++;
+				}
+				else
+				{
+					chunk.polygon_indices.insert(chunk.polygon_indices.end(), indices, indices + 3);
+					chunk.polygon_counts.push_back(3);
+				}
+			}
+		}
+
+		const uint32_t *indices = chunk.polygon_indices.data();
+		for (auto count : chunk.polygon_counts)
+		{
+			const vec4 *v[4];
+			for (unsigned j = 0; j < count; j++)
+				v[j] = &chunk.clip[indices[j]];
+			setup_polygon(chunk, v, count, occluder.double_sided);
+			indices += count;
+		}
+	}
+}
+
+void OcclusionCuller::rasterize_polygon(const Polygon &poly, int x0, int y0, int x1, int y1)
+{
+	// Groups of 4 pixels. Tiles are a multiple of 4 wide, so the last group never leaves the tile.
+	x0 &= ~3;
+
+	for (int y = y0; y <= y1; y++)
+	{
+		float fy = float(y) + 0.5f;
+		float *row = depth.data() + y * width;
+
+#ifdef OCCLUSION_CULLER_SSE2
+		const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		const __m128 zero = _mm_setzero_ps();
+		__m128 a0 = _mm_set1_ps(poly.edge_a[0]);
+		__m128 a1 = _mm_set1_ps(poly.edge_a[1]);
+		__m128 a2 = _mm_set1_ps(poly.edge_a[2]);
+		__m128 a3 = _mm_set1_ps(poly.edge_a[3]);
+		__m128 row_e0 = _mm_set1_ps(poly.edge_b[0] * fy + poly.edge_c[0]);
+		__m128 row_e1 = _mm_set1_ps(poly.edge_b[1] * fy + poly.edge_c[1]);
+		__m128 row_e2 = _mm_set1_ps(poly.edge_b[2] * fy + poly.edge_c[2]);
+		__m128 row_e3 = _mm_set1_ps(poly.edge_b[3] * fy + poly.edge_c[3]);
+		__m128 za = _mm_set1_ps(poly.z_a);
+		__m128 row_z = _mm_set1_ps(poly.z_b * fy + poly.z_c);
+		__m128 min_z = _mm_set1_ps(poly.min_z);
+
+		for (int x = x0; x <= x1; x += 4)
+		{
+			__m128 fx = _mm_add_ps(_mm_set1_ps(float(x)), offsets);
+			__m128 e0 = _mm_add_ps(_mm_mul_ps(a0, fx), row_e0);
+			__m128 e1 = _mm_add_ps(_mm_mul_ps(a1, fx), row_e1);
+			__m128 e2 = _mm_add_ps(_mm_mul_ps(a2, fx), row_e2);
+			__m128 e3 = _mm_add_ps(_mm_mul_ps(a3, fx), row_e3);
+			__m128 outside = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(e0, zero), _mm_cmplt_ps(e1, zero)),
+			                           _mm_or_ps(_mm_cmplt_ps(e2, zero), _mm_cmplt_ps(e3, zero)));
+			if (_mm_movemask_ps(outside) == 0xf)
+				continue;
+
+			__m128 z = _mm_max_ps(_mm_add_ps(_mm_mul_ps(za, fx), row_z), min_z);
+			__m128 old = _mm_loadu_ps(row + x);
+			__m128 nearest = _mm_min_ps(old, z);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(outside, old), _mm_andnot_ps(outside, nearest)));
+		}
+#else
+		float row_e0 = poly.edge_b[0] * fy + poly.edge_c[0];
+		float row_e1 = poly.edge_b[1] * fy + poly.edge_c[1];
+		float row_e2 = poly.edge_b[2] * fy + poly.edge_c[2];
+		float row_e3 = poly.edge_b[3] * fy + poly.edge_c[3];
+		float row_z = poly.z_b * fy + poly.z_c;
+
+		for (int x = x0; x <= x1; x++)
+		{
+			float fx = float(x) + 0.5f;
+			if (poly.edge_a[0] * fx + row_e0 < 0.0f ||
+			    poly.edge_a[1] * fx + row_e1 < 0.0f ||
+			    poly.edge_a[2] * fx + row_e2 < 0.0f ||
+			    poly.edge_a[3] * fx + row_e3 < 0.0f)
+			{
+				continue;
+			}
+
+			// Same operand order as the SSE min and max, so NaNs resolve the same way.
+			float z = poly.z_a * fx + row_z;
+			z = z > poly.min_z ? z : poly.min_z;
+			row[x] = row[x] < z ? row[x] : z;
+		}
+#endif
+	}
+}
+
+void OcclusionCuller::rasterize_tile(unsigned tile_x, unsigned tile_y)
+{
+	int x_begin = int(tile_x * TileWidth);
+	int y_begin = int(tile_y * TileHeight);
+	int x_end = x_begin + TileWidth - 1;
+	int y_end = y_begin + TileHeight - 1;
+
+	for (int y = y_begin; y <= y_end; y++)
+		std::fill(depth.data() + y * width + x_begin, depth.data() + y * width + x_begin + TileWidth, FLT_MAX);
+
+	unsigned tile = tile_y * tiles_x + tile_x;
+	for (unsigned i = 0; i < num_chunks; i++)
+	{
+		auto &chunk = chunks[i];
+		for (auto index : chunk.bins[tile])
+		{
+			auto &poly = chunk.polygons[index];
+			rasterize_polygon(poly, std::max(poly.min_x, x_begin), std::max(poly.min_y, y_begin),
+			                  std::min(poly.max_x, x_end), std::min(poly.max_y, y_end));
+		}
+	}
+
+	for (int block_y = y_begin; block_y <= y_end; block_y += BlockSize)
+	{
+		for (int block_x = x_begin; block_x <= x_end; block_x += BlockSize)
+		{
+			const float *block = depth.data() + block_y * width + block_x;
+#ifdef OCCLUSION_CULLER_SSE2
+			__m128 m = _mm_max_ps(_mm_loadu_ps(block), _mm_loadu_ps(block + 4));
+			for (unsigned y = 1; y < BlockSize; y++)
+			{
+				m = _mm_max_ps(m, _mm_loadu_ps(block + y * width));
+				m = _mm_max_ps(m, _mm_loadu_ps(block + y * width + 4));
+			}
+			m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+			m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+			float max_depth = _mm_cvtss_f32(m);
+#else
+			float max_depth = -FLT_MAX;
+			for (unsigned y = 0; y < BlockSize; y++)
+				for (unsigned x = 0; x < BlockSize; x++)
+					max_depth = std::max(max_depth, block[y * width + x]);
+#endif
+			block_max_depth[(block_y / BlockSize) * blocks_x + block_x / BlockSize] = max_depth;
+		}
+	}
+}
+
+void OcclusionCuller::rasterize(ThreadGroup *workers)
+{
+	// Occluders are never split between chunks, a huge mesh just gets a chunk of its own.
+	num_chunks = 0;
+	unsigned chunk_triangles = 0;
+	for (unsigned i = 0; i < unsigned(occluders.size()); i++)
+	{
+		if (chunk_triangles == 0)
+		{
+			if (chunks.size() <= num_chunks)
+				chunks.emplace_back();
+			chunks[num_chunks++].begin = i;
+		}
+
+		chunks[num_chunks - 1].end = i + 1;
+		chunk_triangles += unsigned(occluders[i].mesh->indices.size() / 3);
+		if (chunk_triangles >= TrianglesPerChunk)
+			chunk_triangles = 0;
+	}
+
+	parallel_for_range(workers, 0, num_chunks, 1, "occlusion-setup", [this](size_t, size_t begin, size_t end) {
+		for (unsigned i = begin; i < end; i++)
+			setup_chunk(chunks[i]);
+	});
+
+	num_rasterized_polygons = 0;
+	for (unsigned i = 0; i < num_chunks; i++)
+		num_rasterized_polygons += unsigned(chunks[i].polygons.size());
+
+	parallel_for_range(workers, 0, tiles_x * tiles_y, 2, "occlusion-raster", [this](size_t, size_t begin, size_t end) {
+		for (unsigned i = begin; i < end; i++)
+			rasterize_tile(i % tiles_x, i / tiles_x);
+	});
+}
+
+bool OcclusionCuller::test_aabb(const AABB &aabb) const
+{
+	auto &mvp = params.view_projection;
+	vec3 lo = aabb.get_minimum();
+	vec3 extent = aabb.get_maximum() - lo;
+
+	// Corners are the minimum corner plus any combination of the three edges.
+	vec4 base = mvp[0] * lo.x + mvp[1] * lo.y + mvp[2] * lo.z + mvp[3];
+	vec4 dx = mvp[0] * extent.x;
+	vec4 dy = mvp[1] * extent.y;
+	vec4 dz = mvp[2] * extent.z;
+
+	float min_x = FLT_MAX, max_x = -FLT_MAX;
+	float min_y = FLT_MAX, max_y = -FLT_MAX;
+	float min_z = FLT_MAX;
+
+	for (unsigned i = 0; i < 8; i++)
+	{
+		vec4 clip = base;
+		if (i & 1)
+			clip += dx;
+		if (i & 2)
+			clip += dy;
+		if (i & 4)
+			clip += dz;
+
+		// The box crosses the near plane, so the camera might be inside it.
+		if (clip.z < 0.0f || !(clip.w > 0.0f))
+			return true;
+
+		float inv_w = 1.0f / clip.w;
+		float x = clip.x * inv_w;
+		float y = clip.y * inv_w;
+		min_x = std::min(min_x, x);
+		max_x = std::max(max_x, x);
+		min_y = std::min(min_y, y);
+		max_y = std::max(max_y, y);
+		min_z = std::min(min_z, clip.z * inv_w);
+	}
+
+	// Every pixel the projected box touches, not only those whose centers it covers.
+	int x0 = int(std::floor(std::max((min_x * 0.5f + 0.5f) * float(width), 0.0f)));
+	int x1 = int(std::floor(std::min((max_x * 0.5f + 0.5f) * float(width), float(width - 1))));
+	int y0 = int(std::floor(std::max((min_y * 0.5f + 0.5f) * float(height), 0.0f)));
+	int y1 = int(std::floor(std::min((max_y * 0.5f + 0.5f) * float(height), float(height - 1))));
+
+	// Off screen, nothing to test against.
+	if (x0 > x1 || y0 > y1)
+		return true;
+
+	for (int block_y = y0 / BlockSize; block_y <= y1 / BlockSize; block_y++)
+	{
+		for (int block_x = x0 / BlockSize; block_x <= x1 / BlockSize; block_x++)
+		{
+			// The whole block has occluders in front of the box.
+			if (block_max_depth[block_y * blocks_x + block_x] < min_z)
+				continue;
+
+			int px0 = std::max(x0, block_x * BlockSize);
+			int px1 = std::min(x1, block_x * BlockSize + BlockSize - 1);
+			int py0 = std::max(y0, block_y * BlockSize);
+			int py1 = std::min(y1, block_y * BlockSize + BlockSize - 1);
+
+			for (int y = py0; y <= py1; y++)
+			{
+				const float *row = depth.data() + y * width;
+#ifdef OCCLUSION_CULLER_SSE2
+				__m128 z = _mm_set1_ps(min_z);
+				__m128i lo_x = _mm_set1_epi32(px0);
+				__m128i hi_x = _mm_set1_epi32(px1);
+				for (int x = block_x * BlockSize; x < (block_x + 1) * BlockSize; x += 4)
+				{
+					__m128i index = _mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3));
+					__m128i outside = _mm_or_si128(_mm_cmplt_epi32(index, lo_x), _mm_cmpgt_epi32(index, hi_x));
+					__m128 visible = _mm_andnot_ps(_mm_castsi128_ps(outside), _mm_cmpge_ps(_mm_loadu_ps(row + x), z));
+					if (_mm_movemask_ps(visible))
+						return true;
+				}
+#else
+				for (int x = px0; x <= px1; x++)
+					if (row[x] >= min_z)
+						return true;
+#endif
+			}
+		}
+	}
+
+	return false;
+}
+}
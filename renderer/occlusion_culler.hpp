@@ -0,0 +1,158 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "math.hpp"
+#include "aabb.hpp"
+#include <vector>
+#include <stdint.h>
+
+namespace Granite
+{
+class ThreadGroup;
+
+namespace SceneFormats
+{
+struct CollisionMesh;
+}
+
+struct OcclusionCullerParameters
+{
+	// Usually RenderContext::get_render_parameters().view_projection.
+	mat4 view_projection;
+	// Resolution of the depth buffer, rounded up to whole tiles.
+	unsigned width = 256;
+	unsigned height = 128;
+};
+
+// CPU occlusion culling against a low resolution depth buffer.
+// Occluders are simplified meshes, e.g. SceneFormats::CollisionMesh. Their triangles are binned into
+// screen tiles and the tiles are rasterized in parallel, keeping the farthest depth of every 8x8 block on the side,
+// so most boxes can be rejected or accepted without looking at individual pixels.
+// Depth follows the projection, 0 at the near plane and 1 at the far plane.
+// Culling is conservative. Occluders only cover pixels which are entirely inside a triangle, at the farthest depth
+// of the triangle within the pixel, and boxes are tested against every pixel they touch.
+// Thin occluders and the seams between triangles of one occluder therefore leave gaps, which only costs culling.
+class OcclusionCuller
+{
+public:
+	enum { TileWidth = 32, TileHeight = 16, BlockSize = 8 };
+
+	void begin(const OcclusionCullerParameters &params);
+
+	// The mesh is referenced until rasterize() returns.
+	// Back faces are culled unless double_sided is set, which is only needed for meshes which are not closed.
+	void add_occluder(const SceneFormats::CollisionMesh &mesh, const mat4 &model, bool double_sided = false);
+
+	void rasterize(ThreadGroup *workers = nullptr);
+
+	// False if the box is hidden behind the occluders. Boxes which cross the near plane are always visible.
+	// Safe to call from multiple threads once rasterize() has returned.
+	bool test_aabb(const AABB &aabb) const;
+
+	unsigned get_width() const
+	{
+		return width;
+	}
+
+	unsigned get_height() const
+	{
+		return height;
+	}
+
+	// width * height floats, row by row. Pixels without occluders are FLT_MAX.
+	const float *get_depth() const
+	{
+		return depth.data();
+	}
+
+	unsigned get_num_occluders() const
+	{
+		return unsigned(occluders.size());
+	}
+
+	unsigned get_num_triangles() const
+	{
+		return num_triangles;
+	}
+
+	// Triangles and quads which survived clipping and culling.
+	// Pairs of coplanar triangles forming a convex quad are merged, and the near plane splits some of them.
+	unsigned get_num_rasterized_polygons() const
+	{
+		return num_rasterized_polygons;
+	}
+
+private:
+	struct Occluder
+	{
+		const SceneFormats::CollisionMesh *mesh;
+		mat4 mvp;
+		bool double_sided;
+	};
+
+	// Edge functions are A * x + B * y + C with the inside being >= 0, and the same for depth.
+	// Triangles or convex quads, triangles repeat their last edge.
+	struct Polygon
+	{
+		float edge_a[4], edge_b[4], edge_c[4];
+		float z_a, z_b, z_c;
+		float min_z;
+		int min_x, min_y, max_x, max_y;
+	};
+
+	// A range of occluders which are set up by one task, with their own polygon bins for every tile.
+	struct Chunk
+	{
+		unsigned begin, end;
+		std::vector<vec4> clip;
+		// Vertex indices of the polygons of polygon_mesh, with a count of 3 or 4 for each.
+		const SceneFormats::CollisionMesh *polygon_mesh;
+		std::vector<uint32_t> polygon_indices;
+		std::vector<uint8_t> polygon_counts;
+		std::vector<Polygon> polygons;
+		std::vector<std::vector<uint32_t>> bins;
+	};
+
+	OcclusionCullerParameters params;
+	unsigned width = 0;
+	unsigned height = 0;
+	unsigned tiles_x = 0;
+	unsigned tiles_y = 0;
+	unsigned blocks_x = 0;
+	unsigned num_triangles = 0;
+	unsigned num_rasterized_polygons = 0;
+
+	std::vector<Occluder> occluders;
+	std::vector<Chunk> chunks;
+	unsigned num_chunks = 0;
+	std::vector<float> depth;
+	std::vector<float> block_max_depth;
+
+	void setup_chunk(Chunk &chunk);
+	void setup_polygon(Chunk &chunk, const vec4 *const *vertices, unsigned count, bool double_sided);
+	void bin_polygon(Chunk &chunk, const vec3 *vertices, unsigned count, bool double_sided);
+	void rasterize_polygon(const Polygon &poly, int x0, int y0, int x1, int y1);
+	void rasterize_tile(unsigned tile_x, unsigned tile_y);
+};
+}
@@ -34,6 +34,7 @@
 #include "lights/lights.hpp"
 #include "lights/volumetric_fog_region.hpp"
 #include "lights/decal_volume.hpp"
+#include <memory>
 
 namespace Granite
 {
@@ -48,6 +49,11 @@ class PositionalLight;
 class Skybox;
 class TaskComposer;
 
+namespace SceneFormats
+{
+struct CollisionMesh;
+}
+
 struct BoundedComponent : ComponentBase
 {
 	GRANITE_COMPONENT_TYPE_DECL(BoundedComponent)
@@ -276,4 +282,12 @@ struct CastsDynamicShadowComponent : ComponentBase
 	GRANITE_COMPONENT_TYPE_DECL(CastsDynamicShadowComponent)
 };
 
+// Simplified geometry which the CPU occlusion culler rasterizes, see Scene::gather_occluders().
+struct OccluderComponent : ComponentBase
+{
+	GRANITE_COMPONENT_TYPE_DECL(OccluderComponent)
+	std::shared_ptr<const SceneFormats::CollisionMesh> mesh;
+	bool double_sided = false;
+};
+
 }
\ No newline at end of file
@@ -3033,9 +3033,11 @@ void RenderGraph::bake()
 	// Also build virtual "transfer" barriers. These things only copy events over to other physical resources.
 	build_aliases();
 
-	for (auto &physical_pass : physical_passes)
-		for (auto pass : physical_pass.passes)
-			passes[pass]->setup(*device);
+	// Baking without a device is allowed for CPU-only benchmarking, but passes are not set up then.
+	if (device)
+		for (auto &physical_pass : physical_passes)
+			for (auto pass : physical_pass.passes)
+				passes[pass]->setup(*device);
 }
 
 ResourceDimensions RenderGraph::get_resource_dimensions(const RenderBufferResource &resource) const
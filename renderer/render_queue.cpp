@@ -187,6 +187,19 @@ void *RenderQueue::allocate(size_t size, size_t alignment)
 	return data;
 }
 
+bool RenderQueue::try_grow(void *data, size_t size, size_t new_size)
+{
+	if (!current)
+		return false;
+
+	auto ptr = reinterpret_cast<uintptr_t>(data);
+	if (ptr + size != current->ptr || ptr + new_size > current->end)
+		return false;
+
+	current->ptr = ptr + new_size;
+	return true;
+}
+
 void RenderQueue::push_renderables(const RenderContext &context, const RenderableInfo *visible, size_t count)
 {
 	for (size_t i = 0; i < count; i++)
@@ -196,6 +196,9 @@ public:
 
 	void *allocate(size_t size, size_t alignment = 64);
 
+	// Grows the most recent allocation in place. Fails if anything was allocated after it or the block is full.
+	bool try_grow(void *data, size_t size, size_t new_size);
+
 	template <typename T>
 	T *allocate_one()
 	{
@@ -257,6 +260,13 @@ public:
 
 	void set_device(Vulkan::Device *device);
 
+	// False until set_device(), e.g. when only the CPU side of a frame is benchmarked.
+	// Renderables which support it then push render infos without GPU resources or programs.
+	bool has_device() const
+	{
+		return resource_manager != nullptr;
+	}
+
 	Vulkan::ResourceManager &get_resource_manager()
 	{
 		VK_ASSERT(resource_manager);
@@ -25,6 +25,7 @@
 #include "lights/lights.hpp"
 #include "simd.hpp"
 #include "task_composer.hpp"
+#include "occlusion_culler.hpp"
 #include <limits>
 
 namespace Granite
@@ -42,6 +43,7 @@ Scene::Scene()
 	  opaque_floating(pool.get_component_group<OpaqueFloatingComponent, RenderableComponent>()),
 	  cameras(pool.get_component_group<CameraComponent, CachedTransformComponent>()),
 	  directional_lights(pool.get_component_group<DirectionalLightComponent, CachedTransformComponent>()),
+	  occluders(pool.get_component_group<OccluderComponent, CachedTransformComponent>()),
 	  volumetric_diffuse_lights(pool.get_component_group<VolumetricDiffuseLightComponent, CachedSpatialTransformTimestampComponent, RenderInfoComponent>()),
 	  volumetric_fog_regions(pool.get_component_group<VolumetricFogRegionComponent, CachedSpatialTransformTimestampComponent, RenderInfoComponent>()),
 	  volumetric_decals(pool.get_component_group<VolumetricDecalComponent, CachedSpatialTransformTimestampComponent, RenderInfoComponent>()),
@@ -67,7 +69,8 @@ Scene::~Scene()
 
 template <typename T, typename Func>
 static void gather_visible_renderables(const Frustum &frustum, VisibilityList &list, const T &objects,
-                                       size_t begin_index, size_t end_index, const Func &filter_func)
+                                       size_t begin_index, size_t end_index, const Func &filter_func,
+                                       const OcclusionCuller *culler = nullptr)
 {
 	for (size_t i = begin_index; i < end_index; i++)
 	{
@@ -88,7 +91,8 @@ static void gather_visible_renderables(const Frustum &frustum, VisibilityList &l
 		if (transform->has_scene_node())
 		{
 			if ((flags & RENDERABLE_FORCE_VISIBLE_BIT) != 0 ||
-			    SIMD::frustum_cull(transform->get_aabb(), frustum.get_planes()))
+			    (SIMD::frustum_cull(transform->get_aabb(), frustum.get_planes()) &&
+			     (!culler || culler->test_aabb(transform->get_aabb()))))
 			{
 				list.push_back({ renderable->renderable.get(), transform, h.get() });
 			}
@@ -480,6 +484,44 @@ void Scene::gather_visible_positional_lights_subset(const Frustum &frustum, Posi
 	gather_positional_lights(frustum, list, positional_lights, start_index, end_index);
 }
 
+void Scene::gather_occluders(OcclusionCuller &culler) const
+{
+	for (auto &occluder : occluders)
+	{
+		auto *info = get_component<OccluderComponent>(occluder);
+		auto *transform = get_component<CachedTransformComponent>(occluder);
+		culler.add_occluder(*info->mesh, *transform->transform, info->double_sided);
+	}
+}
+
+void Scene::gather_visible_opaque_renderables(const Frustum &frustum, const OcclusionCuller &culler,
+                                              VisibilityList &list) const
+{
+	gather_visible_renderables(frustum, list, opaque, 0, opaque.size(), filter_true, &culler);
+}
+
+void Scene::gather_visible_transparent_renderables(const Frustum &frustum, const OcclusionCuller &culler,
+                                                   VisibilityList &list) const
+{
+	gather_visible_renderables(frustum, list, transparent, 0, transparent.size(), filter_true, &culler);
+}
+
+void Scene::gather_visible_opaque_renderables_subset(const Frustum &frustum, const OcclusionCuller &culler,
+                                                     VisibilityList &list, unsigned index, unsigned num_indices) const
+{
+	size_t start_index = (index * opaque.size()) / num_indices;
+	size_t end_index = ((index + 1) * opaque.size()) / num_indices;
+	gather_visible_renderables(frustum, list, opaque, start_index, end_index, filter_true, &culler);
+}
+
+void Scene::gather_visible_transparent_renderables_subset(const Frustum &frustum, const OcclusionCuller &culler,
+                                                          VisibilityList &list, unsigned index, unsigned num_indices) const
+{
+	size_t start_index = (index * transparent.size()) / num_indices;
+	size_t end_index = ((index + 1) * transparent.size()) / num_indices;
+	gather_visible_renderables(frustum, list, transparent, start_index, end_index, filter_true, &culler);
+}
+
 size_t Scene::get_opaque_renderables_count() const
 {
 	return opaque.size();
@@ -1054,6 +1096,21 @@ Entity *Scene::create_volumetric_decal(Node *node)
 	return entity;
 }
 
+Entity *Scene::create_occluder(std::shared_ptr<const SceneFormats::CollisionMesh> mesh, Node *node,
+                               bool double_sided)
+{
+	Entity *entity = pool.create_entity();
+	entities.insert_front(entity);
+
+	auto *occluder = entity->allocate_component<OccluderComponent>();
+	occluder->mesh = std::move(mesh);
+	occluder->double_sided = double_sided;
+	auto *transform = entity->allocate_component<CachedTransformComponent>();
+	transform->transform = &node->get_cached_transform();
+
+	return entity;
+}
+
 Entity *Scene::create_light(const SceneFormats::LightInfo &light, Node *node)
 {
 	Entity *entity = pool.create_entity();
@@ -38,6 +38,7 @@ class RenderContext;
 struct EnvironmentComponent;
 class Node;
 class Scene;
+class OcclusionCuller;
 
 struct TransformBackingAllocator final : Util::SliceBackingAllocator
 {
@@ -155,6 +156,19 @@ public:
 	void gather_visible_positional_lights_subset(const Frustum &frustum, PositionalLightList &list,
 	                                             unsigned index, unsigned num_indices) const;
 
+	// Adds all occluders to the culler, which must have been begun with the camera's parameters.
+	void gather_occluders(OcclusionCuller &culler) const;
+
+	// Like the frustum-only variants, but renderables hidden behind the rasterized occluders are skipped as well.
+	void gather_visible_opaque_renderables(const Frustum &frustum, const OcclusionCuller &culler,
+	                                       VisibilityList &list) const;
+	void gather_visible_transparent_renderables(const Frustum &frustum, const OcclusionCuller &culler,
+	                                            VisibilityList &list) const;
+	void gather_visible_opaque_renderables_subset(const Frustum &frustum, const OcclusionCuller &culler,
+	                                              VisibilityList &list, unsigned index, unsigned num_indices) const;
+	void gather_visible_transparent_renderables_subset(const Frustum &frustum, const OcclusionCuller &culler,
+	                                                   VisibilityList &list, unsigned index, unsigned num_indices) const;
+
 	size_t get_opaque_renderables_count() const;
 	size_t get_motion_vector_renderables_count() const;
 	size_t get_transparent_renderables_count() const;
@@ -198,6 +212,8 @@ public:
 	Entity *create_volumetric_diffuse_light(uvec3 resolution, Node *node);
 	Entity *create_volumetric_fog_region(Node *node);
 	Entity *create_volumetric_decal(Node *node);
+	Entity *create_occluder(std::shared_ptr<const SceneFormats::CollisionMesh> mesh, Node *node,
+	                        bool double_sided = false);
 	Entity *create_entity();
 	void destroy_entity(Entity *entity);
 	void queue_destroy_entity(Entity *entity);
@@ -279,6 +295,9 @@ private:
 	const ComponentGroupVector<
 			DirectionalLightComponent,
 			CachedTransformComponent> &directional_lights;
+	const ComponentGroupVector<
+			OccluderComponent,
+			CachedTransformComponent> &occluders;
 	const ComponentGroupVector<
 			VolumetricDiffuseLightComponent,
 			CachedSpatialTransformTimestampComponent,
@@ -28,6 +28,7 @@
 #include "enum_cast.hpp"
 #include "ground.hpp"
 #include "path_utils.hpp"
+#include "thread_group.hpp"
 
 using namespace rapidjson;
 using namespace Util;
@@ -51,6 +52,37 @@ AnimationSystem &SceneLoader::get_animation_system()
 	return *animation_system;
 }
 
+void SceneLoader::set_occluder_triangle_limit(unsigned limit)
+{
+	occluder_triangle_limit = limit;
+}
+
+void SceneLoader::create_occluder_meshes(SubsceneData &subscene) const
+{
+	subscene.occluders.clear();
+	if (!occluder_triangle_limit)
+		return;
+
+	auto &meshes = subscene.parser->get_meshes();
+	subscene.occluders.resize(meshes.size());
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		// Anything which can be seen through or deforms cannot hide what is behind it.
+		auto &renderable = subscene.meshes[i];
+		if (!renderable->has_static_aabb() || renderable->get_mesh_draw_pipeline() != DrawPipeline::Opaque)
+			continue;
+
+		auto &mesh = meshes[i];
+		bool skinned = mesh.attribute_layout[ecast(MeshAttribute::BoneIndex)].format != VK_FORMAT_UNDEFINED;
+		if (skinned || mesh.count / 3 > occluder_triangle_limit)
+			continue;
+
+		auto collision_mesh = std::make_shared<SceneFormats::CollisionMesh>();
+		if (SceneFormats::extract_collision_mesh(*collision_mesh, mesh))
+			subscene.occluders[i] = std::move(collision_mesh);
+	}
+}
+
 NodeHandle SceneLoader::load_scene_to_root_node(const std::string &path)
 {
 	auto ext = Path::ext(path);
@@ -140,7 +172,11 @@ NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subscene)
 					nodes[i]->add_child(nodes[child]);
 
 			for (auto &mesh : node.meshes)
+			{
 				scene->create_renderable(subscene.meshes[mesh], nodes[i].get());
+				if (mesh < subscene.occluders.size() && subscene.occluders[mesh])
+					scene->create_occluder(subscene.occluders[mesh], nodes[i].get());
+			}
 		}
 		i++;
 	}
@@ -266,10 +302,11 @@ void SceneLoader::load_animation(const std::string &path, SceneFormats::Animatio
 NodeHandle SceneLoader::parse_gltf(const std::string &path)
 {
 	SubsceneData subscene;
-	subscene.parser = std::make_unique<GLTF::Parser>(path);
+	subscene.parser = std::make_unique<GLTF::Parser>(path, GRANITE_THREAD_GROUP());
 
 	for (auto &mesh : subscene.parser->get_meshes())
 		subscene.meshes.push_back(create_imported_mesh(mesh, subscene.parser->get_materials().data()));
+	create_occluder_meshes(subscene);
 
 	if (!subscene.parser->get_environments().empty())
 	{
@@ -312,7 +349,7 @@ NodeHandle SceneLoader::parse_scene_format(const std::string &path, const std::s
 	{
 		auto gltf_path = Path::relpath(path, itr->value.GetString());
 		auto &subscene = subscenes[itr->name.GetString()];
-		subscene.parser.reset(new GLTF::Parser(gltf_path));
+		subscene.parser.reset(new GLTF::Parser(gltf_path, GRANITE_THREAD_GROUP()));
 		auto &parser = *subscene.parser;
 
 		for (auto &mesh : parser.get_meshes())
@@ -342,6 +379,8 @@ NodeHandle SceneLoader::parse_scene_format(const std::string &path, const std::s
 			}
 			subscene.meshes.push_back(renderable);
 		}
+
+		create_occluder_meshes(subscene);
 	}
 
 	std::vector<NodeHandle> hierarchy;
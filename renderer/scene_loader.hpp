@@ -50,20 +50,28 @@ public:
 	std::unique_ptr<AnimationSystem> consume_animation_system();
 	AnimationSystem &get_animation_system();
 
+	// Opaque meshes with at most this many triangles are also added to the scene as occluders for OcclusionCuller.
+	// Disabled with 0, which is the default. Only affects scenes loaded afterwards.
+	void set_occluder_triangle_limit(unsigned limit);
+
 private:
 	struct SubsceneData
 	{
 		std::unique_ptr<GLTF::Parser> parser;
 		std::vector<AbstractRenderableHandle> meshes;
+		// Parallel to meshes, null for meshes which do not occlude.
+		std::vector<std::shared_ptr<const SceneFormats::CollisionMesh>> occluders;
 	};
 	std::unordered_map<std::string, SubsceneData> subscenes;
 
 	std::unique_ptr<Scene> scene;
 	std::unique_ptr<AnimationSystem> animation_system;
+	unsigned occluder_triangle_limit = 0;
 	NodeHandle parse_scene_format(const std::string &path, const std::string &json);
 	NodeHandle parse_gltf(const std::string &path);
 
 	NodeHandle build_tree_for_subscene(const SubsceneData &subscene);
+	void create_occluder_meshes(SubsceneData &subscene) const;
 	void load_animation(const std::string &path, SceneFormats::Animation &animation);
 };
 }
\ No newline at end of file
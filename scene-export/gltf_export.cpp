@@ -29,6 +29,7 @@
 #include "hashmap.hpp"
 #include "thread_group.hpp"
 #include <unordered_set>
+#include <algorithm>
 #include "texture_utils.hpp"
 #include "texture_format.hpp"
 #include "stb_image_write.h"
@@ -185,6 +186,7 @@ struct EmittedAnimation
 struct RemapState
 {
 	const ExportOptions *options = nullptr;
+	ThreadGroup *workers = nullptr;
 	Hash hash(const Mesh &m);
 	Hash hash(const MaterialInfo &mesh);
 
@@ -897,6 +899,7 @@ void RemapState::emit_mesh(unsigned remapped_index)
 		IndexBufferOptimizeOptions opts = {};
 		opts.narrow_index_buffer = true;
 		opts.stripify = options->stripify_meshes;
+		opts.workers = workers;
 		if (!mesh_optimize_index_buffer(new_mesh, opts))
 		{
 			LOGE("Failed to optimize index buffer.\n");
@@ -1550,6 +1553,22 @@ static std::shared_ptr<AnalysisResult> analyze_image(ThreadGroup &workers,
 	return result;
 }
 
+static double estimate_image_cost(const AnalysisResult &result, unsigned quality)
+{
+	if (!result.image || result.image->empty())
+		return 0.0;
+
+	CompressorArguments args;
+	args.format = get_compression_format(result.compression, result.mode);
+	args.quality = quality;
+	double cost = estimate_compression_cost(args, result.image->get_layout());
+
+	// Mipmaps are generated later for single level images, adding about a third.
+	if (result.image->get_layout().get_levels() == 1 && result.mode != TextureMode::HDR)
+		cost *= 4.0 / 3.0;
+	return cost;
+}
+
 static void compress_image(ThreadGroup &workers, const std::string &target_path, std::shared_ptr<AnalysisResult> &result,
                            unsigned quality, TaskSignal *signal)
 {
@@ -1668,6 +1687,7 @@ bool export_scene_to_glb(const SceneInformation &scene, const std::string &path,
 
 	RemapState state;
 	state.options = &options;
+	state.workers = &workers;
 	state.filter_input(state.material, scene.materials);
 	state.filter_input(state.mesh, scene.meshes);
 
@@ -1892,26 +1912,46 @@ bool export_scene_to_glb(const SceneInformation &scene, const std::string &path,
 		workers.wait_idle();
 		LOGI("Analyzed images ...\n");
 
-		TaskSignal signal;
-		unsigned max_count = 0;
 		for (auto &image : state.image_cache)
 		{
 			Value i(kObjectType);
 			i.AddMember("uri", image.target_relpath, allocator);
 			i.AddMember("mimeType", image.target_mime, allocator);
-
 			images.PushBack(i, allocator);
+		}
+		doc.AddMember("images", images, allocator);
 
-			// Only keep a certain number of compression jobs alive at a time.
-			if (max_count > 3)
-				signal.wait_until_at_least(max_count - 3);
+		// Start the most expensive textures first, so the end of the export only has small jobs left
+		// and every worker stays busy until the last one finishes.
+		struct ScheduledImage
+		{
+			double cost;
+			EmittedImage *image;
+		};
+		std::vector<ScheduledImage> schedule;
+		schedule.reserve(state.image_cache.size());
+		for (auto &image : state.image_cache)
+			schedule.push_back({ estimate_image_cost(*image.loaded_image, image.compression_quality), &image });
+		std::stable_sort(schedule.begin(), schedule.end(), [](const ScheduledImage &a, const ScheduledImage &b) {
+			return a.cost > b.cost;
+		});
+
+		// Only keep a certain number of compression jobs alive at a time.
+		// Mipmap generation is serial per texture, so allow at least one job per worker.
+		unsigned max_in_flight = std::max(4u, workers.get_num_threads());
+		TaskSignal signal;
+		unsigned max_count = 0;
+		for (auto &entry : schedule)
+		{
+			auto &image = *entry.image;
+			if (max_count >= max_in_flight)
+				signal.wait_until_at_least(max_count - max_in_flight + 1);
 
 			compress_image(workers, Path::relpath(path, image.target_relpath),
 			               image.loaded_image, image.compression_quality, &signal);
 
 			max_count++;
 		}
-		doc.AddMember("images", images, allocator);
 	}
 
 	// Sources
@@ -25,90 +25,477 @@
 #include "filesystem.hpp"
 #include "memory_mapped_texture.hpp"
 #include "texture_files.hpp"
-#include "string_helpers.hpp"
 #include "path_utils.hpp"
+#include "thread_group.hpp"
+#include "bitops.hpp"
+#include <limits>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 using namespace Util;
 
 namespace OBJ
 {
-void Parser::flush_mesh()
+namespace
 {
-	if (current_positions.empty())
-		return;
+// A view into the mapped file. The mapping outlives every token.
+struct Token
+{
+	const char *begin = nullptr;
+	const char *end = nullptr;
 
-	Mesh mesh = {};
+	bool empty() const
+	{
+		return begin == end;
+	}
 
-	if (current_material >= 0)
+	bool operator==(const char *str) const
 	{
-		mesh.has_material = true;
-		mesh.material_index = unsigned(current_material);
+		size_t len = strlen(str);
+		return size_t(end - begin) == len && memcmp(begin, str, len) == 0;
 	}
 
-	mesh.positions.resize(current_positions.size() * sizeof(vec3));
-	memcpy(mesh.positions.data(), current_positions.data(), mesh.positions.size());
-	mesh.position_stride = sizeof(vec3);
-	mesh.attribute_layout[ecast(MeshAttribute::Position)].format = VK_FORMAT_R32G32B32_SFLOAT;
-	mesh.count = unsigned(current_positions.size());
-	mesh.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	std::string str() const
+	{
+		return std::string(begin, end);
+	}
+};
 
-	vec3 lo = vec3(std::numeric_limits<float>::max());
-	vec3 hi = vec3(-std::numeric_limits<float>::max());
-	for (auto &p : current_positions)
+struct Corner
+{
+	uint32_t position;
+	uint32_t uv;
+	uint32_t normal;
+};
+
+// mtllib and usemtl have to be resolved in file order, so chunks only record where they occurred.
+struct Event
+{
+	enum class Type { MaterialLibrary, UseMaterial };
+	Type type;
+	size_t corner_offset;
+	Token name;
+};
+}
+
+struct Parser::Chunk
+{
+	const char *begin;
+	const char *end;
+
+	// Number of attributes defined in this chunk, and how many were defined before it.
+	size_t num_positions = 0;
+	size_t num_normals = 0;
+	size_t num_uvs = 0;
+	size_t position_base = 0;
+	size_t normal_base = 0;
+	size_t uv_base = 0;
+
+	// Triangulated faces with indices resolved to the global attribute arrays.
+	std::vector<Corner> corners;
+	std::vector<Event> events;
+};
+
+struct Parser::ChunkRange
+{
+	const Chunk *chunk;
+	size_t begin;
+	size_t end;
+};
+
+static constexpr uint32_t NoIndex = ~0u;
+static constexpr size_t ChunkSize = 4 * 1024 * 1024;
+
+static inline bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// Returns a pointer to the next newline in [ptr, end), or end.
+static const char *find_line_end(const char *ptr, const char *end)
+{
+#if defined(__SSE2__)
+	const __m128i newline = _mm_set1_epi8('\n');
+	while (end - ptr >= 16)
 	{
-		lo = min(lo, p);
-		hi = max(hi, p);
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+		uint32_t mask = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)));
+		if (mask)
+			return ptr + trailing_zeroes(mask);
+		ptr += 16;
 	}
-	mesh.static_aabb = AABB(lo, hi);
+#elif defined(__ARM_NEON)
+	const uint8x16_t newline = vdupq_n_u8('\n');
+	while (end - ptr >= 16)
+	{
+		uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(ptr)), newline);
+		// Narrow each byte of the compare to a nibble so the result fits in 64 bits.
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+		if (mask)
+			return ptr + (trailing_zeroes64(mask) >> 2);
+		ptr += 16;
+	}
+#endif
+
+	while (ptr < end && *ptr != '\n')
+		ptr++;
+	return ptr;
+}
 
-	if (!current_normals.empty() && !current_uvs.empty())
+static const char *skip_whitespace(const char *ptr, const char *end)
+{
+	while (ptr < end && is_space(*ptr))
+		ptr++;
+	return ptr;
+}
+
+static Token next_token(const char *&ptr, const char *end)
+{
+	Token token;
+	token.begin = skip_whitespace(ptr, end);
+	token.end = token.begin;
+	while (token.end < end && !is_space(*token.end))
+		token.end++;
+	ptr = token.end;
+	return token;
+}
+
+// Calls func(begin, end) for every line with comments and surrounding whitespace stripped.
+template <typename Func>
+static void for_each_line(const char *ptr, const char *end, const Func &func)
+{
+	while (ptr < end)
 	{
-		if (current_normals.size() != current_positions.size())
-			throw std::runtime_error("Normal size != position size.");
-		if (current_uvs.size() != current_positions.size())
-			throw std::runtime_error("UV size != position size.");
+		const char *line_end = find_line_end(ptr, end);
+		auto *comment = static_cast<const char *>(memchr(ptr, '#', size_t(line_end - ptr)));
+		const char *content_end = comment ? comment : line_end;
 
-		mesh.attribute_layout[ecast(MeshAttribute::Normal)].format = VK_FORMAT_R32G32B32_SFLOAT;
-		mesh.attribute_layout[ecast(MeshAttribute::UV)].format = VK_FORMAT_R32G32_SFLOAT;
-		mesh.attribute_layout[ecast(MeshAttribute::UV)].offset = sizeof(vec3);
-		static const size_t stride = sizeof(vec3) + sizeof(vec2);
-		mesh.attribute_stride = stride;
-		mesh.attributes.resize(stride * current_positions.size());
+		ptr = skip_whitespace(ptr, content_end);
+		while (content_end > ptr && is_space(content_end[-1]))
+			content_end--;
+		if (ptr < content_end)
+			func(ptr, content_end);
+
+		ptr = line_end + 1;
+	}
+}
+
+static const double exact_powers_of_10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static float parse_float_slow(const Token &token)
+{
+	char buffer[64];
+	size_t len = size_t(token.end - token.begin);
+	if (len >= sizeof(buffer))
+		throw std::runtime_error("Number in OBJ is too long.");
+	memcpy(buffer, token.begin, len);
+	buffer[len] = '\0';
+
+	char *parse_end = nullptr;
+	float value = strtof(buffer, &parse_end);
+	if (parse_end != buffer + len)
+		throw std::runtime_error("Failed to parse number in OBJ.");
+	return value;
+}
+
+// Decimal mantissa and exponent are accumulated as integers, then scaled by an exact power of ten in double.
+// Anything which does not fit that scheme (long mantissas, large exponents, inf/nan) goes through strtof.
+// The double is correctly rounded, but rounding it again to float can go the wrong way when it lands exactly
+// halfway between two floats. Those values, and float denormals, also go through strtof,
+// so the result is always bit-identical to strtof.
+static float parse_float(const Token &token)
+{
+	const char *ptr = token.begin;
+	const char *end = token.end;
+
+	bool negative = false;
+	if (ptr < end && (*ptr == '-' || *ptr == '+'))
+		negative = *ptr++ == '-';
+
+	uint64_t mantissa = 0;
+	int significant_digits = 0;
+	int exponent = 0;
+	bool has_digits = false;
+
+	while (ptr < end && is_digit(*ptr))
+	{
+		if (significant_digits < 19)
+		{
+			mantissa = mantissa * 10 + uint64_t(*ptr - '0');
+			if (mantissa)
+				significant_digits++;
+		}
+		else
+			exponent++;
+		has_digits = true;
+		ptr++;
+	}
+
+	if (ptr < end && *ptr == '.')
+	{
+		ptr++;
+		while (ptr < end && is_digit(*ptr))
+		{
+			if (significant_digits < 19)
+			{
+				mantissa = mantissa * 10 + uint64_t(*ptr - '0');
+				if (mantissa)
+					significant_digits++;
+				exponent--;
+			}
+			has_digits = true;
+			ptr++;
+		}
+	}
+
+	if (!has_digits)
+		return parse_float_slow(token);
+
+	if (ptr < end && (*ptr == 'e' || *ptr == 'E'))
+	{
+		ptr++;
+		bool negative_exponent = false;
+		if (ptr < end && (*ptr == '-' || *ptr == '+'))
+			negative_exponent = *ptr++ == '-';
+		if (ptr == end || !is_digit(*ptr))
+			throw std::runtime_error("Failed to parse number in OBJ.");
+
+		int e = 0;
+		while (ptr < end && is_digit(*ptr))
+		{
+			if (e < 10000)
+				e = e * 10 + (*ptr - '0');
+			ptr++;
+		}
+		exponent += negative_exponent ? -e : e;
+	}
+
+	if (ptr != end)
+		throw std::runtime_error("Failed to parse number in OBJ.");
+
+	double value;
+	if (mantissa == 0)
+		value = 0.0;
+	else if (mantissa < (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+	{
+		value = double(mantissa);
+		if (exponent < 0)
+			value /= exact_powers_of_10[-exponent];
+		else
+			value *= exact_powers_of_10[exponent];
+
+		if (value < double(std::numeric_limits<float>::min()))
+			return parse_float_slow(token);
+
+		// A float keeps the top 24 of the 53 significand bits. If the 29 dropped bits are exactly half,
+		// the double sits on a float rounding tie.
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		constexpr uint64_t dropped_mask = (uint64_t(1) << 29) - 1;
+		if ((bits & dropped_mask) == (uint64_t(1) << 28))
+			return parse_float_slow(token);
+	}
+	else
+		return parse_float_slow(token);
+
+	return float(negative ? -value : value);
+}
+
+static Token next_required_token(const char *&ptr, const char *end)
+{
+	auto token = next_token(ptr, end);
+	if (token.empty())
+		throw std::runtime_error("Missing element in OBJ line.");
+	return token;
+}
+
+static float next_float(const char *&ptr, const char *end)
+{
+	return parse_float(next_required_token(ptr, end));
+}
+
+// Resolves a 1-based or negative (relative) OBJ index against the number of attributes defined so far.
+static uint32_t parse_index(const char *&ptr, const char *end, size_t count)
+{
+	bool negative = false;
+	if (ptr < end && *ptr == '-')
+	{
+		negative = true;
+		ptr++;
+	}
+
+	if (ptr == end || !is_digit(*ptr))
+		throw std::runtime_error("Failed to parse index in OBJ.");
+
+	uint64_t value = 0;
+	while (ptr < end && is_digit(*ptr))
+	{
+		value = value * 10 + uint64_t(*ptr - '0');
+		if (value > UINT32_MAX)
+			throw std::logic_error("Index out of bounds.");
+		ptr++;
+	}
+
+	if (value == 0 || value > count)
+		throw std::logic_error("Index out of bounds.");
+	return uint32_t(negative ? count - value : value - 1);
+}
+
+static Corner parse_corner(const Token &token, size_t num_positions, size_t num_uvs, size_t num_normals)
+{
+	Corner corner = { NoIndex, NoIndex, NoIndex };
+	const char *ptr = token.begin;
+	const char *end = token.end;
+
+	corner.position = parse_index(ptr, end, num_positions);
+	if (ptr < end && *ptr == '/')
+	{
+		ptr++;
+		if (ptr < end && *ptr != '/')
+			corner.uv = parse_index(ptr, end, num_uvs);
+		if (ptr < end && *ptr == '/')
+		{
+			ptr++;
+			if (ptr < end)
+				corner.normal = parse_index(ptr, end, num_normals);
+		}
+	}
+
+	if (ptr != end)
+		throw std::runtime_error("Failed to parse face in OBJ.");
+	return corner;
+}
+
+void Parser::flush_mesh(const std::vector<ChunkRange> &ranges, int material)
+{
+	std::vector<size_t> offsets(ranges.size());
+	size_t count = 0;
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		offsets[i] = count;
+		count += ranges[i].end - ranges[i].begin;
+	}
 
-		for (size_t i = 0; i < current_positions.size(); i++)
+	if (count == 0)
+		return;
+	if (count > UINT32_MAX)
+		throw std::runtime_error("Too many vertices in OBJ mesh.");
+
+	// A mesh either has an attribute on every corner or on none of them.
+	std::vector<size_t> normal_counts(ranges.size());
+	std::vector<size_t> uv_counts(ranges.size());
+	parallel_for_range(workers, 0, ranges.size(), 1, "obj-build-mesh", [&](size_t i, size_t, size_t) {
+		auto &range = ranges[i];
+		for (size_t j = range.begin; j < range.end; j++)
 		{
-			memcpy(mesh.attributes.data() + stride * i, &current_normals[i], sizeof(vec3));
-			memcpy(mesh.attributes.data() + stride * i + sizeof(vec3), &current_uvs[i], sizeof(vec2));
+			auto &corner = range.chunk->corners[j];
+			normal_counts[i] += corner.normal != NoIndex;
+			uv_counts[i] += corner.uv != NoIndex;
 		}
+	});
+
+	size_t num_normals = 0;
+	size_t num_uvs = 0;
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		num_normals += normal_counts[i];
+		num_uvs += uv_counts[i];
 	}
-	else if (!current_normals.empty())
+
+	if (num_normals != 0 && num_normals != count)
+		throw std::runtime_error("Normal size != position size.");
+	if (num_uvs != 0 && num_uvs != count)
+		throw std::runtime_error("UV size != position size.");
+
+	bool has_normals = num_normals != 0;
+	bool has_uvs = num_uvs != 0;
+
+	Mesh mesh = {};
+
+	if (material >= 0)
+	{
+		mesh.has_material = true;
+		mesh.material_index = unsigned(material);
+	}
+
+	mesh.positions.resize(count * sizeof(vec3));
+	mesh.position_stride = sizeof(vec3);
+	mesh.attribute_layout[ecast(MeshAttribute::Position)].format = VK_FORMAT_R32G32B32_SFLOAT;
+	mesh.count = unsigned(count);
+	mesh.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	size_t stride = 0;
+	size_t uv_offset = 0;
+	if (has_normals)
 	{
-		if (current_normals.size() != current_positions.size())
-			throw std::runtime_error("Normal size != position size.");
 		mesh.attribute_layout[ecast(MeshAttribute::Normal)].format = VK_FORMAT_R32G32B32_SFLOAT;
-		static const size_t stride = sizeof(vec3);
-		mesh.attribute_stride = stride;
-		mesh.attributes.resize(stride * current_positions.size());
-		for (size_t i = 0; i < current_positions.size(); i++)
-			memcpy(mesh.attributes.data() + stride * i, &current_normals[i], sizeof(vec3));
+		stride += sizeof(vec3);
 	}
-	else if (!current_uvs.empty())
+
+	if (has_uvs)
 	{
-		if (current_uvs.size() != current_positions.size())
-			throw std::runtime_error("UV size != position size.");
 		mesh.attribute_layout[ecast(MeshAttribute::UV)].format = VK_FORMAT_R32G32_SFLOAT;
-		static const size_t stride = sizeof(vec2);
-		mesh.attribute_stride = stride;
-		mesh.attributes.resize(stride * current_positions.size());
-		for (size_t i = 0; i < current_positions.size(); i++)
-			memcpy(mesh.attributes.data() + stride * i, &current_uvs[i], sizeof(vec2));
+		mesh.attribute_layout[ecast(MeshAttribute::UV)].offset = uint32_t(stride);
+		uv_offset = stride;
+		stride += sizeof(vec2);
 	}
 
-	current_positions.clear();
-	current_normals.clear();
-	current_uvs.clear();
+	mesh.attribute_stride = uint32_t(stride);
+	mesh.attributes.resize(stride * count);
+
+	std::vector<vec3> range_lo(ranges.size(), vec3(std::numeric_limits<float>::max()));
+	std::vector<vec3> range_hi(ranges.size(), vec3(-std::numeric_limits<float>::max()));
+
+	parallel_for_range(workers, 0, ranges.size(), 1, "obj-build-mesh", [&](size_t i, size_t, size_t) {
+		auto &range = ranges[i];
+		auto *dst_positions = reinterpret_cast<vec3 *>(mesh.positions.data()) + offsets[i];
+		uint8_t *dst_attributes = mesh.attributes.data() + stride * offsets[i];
+		vec3 lo = range_lo[i];
+		vec3 hi = range_hi[i];
+
+		for (size_t j = range.begin; j < range.end; j++)
+		{
+			auto &corner = range.chunk->corners[j];
+			vec3 p = positions[corner.position];
+			*dst_positions++ = p;
+			lo = min(lo, p);
+			hi = max(hi, p);
+
+			if (has_normals)
+				memcpy(dst_attributes, &normals[corner.normal], sizeof(vec3));
+			if (has_uvs)
+				memcpy(dst_attributes + uv_offset, &uvs[corner.uv], sizeof(vec2));
+			dst_attributes += stride;
+		}
+
+		range_lo[i] = lo;
+		range_hi[i] = hi;
+	});
+
+	vec3 lo = vec3(std::numeric_limits<float>::max());
+	vec3 hi = vec3(-std::numeric_limits<float>::max());
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		lo = min(lo, range_lo[i]);
+		hi = max(hi, range_hi[i]);
+	}
+	mesh.static_aabb = AABB(lo, hi);
 
-	mesh_deduplicate_vertices(mesh);
+	mesh_deduplicate_vertices(mesh, workers);
 
 	root_node.meshes.push_back(meshes.size());
 	meshes.push_back(std::move(mesh));
@@ -361,85 +748,22 @@ void Parser::emit_gltf_pbr_metallic_roughness(const std::string &metallic_path,
 	}
 }
 
-void Parser::emit_vertex(const OBJVertex * const *face)
-{
-	// Positions
-	for (unsigned i = 0; i < 3; i++)
-	{
-		auto &p = face[i]->operator[](0);
-
-		if (!p.empty())
-		{
-			int index = stoi(p);
-			if (index < 0)
-				index = int(positions.size()) + index;
-			else
-				index--;
-
-			if (index < 0 || index >= int(positions.size()))
-				throw std::logic_error("Index out of bounds.");
-			current_positions.push_back(positions[index]);
-		}
-
-		if (face[i]->size() == 1)
-			continue;
-
-		auto &u = face[i]->operator[](1);
-		auto &n = face[i]->operator[](2);
-
-		if (!u.empty())
-		{
-			int index = stoi(u);
-			if (index < 0)
-				index = int(uvs.size()) + index;
-			else
-				index--;
-
-			if (index < 0 || index >= int(uvs.size()))
-				throw std::logic_error("Index out of bounds.");
-			current_uvs.push_back(uvs[index]);
-		}
-
-		if (!n.empty())
-		{
-			int index = stoi(n);
-			if (index < 0)
-				index = int(normals.size()) + index;
-			else
-				index--;
-
-			if (index < 0 || index >= int(normals.size()))
-				throw std::logic_error("Index out of bounds.");
-			current_normals.push_back(normals[index]);
-		}
-	}
-}
-
 void Parser::load_material_library(const std::string &path)
 {
-	std::string mtl;
-	if (!GRANITE_FILESYSTEM()->read_file_to_string(path, mtl))
+	auto mapping = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
+	if (!mapping)
 		throw std::runtime_error("Failed to load material library.");
 
-	std::vector<std::string> lines = split_no_empty(mtl, "\n");
 	std::string metallic;
 	std::string roughness;
 	std::string base_color;
 	std::string alpha_mask;
 	std::string ue_pbr;
 
-	for (auto &line : lines)
-	{
-		line = strip_whitespace(line);
-		auto comment_index = line.find_first_of('#');
-		if (comment_index != std::string::npos)
-			line = line.substr(comment_index, std::string::npos);
-
-		auto elements = split_no_empty(line, " ");
-		if (elements.empty())
-			continue;
+	const auto *mtl = mapping->data<char>();
+	for_each_line(mtl, mtl + mapping->get_size(), [&](const char *ptr, const char *end) {
+		auto ident = next_token(ptr, end);
 
-		auto &ident = elements.front();
 		if (ident == "newmtl")
 		{
 			if (!metallic.empty() || !roughness.empty())
@@ -449,7 +773,7 @@ void Parser::load_material_library(const std::string &path)
 			if (!base_color.empty())
 				emit_gltf_base_color(base_color, alpha_mask);
 
-			material_library[elements.at(1)] = unsigned(materials.size());
+			material_library[next_required_token(ptr, end).str()] = unsigned(materials.size());
 			materials.push_back({});
 			metallic.clear();
 			roughness.clear();
@@ -462,48 +786,49 @@ void Parser::load_material_library(const std::string &path)
 			if (materials.empty())
 				throw std::logic_error("No material");
 			for (unsigned i = 0; i < 3; i++)
-				materials.back().uniform_base_color[i] = stof(elements.at(i + 1));
+				materials.back().uniform_base_color[i] = next_float(ptr, end);
 		}
 		else if (ident == "map_Kd")
 		{
 			if (materials.empty())
 				throw std::logic_error("No material");
-			base_color = Path::relpath(path, elements.at(1));
+			base_color = Path::relpath(path, next_required_token(ptr, end).str());
 		}
 		else if (ident == "map_d")
 		{
 			if (materials.empty())
 				throw std::logic_error("No material");
-			alpha_mask = Path::relpath(path, elements.at(1));
+			alpha_mask = Path::relpath(path, next_required_token(ptr, end).str());
 		}
 		else if (ident == "bump")
 		{
 			if (materials.empty())
 				throw std::logic_error("No material");
-			materials.back().paths[Util::ecast(TextureKind::Normal)] = Path::relpath(path, elements.at(1));
+			materials.back().paths[Util::ecast(TextureKind::Normal)] =
+					Path::relpath(path, next_required_token(ptr, end).str());
 		}
 		else if (ident == "map_Ka")
 		{
 			// Custom magic stuff for Sponza PBR.
 			if (materials.empty())
 				throw std::logic_error("No material");
-			metallic = Path::relpath(path, elements.at(1));
+			metallic = Path::relpath(path, next_required_token(ptr, end).str());
 		}
 		else if (ident == "map_Ns")
 		{
 			// Custom magic stuff for Sponza PBR.
 			if (materials.empty())
 				throw std::logic_error("No material");
-			roughness = Path::relpath(path, elements.at(1));
+			roughness = Path::relpath(path, next_required_token(ptr, end).str());
 		}
 		else if (ident == "map_ue_pbr")
 		{
 			// Custom hacks.
 			if (materials.empty())
 				throw std::logic_error("No material");
-			ue_pbr = Path::relpath(path, elements.at(1));
+			ue_pbr = Path::relpath(path, next_required_token(ptr, end).str());
 		}
-	}
+	});
 
 	if (!metallic.empty() || !roughness.empty())
 		emit_gltf_pbr_metallic_roughness(metallic, roughness);
@@ -513,74 +838,197 @@ void Parser::load_material_library(const std::string &path)
 		emit_gltf_base_color(base_color, alpha_mask);
 }
 
-Parser::Parser(const std::string &path, float position_scale)
+// Only looks at the start of each line, so attribute bases are known before any number is parsed.
+void Parser::count_chunk(Chunk &chunk)
 {
-	std::string obj;
-	if (!GRANITE_FILESYSTEM()->read_file_to_string(path, obj))
-		throw std::runtime_error("Failed to load OBJ.");
-
-	std::vector<std::string> lines = split_no_empty(obj, "\n");
-	for (auto &line : lines)
+	const char *ptr = chunk.begin;
+	while (ptr < chunk.end)
 	{
-		line = strip_whitespace(line);
-		auto comment_index = line.find_first_of('#');
-		if (comment_index != std::string::npos)
-			line = line.substr(comment_index, std::string::npos);
+		const char *line_end = find_line_end(ptr, chunk.end);
+		ptr = skip_whitespace(ptr, line_end);
+
+		if (line_end - ptr >= 2 && ptr[0] == 'v')
+		{
+			if (is_space(ptr[1]))
+				chunk.num_positions++;
+			else if (line_end - ptr >= 3 && is_space(ptr[2]))
+			{
+				if (ptr[1] == 'n')
+					chunk.num_normals++;
+				else if (ptr[1] == 't')
+					chunk.num_uvs++;
+			}
+		}
 
-		auto elements = split_no_empty(line, " ");
-		if (elements.empty())
-			continue;
+		ptr = line_end + 1;
+	}
+}
 
-		auto &ident = elements.front();
-		if (ident == "mtllib")
-			load_material_library(Path::relpath(path, elements.at(1)));
-		else if (ident == "v")
-			positions.push_back(position_scale * vec3(stof(elements.at(1)), stof(elements.at(2)), stof(elements.at(3))));
+void Parser::parse_chunk(Chunk &chunk, float position_scale)
+{
+	size_t position_index = chunk.position_base;
+	size_t normal_index = chunk.normal_base;
+	size_t uv_index = chunk.uv_base;
+	std::vector<Corner> face;
+
+	for_each_line(chunk.begin, chunk.end, [&](const char *ptr, const char *end) {
+		auto ident = next_token(ptr, end);
+
+		if (ident == "v")
+		{
+			float x = next_float(ptr, end);
+			float y = next_float(ptr, end);
+			float z = next_float(ptr, end);
+			positions[position_index++] = position_scale * vec3(x, y, z);
+		}
 		else if (ident == "vn")
-			normals.push_back(vec3(stof(elements.at(1)), stof(elements.at(2)), stof(elements.at(3))));
+		{
+			float x = next_float(ptr, end);
+			float y = next_float(ptr, end);
+			float z = next_float(ptr, end);
+			normals[normal_index++] = vec3(x, y, z);
+		}
 		else if (ident == "vt")
-			uvs.push_back(vec2(stof(elements.at(1)), 1.0f - stof(elements.at(2))));
-		else if (ident == "usemtl")
 		{
-			auto itr = material_library.find(elements.at(1));
-			if (itr == end(material_library))
-			{
-				LOGE("Material %s does not exist!\n",
-				     elements.at(1).c_str());
-				throw std::runtime_error("Material does not exist.");
-			}
-			int index = int(itr->second);
-			if (index != current_material)
-				flush_mesh();
-			current_material = index;
+			float u = next_float(ptr, end);
+			float v = next_float(ptr, end);
+			uvs[uv_index++] = vec2(u, 1.0f - v);
 		}
 		else if (ident == "f")
 		{
-			if (elements.size() == 5)
+			face.clear();
+			for (;;)
 			{
-				auto v0 = split(elements.at(1), "/");
-				auto v1 = split(elements.at(2), "/");
-				auto v2 = split(elements.at(3), "/");
-				auto v3 = split(elements.at(4), "/");
-
-				const OBJVertex *f0[3] = { &v0, &v1, &v2 };
-				const OBJVertex *f1[3] = { &v0, &v2, &v3 };
-				emit_vertex(f0);
-				emit_vertex(f1);
+				auto token = next_token(ptr, end);
+				if (token.empty())
+					break;
+				face.push_back(parse_corner(token, position_index, uv_index, normal_index));
 			}
-			else if (elements.size() == 4)
+
+			if (face.size() < 3)
+				throw std::runtime_error("Face in OBJ has fewer than 3 vertices.");
+
+			// Triangle fan, which matches the split used for quads.
+			for (size_t i = 2; i < face.size(); i++)
 			{
-				auto v0 = split(elements.at(1), "/");
-				auto v1 = split(elements.at(2), "/");
-				auto v2 = split(elements.at(3), "/");
-				const OBJVertex *f0[3] = { &v0, &v1, &v2 };
-				emit_vertex(f0);
+				chunk.corners.push_back(face[0]);
+				chunk.corners.push_back(face[i - 1]);
+				chunk.corners.push_back(face[i]);
 			}
 		}
+		else if (ident == "usemtl" || ident == "mtllib")
+		{
+			Event event;
+			event.type = ident == "usemtl" ? Event::Type::UseMaterial : Event::Type::MaterialLibrary;
+			event.corner_offset = chunk.corners.size();
+			event.name = next_required_token(ptr, end);
+			chunk.events.push_back(event);
+		}
+	});
+
+	if (position_index != chunk.position_base + chunk.num_positions ||
+	    normal_index != chunk.normal_base + chunk.num_normals ||
+	    uv_index != chunk.uv_base + chunk.num_uvs)
+	{
+		throw std::runtime_error("Malformed attribute line in OBJ.");
 	}
+}
 
-	flush_mesh();
+Parser::Parser(const std::string &path, float position_scale, ThreadGroup *workers_)
+	: workers(workers_)
+{
+	auto mapping = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
+	if (!mapping)
+		throw std::runtime_error("Failed to load OBJ.");
+
+	const auto *obj = mapping->data<char>();
+	const auto *obj_end = obj + mapping->get_size();
+
+	// Chunk boundaries only depend on the file, so the output is the same for any number of workers.
+	std::vector<Chunk> chunks;
+	for (const char *ptr = obj; ptr < obj_end; )
+	{
+		Chunk chunk;
+		chunk.begin = ptr;
+		if (size_t(obj_end - ptr) <= ChunkSize)
+			chunk.end = obj_end;
+		else
+		{
+			chunk.end = find_line_end(ptr + ChunkSize, obj_end);
+			if (chunk.end < obj_end)
+				chunk.end++;
+		}
+		ptr = chunk.end;
+		chunks.push_back(std::move(chunk));
+	}
+
+	parallel_for_range(workers, 0, chunks.size(), 1, "obj-parse", [&](size_t i, size_t, size_t) {
+		count_chunk(chunks[i]);
+	});
+
+	size_t num_positions = 0;
+	size_t num_normals = 0;
+	size_t num_uvs = 0;
+	for (auto &chunk : chunks)
+	{
+		chunk.position_base = num_positions;
+		chunk.normal_base = num_normals;
+		chunk.uv_base = num_uvs;
+		num_positions += chunk.num_positions;
+		num_normals += chunk.num_normals;
+		num_uvs += chunk.num_uvs;
+	}
+
+	if (num_positions > UINT32_MAX || num_normals > UINT32_MAX || num_uvs > UINT32_MAX)
+		throw std::runtime_error("Too many attributes in OBJ.");
+
+	positions.resize(num_positions);
+	normals.resize(num_normals);
+	uvs.resize(num_uvs);
+
+	parallel_for_range(workers, 0, chunks.size(), 1, "obj-parse", [&](size_t i, size_t, size_t) {
+		parse_chunk(chunks[i], position_scale);
+	});
+
+	// Stitch faces together in file order. Material state is only known here.
+	std::vector<ChunkRange> ranges;
+	int current_material = -1;
+	for (auto &chunk : chunks)
+	{
+		size_t offset = 0;
+		for (auto &event : chunk.events)
+		{
+			if (event.corner_offset > offset)
+				ranges.push_back({ &chunk, offset, event.corner_offset });
+			offset = event.corner_offset;
+
+			if (event.type == Event::Type::MaterialLibrary)
+				load_material_library(Path::relpath(path, event.name.str()));
+			else
+			{
+				auto name = event.name.str();
+				auto itr = material_library.find(name);
+				if (itr == end(material_library))
+				{
+					LOGE("Material %s does not exist!\n", name.c_str());
+					throw std::runtime_error("Material does not exist.");
+				}
+
+				int index = int(itr->second);
+				if (index != current_material)
+				{
+					flush_mesh(ranges, current_material);
+					ranges.clear();
+				}
+				current_material = index;
+			}
+		}
+
+		if (chunk.corners.size() > offset)
+			ranges.push_back({ &chunk, offset, chunk.corners.size() });
+	}
+
+	flush_mesh(ranges, current_material);
 	nodes.push_back(std::move(root_node));
 }
 }
-
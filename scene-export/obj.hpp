@@ -27,6 +27,11 @@
 #include "math.hpp"
 #include "scene_formats.hpp"
 
+namespace Granite
+{
+class ThreadGroup;
+}
+
 namespace OBJ
 {
 using namespace Granite;
@@ -35,7 +40,9 @@ using namespace Granite::SceneFormats;
 class Parser
 {
 public:
-	Parser(const std::string &path, float position_scale = 1.0f);
+	// The OBJ is memory mapped and parsed in chunks. With a thread group, chunks are parsed concurrently.
+	// Output does not depend on the number of threads.
+	Parser(const std::string &path, float position_scale = 1.0f, ThreadGroup *workers = nullptr);
 
 	const std::vector<Mesh> &get_meshes() const
 	{
@@ -61,16 +68,16 @@ private:
 	std::vector<vec3> positions;
 	std::vector<vec3> normals;
 	std::vector<vec2> uvs;
-	std::vector<vec3> current_positions;
-	std::vector<vec3> current_normals;
-	std::vector<vec2> current_uvs;
-	int current_material = -1;
+	ThreadGroup *workers;
+
+	struct Chunk;
+	struct ChunkRange;
+	void count_chunk(Chunk &chunk);
+	void parse_chunk(Chunk &chunk, float position_scale);
 
 	void load_material_library(const std::string &path);
-	void flush_mesh();
+	void flush_mesh(const std::vector<ChunkRange> &ranges, int material);
 
-	using OBJVertex = std::vector<std::string>;
-	void emit_vertex(const OBJVertex * const *face);
 	void emit_gltf_pbr_metallic_roughness(const std::string &metallic, const std::string &roughness);
 	void emit_gltf_ue_pbr(const std::string &ue_pbr);
 	void emit_gltf_base_color(const std::string &metallic, const std::string &roughness);
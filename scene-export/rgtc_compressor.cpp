@@ -25,6 +25,13 @@
 #include <algorithm>
 #include <iterator>
 #include <assert.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace Granite
 {
@@ -69,102 +76,268 @@ private:
 };
 static DividerLut divider_lut;
 
+// Decoded value of each of the 8 codes for a pair of endpoints.
+static void build_palette(uint8_t *palette, int red0, int red1)
+{
+	palette[0] = uint8_t(red0);
+	palette[1] = uint8_t(red1);
+
+	if (red0 > red1)
+	{
+		for (int i = 1; i < 7; i++)
+			palette[i + 1] = uint8_t((((7 - i) * red0 + i * red1) * div_7 + 0x80000) >> 20);
+	}
+	else
+	{
+		for (int i = 1; i < 5; i++)
+			palette[i + 1] = uint8_t((((5 - i) * red0 + i * red1) * div_5 + 0x80000) >> 20);
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
 void decompress_rgtc_red_block(uint8_t *output_r, const uint8_t *block)
 {
-	uint8_t red0 = block[0];
-	uint8_t red1 = block[1];
-	uint64_t bits = 0;
+	uint8_t palette[8];
+	build_palette(palette, block[0], block[1]);
 
+	uint64_t bits = 0;
 	for (int i = 0; i < 6; i++)
 		bits |= uint64_t(block[2 + i]) << (8 * i);
 
-	if (red0 > red1)
+	for (int i = 0; i < 16; i++)
+		output_r[i] = palette[(bits >> (3 * i)) & 7];
+}
+
+unsigned compute_rgtc_red_block_error(const uint8_t *block, const uint8_t *input_r)
+{
+	uint8_t decoded[16];
+	decompress_rgtc_red_block(decoded, block);
+
+	unsigned error = 0;
+	for (int i = 0; i < 16; i++)
 	{
-		for (int i = 0; i < 16; i++)
+		int diff = int(decoded[i]) - int(input_r[i]);
+		error += unsigned(diff * diff);
+	}
+	return error;
+}
+
+// Squared error of the block if every texel picks its nearest palette entry.
+static unsigned compute_palette_error(const uint8_t *palette, const uint8_t *input_r)
+{
+#if defined(__SSE2__)
+	const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input_r));
+
+	// Splat each palette entry to 4 bytes, then to all 16 with a dword shuffle.
+	__m128i entries = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(palette));
+	entries = _mm_unpacklo_epi8(entries, entries);
+	const __m128i entries_lo = _mm_unpacklo_epi16(entries, entries);
+	const __m128i entries_hi = _mm_unpackhi_epi16(entries, entries);
+
+	const auto abs_diff = [&](__m128i entry) -> __m128i {
+		return _mm_or_si128(_mm_subs_epu8(values, entry), _mm_subs_epu8(entry, values));
+	};
+
+	__m128i best;
+	if (palette[0] <= palette[1])
+	{
+		// The last two entries are 0 and 255, and 255 - v is just the complement.
+		best = _mm_min_epu8(values, _mm_xor_si128(values, _mm_set1_epi8(-1)));
+	}
+	else
+	{
+		best = _mm_min_epu8(abs_diff(_mm_shuffle_epi32(entries_hi, _MM_SHUFFLE(2, 2, 2, 2))),
+		                    abs_diff(_mm_shuffle_epi32(entries_hi, _MM_SHUFFLE(3, 3, 3, 3))));
+	}
+
+	best = _mm_min_epu8(best, abs_diff(_mm_shuffle_epi32(entries_lo, _MM_SHUFFLE(0, 0, 0, 0))));
+	best = _mm_min_epu8(best, abs_diff(_mm_shuffle_epi32(entries_lo, _MM_SHUFFLE(1, 1, 1, 1))));
+	best = _mm_min_epu8(best, abs_diff(_mm_shuffle_epi32(entries_lo, _MM_SHUFFLE(2, 2, 2, 2))));
+	best = _mm_min_epu8(best, abs_diff(_mm_shuffle_epi32(entries_lo, _MM_SHUFFLE(3, 3, 3, 3))));
+	best = _mm_min_epu8(best, abs_diff(_mm_shuffle_epi32(entries_hi, _MM_SHUFFLE(0, 0, 0, 0))));
+	best = _mm_min_epu8(best, abs_diff(_mm_shuffle_epi32(entries_hi, _MM_SHUFFLE(1, 1, 1, 1))));
+
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_unpacklo_epi8(best, zero);
+	__m128i hi = _mm_unpackhi_epi8(best, zero);
+	__m128i sum = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return unsigned(_mm_cvtsi128_si32(sum));
+#elif defined(__ARM_NEON)
+	const uint8x16_t values = vld1q_u8(input_r);
+	uint8x16_t best = vdupq_n_u8(255);
+	for (int i = 0; i < 8; i++)
+		best = vminq_u8(best, vabdq_u8(values, vdupq_n_u8(palette[i])));
+
+	uint16x8_t sq_lo = vmull_u8(vget_low_u8(best), vget_low_u8(best));
+	uint16x8_t sq_hi = vmull_u8(vget_high_u8(best), vget_high_u8(best));
+	uint64x2_t sum = vpaddlq_u32(vaddq_u32(vpaddlq_u16(sq_lo), vpaddlq_u16(sq_hi)));
+	return unsigned(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+#else
+	unsigned error = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 255;
+		for (int j = 0; j < 8; j++)
+			best = std::min(best, std::abs(int(input_r[i]) - int(palette[j])));
+		error += unsigned(best * best);
+	}
+	return error;
+#endif
+}
+
+static void encode_block(uint8_t *output_r, const uint8_t *input_r, int red0, int red1)
+{
+	uint8_t palette[8];
+	build_palette(palette, red0, red1);
+
+	uint64_t block = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best_code = 0;
+		int best_diff = 256;
+		for (int code = 0; code < 8; code++)
 		{
-			int code = int((bits >> (3 * i)) & 7);
-			switch (code)
+			int diff = std::abs(int(input_r[i]) - int(palette[code]));
+			if (diff < best_diff)
 			{
-			default:
-			case 0:
-				output_r[i] = red0;
-				break;
-
-			case 1:
-				output_r[i] = red1;
-				break;
-
-			case 2:
-				output_r[i] = uint8_t(((red0 * 6 + red1 * 1) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 3:
-				output_r[i] = uint8_t(((red0 * 5 + red1 * 2) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 4:
-				output_r[i] = uint8_t(((red0 * 4 + red1 * 3) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 5:
-				output_r[i] = uint8_t(((red0 * 3 + red1 * 4) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 6:
-				output_r[i] = uint8_t(((red0 * 2 + red1 * 5) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 7:
-				output_r[i] = uint8_t(((red0 * 1 + red1 * 6) * div_7 + 0x80000) >> 20);
-				break;
+				best_diff = diff;
+				best_code = code;
 			}
 		}
+
+		block |= uint64_t(best_code) << (3 * i);
 	}
-	else
+
+	output_r[0] = uint8_t(red0);
+	output_r[1] = uint8_t(red1);
+	for (int i = 0; i < 6; i++)
+		output_r[2 + i] = uint8_t((block >> (8 * i)) & 0xff);
+}
+
+namespace
+{
+struct EndpointSearch
+{
+	const uint8_t *input_r;
+	unsigned best_error = UINT32_MAX;
+	int best_red0 = 0;
+	int best_red1 = 0;
+
+	bool try_endpoints(int red0, int red1)
 	{
-		for (int i = 0; i < 16; i++)
+		uint8_t palette[8];
+		build_palette(palette, red0, red1);
+		unsigned error = compute_palette_error(palette, input_r);
+		if (error < best_error)
+		{
+			best_error = error;
+			best_red0 = red0;
+			best_red1 = red1;
+			return true;
+		}
+		else
+			return false;
+	}
+
+	// Tries every pair of distinct values in the sorted block as endpoints.
+	// With red0 <= red1, the palette also has 0 and 255 which absorb outliers.
+	void try_sorted_pairs(const uint8_t *sorted, bool six_interpolated)
+	{
+		for (int lo = 0; lo < 16 && best_error; lo++)
+		{
+			if (lo && sorted[lo] == sorted[lo - 1])
+				continue;
+
+			for (int hi = lo; hi < 16; hi++)
+			{
+				if (hi > lo && sorted[hi] == sorted[hi - 1])
+					continue;
+
+				if (six_interpolated)
+				{
+					if (sorted[hi] > sorted[lo])
+						try_endpoints(sorted[hi], sorted[lo]);
+				}
+				else
+					try_endpoints(sorted[lo], sorted[hi]);
+			}
+		}
+	}
+
+	// Moves both endpoints around in a window until the error stops improving.
+	// Swapping the order of the endpoints switches between the two palette modes.
+	void refine(int radius)
+	{
+		bool improved = true;
+		while (improved && best_error)
 		{
-			int code = int((bits >> (3 * i)) & 7);
-			switch (code)
+			improved = false;
+			int center0 = best_red0;
+			int center1 = best_red1;
+
+			for (int y = std::max(center1 - radius, 0); y <= std::min(center1 + radius, 255); y++)
 			{
-			default:
-			case 0:
-				output_r[i] = red0;
-				break;
-
-			case 1:
-				output_r[i] = red1;
-				break;
-
-			case 2:
-				output_r[i] = uint8_t(((red0 * 4 + red1 * 1) * div_5 + 0x80000) >> 20);
-				break;
-
-			case 3:
-				output_r[i] = uint8_t(((red0 * 3 + red1 * 2) * div_5 + 0x80000) >> 20);
-				break;
-
-			case 4:
-				output_r[i] = uint8_t(((red0 * 2 + red1 * 3) * div_5 + 0x80000) >> 20);
-				break;
-
-			case 5:
-				output_r[i] = uint8_t(((red0 * 1 + red1 * 4) * div_5 + 0x80000) >> 20);
-				break;
-
-			case 6:
-				output_r[i] = 0;
-				break;
-
-			case 7:
-				output_r[i] = 255;
-				break;
+				for (int x = std::max(center0 - radius, 0); x <= std::min(center0 + radius, 255); x++)
+				{
+					if (try_endpoints(x, y))
+						improved = true;
+					if (x != y && try_endpoints(y, x))
+						improved = true;
+				}
 			}
 		}
 	}
+};
 }
 
-void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r)
+void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r, RGTCQuality quality)
+{
+	int block_lo = 255;
+	int block_hi = 0;
+
+	for (int i = 0; i < 16; i++)
+	{
+		block_lo = std::min<int>(block_lo, input_r[i]);
+		block_hi = std::max<int>(block_hi, input_r[i]);
+	}
+
+	EndpointSearch search;
+	search.input_r = input_r;
+
+	// The full range with 6 interpolated values is a good start, and optimal for small ranges.
+	if (block_hi > block_lo)
+		search.try_endpoints(block_hi, block_lo);
+	else
+		search.try_endpoints(block_lo, block_lo);
+
+	if (block_hi - block_lo >= range_threshold || quality == RGTCQuality::High)
+	{
+		uint8_t sorted[16];
+		std::copy(input_r, input_r + 16, sorted);
+		std::sort(std::begin(sorted), std::end(sorted));
+
+		search.try_sorted_pairs(sorted, false);
+		if (quality == RGTCQuality::High)
+		{
+			search.try_sorted_pairs(sorted, true);
+			search.refine(3);
+		}
+	}
+
+	encode_block(output_r, input_r, search.best_red0, search.best_red1);
+}
+
+void compress_rgtc_red_green_block(uint8_t *output_rg, const uint8_t *input_r, const uint8_t *input_g,
+                                   RGTCQuality quality)
+{
+	compress_rgtc_red_block(output_rg, input_r, quality);
+	compress_rgtc_red_block(output_rg + 8, input_g, quality);
+}
+
+void compress_rgtc_red_block_reference(uint8_t *output_r, const uint8_t *input_r)
 {
 	int block_lo = 255;
 	int block_hi = 0;
@@ -339,10 +512,4 @@ void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r)
 	for (int i = 0; i < 6; i++)
 		output_r[2 + i] = uint8_t((block >> (8 * i)) & 0xff);
 }
-
-void compress_rgtc_red_green_block(uint8_t *output_rg, const uint8_t *input_r, const uint8_t *input_g)
-{
-	compress_rgtc_red_block(output_rg, input_r);
-	compress_rgtc_red_block(output_rg + 8, input_g);
 }
-}
\ No newline at end of file
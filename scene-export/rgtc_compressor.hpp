@@ -26,7 +26,25 @@
 
 namespace Granite
 {
-void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r);
-void compress_rgtc_red_green_block(uint8_t *output_rg, const uint8_t *input_r, const uint8_t *input_g);
+enum class RGTCQuality
+{
+	// Full range, or the best sub-range of the block with explicit 0 and 255 codes.
+	Default,
+	// Also tries sub-ranges with 6 interpolated values, then searches a window around
+	// the best endpoints until the error no longer improves.
+	High
+};
+
+// Endpoints are chosen by the squared error of the decoded block, so the result is never
+// worse than compress_rgtc_red_block_reference() for the same input.
+void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r, RGTCQuality quality = RGTCQuality::Default);
+void compress_rgtc_red_green_block(uint8_t *output_rg, const uint8_t *input_r, const uint8_t *input_g,
+                                   RGTCQuality quality = RGTCQuality::Default);
 void decompress_rgtc_red_block(uint8_t *output_r, const uint8_t *block);
+
+// Squared error of the decoded block against the 16 input values.
+unsigned compute_rgtc_red_block_error(const uint8_t *block, const uint8_t *input_r);
+
+// The original scalar encoder, kept as a baseline for tests and benchmarks.
+void compress_rgtc_red_block_reference(uint8_t *output_r, const uint8_t *input_r);
 }
\ No newline at end of file
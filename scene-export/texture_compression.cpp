@@ -25,7 +25,11 @@
 #include "texture_files.hpp"
 #include "format.hpp"
 #include "muglm/muglm_impl.hpp"
+#include "timer.hpp"
 #include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
 #include <string.h>
 
 #ifdef HAVE_ISPC
@@ -159,17 +163,34 @@ struct CompressorState : std::enable_shared_from_this<CompressorState>
 	unsigned block_size_x = 1;
 	unsigned block_size_y = 1;
 
+	// Levels are split into tiles which are grouped into tasks of roughly equal cost.
+	enum class TileKernel
+	{
+		RGTC,
+		ISPC,
+		Copy8,
+		Copy16
+	};
+
 	void setup();
 	void enqueue_compression(ThreadGroup &group);
-	void enqueue_compression_block_ispc(TaskGroupHandle &group, unsigned layer, unsigned level);
 	void enqueue_compression_block_astc(TaskGroupHandle &group, unsigned layer, unsigned level, TextureMode mode);
-	void enqueue_compression_block_rgtc(TaskGroupHandle &group, unsigned layer, unsigned level);
-	void enqueue_compression_copy_8bit(TaskGroupHandle &group, unsigned layer, unsigned level);
-	void enqueue_compression_copy_16bit(TaskGroupHandle &group, unsigned layer, unsigned level);
+	void enqueue_tiles(TaskGroupHandle &group, TileKernel kernel, unsigned layer, unsigned level);
+	void get_tile_size(TileKernel kernel, unsigned level, unsigned &width, unsigned &height) const;
+	void compress_tile(TileKernel kernel, unsigned layer, unsigned level, int x, int y, double *error);
+	void compress_block_rgtc(unsigned layer, unsigned level, int x, int y, double *error);
+	void compress_tile_ispc(unsigned layer, unsigned level, int x, int y);
+	void copy_row_8bit(unsigned layer, unsigned level, int y);
+	void copy_row_16bit(unsigned layer, unsigned level, int y);
+	void mark_started();
 
 	double total_error[4] = {};
 	std::mutex lock;
 	TaskSignal *signal = nullptr;
+
+	double cost_per_pixel = 1.0;
+	uint64_t total_pixels = 0;
+	std::atomic<int64_t> start_time{0};
 };
 
 void CompressorState::setup()
@@ -440,288 +461,426 @@ void CompressorState::setup()
 	}
 }
 
-void CompressorState::enqueue_compression_copy_16bit(TaskGroupHandle &group, unsigned layer, unsigned level)
+// Relative cost per pixel of each encoder, normalized to a plain copy.
+// These are ballpark figures, only used to size work units and to order textures.
+static double get_cost_per_pixel(VkFormat format, unsigned quality)
 {
-	group->enqueue_task([=]() {
-		auto &input_layout = input->get_layout();
-		auto &output_layout = output->get_layout();
-		auto input_stride = input_layout.get_block_stride();
-		auto output_stride = output_layout.get_block_stride();
-
-		u16vec4 tmp(0, 0, 0, floatToHalf(1.0f));
-		if (input_stride <= sizeof(u16vec4) && output_stride <= sizeof(u16vec4))
-		{
-			unsigned width = input_layout.get_width(level);
-			unsigned height = input_layout.get_height(level);
+	quality = std::max(1u, std::min(quality, 5u));
 
-			for (unsigned y = 0; y < height; y++)
-			{
-				for (unsigned x = 0; x < width; x++)
-				{
-					void *output_opaque = output_layout.data_opaque(x, y, layer, level);
-					void *input_opaque = input_layout.data_opaque(x, y, layer, level);
-					memcpy(tmp.data, input_opaque, input_stride);
-					memcpy(output_opaque, tmp.data, output_stride);
-				}
-			}
-		}
+	switch (format)
+	{
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		return quality >= 4 ? 32.0 : 8.0;
+
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		return quality >= 4 ? 64.0 : 16.0;
+
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		return 4.0;
+
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+		return 8.0;
+
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+		return 16.0 * double(1u << (quality - 1));
+
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+		return 32.0 * double(1u << (quality - 1));
+
+	case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+	case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_4x4_SFLOAT_BLOCK_EXT:
+	case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:
+	case VK_FORMAT_ASTC_5x5_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_5x5_SFLOAT_BLOCK_EXT:
+	case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+	case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_6x6_SFLOAT_BLOCK_EXT:
+	case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+	case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_8x8_SFLOAT_BLOCK_EXT:
+		if (quality >= 5)
+			return 1024.0;
+		else if (quality >= 4)
+			return 256.0;
+		else if (quality >= 3)
+			return 128.0;
 		else
-			LOGE("Format is not as expected.\n");
-	});
+			return 64.0;
+
+	default:
+		return 1.0;
+	}
 }
 
-void CompressorState::enqueue_compression_copy_8bit(TaskGroupHandle &group, unsigned layer, unsigned level)
+// Amount of work per task, in copied pixels. Large enough to amortize the task overhead,
+// small enough that the tail of an export is spread over all workers.
+static constexpr double TargetUnitCost = 256.0 * 1024.0;
+
+double estimate_compression_cost(const CompressorArguments &args, const Vulkan::TextureFormatLayout &layout)
 {
-	group->enqueue_task([=]() {
-		auto &input_layout = input->get_layout();
-		auto &output_layout = output->get_layout();
-		auto input_stride = input_layout.get_block_stride();
-		auto output_stride = output_layout.get_block_stride();
+	double pixels = 0.0;
+	for (unsigned level = 0; level < layout.get_levels(); level++)
+		pixels += double(layout.get_width(level)) * double(layout.get_height(level));
+	return pixels * double(layout.get_layers()) * get_cost_per_pixel(args.format, args.quality);
+}
 
-		if (input_stride <= sizeof(u8vec4) && output_stride <= sizeof(u8vec4))
-		{
-			unsigned width = input_layout.get_width(level);
-			unsigned height = input_layout.get_height(level);
-			u8vec4 tmp(0, 0, 0, 255);
+void CompressorState::mark_started()
+{
+	if (start_time.load(std::memory_order_relaxed) == 0)
+	{
+		int64_t expected = 0;
+		start_time.compare_exchange_strong(expected, Util::get_current_time_nsecs(), std::memory_order_relaxed);
+	}
+}
 
-			for (unsigned y = 0; y < height; y++)
+void CompressorState::get_tile_size(TileKernel kernel, unsigned level, unsigned &width, unsigned &height) const
+{
+	switch (kernel)
+	{
+	case TileKernel::RGTC:
+		width = block_size_x;
+		height = block_size_y;
+		break;
+
+	case TileKernel::ISPC:
+		width = (32 / block_size_x) * block_size_x;
+		height = (32 / block_size_y) * block_size_y;
+		break;
+
+	default:
+		width = input->get_layout().get_width(level);
+		height = 1;
+		break;
+	}
+}
+
+void CompressorState::enqueue_tiles(TaskGroupHandle &group, TileKernel kernel, unsigned layer, unsigned level)
+{
+	unsigned tile_width, tile_height;
+	get_tile_size(kernel, level, tile_width, tile_height);
+
+	auto &layout = input->get_layout();
+	unsigned tiles_x = (layout.get_width(level) + tile_width - 1) / tile_width;
+	unsigned tiles_y = (layout.get_height(level) + tile_height - 1) / tile_height;
+	unsigned num_tiles = tiles_x * tiles_y;
+	if (!num_tiles)
+		return;
+
+	// Tiles are handed out in row-major order, so a unit is a band of block rows,
+	// or part of a row if a single row is already more than a unit's worth of work.
+	double tile_cost = double(tile_width) * double(tile_height) * cost_per_pixel;
+	unsigned tiles_per_unit = unsigned(muglm::clamp(TargetUnitCost / tile_cost, 1.0, double(num_tiles)));
+	unsigned num_units = (num_tiles + tiles_per_unit - 1) / tiles_per_unit;
+	// Spread tiles evenly rather than leaving a small remainder unit at the end.
+	tiles_per_unit = (num_tiles + num_units - 1) / num_units;
+
+	for (unsigned first = 0; first < num_tiles; first += tiles_per_unit)
+	{
+		unsigned last = std::min(num_tiles, first + tiles_per_unit);
+		group->enqueue_task([this, kernel, layer, level, first, last, tiles_x, tile_width, tile_height]() {
+			mark_started();
+
+			double error[2] = {};
+			for (unsigned tile = first; tile < last; tile++)
 			{
-				for (unsigned x = 0; x < width; x++)
-				{
-					void *output_opaque = output_layout.data_opaque(x, y, layer, level);
-					void *input_opaque = input_layout.data_opaque(x, y, layer, level);
-					memcpy(tmp.data, input_opaque, input_stride);
-					memcpy(output_opaque, tmp.data, output_stride);
-				}
+				int x = int((tile % tiles_x) * tile_width);
+				int y = int((tile / tiles_x) * tile_height);
+				compress_tile(kernel, layer, level, x, y, error);
+			}
+
+			if (error[0] != 0.0 || error[1] != 0.0)
+			{
+				std::lock_guard<std::mutex> l{lock};
+				total_error[0] += error[0];
+				total_error[1] += error[1];
 			}
+		});
+	}
+}
+
+void CompressorState::compress_tile(TileKernel kernel, unsigned layer, unsigned level, int x, int y, double *error)
+{
+	switch (kernel)
+	{
+	case TileKernel::RGTC:
+		compress_block_rgtc(layer, level, x, y, error);
+		break;
+
+	case TileKernel::ISPC:
+#ifdef HAVE_ISPC
+		compress_tile_ispc(layer, level, x, y);
+#endif
+		break;
+
+	case TileKernel::Copy8:
+		copy_row_8bit(layer, level, y);
+		break;
+
+	case TileKernel::Copy16:
+		copy_row_16bit(layer, level, y);
+		break;
+	}
+}
+
+template <size_t OutputStride>
+static void copy_texels(uint8_t *output, const uint8_t *input, unsigned width, size_t input_stride)
+{
+	for (unsigned x = 0; x < width; x++)
+		memcpy(output + x * OutputStride, input + x * input_stride, OutputStride);
+}
+
+// Rows are contiguous in both layouts. Missing components are filled in from tmp.
+static void copy_row(void *output, const void *input, unsigned width,
+                     size_t output_stride, size_t input_stride, void *tmp)
+{
+	auto *output_bytes = static_cast<uint8_t *>(output);
+	auto *input_bytes = static_cast<const uint8_t *>(input);
+
+	if (output_stride == input_stride)
+	{
+		memcpy(output_bytes, input_bytes, width * input_stride);
+		return;
+	}
+
+	// Dropping components is the common case. A fixed size lets each texel be a single load and store.
+	if (output_stride < input_stride)
+	{
+		switch (output_stride)
+		{
+		case 1:
+			copy_texels<1>(output_bytes, input_bytes, width, input_stride);
+			return;
+		case 2:
+			copy_texels<2>(output_bytes, input_bytes, width, input_stride);
+			return;
+		case 4:
+			copy_texels<4>(output_bytes, input_bytes, width, input_stride);
+			return;
+		default:
+			break;
 		}
-		else
-			LOGE("Format is not as expected.\n");
-	});
+	}
+
+	for (unsigned x = 0; x < width; x++)
+	{
+		memcpy(tmp, input_bytes + x * input_stride, input_stride);
+		memcpy(output_bytes + x * output_stride, tmp, output_stride);
+	}
 }
 
-void CompressorState::enqueue_compression_block_rgtc(TaskGroupHandle &group, unsigned layer, unsigned level)
+void CompressorState::copy_row_16bit(unsigned layer, unsigned level, int y)
 {
-	int width = input->get_layout().get_width(level);
-	int height = input->get_layout().get_height(level);
+	auto &input_layout = input->get_layout();
+	auto &output_layout = output->get_layout();
+
+	u16vec4 tmp(0, 0, 0, floatToHalf(1.0f));
+	copy_row(output_layout.data_opaque(0, y, layer, level), input_layout.data_opaque(0, y, layer, level),
+	         input_layout.get_width(level), output_layout.get_block_stride(), input_layout.get_block_stride(),
+	         tmp.data);
+}
+
+void CompressorState::copy_row_8bit(unsigned layer, unsigned level, int y)
+{
+	auto &input_layout = input->get_layout();
+	auto &output_layout = output->get_layout();
+
+	u8vec4 tmp(0, 0, 0, 255);
+	copy_row(output_layout.data_opaque(0, y, layer, level), input_layout.data_opaque(0, y, layer, level),
+	         input_layout.get_width(level), output_layout.get_block_stride(), input_layout.get_block_stride(),
+	         tmp.data);
+}
+
+void CompressorState::compress_block_rgtc(unsigned layer, unsigned level, int x, int y, double *error)
+{
+	auto &layout = input->get_layout();
+	int width = layout.get_width(level);
+	int height = layout.get_height(level);
 	int blocks_x = (width + block_size_x - 1) / block_size_x;
 
-	for (int y = 0; y < height; y += block_size_y)
+	uint8_t padded_red[4 * 4];
+	uint8_t padded_green[4 * 4];
+	auto *src = static_cast<const uint8_t *>(layout.data(layer, level));
+	unsigned pixel_stride = layout.get_block_stride();
+
+	const auto get_block_data = [&](int block_size) -> uint8_t * {
+		auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
+		dst += (x / block_size_x) * block_size;
+		dst += (y / block_size_y) * blocks_x * block_size;
+		return dst;
+	};
+
+	const auto get_encode_data = [&](int block_size) -> uint8_t * {
+		return get_block_data(block_size);
+	};
+
+	const auto get_component = [&](int sx, int sy, int c) -> uint8_t {
+		sx = std::min(sx, width - 1);
+		sy = std::min(sy, height - 1);
+		return src[pixel_stride * (sy * width + sx) + c];
+	};
+
+	for (int sy = 0; sy < 4; sy++)
 	{
-		for (int x = 0; x < width; x += block_size_x)
+		for (int sx = 0; sx < 4; sx++)
 		{
-			group->enqueue_task([=, format = args.format]() {
-				auto &layout = input->get_layout();
-				uint8_t padded_red[4 * 4];
-				uint8_t padded_green[4 * 4];
-				auto *src = static_cast<const uint8_t *>(layout.data(layer, level));
-				unsigned pixel_stride = layout.get_block_stride();
-
-				const auto get_block_data = [&](int block_size) -> uint8_t * {
-					auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
-					dst += (x / block_size_x) * block_size;
-					dst += (y / block_size_y) * blocks_x * block_size;
-					return dst;
-				};
-
-				const auto get_encode_data = [&](int block_size) -> uint8_t * {
-					return get_block_data(block_size);
-				};
-
-				const auto get_component = [&](int sx, int sy, int c) -> uint8_t {
-					sx = std::min(sx, width - 1);
-					sy = std::min(sy, height - 1);
-					return src[pixel_stride * (sy * width + sx) + c];
-				};
-
-				for (int sy = 0; sy < 4; sy++)
-				{
-					for (int sx = 0; sx < 4; sx++)
-					{
-						padded_red[sy * 4 + sx] = get_component(x + sx, y + sy, 0);
-						if (pixel_stride > 1)
-							padded_green[sy * 4 + sx] = get_component(x + sx, y + sy, 1);
-					}
-				}
+			padded_red[sy * 4 + sx] = get_component(x + sx, y + sy, 0);
+			if (pixel_stride > 1)
+				padded_green[sy * 4 + sx] = get_component(x + sx, y + sy, 1);
+		}
+	}
 
-				switch (format)
-				{
-				case VK_FORMAT_BC4_UNORM_BLOCK:
-				{
-					compress_rgtc_red_block(get_encode_data(8), padded_red);
+	// The exhaustive endpoint search is several times slower, only use it when asked for quality.
+	RGTCQuality quality = args.quality >= 4 ? RGTCQuality::High : RGTCQuality::Default;
+
+	switch (args.format)
+	{
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	{
+		compress_rgtc_red_block(get_encode_data(8), padded_red, quality);
 
 #ifdef RGTC_DEBUG
-					if (level == 0 && layer == 0)
-					{
-						uint8_t decoded_red[16];
-						decompress_rgtc_red_block(decoded_red, get_encode_data(8));
-						double error = 0.0;
-						for (int i = 0; i < 16; i++)
-							error += double((decoded_red[i] - padded_red[i]) * (decoded_red[i] - padded_red[i])) / (width * height);
-
-						std::lock_guard<std::mutex> l{lock};
-						total_error[0] += error;
-					}
+		if (level == 0 && layer == 0)
+			error[0] += double(compute_rgtc_red_block_error(get_encode_data(8), padded_red)) / (width * height);
+#else
+		(void)error;
 #endif
-					break;
-				}
+		break;
+	}
 
-				case VK_FORMAT_BC5_UNORM_BLOCK:
-				{
-					compress_rgtc_red_green_block(get_encode_data(16), padded_red, padded_green);
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	{
+		compress_rgtc_red_green_block(get_encode_data(16), padded_red, padded_green, quality);
 
 #ifdef RGTC_DEBUG
-					if (level == 0 && layer == 0)
-					{
-						uint8_t decoded_red[16];
-						uint8_t decoded_green[16];
-						decompress_rgtc_red_block(decoded_red, get_encode_data(16));
-						decompress_rgtc_red_block(decoded_green, get_encode_data(16) + 8);
-
-						double error_red = 0.0;
-						double error_green = 0.0;
-						for (int i = 0; i < 16; i++)
-							error_red += double((decoded_red[i] - padded_red[i]) * (decoded_red[i] - padded_red[i])) / (width * height);
-						for (int i = 0; i < 16; i++)
-							error_green += double((decoded_green[i] - padded_green[i]) * (decoded_green[i] - padded_green[i])) / (width * height);
-
-						std::lock_guard<std::mutex> l{lock};
-						total_error[0] += error_red;
-						total_error[1] += error_green;
-					}
+		if (level == 0 && layer == 0)
+		{
+			error[0] += double(compute_rgtc_red_block_error(get_encode_data(16), padded_red)) / (width * height);
+			error[1] += double(compute_rgtc_red_block_error(get_encode_data(16) + 8, padded_green)) / (width * height);
+		}
+#else
+		(void)error;
 #endif
-					break;
-				}
+		break;
+	}
 
-				default:
-					break;
-				}
-			});
-		}
+	default:
+		break;
 	}
 }
 
 #ifdef HAVE_ISPC
-void CompressorState::enqueue_compression_block_ispc(TaskGroupHandle &group, unsigned layer, unsigned level)
+void CompressorState::compress_tile_ispc(unsigned layer, unsigned level, int x, int y)
 {
-	int width = input->get_layout().get_width(level);
-	int height = input->get_layout().get_height(level);
+	auto &layout = input->get_layout();
+	auto format = args.format;
+	int width = layout.get_width(level);
+	int height = layout.get_height(level);
 	int grid_stride_x = (32 / block_size_x) * block_size_x;
 	int grid_stride_y = (32 / block_size_y) * block_size_y;
 
-	for (int y = 0; y < height; y += grid_stride_y)
-	{
-		for (int x = 0; x < width; x += grid_stride_x)
+	uint8_t padded_buffer[32 * 32 * 8];
+	uint8_t encode_buffer[16 * 8 * 8];
+	rgba_surface surface = {};
+
+	assert(layout.get_block_stride() == output_format_to_input_stride(format));
+	surface.ptr = const_cast<uint8_t *>(static_cast<const uint8_t *>(layout.data(layer, level)));
+	surface.width = std::min(width - x, grid_stride_x);
+	surface.height = std::min(height - y, grid_stride_y);
+	surface.stride = width * output_format_to_input_stride(format);
+	surface.ptr += y * surface.stride + x * output_format_to_input_stride(format);
+
+	rgba_surface padded_surface = {};
+
+	int num_blocks_x = (surface.width + block_size_x - 1) / block_size_x;
+	int num_blocks_y = (surface.height + block_size_y - 1) / block_size_y;
+	int blocks_x = (width + block_size_x - 1) / block_size_x;
+
+	const auto get_block_data = [&](int bx, int by, int block_size) -> uint8_t * {
+		auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
+		dst += ((x / block_size_x) + bx) * block_size;
+		dst += ((y / block_size_y) + by) * blocks_x * block_size;
+		return dst;
+	};
+
+	const auto write_encode_data = [&](int block_size) {
+		for (int by = 0; by < num_blocks_y; by++)
 		{
-			group->enqueue_task([=, format = args.format]() {
-				auto &layout = input->get_layout();
-				uint8_t padded_buffer[32 * 32 * 8];
+			for (int bx = 0; bx < num_blocks_x; bx++)
+			{
+				auto *dst = get_block_data(bx, by, block_size);
+				memcpy(dst, &encode_buffer[(by * num_blocks_x + bx) * block_size], block_size);
+			}
+		}
+	};
 
-				union
-				{
-					u8vec4 splat_buffer8[32 * 32];
-					u16vec4 splat_buffer16[32 * 32];
-				};
-
-				uint8_t encode_buffer[16 * 8 * 8];
-				rgba_surface surface = {};
-
-				assert(layout.get_block_stride() == output_format_to_input_stride(format));
-				surface.ptr = const_cast<uint8_t *>(static_cast<const uint8_t *>(layout.data(layer, level)));
-				surface.width = std::min(width - x, grid_stride_x);
-				surface.height = std::min(height - y, grid_stride_y);
-				surface.stride = width * output_format_to_input_stride(format);
-				surface.ptr += y * surface.stride + x * output_format_to_input_stride(format);
-
-				rgba_surface padded_surface = {};
-
-				int num_blocks_x = (surface.width + block_size_x - 1) / block_size_x;
-				int num_blocks_y = (surface.height + block_size_y - 1) / block_size_y;
-				int blocks_x = (width + block_size_x - 1) / block_size_x;
-
-				const auto get_block_data = [&](int bx, int by, int block_size) -> uint8_t * {
-					auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
-					dst += ((x / block_size_x) + bx) * block_size;
-					dst += ((y / block_size_y) + by) * blocks_x * block_size;
-					return dst;
-				};
-
-				const auto write_encode_data = [&](int block_size) {
-					for (int by = 0; by < num_blocks_y; by++)
-					{
-						for (int bx = 0; bx < num_blocks_x; bx++)
-						{
-							auto *dst = get_block_data(bx, by, block_size);
-							memcpy(dst, &encode_buffer[(by * num_blocks_x + bx) * block_size], block_size);
-						}
-					}
-				};
-
-				if ((surface.width % block_size_x) || (surface.height % block_size_y))
-				{
-					padded_surface.width = num_blocks_x * block_size_x;
-					padded_surface.height = num_blocks_y * block_size_y;
-					padded_surface.stride = padded_surface.width * output_format_to_input_stride(format);
-					padded_surface.ptr = padded_buffer;
-					ReplicateBorders(&padded_surface, &surface, 0, 0, output_format_to_input_stride(format) * 8);
-				}
-				else
-					padded_surface = surface;
+	if ((surface.width % block_size_x) || (surface.height % block_size_y))
+	{
+		padded_surface.width = num_blocks_x * block_size_x;
+		padded_surface.height = num_blocks_y * block_size_y;
+		padded_surface.stride = padded_surface.width * output_format_to_input_stride(format);
+		padded_surface.ptr = padded_buffer;
+		ReplicateBorders(&padded_surface, &surface, 0, 0, output_format_to_input_stride(format) * 8);
+	}
+	else
+		padded_surface = surface;
 
-				switch (format)
-				{
-				case VK_FORMAT_BC6H_UFLOAT_BLOCK:
-				{
-					CompressBlocksBC6H(&padded_surface, encode_buffer, &bc6);
-					write_encode_data(16);
-					break;
-				}
+	switch (format)
+	{
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	{
+		CompressBlocksBC6H(&padded_surface, encode_buffer, &bc6);
+		write_encode_data(16);
+		break;
+	}
 
-				case VK_FORMAT_BC7_SRGB_BLOCK:
-				case VK_FORMAT_BC7_UNORM_BLOCK:
-				{
-					CompressBlocksBC7(&padded_surface, encode_buffer, &bc7);
-					write_encode_data(16);
-					break;
-				}
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	{
+		CompressBlocksBC7(&padded_surface, encode_buffer, &bc7);
+		write_encode_data(16);
+		break;
+	}
 
-				case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
-				case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
-				case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
-				case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
-				{
-					CompressBlocksBC1(&padded_surface, encode_buffer);
-					write_encode_data(8);
-					break;
-				}
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	{
+		CompressBlocksBC1(&padded_surface, encode_buffer);
+		write_encode_data(8);
+		break;
+	}
 
-				case VK_FORMAT_BC3_SRGB_BLOCK:
-				case VK_FORMAT_BC3_UNORM_BLOCK:
-				{
-					CompressBlocksBC3(&padded_surface, encode_buffer);
-					write_encode_data(16);
-					break;
-				}
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	{
+		CompressBlocksBC3(&padded_surface, encode_buffer);
+		write_encode_data(16);
+		break;
+	}
 
-				case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
-				case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
-				case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:
-				case VK_FORMAT_ASTC_5x5_UNORM_BLOCK:
-				case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
-				case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
-				case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
-				case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
-				{
-					CompressBlocksASTC(&padded_surface, encode_buffer, &astc);
-					write_encode_data(16);
-					break;
-				}
+	case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+	case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:
+	case VK_FORMAT_ASTC_5x5_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+	case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+	case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
+	{
+		CompressBlocksASTC(&padded_surface, encode_buffer, &astc);
+		write_encode_data(16);
+		break;
+	}
 
-				default:
-					break;
-				}
-			});
-		}
+	default:
+		break;
 	}
 }
 #endif
@@ -810,7 +969,11 @@ void CompressorState::enqueue_compression_block_astc(TaskGroupHandle &compressio
 	// Seems to be a bug in astcenc itself.
 
 	auto *group = compression_task->get_thread_group();
-	auto num_threads = muglm::max(1u, group->get_num_threads() / 4);
+	auto max_threads = muglm::max(1u, group->get_num_threads() / 4);
+
+	// astcenc splits a level internally, so only scale the number of tasks with the work in it.
+	double level_cost = double(width) * double(height) * cost_per_pixel;
+	auto num_threads = unsigned(muglm::clamp(std::ceil(level_cost / TargetUnitCost), 1.0, double(max_threads)));
 
 	astcenc_context *context = nullptr;
 	if (astcenc_context_alloc(&state->config, num_threads, &context) != ASTCENC_SUCCESS)
@@ -842,6 +1005,7 @@ void CompressorState::enqueue_compression_block_astc(TaskGroupHandle &compressio
 	for (unsigned i = 0; i < num_threads; i++)
 	{
 		compression_task->enqueue_task([this, state, i, swiz]() {
+			mark_started();
 			if (astcenc_compress_image(state->context.get(), &state->image, &swiz,
 					static_cast<uint8_t *>(output->get_layout().data(state->layer, state->level)),
 					output->get_layout().get_layer_size(state->level), i) != ASTCENC_SUCCESS)
@@ -856,6 +1020,16 @@ void CompressorState::enqueue_compression_block_astc(TaskGroupHandle &compressio
 void CompressorState::enqueue_compression(ThreadGroup &group)
 {
 	auto compression_task = group.create_task();
+	auto &layout = input->get_layout();
+
+	cost_per_pixel = get_cost_per_pixel(args.format, args.quality);
+	for (unsigned level = 0; level < layout.get_levels(); level++)
+		total_pixels += uint64_t(layout.get_width(level)) * layout.get_height(level) * layout.get_layers();
+
+	bool copy_8bit_supported = layout.get_block_stride() <= sizeof(u8vec4) &&
+	                           output->get_layout().get_block_stride() <= sizeof(u8vec4);
+	bool copy_16bit_supported = layout.get_block_stride() <= sizeof(u16vec4) &&
+	                            output->get_layout().get_block_stride() <= sizeof(u16vec4);
 
 	for (unsigned layer = 0; layer < input->get_layout().get_layers(); layer++)
 	{
@@ -865,7 +1039,7 @@ void CompressorState::enqueue_compression(ThreadGroup &group)
 			{
 			case VK_FORMAT_BC4_UNORM_BLOCK:
 			case VK_FORMAT_BC5_UNORM_BLOCK:
-				enqueue_compression_block_rgtc(compression_task, layer, level);
+				enqueue_tiles(compression_task, TileKernel::RGTC, layer, level);
 				break;
 
 			case VK_FORMAT_BC6H_UFLOAT_BLOCK:
@@ -878,7 +1052,7 @@ void CompressorState::enqueue_compression(ThreadGroup &group)
 			case VK_FORMAT_BC3_SRGB_BLOCK:
 			case VK_FORMAT_BC3_UNORM_BLOCK:
 #ifdef HAVE_ISPC
-				enqueue_compression_block_ispc(compression_task, layer, level);
+				enqueue_tiles(compression_task, TileKernel::ISPC, layer, level);
 #endif
 				break;
 
@@ -892,7 +1066,7 @@ void CompressorState::enqueue_compression(ThreadGroup &group)
 			case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
 #ifdef HAVE_ISPC
 				if (!use_astc_encoder)
-					enqueue_compression_block_ispc(compression_task, layer, level);
+					enqueue_tiles(compression_task, TileKernel::ISPC, layer, level);
 				else
 #endif
 				{
@@ -915,13 +1089,19 @@ void CompressorState::enqueue_compression(ThreadGroup &group)
 			case VK_FORMAT_R8G8B8A8_UNORM:
 			case VK_FORMAT_R8G8_UNORM:
 			case VK_FORMAT_R8_UNORM:
-				enqueue_compression_copy_8bit(compression_task, layer, level);
+				if (copy_8bit_supported)
+					enqueue_tiles(compression_task, TileKernel::Copy8, layer, level);
+				else
+					LOGE("Format is not as expected.\n");
 				break;
 
 			case VK_FORMAT_R16G16B16A16_SFLOAT:
 			case VK_FORMAT_R16G16_SFLOAT:
 			case VK_FORMAT_R16_SFLOAT:
-				enqueue_compression_copy_16bit(compression_task, layer, level);
+				if (copy_16bit_supported)
+					enqueue_tiles(compression_task, TileKernel::Copy16, layer, level);
+				else
+					LOGE("Format is not as expected.\n");
 				break;
 
 			default:
@@ -937,6 +1117,16 @@ void CompressorState::enqueue_compression(ThreadGroup &group)
 		if (state->total_error[1] != 0.0)
 			LOGI("Green PSNR: %.f dB\n", 10.0 * log10(255.0 * 255.0 / state->total_error[1]));
 
+		// Wall-clock time from the first unit starting, which includes sharing the workers with other textures.
+		int64_t start_time = state->start_time.load(std::memory_order_relaxed);
+		if (start_time)
+		{
+			double seconds = 1e-9 * double(Util::get_current_time_nsecs() - start_time);
+			double mpix = 1e-6 * double(state->total_pixels);
+			LOGI("Compressed %s: %.2f MPix in %.3f s, %.1f MPix/s.\n",
+			     state->args.output.c_str(), mpix, seconds, seconds > 0.0 ? mpix / seconds : 0.0);
+		}
+
 		LOGI("Unmapping %u bytes for texture writing.\n", unsigned(state->output->get_required_size()));
 		LOGI("Unmapping %u bytes for texture reading.\n", unsigned(state->input->get_required_size()));
 
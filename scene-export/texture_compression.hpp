@@ -58,6 +58,11 @@ struct CompressorArguments
 };
 
 VkFormat string_to_format(const std::string &s);
+
+// Rough relative cost of compressing every layer and level in layout with args.
+// Only meaningful when compared against other estimates, e.g. to schedule the largest jobs first.
+double estimate_compression_cost(const CompressorArguments &args, const Vulkan::TextureFormatLayout &layout);
+
 bool compress_texture(ThreadGroup &group, const CompressorArguments &args,
                       const std::shared_ptr<Vulkan::MemoryMappedTexture> &input,
                       TaskGroupHandle &dep, TaskSignal *signal);
@@ -23,6 +23,10 @@
 #define NOMINMAX
 #include "texture_utils.hpp"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace Granite
 {
 namespace SceneFormats
@@ -474,21 +478,36 @@ bool swizzle_image(Vulkan::MemoryMappedTexture &texture, const VkComponentMappin
 
 static TransparencyType check_transparency(const Vulkan::TextureFormatLayout &layout, unsigned layer, unsigned level)
 {
+	// Uncompressed mips are tightly packed, so the slice can be scanned as one run of texels.
+	auto *texels = static_cast<const uint8_t *>(layout.data(layer, level));
+	size_t count = size_t(layout.get_width(level)) * layout.get_height(level);
 	bool non_opaque_pixel = false;
-	auto width = layout.get_width();
-	auto height = layout.get_height();
-	for (unsigned y = 0; y < height; y++)
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i alpha_mask = _mm_set1_epi32(int(0xff000000u));
+	__m128i any_transparent = _mm_setzero_si128();
+	for (; i + 4 <= count; i += 4)
 	{
-		for (unsigned x = 0; x < width; x++)
+		__m128i alpha = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(texels + 4 * i)), alpha_mask);
+		__m128i opaque = _mm_cmpeq_epi32(alpha, alpha_mask);
+		__m128i transparent = _mm_cmpeq_epi32(alpha, _mm_setzero_si128());
+		if (_mm_movemask_epi8(_mm_or_si128(opaque, transparent)) != 0xffff)
+			return TransparencyType::Floating;
+		any_transparent = _mm_or_si128(any_transparent, transparent);
+	}
+	non_opaque_pixel = _mm_movemask_epi8(any_transparent) != 0;
+#endif
+
+	for (; i < count; i++)
+	{
+		uint8_t alpha = texels[4 * i + 3];
+		if (alpha != 0xff)
 		{
-			uint8_t alpha = layout.data_2d<u8vec4>(x, y, layer, level)->w;
-			if (alpha != 0xff)
-			{
-				if (alpha == 0)
-					non_opaque_pixel = true;
-				else
-					return TransparencyType::Floating;
-			}
+			if (alpha == 0)
+				non_opaque_pixel = true;
+			else
+				return TransparencyType::Floating;
 		}
 	}
 
@@ -27,6 +27,8 @@
 #include "rapidjson_wrapper.hpp"
 #include "texture_files.hpp"
 #include "texture_utils.hpp"
+#include "thread_group.hpp"
+#include <algorithm>
 #include <stdexcept>
 
 using namespace rapidjson;
@@ -250,28 +252,51 @@ void TMXParser::parse(const std::string &base_path, const std::string &json)
 				base_y += y * tile_size.x;
 
 				copy_tile(tilemap.get_layout(), tile_dst_index, file.get_layout(), base_x, base_y);
-				auto transparency_type = SceneFormats::image_slice_contains_transparency(tilemap.get_layout(), tile_dst_index, 0);
+				tile_dst_index++;
+			}
+		}
+	}
 
-				auto &pipeline = tiles[tile_dst_index].pipeline;
+	// Each tile is its own layer, so tiles are classified in parallel, a batch per task.
+	constexpr unsigned TilesPerTask = 64;
+	unsigned num_batches = (tile_dst_index + TilesPerTask - 1) / TilesPerTask;
 
-				switch (transparency_type)
-				{
-				case SceneFormats::TransparencyType::None:
-					pipeline = DrawPipeline::Opaque;
-					break;
+	const auto classify_tiles = [&](unsigned batch) {
+		unsigned end_tile = std::min(tile_dst_index, (batch + 1) * TilesPerTask);
+		for (unsigned tile = batch * TilesPerTask; tile < end_tile; tile++)
+		{
+			auto &pipeline = tiles[tile].pipeline;
 
-				case SceneFormats::TransparencyType::Floating:
-					pipeline = DrawPipeline::AlphaBlend;
-					break;
+			switch (SceneFormats::image_slice_contains_transparency(tilemap.get_layout(), tile, 0))
+			{
+			case SceneFormats::TransparencyType::None:
+				pipeline = DrawPipeline::Opaque;
+				break;
 
-				case SceneFormats::TransparencyType::Binary:
-					pipeline = DrawPipeline::AlphaTest;
-					break;
-				}
+			case SceneFormats::TransparencyType::Floating:
+				pipeline = DrawPipeline::AlphaBlend;
+				break;
 
-				tile_dst_index++;
+			case SceneFormats::TransparencyType::Binary:
+				pipeline = DrawPipeline::AlphaTest;
+				break;
 			}
 		}
+	};
+
+	auto *workers = GRANITE_THREAD_GROUP();
+	if (workers && workers->get_num_threads() != 0 && num_batches > 1)
+	{
+		auto group = workers->create_task();
+		group->set_desc("tmx-classify-tiles");
+		for (unsigned batch = 0; batch < num_batches; batch++)
+			group->enqueue_task([&classify_tiles, batch]() { classify_tiles(batch); });
+		group->wait();
+	}
+	else
+	{
+		for (unsigned batch = 0; batch < num_batches; batch++)
+			classify_tiles(batch);
 	}
 
 	tilemap = SceneFormats::fixup_alpha_edges(tilemap.get_layout(), 0);
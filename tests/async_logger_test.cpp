@@ -0,0 +1,298 @@
+#include "async_logger.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace Util;
+
+static void log_to(LoggingInterface &iface, const char *fmt, ...)
+{
+	va_list va;
+	va_start(va, fmt);
+	iface.log("[INFO]: ", fmt, va);
+	va_end(va);
+}
+
+static std::string read_file(FILE *file)
+{
+	std::string str;
+	fflush(file);
+	rewind(file);
+	char buf[4096];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), file)) != 0)
+		str.append(buf, len);
+	return str;
+}
+
+static void log_format_cases(LoggingInterface &iface)
+{
+	const char *str = "granite";
+	log_to(iface, "plain\n");
+	log_to(iface, "%d %i %u %x %X %o %c %%\n", -42, 17, 4000000000u, 0xbeefu, 0xcafeu, 8u, 'g');
+	log_to(iface, "%hhd %hd %ld %lld %zu %td %jd\n", -3, -1234, -123456789l, -1234567890123ll,
+	       size_t(1) << 40, ptrdiff_t(-99), intmax_t(77));
+	log_to(iface, "%hhu %hu %lu %llu %zx\n", 255u, 65535u, 123456789ul, 12345678901234567ull, size_t(0xdead));
+	log_to(iface, "[%8.3f] [%-10.2e] [%g] [%+.1f] [%a]\n", 3.14159, 2.5e-7, 1e20, -0.05f, 1.0);
+	log_to(iface, "[%s] [%10s] [%-10s] [%.3s] [%s]\n", str, str, str, str, static_cast<const char *>(nullptr));
+	log_to(iface, "[%*d] [%-*d] [%.*f] [%*.*s]\n", 6, 42, 6, 42, 2, 1.23456, 10, 4, str);
+	log_to(iface, "[%#x] [%#o] [%05d] [% d] [%+d]\n", 255u, 8u, 42, 42, 42);
+	log_to(iface, "%s is %u frames behind\n", std::string(100, 'x').c_str(), 3u);
+}
+
+static bool test_binary_matches_text()
+{
+	FILE *text_file = tmpfile();
+	FILE *binary_file = tmpfile();
+	if (!text_file || !binary_file)
+		return false;
+
+	{
+		AsyncLoggerOptions options;
+		options.output = text_file;
+		AsyncLogger text_logger(options);
+		options.mode = AsyncLoggerOptions::Mode::Binary;
+		options.output = binary_file;
+		AsyncLogger binary_logger(options);
+
+		log_format_cases(text_logger);
+		log_format_cases(binary_logger);
+		text_logger.flush();
+		binary_logger.flush();
+	}
+
+	auto text = read_file(text_file);
+	auto binary = read_file(binary_file);
+	fclose(text_file);
+	fclose(binary_file);
+
+	if (text != binary || text.empty())
+	{
+		LOGE("Binary mode output differs from text mode.\nText:\n%s\nBinary:\n%s\n", text.c_str(), binary.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+static bool test_rate_limit()
+{
+	FILE *file = tmpfile();
+	if (!file)
+		return false;
+
+	AsyncLoggerOptions options;
+	options.output = file;
+	options.rate_limit_messages = 10;
+	options.rate_limit_window_ms = 100000;
+	AsyncLogger logger(options);
+
+	for (unsigned i = 0; i < 1000; i++)
+		log_to(logger, "Spam %u\n", i);
+	log_to(logger, "Other call site\n");
+	logger.flush();
+
+	auto output = read_file(file);
+	fclose(file);
+
+	if (logger.get_suppressed_count() != 990 || output.find("Spam 9\n") == std::string::npos ||
+	    output.find("Spam 10\n") != std::string::npos || output.find("Other call site") == std::string::npos)
+	{
+		LOGE("Rate limiting did not behave as expected, %llu suppressed.\n",
+		     static_cast<unsigned long long>(logger.get_suppressed_count()));
+		return false;
+	}
+
+	return true;
+}
+
+static bool test_threads(AsyncLoggerOptions::Mode mode)
+{
+	constexpr unsigned NumThreads = 8;
+	constexpr unsigned MessagesPerThread = 20000;
+
+	FILE *file = tmpfile();
+	if (!file)
+		return false;
+
+	AsyncLoggerOptions options;
+	options.output = file;
+	options.mode = mode;
+	options.thread_buffer_size = 4 * 1024 * 1024;
+	AsyncLogger logger(options);
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < NumThreads; t++)
+	{
+		threads.emplace_back([&logger, t]() {
+			for (unsigned i = 0; i < MessagesPerThread; i++)
+				log_to(logger, "thread %u message %u\n", t, i);
+		});
+	}
+
+	for (auto &thr : threads)
+		thr.join();
+	logger.flush();
+
+	auto output = read_file(file);
+	fclose(file);
+
+	// Every thread's messages must come out in order, and nothing may be lost unless it was reported as dropped.
+	std::vector<unsigned> next(NumThreads);
+	unsigned lines = 0;
+	size_t offset = 0;
+	while (offset < output.size())
+	{
+		size_t end = output.find('\n', offset);
+		if (end == std::string::npos)
+			end = output.size();
+		auto line = output.substr(offset, end - offset);
+		offset = end + 1;
+
+		unsigned t, i;
+		if (sscanf(line.c_str(), "[INFO]: thread %u message %u", &t, &i) == 2)
+		{
+			if (t >= NumThreads || i < next[t])
+			{
+				LOGE("Message %u from thread %u is out of order.\n", i, t);
+				return false;
+			}
+			next[t] = i + 1;
+			lines++;
+		}
+	}
+
+	if (lines + logger.get_dropped_count() != NumThreads * MessagesPerThread)
+	{
+		LOGE("Expected %u messages, got %u with %llu dropped.\n", NumThreads * MessagesPerThread, lines,
+		     static_cast<unsigned long long>(logger.get_dropped_count()));
+		return false;
+	}
+
+	return true;
+}
+
+// Time spent on the logging thread per message.
+#ifndef _WIN32
+// Text records still sitting in the rings when the process crashes must reach the output.
+static bool test_crash_drain()
+{
+	FILE *file = tmpfile();
+	if (!file)
+		return false;
+
+	pid_t pid = fork();
+	if (pid < 0)
+		return false;
+
+	if (pid == 0)
+	{
+		AsyncLoggerOptions options;
+		options.output = file;
+		// Make sure the drain thread does not get to it first.
+		options.drain_interval_ms = 60000;
+		auto *logger = new AsyncLogger(options);
+		logger->install_exit_handlers();
+		log_to(*logger, "Logged %d messages before crashing.\n", 1);
+		abort();
+	}
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+	auto output = read_file(file);
+	fclose(file);
+
+	if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGABRT)
+	{
+		LOGE("Crash was not passed on to the default handler.\n");
+		return false;
+	}
+
+	if (output != "[INFO]: Logged 1 messages before crashing.\n")
+	{
+		LOGE("Unexpected output after crash: \"%s\".\n", output.c_str());
+		return false;
+	}
+
+	return true;
+}
+#endif
+
+template <typename Func>
+static double measure_ns_per_message(unsigned count, const Func &func)
+{
+	auto start = get_current_time_nsecs();
+	for (unsigned i = 0; i < count; i++)
+		func(i);
+	auto end = get_current_time_nsecs();
+	return double(end - start) / double(count);
+}
+
+static void run_bench()
+{
+	constexpr unsigned NumMessages = 20000;
+	FILE *null_file = fopen(
+#ifdef _WIN32
+			"NUL",
+#else
+			"/dev/null",
+#endif
+			"w");
+	if (!null_file)
+		return;
+
+	double sync_ns = measure_ns_per_message(NumMessages, [&](unsigned i) {
+		fprintf(null_file, "[INFO]: Frame %u took %.3f ms on %s.\n", i, 16.6f, "main");
+		fflush(null_file);
+	});
+
+	AsyncLoggerOptions options;
+	options.output = null_file;
+	options.thread_buffer_size = 8 * 1024 * 1024;
+
+	double text_ns, binary_ns;
+	{
+		AsyncLogger logger(options);
+		text_ns = measure_ns_per_message(NumMessages, [&](unsigned i) {
+			log_to(logger, "Frame %u took %.3f ms on %s.\n", i, 16.6f, "main");
+		});
+	}
+
+	options.mode = AsyncLoggerOptions::Mode::Binary;
+	{
+		AsyncLogger logger(options);
+		binary_ns = measure_ns_per_message(NumMessages, [&](unsigned i) {
+			log_to(logger, "Frame %u took %.3f ms on %s.\n", i, 16.6f, "main");
+		});
+	}
+
+	fclose(null_file);
+	LOGI("Per message on the logging thread: fprintf + fflush %.0f ns, async text %.0f ns, async binary %.0f ns.\n",
+	     sync_ns, text_ns, binary_ns);
+}
+
+int main()
+{
+	if (!test_binary_matches_text())
+		return EXIT_FAILURE;
+	if (!test_rate_limit())
+		return EXIT_FAILURE;
+	if (!test_threads(AsyncLoggerOptions::Mode::Text))
+		return EXIT_FAILURE;
+	if (!test_threads(AsyncLoggerOptions::Mode::Binary))
+		return EXIT_FAILURE;
+#ifndef _WIN32
+	if (!test_crash_drain())
+		return EXIT_FAILURE;
+#endif
+
+	run_bench();
+	return EXIT_SUCCESS;
+}
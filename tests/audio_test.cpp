@@ -1,10 +1,12 @@
 #include "audio_mixer.hpp"
+#include "audio_submix.hpp"
 #include "audio_interface.hpp"
 #include "timer.hpp"
 #include "vorbis_stream.hpp"
 #include <chrono>
 #include <thread>
 #include <cmath>
+#include <string.h>
 #include "logging.hpp"
 #include "global_managers_init.hpp"
 #include "filesystem.hpp"
@@ -15,8 +17,150 @@
 using namespace Granite;
 using namespace Granite::Audio;
 
-int main()
+// Cheap oscillator so the stress test measures mixing rather than sinf().
+struct OscillatorStream final : MixerStream
 {
+	explicit OscillatorStream(float freq_)
+		: freq(freq_)
+	{
+	}
+
+	bool setup(float rate, unsigned channels, size_t max_num_frames) override
+	{
+		sample_rate = rate;
+		num_channels = channels;
+		buffer.resize(max_num_frames);
+		float w = 2.0f * 3.14159265f * freq / rate;
+		rot_cos = std::cos(w);
+		rot_sin = std::sin(w);
+		return true;
+	}
+
+	size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept override
+	{
+		for (size_t i = 0; i < num_frames; i++)
+		{
+			buffer[i] = im;
+			float new_re = re * rot_cos - im * rot_sin;
+			im = re * rot_sin + im * rot_cos;
+			re = new_re;
+		}
+
+		for (unsigned c = 0; c < num_channels; c++)
+			DSP::accumulate_channel(channels[c], buffer.data(), gain[c], num_frames);
+		return num_frames;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return sample_rate;
+	}
+
+	float freq;
+	float sample_rate = 0.0f;
+	unsigned num_channels = 0;
+	float rot_cos = 1.0f, rot_sin = 0.0f;
+	float re = 1.0f, im = 0.0f;
+	std::vector<float> buffer;
+};
+
+static void run_voice_stress(const char *tag, unsigned num_buses, unsigned voices_per_bus,
+                             bool use_buses, bool render_ahead)
+{
+	constexpr float SampleRate = 48000.0f;
+	constexpr size_t BlockFrames = 256;
+	constexpr unsigned NumBlocks = 750;
+
+	Mixer mixer;
+	mixer.set_backend_parameters(SampleRate, 2, BlockFrames);
+	mixer.on_backend_start();
+
+	std::vector<SubMixStream *> buses;
+	unsigned voice_index = 0;
+	auto make_voice = [&]() {
+		voice_index++;
+		return new OscillatorStream(100.0f + 3.0f * float(voice_index));
+	};
+
+	if (use_buses)
+	{
+		for (unsigned bus_index = 0; bus_index < num_buses; bus_index++)
+		{
+			SubMixOptions options;
+			options.render_ahead = render_ahead;
+			auto *bus = new SubMixStream(options);
+			if (!mixer.add_mixer_stream(bus))
+				return;
+			buses.push_back(bus);
+			for (unsigned i = 0; i < voices_per_bus; i++)
+				bus->get_mixer().add_mixer_stream(make_voice(), true, -40.0f, float(i & 1) - 0.5f);
+		}
+	}
+	else
+	{
+		for (unsigned i = 0; i < voices_per_bus; i++)
+			mixer.add_mixer_stream(make_voice(), true, -40.0f, float(i & 1) - 0.5f);
+	}
+
+	float l[BlockFrames];
+	float r[BlockFrames];
+	float *channels[2] = { l, r };
+
+	// Let render-ahead buses fill up before we start measuring.
+	if (render_ahead)
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	auto block_duration = std::chrono::nanoseconds(int64_t(1e9 * double(BlockFrames) / SampleRate));
+	auto next_deadline = std::chrono::steady_clock::now();
+	uint64_t total_time = 0;
+	uint64_t max_time = 0;
+
+	for (unsigned block = 0; block < NumBlocks; block++)
+	{
+		auto start = Util::get_current_time_nsecs();
+		mixer.mix_samples(channels, BlockFrames);
+		auto end = Util::get_current_time_nsecs();
+		total_time += end - start;
+		max_time = std::max<uint64_t>(max_time, end - start);
+
+		// Render-ahead only makes sense when the callback is paced like a real backend.
+		if (render_ahead)
+		{
+			next_deadline += block_duration;
+			std::this_thread::sleep_until(next_deadline);
+		}
+	}
+
+	uint64_t underruns = 0;
+	for (auto *bus : buses)
+		underruns += bus->get_underrun_count();
+
+	double budget_usec = 1e6 * double(BlockFrames) / SampleRate;
+	double avg_usec = 1e-3 * double(total_time) / NumBlocks;
+	LOGI("%-24s %4u voices: avg %8.2f us, max %8.2f us per %zu frame callback (%.1f %% of budget), %llu underruns.\n",
+	     tag, use_buses ? num_buses * voices_per_bus : voices_per_bus,
+	     avg_usec, 1e-3 * double(max_time), BlockFrames, 100.0 * avg_usec / budget_usec,
+	     static_cast<unsigned long long>(underruns));
+}
+
+static int run_voice_stress_bench()
+{
+	run_voice_stress("flat", 1, 128, false, false);
+	run_voice_stress("4 buses", 4, 128, true, false);
+	run_voice_stress("4 buses, render-ahead", 4, 128, true, true);
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc >= 2 && strcmp(argv[1], "--voice-stress") == 0)
+		return run_voice_stress_bench();
+
 	Global::init(/*Granite::Global::MANAGER_FEATURE_AUDIO_BIT |*/
 	             Granite::Global::MANAGER_FEATURE_FILESYSTEM_BIT);
 	GRANITE_FILESYSTEM()->register_protocol("assets", std::make_unique<OSFilesystem>(ASSET_DIRECTORY));
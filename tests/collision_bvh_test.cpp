@@ -0,0 +1,108 @@
+#include "physics_system.hpp"
+#include "logging.hpp"
+#include <cmath>
+#include <stdlib.h>
+#include <vector>
+
+using namespace Granite;
+
+// Flat grid of unit quads in the XZ plane. GridSize * GridSize * 2 == MaxQuantizedBvhTriangles.
+static constexpr unsigned GridSize = 1024;
+
+struct GridMesh
+{
+	std::vector<vec4> positions;
+	std::vector<uint32_t> indices;
+};
+
+static GridMesh build_grid()
+{
+	GridMesh grid;
+	grid.positions.reserve((GridSize + 1) * (GridSize + 1));
+	for (unsigned z = 0; z <= GridSize; z++)
+		for (unsigned x = 0; x <= GridSize; x++)
+			grid.positions.emplace_back(float(x), 0.0f, float(z), 1.0f);
+
+	grid.indices.reserve(GridSize * GridSize * 6);
+	for (unsigned z = 0; z < GridSize; z++)
+	{
+		for (unsigned x = 0; x < GridSize; x++)
+		{
+			uint32_t i00 = z * (GridSize + 1) + x;
+			uint32_t i10 = i00 + 1;
+			uint32_t i01 = i00 + GridSize + 1;
+			uint32_t i11 = i01 + 1;
+			grid.indices.insert(grid.indices.end(), { i00, i01, i10, i10, i01, i11 });
+		}
+	}
+
+	return grid;
+}
+
+static PhysicsSystem::CollisionMesh get_collision_mesh(const GridMesh &grid, unsigned num_triangles)
+{
+	PhysicsSystem::CollisionMesh mesh;
+	mesh.indices = grid.indices.data();
+	mesh.num_triangles = num_triangles;
+	mesh.index_stride_triangle = 3 * sizeof(uint32_t);
+	mesh.positions = grid.positions.front().data;
+	mesh.num_attributes = unsigned(grid.positions.size());
+	mesh.position_stride = sizeof(vec4);
+	mesh.aabb = AABB(vec3(0.0f), vec3(float(GridSize), 0.0f, float(GridSize)));
+	return mesh;
+}
+
+static bool ray_hits(PhysicsSystem &physics, float x, float z)
+{
+	auto result = physics.query_closest_hit_ray(vec3(x, 10.0f, z), vec3(0.0f, -1.0f, 0.0f), 20.0f);
+	return result.handle && std::abs(result.t - 10.0f) < 1e-3f;
+}
+
+static bool test_mesh(const GridMesh &grid, unsigned num_triangles)
+{
+	PhysicsSystem physics;
+	unsigned index = physics.register_collision_mesh(get_collision_mesh(grid, num_triangles));
+	physics.add_mesh(nullptr, index, {});
+
+	constexpr float Last = float(GridSize - 1);
+	bool last_triangle_present = num_triangles == GridSize * GridSize * 2;
+
+	// First triangle, the lower half of the last quad, and the upper half of the last quad,
+	// which holds the highest triangle index.
+	if (!ray_hits(physics, 0.25f, 0.25f))
+		return false;
+	if (!ray_hits(physics, Last + 0.25f, Last + 0.25f))
+		return false;
+	if (ray_hits(physics, Last + 0.75f, Last + 0.75f) != last_triangle_present)
+		return false;
+
+	return true;
+}
+
+int main()
+{
+	static_assert(GridSize * GridSize * 2 == PhysicsSystem::MaxQuantizedBvhTriangles, "Grid does not hit the boundary.");
+	auto grid = build_grid();
+
+	bool success = true;
+	const auto check = [&](bool result, const char *name) {
+		if (!result)
+		{
+			LOGE("%s failed.\n", name);
+			success = false;
+		}
+	};
+
+	// Largest mesh which still uses the quantized BVH, and the smallest one which falls back.
+	check(test_mesh(grid, PhysicsSystem::MaxQuantizedBvhTriangles - 1), "Quantized BVH");
+	check(test_mesh(grid, PhysicsSystem::MaxQuantizedBvhTriangles), "Unquantized BVH");
+
+	// The fallback is never cached, so offline tooling must refuse it.
+	check(!PhysicsSystem::write_collision_bvh_cache(
+			get_collision_mesh(grid, PhysicsSystem::MaxQuantizedBvhTriangles), "."),
+	      "Cache write refusal");
+
+	if (success)
+		LOGI("All tests passed.\n");
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,232 @@
+#include "dsp/convolution_reverb.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <thread>
+#include <chrono>
+
+using namespace Granite;
+using namespace Granite::Audio;
+
+// Deterministic white noise, optionally ending after a fixed number of frames.
+struct NoiseStream : MixerStream
+{
+	NoiseStream(unsigned num_channels_, size_t length_)
+		: num_channels(num_channels_), length(length_)
+	{
+	}
+
+	bool setup(float, unsigned, size_t) override
+	{
+		return true;
+	}
+
+	size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept override
+	{
+		size_t to_write = std::min(num_frames, length - position);
+		for (unsigned c = 0; c < num_channels; c++)
+			for (size_t i = 0; i < to_write; i++)
+				channels[c][i] += sample(c, position + i) * gain[c];
+		position += to_write;
+		return to_write;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return 48000.0f;
+	}
+
+	static float sample(unsigned channel, size_t index)
+	{
+		uint32_t v = uint32_t(index) * 0x9e3779b9u + channel * 0x85ebca6bu;
+		v ^= v >> 15;
+		v *= 0x2c1b3c6du;
+		v ^= v >> 12;
+		return float(v & 0xffff) / 32768.0f - 1.0f;
+	}
+
+	unsigned num_channels;
+	size_t length;
+	size_t position = 0;
+};
+
+// Exponentially decaying noise, roughly a 60 dB decay over the length.
+static std::vector<float> make_impulse(size_t frames, unsigned seed)
+{
+	std::mt19937 rnd(seed);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	std::vector<float> impulse(frames);
+	for (size_t i = 0; i < frames; i++)
+		impulse[i] = 0.1f * dist(rnd) * std::exp(-6.9f * float(i) / float(frames));
+	return impulse;
+}
+
+static bool test_against_direct(bool mono_impulse, bool background_tail)
+{
+	constexpr unsigned NumChannels = 2;
+	constexpr size_t InputFrames = 20000;
+	constexpr size_t ImpulseFrames = 6001;
+	constexpr size_t CallbackFrames = 100;
+
+	std::vector<float> impulses[NumChannels];
+	const float *impulse_ptrs[NumChannels];
+	for (unsigned c = 0; c < NumChannels; c++)
+	{
+		impulses[c] = make_impulse(ImpulseFrames, c + 1);
+		impulse_ptrs[c] = impulses[c].data();
+	}
+
+	DSP::ConvolutionReverbOptions options;
+	options.head_block_frames = 64;
+	options.tail_block_frames = 256;
+	options.background_tail = background_tail;
+	options.dry_gain = 0.5f;
+
+	DSP::ConvolutionReverbStream stream(new NoiseStream(NumChannels, InputFrames), impulse_ptrs,
+	                                    mono_impulse ? 1 : NumChannels, ImpulseFrames, options);
+	if (!stream.setup(48000.0f, NumChannels, CallbackFrames))
+		return false;
+
+	std::vector<float> output[NumChannels];
+	for (auto &o : output)
+		o.resize(InputFrames + ImpulseFrames + 4096);
+
+	const float gains[NumChannels] = { 1.0f, 1.0f };
+	size_t rendered = 0;
+	for (;;)
+	{
+		// Callbacks are not paced here, so the tail thread would fall behind and get dropped.
+		stream.wait_for_tail();
+
+		float *channels[NumChannels];
+		for (unsigned c = 0; c < NumChannels; c++)
+			channels[c] = output[c].data() + rendered;
+		size_t ret = stream.accumulate_samples(channels, gains, CallbackFrames);
+		rendered += ret;
+		if (ret < CallbackFrames)
+			break;
+	}
+
+	if (rendered < InputFrames + ImpulseFrames - 1)
+	{
+		LOGE("Reverb stopped after %zu frames, before ringing out.\n", rendered);
+		return false;
+	}
+
+	float max_error = 0.0f;
+	for (unsigned c = 0; c < NumChannels; c++)
+	{
+		const float *h = impulses[mono_impulse ? 0 : c].data();
+		for (size_t i = 0; i < InputFrames + ImpulseFrames - 1; i++)
+		{
+			double ref = i < InputFrames ? options.dry_gain * NoiseStream::sample(c, i) : 0.0;
+			size_t lo = i >= ImpulseFrames - 1 ? i - (ImpulseFrames - 1) : 0;
+			size_t hi = std::min(i, InputFrames - 1);
+			for (size_t j = lo; j <= hi; j++)
+				ref += double(NoiseStream::sample(c, j)) * h[i - j];
+			max_error = std::max(max_error, float(std::abs(ref - output[c][i])));
+		}
+	}
+
+	LOGI("%s impulse, %s tail: max error vs. direct convolution %g.\n",
+	     mono_impulse ? "Mono" : "Stereo", background_tail ? "background" : "inline", max_error);
+	return max_error < 1e-3f && stream.get_late_tail_count() == 0;
+}
+
+// With a background tail, callbacks are paced like a real device so the tail thread gets its share of the CPU.
+static void bench(const char *desc, float impulse_seconds, const DSP::ConvolutionReverbOptions &options)
+{
+	constexpr unsigned NumChannels = 2;
+	constexpr size_t CallbackFrames = 128;
+	constexpr float SampleRate = 48000.0f;
+	constexpr size_t NumCallbacks = 48000 * 5 / CallbackFrames;
+
+	size_t impulse_frames = size_t(impulse_seconds * SampleRate);
+	std::vector<float> impulses[NumChannels];
+	const float *impulse_ptrs[NumChannels];
+	for (unsigned c = 0; c < NumChannels; c++)
+	{
+		impulses[c] = make_impulse(impulse_frames, c + 1);
+		impulse_ptrs[c] = impulses[c].data();
+	}
+
+	DSP::ConvolutionReverbStream stream(new NoiseStream(NumChannels, SIZE_MAX), impulse_ptrs, NumChannels,
+	                                    impulse_frames, options);
+	if (!stream.setup(SampleRate, NumChannels, CallbackFrames))
+	{
+		LOGE("Failed to set up reverb.\n");
+		return;
+	}
+
+	float left[CallbackFrames];
+	float right[CallbackFrames];
+	float *channels[NumChannels] = { left, right };
+	const float gains[NumChannels] = { 1.0f, 1.0f };
+
+	std::vector<uint64_t> times;
+	times.reserve(NumCallbacks);
+	auto deadline = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < NumCallbacks; i++)
+	{
+		if (options.background_tail)
+		{
+			deadline += std::chrono::microseconds(1000000 * CallbackFrames / 48000);
+			std::this_thread::sleep_until(deadline);
+		}
+
+		std::fill(std::begin(left), std::end(left), 0.0f);
+		std::fill(std::begin(right), std::end(right), 0.0f);
+		auto start = Util::get_current_time_nsecs();
+		stream.accumulate_samples(channels, gains, CallbackFrames);
+		auto end = Util::get_current_time_nsecs();
+		times.push_back(end - start);
+	}
+
+	uint64_t total = 0;
+	for (auto t : times)
+		total += t;
+	std::sort(times.begin(), times.end());
+
+	const double budget_usec = 1e6 * double(CallbackFrames) / double(SampleRate);
+	LOGI("%-28s %.0f s IR: avg %7.1f us, p99 %7.1f us, max %8.1f us (budget %.0f us), %.1f%% of real-time, %llu late tail blocks.\n",
+	     desc, impulse_seconds,
+	     1e-3 * double(total) / double(times.size()),
+	     1e-3 * double(times[times.size() * 99 / 100]),
+	     1e-3 * double(times.back()),
+	     budget_usec,
+	     100.0 * 1e-3 * double(total) / (budget_usec * double(times.size())),
+	     static_cast<unsigned long long>(stream.get_late_tail_count()));
+}
+
+int main()
+{
+	for (bool mono : { false, true })
+		for (bool background : { false, true })
+			if (!test_against_direct(mono, background))
+				return EXIT_FAILURE;
+
+	for (float seconds : { 2.0f, 4.0f })
+	{
+		DSP::ConvolutionReverbOptions uniform;
+		// A tail partition larger than the IR leaves everything in the 128 frame head partitions.
+		uniform.tail_block_frames = unsigned(seconds * 48000.0f);
+		bench("Uniform, 128 frames", seconds, uniform);
+
+		DSP::ConvolutionReverbOptions inline_tail;
+		inline_tail.background_tail = false;
+		bench("Non-uniform, inline tail", seconds, inline_tail);
+
+		DSP::ConvolutionReverbOptions background_tail;
+		bench("Non-uniform, background tail", seconds, background_tail);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,308 @@
+#include "decoded_pcm.hpp"
+#include "decode_ahead_stream.hpp"
+#include "global_managers_init.hpp"
+#include "thread_group.hpp"
+#include "logging.hpp"
+#include <cmath>
+#include <string.h>
+#include <vector>
+
+using namespace Granite;
+using namespace Granite::Audio;
+
+static DecodedPCMHandle create_pcm(size_t num_frames, unsigned num_channels, float sample_rate)
+{
+	auto pcm = Util::make_handle<DecodedPCM>();
+	pcm->num_frames = num_frames;
+	pcm->num_channels = num_channels;
+	pcm->sample_rate = sample_rate;
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		pcm->channels[c].resize(num_frames);
+		for (size_t i = 0; i < num_frames; i++)
+			pcm->channels[c][i] = std::sin(0.05f * float(i) + float(c));
+	}
+	return pcm;
+}
+
+static bool test_cache_insert_find()
+{
+	DecodedPCMCache cache;
+	cache.set_budget(4096);
+
+	auto pcm = create_pcm(256, 1, 44100.0f);
+	if (cache.find(1))
+		return false;
+	if (cache.insert(1, pcm) != pcm || cache.find(1) != pcm)
+		return false;
+
+	// Losing a race keeps the first clip.
+	if (cache.insert(1, create_pcm(256, 1, 44100.0f)) != pcm)
+		return false;
+
+	// Clips above a quarter of the budget are passed through, but not kept.
+	auto large = create_pcm(257, 1, 44100.0f);
+	if (cache.is_cacheable(large->get_size()))
+		return false;
+	if (cache.insert(2, large) != large || cache.find(2))
+		return false;
+
+	return true;
+}
+
+static bool test_cache_eviction()
+{
+	DecodedPCMCache cache;
+	cache.set_budget(4096);
+
+	auto first = create_pcm(256, 1, 44100.0f);
+	auto second = create_pcm(256, 1, 44100.0f);
+	cache.insert(0, first);
+	cache.insert(1, second);
+	for (uint64_t key = 2; key < 4; key++)
+		cache.insert(key, create_pcm(256, 1, 44100.0f));
+
+	// Touching the first clip makes the second one the least recently used.
+	if (cache.find(0) != first)
+		return false;
+
+	cache.insert(4, create_pcm(256, 1, 44100.0f));
+	if (cache.find(0) != first || cache.find(1))
+		return false;
+
+	// Streams holding an evicted clip keep it alive.
+	if (second->channels[0].size() != 256 || second->channels[0][10] != std::sin(0.05f * 10.0f))
+		return false;
+
+	// Lowering the budget prunes right away.
+	cache.set_budget(1024);
+	unsigned live = 0;
+	for (uint64_t key = 0; key < 5; key++)
+		if (cache.find(key))
+			live++;
+	return live == 1;
+}
+
+static bool test_cache_resample()
+{
+	auto &group = *GRANITE_THREAD_GROUP();
+	DecodedPCMCache cache;
+
+	auto pcm = create_pcm(4410, 2, 44100.0f);
+	uint64_t key = DecodedPCMCache::get_key("clip", 48000.0f);
+
+	// Misses never block on the resampler, and asking again while it runs doesn't start another one.
+	if (cache.find_resampled(key, pcm, 48000.0f))
+		return false;
+	cache.find_resampled(key, pcm, 48000.0f);
+	group.wait_idle();
+
+	auto resampled = cache.find_resampled(key, pcm, 48000.0f);
+	if (!resampled || resampled != cache.find(key))
+		return false;
+
+	auto reference = resample_pcm(*pcm, 48000.0f);
+	if (resampled->sample_rate != 48000.0f || resampled->num_frames != reference->num_frames ||
+	    resampled->num_channels != 2)
+		return false;
+	for (unsigned c = 0; c < 2; c++)
+		if (memcmp(resampled->channels[c].data(), reference->channels[c].data(), reference->num_frames * sizeof(float)) != 0)
+			return false;
+
+	// Results which would not be kept are not computed at all.
+	cache.set_budget(4096);
+	uint64_t other_key = DecodedPCMCache::get_key("clip", 96000.0f);
+	if (cache.find_resampled(other_key, pcm, 96000.0f))
+		return false;
+	group.wait_idle();
+	return !cache.find(other_key);
+}
+
+// Counts frames, so any dropped or repeated frame shows up in the output.
+struct RampDecoder : PCMDecoder
+{
+	RampDecoder(size_t num_frames_, unsigned num_channels_)
+		: num_frames(num_frames_), num_channels(num_channels_)
+	{
+	}
+
+	float get_sample_rate() const override
+	{
+		return 48000.0f;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	int decode(float **channels, unsigned frames) override
+	{
+		size_t to_decode = std::min<size_t>(frames, num_frames - offset);
+		for (size_t i = 0; i < to_decode; i++)
+			for (unsigned c = 0; c < num_channels; c++)
+				channels[c][i] = get_value(offset + i, c);
+		offset += to_decode;
+		return int(to_decode);
+	}
+
+	void rewind() override
+	{
+		offset = 0;
+	}
+
+	static float get_value(size_t frame, unsigned channel)
+	{
+		return float(frame + 1) + 0.25f * float(channel);
+	}
+
+	size_t num_frames;
+	size_t offset = 0;
+	unsigned num_channels;
+};
+
+struct StreamDeleter
+{
+	void operator()(DecodeAheadStream *stream)
+	{
+		stream->dispose();
+	}
+};
+using StreamPtr = std::unique_ptr<DecodeAheadStream, StreamDeleter>;
+
+static StreamPtr create_stream(size_t num_frames, unsigned num_channels, unsigned mixer_channels, bool looping,
+                               size_t block_frames)
+{
+	StreamPtr stream(new DecodeAheadStream);
+	// 0.1 seconds gives the minimum ring size, so refills happen often.
+	if (!stream->init(std::unique_ptr<PCMDecoder>(new RampDecoder(num_frames, num_channels)), looping, 0.1f))
+		return {};
+	if (!stream->setup(48000.0f, mixer_channels, block_frames))
+		return {};
+	return stream;
+}
+
+// Mixes like the mixer does, returning the frame count reported by the stream.
+static size_t mix(DecodeAheadStream &stream, std::vector<float> (&output)[2], unsigned mixer_channels, size_t frames)
+{
+	float *channels[2];
+	const float gains[2] = { 1.0f, 1.0f };
+	for (unsigned c = 0; c < mixer_channels; c++)
+	{
+		output[c].assign(frames, 0.0f);
+		channels[c] = output[c].data();
+	}
+	return stream.accumulate_samples(channels, gains, frames);
+}
+
+static bool test_ring_continuity(unsigned num_channels, unsigned mixer_channels, bool looping)
+{
+	auto &group = *GRANITE_THREAD_GROUP();
+	constexpr size_t BlockFrames = 256;
+	// Not a multiple of the block sizes, so loop points and the end land in the middle of a block.
+	constexpr size_t Length = 20011;
+
+	auto stream = create_stream(Length, num_channels, mixer_channels, looping, BlockFrames);
+	if (!stream)
+		return false;
+
+	std::vector<float> output[2];
+	size_t frame = 0;
+	size_t total = looping ? 3 * Length : Length;
+
+	while (frame < total)
+	{
+		size_t frames = mix(*stream, output, mixer_channels, BlockFrames);
+		size_t expected_frames = looping ? BlockFrames : std::min(BlockFrames, total - frame);
+		if (frames != expected_frames)
+		{
+			LOGE("Expected %zu frames, got %zu.\n", expected_frames, frames);
+			return false;
+		}
+
+		for (size_t i = 0; i < frames; i++, frame++)
+		{
+			for (unsigned c = 0; c < mixer_channels; c++)
+			{
+				float expected = RampDecoder::get_value(frame % Length, num_channels == 1 ? 0 : c);
+				if (output[c][i] != expected)
+				{
+					LOGE("Frame %zu, channel %u: expected %f, got %f.\n", frame, c, expected, output[c][i]);
+					return false;
+				}
+			}
+		}
+
+		// Mixer::dispose_dead_streams() runs often enough that refills never fall behind here.
+		stream->non_critical_update();
+		group.wait_idle();
+	}
+
+	// A finished stream reports that it is done, and a looping one never does.
+	return mix(*stream, output, mixer_channels, BlockFrames) == (looping ? BlockFrames : 0);
+}
+
+static bool test_ring_underrun()
+{
+	auto &group = *GRANITE_THREAD_GROUP();
+	constexpr size_t BlockFrames = 256;
+	auto stream = create_stream(1000000, 1, 1, false, BlockFrames);
+	if (!stream)
+		return false;
+
+	// Without refills the ring runs dry, after which the stream must pad with silence rather than end.
+	std::vector<float> output[2];
+	size_t frame = 0;
+	bool seen_silence = false;
+	for (unsigned i = 0; i < 64; i++)
+	{
+		if (mix(*stream, output, 1, BlockFrames) != BlockFrames)
+			return false;
+
+		for (float v : output[0])
+		{
+			if (v == 0.0f)
+				seen_silence = true;
+			else if (seen_silence || v != RampDecoder::get_value(frame++, 0))
+				return false;
+		}
+	}
+
+	if (!seen_silence)
+		return false;
+
+	// Once refilled, playback continues where it left off.
+	stream->non_critical_update();
+	group.wait_idle();
+	mix(*stream, output, 1, BlockFrames);
+	return output[0][0] == RampDecoder::get_value(frame, 0);
+}
+
+int main()
+{
+	Global::init(Global::MANAGER_FEATURE_THREAD_GROUP_BIT);
+
+	bool success = true;
+	const auto check = [&](bool result, const char *name) {
+		if (!result)
+		{
+			LOGE("%s failed.\n", name);
+			success = false;
+		}
+	};
+
+	check(test_cache_insert_find(), "Cache insert/find");
+	check(test_cache_eviction(), "Cache eviction");
+	check(test_cache_resample(), "Cache background resample");
+	check(test_ring_continuity(1, 2, false), "Mono ring");
+	check(test_ring_continuity(2, 2, false), "Stereo ring");
+	check(test_ring_continuity(2, 2, true), "Looping stereo ring");
+	check(test_ring_continuity(1, 1, true), "Looping mono ring");
+	check(test_ring_underrun(), "Ring underrun");
+
+	Global::deinit();
+
+	if (success)
+		LOGI("All tests passed.\n");
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,106 @@
+#include "flat_renderer.hpp"
+#include "global_managers_init.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace Granite;
+
+struct Quad
+{
+	vec3 offset;
+	vec2 size;
+	vec4 color;
+};
+
+// No device is created, so this measures pushing quads and sorting the queue, not drawing.
+static void bench(const char *desc, const std::vector<Quad> &quads, unsigned quads_per_scissor)
+{
+	FlatRenderer renderer;
+	constexpr unsigned Iterations = 20;
+	uint64_t push_time = 0;
+	uint64_t sort_time = 0;
+	size_t entries = 0;
+
+	for (unsigned iter = 0; iter < Iterations + 1; iter++)
+	{
+		auto start = Util::get_current_time_nsecs();
+		renderer.begin();
+
+		if (quads_per_scissor)
+		{
+			for (size_t i = 0; i < quads.size(); i += quads_per_scissor)
+			{
+				// Panels are smaller than their contents, so every panel clips differently.
+				renderer.push_scissor(quads[i].offset.xy(), vec2(64.0f));
+				size_t end = std::min(quads.size(), i + quads_per_scissor);
+				for (size_t j = i; j < end; j++)
+					renderer.render_quad(quads[j].offset, quads[j].size, quads[j].color);
+				renderer.pop_scissor();
+			}
+		}
+		else
+		{
+			for (auto &quad : quads)
+				renderer.render_quad(quad.offset, quad.size, quad.color);
+		}
+
+		auto pushed = Util::get_current_time_nsecs();
+		renderer.sort();
+		auto sorted = Util::get_current_time_nsecs();
+
+		// First iteration warms up the queue's allocator.
+		if (iter)
+		{
+			push_time += pushed - start;
+			sort_time += sorted - pushed;
+		}
+
+		entries = renderer.get_queue().get_queue_data(Queue::Opaque).size() +
+		          renderer.get_queue().get_queue_data(Queue::Transparent).size();
+	}
+
+	LOGI("%-34s %zu quads: push %.3f ms, sort %.3f ms, %zu queue entries.\n", desc, quads.size(),
+	     1e-6 * double(push_time) / Iterations, 1e-6 * double(sort_time) / Iterations, entries);
+}
+
+int main()
+{
+	Global::init(Global::MANAGER_FEATURE_EVENT_BIT);
+
+	constexpr unsigned NumQuads = 100000;
+	std::mt19937 rnd(1);
+	std::uniform_real_distribution<float> pos(0.0f, 1900.0f);
+	std::uniform_real_distribution<float> depth(1.0f, 1000.0f);
+
+	std::vector<Quad> quads(NumQuads);
+	for (auto &quad : quads)
+		quad = { vec3(pos(rnd), pos(rnd), 10.0f), vec2(16.0f), vec4(1.0f, 0.5f, 0.25f, 0.5f) };
+	bench("Blended sprites, one layer", quads, 0);
+
+	for (auto &quad : quads)
+	{
+		quad.offset.z = depth(rnd);
+		quad.color.w = 1.0f;
+	}
+	bench("Opaque sprites, random depth", quads, 0);
+
+	for (size_t i = 0; i < quads.size(); i++)
+	{
+		quads[i].offset.z = float(i & 63);
+		quads[i].color.w = 0.5f;
+	}
+	bench("Blended sprites, 64 layers", quads, 0);
+
+	for (size_t i = 0; i < quads.size(); i++)
+	{
+		quads[i].offset = vec3(quads[i & ~size_t(15)].offset.xy() + vec2(float(i & 15) * 6.0f), 10.0f);
+		quads[i].color.w = 0.5f;
+	}
+	bench("Blended UI, scissor per 16 quads", quads, 16);
+
+	Global::deinit();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,388 @@
+#include "glyph_cache.hpp"
+#include "global_managers_init.hpp"
+#include "filesystem.hpp"
+#include "string_helpers.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <thread>
+#include <set>
+#include <vector>
+
+using namespace Granite;
+
+// UI strings in a few scripts. The Latin ones share most of their glyphs.
+static const char *english[] = {
+	"Start game", "Options", "Quit to desktop", "Audio volume", "Resolution: 1920x1080",
+	"Loading, please wait...", "Press any key to continue", "Inventory (12/40)", "Save slot 3 - 02:41:13",
+};
+
+static const char *german[] = {
+	"Spiel starten", "Einstellungen", "Zurück zum Desktop", "Lautstärke", "Auflösung: 1920x1080",
+	"Wird geladen, bitte warten ...", "Drücke eine beliebige Taste", "Inventar (12/40)", "Größe ändern",
+};
+
+static const char *greek[] = {
+	"Έναρξη παιχνιδιού", "Ρυθμίσεις", "Έξοδος", "Ένταση ήχου", "Ανάλυση: 1920x1080",
+	"Φόρτωση, παρακαλώ περιμένετε", "Πατήστε οποιοδήποτε πλήκτρο", "Αποθήκευση",
+};
+
+static const char *russian[] = {
+	"Начать игру", "Настройки", "Выйти на рабочий стол", "Громкость", "Разрешение: 1920x1080",
+	"Загрузка, пожалуйста, подождите...", "Нажмите любую клавишу", "Инвентарь (12/40)",
+};
+
+struct Screen
+{
+	const char * const *strings;
+	unsigned count;
+};
+
+static const Screen screens[] = {
+	{ english, sizeof(english) / sizeof(english[0]) },
+	{ german, sizeof(german) / sizeof(german[0]) },
+	{ greek, sizeof(greek) / sizeof(greek[0]) },
+	{ russian, sizeof(russian) / sizeof(russian[0]) },
+};
+
+static const float font_sizes[] = { 12.0f, 16.0f, 24.0f, 36.0f };
+
+static bool test_utf8()
+{
+	struct Case
+	{
+		const char *text;
+		std::vector<uint32_t> expected;
+	};
+
+	const Case cases[] = {
+		{ "A\xc3\xa4\xe2\x82\xac\xf0\x9f\x98\x80", { 0x41, 0xe4, 0x20ac, 0x1f600 } },
+		// Truncated sequence, stray continuation byte, overlong NUL, surrogate.
+		{ "\xe2\x82" "A", { 0xfffd, 0xfffd, 0x41 } },
+		{ "\x80" "B", { 0xfffd, 0x42 } },
+		{ "\xc0\x80", { 0xfffd, 0xfffd } },
+		{ "\xed\xa0\x80", { 0xfffd, 0xfffd, 0xfffd } },
+	};
+
+	for (auto &c : cases)
+	{
+		std::vector<uint32_t> decoded;
+		const char *text = c.text;
+		uint32_t codepoint;
+		while ((codepoint = Util::decode_utf8(text)) != 0)
+			decoded.push_back(codepoint);
+
+		if (decoded != c.expected)
+		{
+			LOGE("UTF-8 decoding mismatch.\n");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Lays out a string the way Font does, returning the number of glyphs.
+static unsigned layout(GlyphCache &cache, const char *text, float size, float &width)
+{
+	float glyph_scale = size / cache.get_rasterizer().get_pixel_height();
+	float pen = 0.0f;
+	unsigned count = 0;
+	uint32_t codepoint;
+	while ((codepoint = Util::decode_utf8(text)) != 0)
+	{
+		cache.find_glyph(codepoint);
+		pen += cache.get_advance(codepoint) * glyph_scale;
+		count++;
+	}
+	width = std::max(width, pen);
+	return count;
+}
+
+static bool check_atlas(GlyphCache &cache, const std::set<uint32_t> &codepoints, bool require_resident)
+{
+	std::vector<const CachedGlyph *> resident;
+	for (auto codepoint : codepoints)
+	{
+		auto *glyph = cache.find_glyph(codepoint);
+		if (!glyph)
+		{
+			if (!require_resident)
+				continue;
+			LOGE("Glyph U+%04X is not resident after flush.\n", codepoint);
+			return false;
+		}
+
+		if (glyph->width)
+		{
+			if (glyph->x + glyph->width > cache.get_atlas_width() || glyph->y + glyph->height > cache.get_atlas_height())
+			{
+				LOGE("Glyph U+%04X is outside the atlas.\n", codepoint);
+				return false;
+			}
+			resident.push_back(glyph);
+		}
+	}
+
+	for (size_t i = 0; i < resident.size(); i++)
+	{
+		for (size_t j = i + 1; j < resident.size(); j++)
+		{
+			auto &a = *resident[i];
+			auto &b = *resident[j];
+			if (a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height)
+			{
+				LOGE("Glyphs overlap in the atlas.\n");
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// Simulates a UI which switches language every 60 frames and draws each string at every size.
+static bool run_frames(const char *desc, unsigned atlas_size, ThreadGroup *workers)
+{
+	GlyphCache cache(std::unique_ptr<GlyphRasterizer>(new TrueTypeRasterizer("builtin://fonts/font.ttf", 32.0f, 4)),
+	                 atlas_size, atlas_size, workers);
+
+	constexpr unsigned NumFrames = 480;
+	float width = 0.0f;
+	uint64_t steady_hits = 0;
+	uint64_t steady_lookups = 0;
+
+	for (unsigned frame = 0; frame < NumFrames; frame++)
+	{
+		cache.begin_frame();
+		auto &screen = screens[(frame / 60) % 4];
+
+		uint64_t hits = cache.get_statistics().hits;
+		uint64_t misses = cache.get_statistics().misses;
+		for (unsigned i = 0; i < screen.count; i++)
+			for (float size : font_sizes)
+				layout(cache, screen.strings[i], size, width);
+
+		// Frames 30 to 59 of each screen, once rasterization has had time to catch up.
+		if (frame % 60 >= 30)
+		{
+			steady_hits += cache.get_statistics().hits - hits;
+			steady_lookups += cache.get_statistics().hits - hits + cache.get_statistics().misses - misses;
+		}
+
+		// Give the workers a moment, like the rest of a frame would.
+		if (workers)
+			std::this_thread::sleep_for(std::chrono::microseconds(500));
+	}
+
+	auto &stats = cache.get_statistics();
+	LOGI("%s, %ux%u atlas: hit rate %.2f %% overall, %.2f %% in steady state, %llu rasterized, "
+	     "%llu glyphs in %llu shelves evicted, %llu dropped, %u resident.\n",
+	     desc, atlas_size, atlas_size, 100.0 * stats.get_hit_rate(),
+	     100.0 * double(steady_hits) / double(std::max<uint64_t>(steady_lookups, 1)),
+	     static_cast<unsigned long long>(stats.rasterized),
+	     static_cast<unsigned long long>(stats.evicted_glyphs),
+	     static_cast<unsigned long long>(stats.evicted_shelves),
+	     static_cast<unsigned long long>(stats.dropped),
+	     stats.resident_glyphs);
+
+	// Once rasterization is done, everything on the last screen must be resident unless the atlas is too small.
+	std::set<uint32_t> codepoints;
+	auto &screen = screens[((NumFrames - 1) / 60) % 4];
+	for (unsigned i = 0; i < screen.count; i++)
+	{
+		const char *text = screen.strings[i];
+		uint32_t codepoint;
+		while ((codepoint = Util::decode_utf8(text)) != 0)
+			codepoints.insert(codepoint);
+	}
+
+	cache.begin_frame();
+	for (auto codepoint : codepoints)
+		cache.find_glyph(codepoint);
+	cache.flush();
+	return check_atlas(cache, codepoints, atlas_size >= 1024);
+}
+
+// A cached UI panel keeps drawing the same text without laying it out again,
+// touching the shelves it captured instead. Other text churns through a small atlas meanwhile.
+static bool test_shelf_touch()
+{
+	GlyphCache cache(std::unique_ptr<GlyphRasterizer>(new TrueTypeRasterizer("builtin://fonts/font.ttf", 32.0f, 4)),
+	                 256, 256);
+
+	float width = 0.0f;
+	cache.begin_frame();
+	for (unsigned i = 0; i < screens[0].count; i++)
+		layout(cache, screens[0].strings[i], 16.0f, width);
+	cache.flush();
+
+	std::vector<GlyphShelfReference> shelves;
+	std::vector<std::pair<uint32_t, CachedGlyph>> recorded;
+	cache.begin_frame();
+	cache.set_shelf_capture(&shelves);
+	for (unsigned i = 0; i < screens[0].count; i++)
+	{
+		const char *text = screens[0].strings[i];
+		uint32_t codepoint;
+		while ((codepoint = Util::decode_utf8(text)) != 0)
+		{
+			auto *glyph = cache.find_glyph(codepoint);
+			if (!glyph)
+			{
+				LOGE("Glyph U+%04X is not resident after flush.\n", codepoint);
+				return false;
+			}
+			recorded.push_back({ codepoint, *glyph });
+		}
+	}
+	cache.set_shelf_capture(nullptr);
+
+	std::sort(shelves.begin(), shelves.end(), [](const GlyphShelfReference &a, const GlyphShelfReference &b) {
+		return a.index < b.index;
+	});
+	shelves.erase(std::unique(shelves.begin(), shelves.end()), shelves.end());
+
+	constexpr uint32_t ChurnGlyphs = 24;
+	constexpr uint32_t ChurnBatches = 8;
+	const auto churn = [&](unsigned frames, bool touch) -> bool {
+		for (unsigned frame = 0; frame < frames; frame++)
+		{
+			cache.begin_frame();
+			if (touch)
+			{
+				for (auto &shelf : shelves)
+				{
+					if (!cache.touch_shelf(shelf))
+					{
+						LOGE("Shelf %u of a replayed panel was evicted.\n", shelf.index);
+						return false;
+					}
+				}
+			}
+
+			// Each frame draws glyphs no other frame uses, so their shelves age out quickly.
+			for (uint32_t codepoint = 0; codepoint < ChurnGlyphs; codepoint++)
+				cache.find_glyph(0x100 + (frame % ChurnBatches) * ChurnGlyphs + codepoint);
+			cache.flush();
+		}
+		return true;
+	};
+
+	uint64_t evicted = cache.get_statistics().evicted_shelves;
+	if (!churn(30, true))
+		return false;
+	if (cache.get_statistics().evicted_shelves == evicted)
+	{
+		LOGE("Nothing was evicted, the atlas is too large for this test.\n");
+		return false;
+	}
+
+	// Glyphs of touched shelves must stay where the recorded geometry expects them.
+	for (auto &glyph : recorded)
+	{
+		auto *current = cache.find_glyph(glyph.first);
+		if (!current || current->x != glyph.second.x || current->y != glyph.second.y ||
+		    current->width != glyph.second.width || current->height != glyph.second.height)
+		{
+			LOGE("Glyph U+%04X of a replayed panel moved.\n", glyph.first);
+			return false;
+		}
+	}
+
+	// Without touches, the panel's shelves are fair game, and stale references must be refused.
+	churn(30, false);
+	bool any_lost = false;
+	for (auto &shelf : shelves)
+		if (!cache.touch_shelf(shelf))
+			any_lost = true;
+	if (!any_lost)
+	{
+		LOGE("Untouched shelves were never evicted.\n");
+		return false;
+	}
+
+	LOGI("Replayed panel kept %zu shelves resident through %llu shelf evictions.\n",
+	     shelves.size(), static_cast<unsigned long long>(cache.get_statistics().evicted_shelves - evicted));
+	return true;
+}
+
+static void bench_layout(ThreadGroup *workers)
+{
+	GlyphCache cache(std::unique_ptr<GlyphRasterizer>(new TrueTypeRasterizer("builtin://fonts/font.ttf", 32.0f, 4)),
+	                 1024, 1024, workers);
+
+	std::set<uint32_t> codepoints;
+	for (auto &screen : screens)
+	{
+		for (unsigned i = 0; i < screen.count; i++)
+		{
+			const char *text = screen.strings[i];
+			uint32_t codepoint;
+			while ((codepoint = Util::decode_utf8(text)) != 0)
+				codepoints.insert(codepoint);
+		}
+	}
+
+	for (auto codepoint : codepoints)
+		cache.find_glyph(codepoint);
+	cache.flush();
+
+	// Bitmap fonts need a copy of every glyph per size, the SDF atlas a single one.
+	double sdf_texels = 0.0;
+	double baked_texels = 0.0;
+	for (auto codepoint : codepoints)
+	{
+		auto *glyph = cache.find_glyph(codepoint);
+		if (!glyph)
+			continue;
+		double area = double(glyph->width) * double(glyph->height);
+		sdf_texels += area;
+		for (float size : font_sizes)
+		{
+			float rel = size / cache.get_rasterizer().get_pixel_height();
+			baked_texels += area * rel * rel;
+		}
+	}
+
+	LOGI("%zu glyphs take %.0f texels in the SDF atlas, about %.0f texels as bitmaps in %zu sizes.\n",
+	     codepoints.size(), sdf_texels, baked_texels, sizeof(font_sizes) / sizeof(font_sizes[0]));
+
+	constexpr unsigned Iterations = 2000;
+	float width = 0.0f;
+	uint64_t glyphs = 0;
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned iter = 0; iter < Iterations; iter++)
+	{
+		cache.begin_frame();
+		for (auto &screen : screens)
+			for (unsigned i = 0; i < screen.count; i++)
+				glyphs += layout(cache, screen.strings[i], font_sizes[iter & 3], width);
+	}
+	auto end = Util::get_current_time_nsecs();
+
+	LOGI("Layout: %.1f M glyphs/s with a warm cache.\n", 1e-6 * double(glyphs) / (1e-9 * double(end - start)));
+}
+
+int main()
+{
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT);
+	Filesystem::setup_default_filesystem(GRANITE_FILESYSTEM(), ASSET_DIRECTORY);
+
+	if (!test_utf8() || !test_shelf_touch())
+		return EXIT_FAILURE;
+
+	ThreadGroup workers;
+	workers.start(std::thread::hardware_concurrency(), 0, {});
+
+	bool ok = run_frames("Inline rasterization", 1024, nullptr) &&
+	          run_frames("Worker rasterization", 1024, &workers) &&
+	          run_frames("Worker rasterization", 256, &workers) &&
+	          run_frames("Worker rasterization", 128, &workers);
+
+	if (ok)
+		bench_layout(&workers);
+
+	Global::deinit();
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
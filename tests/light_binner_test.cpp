@@ -0,0 +1,326 @@
+#include "light_binner.hpp"
+#include "thread_group.hpp"
+#include "transforms.hpp"
+#include "muglm/matrix_helper.hpp"
+#include "bitops.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <vector>
+
+using namespace Granite;
+
+static LightBinnerParameters build_parameters(unsigned res_x, unsigned res_y, unsigned res_z)
+{
+	vec3 camera_pos(0.0f, 2.0f, 0.0f);
+	vec3 front = normalize(vec3(0.2f, -0.1f, -1.0f));
+	mat4 view = mat4_cast(look_at(front, vec3(0.0f, 1.0f, 0.0f))) * translate(-camera_pos);
+	mat4 proj = projection(0.5f * pi<float>(), 16.0f / 9.0f, 0.1f, 100.0f);
+
+	LightBinnerParameters params;
+	params.transform = translate(vec3(0.5f, 0.5f, 0.0f)) * scale(vec3(0.5f, 0.5f, 1.0f)) * proj * view;
+	params.camera_position = camera_pos;
+	params.camera_front = front;
+	params.z_far = 100.0f;
+	params.resolution_x = res_x;
+	params.resolution_y = res_y;
+	params.resolution_z = res_z;
+	return params;
+}
+
+// Lights scattered around and behind the camera, a quarter of them spot lights.
+static std::vector<LightBinningVolume> build_lights(unsigned count, unsigned seed)
+{
+	std::mt19937 rnd(seed);
+	std::uniform_real_distribution<float> pos_x(-60.0f, 60.0f);
+	std::uniform_real_distribution<float> pos_y(-5.0f, 10.0f);
+	std::uniform_real_distribution<float> pos_z(-110.0f, 10.0f);
+	std::uniform_real_distribution<float> radius(0.2f, 4.0f);
+	std::uniform_real_distribution<float> dir(-1.0f, 1.0f);
+
+	std::vector<LightBinningVolume> lights;
+	lights.reserve(count);
+	for (unsigned i = 0; i < count; i++)
+	{
+		vec3 pos(pos_x(rnd), pos_y(rnd), pos_z(rnd));
+		if ((i & 3) == 3)
+		{
+			float range = 2.0f * radius(rnd);
+			lights.push_back(LightBinningVolume::spot(pos, vec3(dir(rnd), dir(rnd) - 0.5f, dir(rnd)), range,
+			                                          0.1f * range + 0.3f * radius(rnd)));
+		}
+		else
+			lights.push_back(LightBinningVolume::point(pos, radius(rnd)));
+	}
+	return lights;
+}
+
+// Random point inside the light's volume.
+static vec3 sample_light(const LightBinningVolume &light, std::mt19937 &rnd)
+{
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+	float height = length(light.axis);
+	vec3 axis = height > 0.0f ? light.axis / height : vec3(0.0f, 0.0f, 1.0f);
+	vec3 tangent = normalize(cross(axis, std::abs(axis.x) < 0.9f ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f)));
+	vec3 bitangent = cross(axis, tangent);
+
+	float phi = 2.0f * pi<float>() * dist(rnd);
+	if (height > 0.0f)
+	{
+		float t = std::cbrt(dist(rnd));
+		float r = std::sqrt(dist(rnd)) * t * light.base_radius;
+		return light.position + t * light.axis + r * (std::cos(phi) * tangent + std::sin(phi) * bitangent);
+	}
+	else
+	{
+		float r = std::cbrt(dist(rnd)) * light.radius;
+		float c = 2.0f * dist(rnd) - 1.0f;
+		float s = std::sqrt(1.0f - c * c);
+		return light.position + r * (c * axis + s * (std::cos(phi) * tangent + std::sin(phi) * bitangent));
+	}
+}
+
+static bool contains(const LightBinningVolume &light, const vec3 &pos)
+{
+	vec3 d = pos - light.position;
+	if (dot(d, d) <= light.radius * light.radius)
+		return true;
+	float height2 = dot(light.axis, light.axis);
+	if (height2 <= 0.0f)
+		return false;
+	float t = dot(d, light.axis) / height2;
+	if (t < 0.0f || t > 1.0f)
+		return false;
+	float perp2 = dot(d, d) - t * t * height2;
+	return perp2 <= t * t * light.base_radius * light.base_radius;
+}
+
+static vec4 boundary_plane(const mat4 &transform, unsigned axis, unsigned index, unsigned resolution)
+{
+	float uv = float(index) / float(resolution);
+	vec4 plane;
+	for (unsigned i = 0; i < 4; i++)
+		plane[i] = transform[i][axis] - uv * transform[i][3];
+	return plane / length(plane.xyz());
+}
+
+// Furthest signed distance of the light's hull along the plane normal.
+static float max_plane_distance(const LightBinningVolume &light, const vec4 &plane)
+{
+	float height = length(light.axis);
+	vec3 axis = height > 0.0f ? light.axis / height : vec3(0.0f);
+	float s = std::sqrt(std::max(1.0f - dot(plane.xyz(), axis) * dot(plane.xyz(), axis), 0.0f));
+	return std::max(dot(plane.xyz(), light.position) + plane.w + light.radius,
+	                dot(plane.xyz(), light.position + light.axis) + plane.w + (height > 0.0f ? light.base_radius * s : 0.0f));
+}
+
+// Tests every light against the four side planes of every tile.
+static std::vector<uint32_t> reference_tile_bitmask(const LightBinnerParameters &params,
+                                                    const std::vector<LightBinningVolume> &lights)
+{
+	unsigned num_lights_32 = unsigned(lights.size() + 31) / 32;
+	std::vector<uint32_t> bitmask(params.resolution_x * params.resolution_y * num_lights_32);
+	for (unsigned y = 0; y < params.resolution_y; y++)
+	{
+		for (unsigned x = 0; x < params.resolution_x; x++)
+		{
+			const vec4 planes[4] = {
+				boundary_plane(params.transform, 0, x, params.resolution_x),
+				-boundary_plane(params.transform, 0, x + 1, params.resolution_x),
+				boundary_plane(params.transform, 1, y, params.resolution_y),
+				-boundary_plane(params.transform, 1, y + 1, params.resolution_y),
+			};
+
+			for (unsigned i = 0; i < lights.size(); i++)
+			{
+				bool inside = true;
+				for (auto &plane : planes)
+					inside = inside && max_plane_distance(lights[i], plane) >= 0.0f;
+				if (inside)
+					bitmask[(y * params.resolution_x + x) * num_lights_32 + i / 32] |= 1u << (i & 31);
+			}
+		}
+	}
+	return bitmask;
+}
+
+// Straight port of clusterer_bindless_z_range.comp.
+static std::vector<uvec2> reference_slice_ranges(const LightBinner &binner)
+{
+	unsigned res_z = binner.get_parameters().resolution_z;
+	std::vector<uvec2> ranges(res_z);
+	const uvec2 *z_ranges = binner.get_light_z_ranges();
+	for (unsigned z = 0; z < res_z; z++)
+	{
+		uint32_t z_lo = 0xffffffffu;
+		uint32_t z_hi = 0;
+		for (unsigned i = 0; i < binner.get_num_lights(); i++)
+		{
+			if (z >= z_ranges[i].x && z <= z_ranges[i].y)
+			{
+				z_lo = i;
+				break;
+			}
+		}
+
+		int z_lo_int = std::max(int(z_lo), 0);
+		for (int i = int(binner.get_num_lights()) - 1; i >= z_lo_int; i--)
+		{
+			if (z >= z_ranges[i].x && z <= z_ranges[i].y)
+			{
+				z_hi = i;
+				break;
+			}
+		}
+		ranges[z] = uvec2(z_lo, z_hi);
+	}
+	return ranges;
+}
+
+// Every sampled point of every light must find its light through the clusters.
+static bool validate(const LightBinner &binner, const std::vector<LightBinningVolume> &lights)
+{
+	auto &params = binner.get_parameters();
+	auto reference = reference_slice_ranges(binner);
+	for (unsigned z = 0; z < params.resolution_z; z++)
+	{
+		if (any(notEqual(reference[z], binner.get_z_ranges()[z])))
+		{
+			LOGE("Z range mismatch in slice %u.\n", z);
+			return false;
+		}
+	}
+
+	std::mt19937 rnd(7);
+	std::vector<uint32_t> result;
+	unsigned binned_samples = 0;
+	for (unsigned i = 0; i < binner.get_num_lights(); i++)
+	{
+		for (unsigned sample = 0; sample < 16; sample++)
+		{
+			vec3 pos = sample_light(lights[i], rnd);
+			binner.query_point(pos, result);
+			if (std::find(result.begin(), result.end(), i) == result.end())
+			{
+				LOGE("Light %u missing at sample %u.\n", i, sample);
+				return false;
+			}
+
+			vec4 clip = params.transform * vec4(pos, 1.0f);
+			vec2 uv = clip.xy() / clip.w;
+			if (clip.w > 0.0f && all(greaterThanEqual(uv, vec2(0.0f))) && all(lessThan(uv, vec2(1.0f))))
+				binned_samples++;
+
+			for (auto index : result)
+			{
+				if (!contains(lights[index], pos))
+				{
+					LOGE("Query returned light %u which does not contain the point.\n", index);
+					return false;
+				}
+			}
+
+			AABB aabb(pos - vec3(0.1f), pos + vec3(0.1f));
+			binner.query_aabb(aabb, result);
+			if (std::find(result.begin(), result.end(), i) == result.end())
+			{
+				LOGE("Light %u missing from box query.\n", i);
+				return false;
+			}
+		}
+	}
+
+	LOGI("%u lights validated, %u samples went through the clusters.\n", binner.get_num_lights(), binned_samples);
+	return true;
+}
+
+int main()
+{
+	constexpr unsigned NumLights = 4096;
+	constexpr unsigned Iterations = 50;
+	auto params = build_parameters(64, 32, 64);
+	auto lights = build_lights(NumLights, 1);
+
+	ThreadGroup workers;
+	workers.start(std::thread::hardware_concurrency(), 0, {});
+
+	LightBinner serial, parallel;
+	serial.build(params, lights.data(), NumLights);
+	parallel.build(params, lights.data(), NumLights, &workers);
+
+	size_t num_words = params.resolution_x * params.resolution_y * serial.get_num_lights_32();
+	if (!std::equal(serial.get_tile_bitmask(), serial.get_tile_bitmask() + num_words, parallel.get_tile_bitmask()))
+	{
+		LOGE("Threaded build does not match.\n");
+		return EXIT_FAILURE;
+	}
+
+	auto start = Util::get_current_time_nsecs();
+	auto reference = reference_tile_bitmask(params, lights);
+	auto end = Util::get_current_time_nsecs();
+	LOGI("Per-tile reference: %.3f ms.\n", 1e-6 * double(end - start));
+
+	// Rounding differs in the last bit, so allow the odd disagreement right at a plane.
+	unsigned mismatches = 0;
+	for (size_t i = 0; i < num_words; i++)
+		mismatches += Util::popcount32(reference[i] ^ serial.get_tile_bitmask()[i]);
+	if (mismatches > 16)
+	{
+		LOGE("%u tile bits differ from the per-tile reference.\n", mismatches);
+		return EXIT_FAILURE;
+	}
+
+	if (!validate(serial, lights))
+		return EXIT_FAILURE;
+
+	// Odd light counts exercise the padding.
+	for (unsigned count : { 0u, 1u, 33u, 100u })
+	{
+		LightBinner binner;
+		binner.build(params, lights.data(), count, &workers);
+		if (!validate(binner, lights))
+			return EXIT_FAILURE;
+	}
+
+	uint64_t bits = 0;
+	for (size_t i = 0; i < num_words; i++)
+		bits += Util::popcount32(serial.get_tile_bitmask()[i]);
+	LOGI("%.1f lights per tile on average.\n", double(bits) / double(params.resolution_x * params.resolution_y));
+
+	start = Util::get_current_time_nsecs();
+	for (unsigned i = 0; i < Iterations; i++)
+		serial.build(params, lights.data(), NumLights);
+	end = Util::get_current_time_nsecs();
+	LOGI("%u lights, %ux%ux%u clusters, serial: %.3f ms.\n", NumLights,
+	     params.resolution_x, params.resolution_y, params.resolution_z, 1e-6 * double(end - start) / Iterations);
+
+	start = Util::get_current_time_nsecs();
+	for (unsigned i = 0; i < Iterations; i++)
+		parallel.build(params, lights.data(), NumLights, &workers);
+	end = Util::get_current_time_nsecs();
+	LOGI("%u lights, %ux%ux%u clusters, %u threads: %.3f ms.\n", NumLights,
+	     params.resolution_x, params.resolution_y, params.resolution_z, workers.get_num_threads(),
+	     1e-6 * double(end - start) / Iterations);
+
+	std::vector<uint32_t> result;
+	std::mt19937 rnd(3);
+	std::uniform_real_distribution<float> dist(-20.0f, 20.0f);
+	std::vector<vec3> points(10000);
+	for (auto &p : points)
+		p = vec3(dist(rnd), dist(rnd) * 0.25f, -30.0f + dist(rnd));
+
+	size_t total = 0;
+	start = Util::get_current_time_nsecs();
+	for (auto &p : points)
+	{
+		serial.query_point(p, result);
+		total += result.size();
+	}
+	end = Util::get_current_time_nsecs();
+	LOGI("%zu point queries: %.3f us per query, %.2f lights per point.\n", points.size(),
+	     1e-3 * double(end - start) / double(points.size()), double(total) / double(points.size()));
+
+	return EXIT_SUCCESS;
+}
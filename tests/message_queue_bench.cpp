@@ -0,0 +1,181 @@
+#include "message_queue.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <thread>
+#include <vector>
+#include <string.h>
+
+using namespace Util;
+
+struct Message
+{
+	unsigned producer;
+	unsigned sequence;
+	unsigned padding[14];
+};
+
+// The SPSC queue behind a mutex, which is what MessageQueue used to do.
+struct LockedQueue
+{
+	// push_written_payload() drops the payload when the ring is full, so stay below its depth.
+	enum { RingDepth = 32 * 1024 };
+
+	LockFreeMessageQueue queue;
+	std::mutex lock;
+
+	MessageQueuePayload allocate_write_payload(size_t size)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		return queue.allocate_write_payload(size);
+	}
+
+	size_t push_written_payloads(MessageQueuePayload *payloads, size_t count)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		size_t pushed = 0;
+		while (pushed < count && queue.available_read_messages() < RingDepth)
+			queue.push_written_payload(std::move(payloads[pushed++]));
+		return pushed;
+	}
+
+	size_t read_messages(MessageQueuePayload *payloads, size_t count)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		size_t read = 0;
+		while (read < count && (payloads[read] = queue.read_message()))
+			read++;
+		return read;
+	}
+
+	void recycle_payloads(MessageQueuePayload *payloads, size_t count)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		for (size_t i = 0; i < count; i++)
+			queue.recycle_payload(std::move(payloads[i]));
+	}
+};
+
+struct MPMCQueue
+{
+	LockFreeMPMCMessageQueue queue;
+
+	MessageQueuePayload allocate_write_payload(size_t size)
+	{
+		return queue.allocate_write_payload(size);
+	}
+
+	// The batched path only moves from payloads which were actually pushed, so it's also used for single pushes.
+	size_t push_written_payloads(MessageQueuePayload *payloads, size_t count)
+	{
+		return queue.push_written_payloads(payloads, count);
+	}
+
+	size_t read_messages(MessageQueuePayload *payloads, size_t count)
+	{
+		if (count == 1)
+			return (payloads[0] = queue.read_message()) ? 1 : 0;
+		return queue.read_messages(payloads, count);
+	}
+
+	void recycle_payloads(MessageQueuePayload *payloads, size_t count)
+	{
+		if (count == 1)
+			queue.recycle_payload(std::move(payloads[0]));
+		else
+			queue.recycle_payloads(payloads, count);
+	}
+};
+
+template <typename Queue>
+static double run_bench(unsigned num_producers, unsigned total_messages, unsigned batch_size)
+{
+	constexpr unsigned MaxBatch = 64;
+	Queue queue;
+	unsigned messages_per_producer = total_messages / num_producers;
+	std::vector<std::thread> producers;
+	bool ok = true;
+
+	auto start = get_current_time_nsecs();
+
+	for (unsigned p = 0; p < num_producers; p++)
+	{
+		producers.emplace_back([&queue, p, messages_per_producer, batch_size]() {
+			MessageQueuePayload batch[MaxBatch];
+			unsigned sent = 0;
+			while (sent < messages_per_producer)
+			{
+				unsigned count = std::min(batch_size, messages_per_producer - sent);
+				for (unsigned i = 0; i < count; i++)
+				{
+					batch[i] = queue.allocate_write_payload(sizeof(Message));
+					auto *msg = static_cast<Message *>(batch[i].get_payload_data());
+					msg->producer = p;
+					msg->sequence = sent + i;
+				}
+
+				unsigned pushed = 0;
+				while (pushed < count)
+				{
+					size_t n = queue.push_written_payloads(batch + pushed, count - pushed);
+					if (n == 0)
+						std::this_thread::yield();
+					pushed += unsigned(n);
+				}
+				sent += count;
+			}
+		});
+	}
+
+	// A single consumer, like a main thread draining telemetry.
+	std::vector<unsigned> next_sequence(num_producers);
+	unsigned received = 0;
+	unsigned expected = messages_per_producer * num_producers;
+	MessageQueuePayload batch[MaxBatch];
+	while (received < expected)
+	{
+		size_t n = queue.read_messages(batch, batch_size);
+		if (n == 0)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		for (size_t i = 0; i < n; i++)
+		{
+			auto *msg = static_cast<const Message *>(batch[i].get_payload_data());
+			if (msg->sequence != next_sequence[msg->producer]++)
+				ok = false;
+		}
+
+		queue.recycle_payloads(batch, n);
+		received += unsigned(n);
+	}
+
+	for (auto &t : producers)
+		t.join();
+	auto end = get_current_time_nsecs();
+
+	if (!ok)
+		LOGE("Messages from a producer arrived out of order.\n");
+
+	return 1e-9 * double(end - start);
+}
+
+int main()
+{
+	constexpr unsigned TotalMessages = 2 * 1024 * 1024;
+	static const unsigned producer_counts[] = { 1, 4, 16 };
+
+	for (unsigned producers : producer_counts)
+	{
+		double locked = run_bench<LockedQueue>(producers, TotalMessages, 1);
+		double mpmc = run_bench<MPMCQueue>(producers, TotalMessages, 1);
+		double mpmc_bulk = run_bench<MPMCQueue>(producers, TotalMessages, 16);
+
+		LOGI("%2u producers: locked SPSC %6.2f M msgs/s, MPMC %6.2f M msgs/s, MPMC bulk (16) %6.2f M msgs/s.\n",
+		     producers,
+		     1e-6 * TotalMessages / locked,
+		     1e-6 * TotalMessages / mpmc,
+		     1e-6 * TotalMessages / mpmc_bulk);
+	}
+}
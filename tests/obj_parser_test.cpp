@@ -0,0 +1,408 @@
+#include "obj.hpp"
+#include "global_managers_init.hpp"
+#include "filesystem.hpp"
+#include "thread_group.hpp"
+#include "logging.hpp"
+#include <random>
+#include <string>
+#include <vector>
+#include <exception>
+#include <cmath>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace Granite;
+using namespace Granite::SceneFormats;
+
+struct Corner
+{
+	vec3 position;
+	vec3 normal;
+	vec2 uv;
+};
+
+struct ExpectedMesh
+{
+	int material;
+	std::vector<Corner> corners;
+};
+
+static void write_file(const std::string &path, const std::string &data)
+{
+	auto file = GRANITE_FILESYSTEM()->open_writeonly_mapping(path, data.size());
+	if (!file)
+		throw std::runtime_error("Failed to create scratch file.");
+	memcpy(file->mutable_data(), data.data(), data.size());
+}
+
+// Expands the (deduplicated) index buffer back into one entry per triangle corner.
+static std::vector<Corner> unroll(const Mesh &mesh)
+{
+	auto &normal_layout = mesh.attribute_layout[Util::ecast(MeshAttribute::Normal)];
+	auto &uv_layout = mesh.attribute_layout[Util::ecast(MeshAttribute::UV)];
+	bool has_normals = normal_layout.format != VK_FORMAT_UNDEFINED;
+	bool has_uvs = uv_layout.format != VK_FORMAT_UNDEFINED;
+
+	std::vector<Corner> corners(mesh.count);
+	for (uint32_t i = 0; i < mesh.count; i++)
+	{
+		uint32_t index = i;
+		if (!mesh.indices.empty())
+		{
+			if (mesh.index_type == VK_INDEX_TYPE_UINT16)
+			{
+				uint16_t index16;
+				memcpy(&index16, &mesh.indices[i * sizeof(uint16_t)], sizeof(index16));
+				index = index16;
+			}
+			else
+				memcpy(&index, &mesh.indices[i * sizeof(uint32_t)], sizeof(index));
+		}
+
+		auto &corner = corners[i];
+		corner = {};
+		memcpy(&corner.position, &mesh.positions[index * mesh.position_stride], sizeof(vec3));
+		if (has_normals)
+			memcpy(&corner.normal, &mesh.attributes[index * mesh.attribute_stride + normal_layout.offset], sizeof(vec3));
+		if (has_uvs)
+			memcpy(&corner.uv, &mesh.attributes[index * mesh.attribute_stride + uv_layout.offset], sizeof(vec2));
+	}
+	return corners;
+}
+
+// Bitwise, so a parser which only gets within an ULP of strtof fails.
+static bool corners_equal(const Corner &a, const Corner &b)
+{
+	return memcmp(&a.position, &b.position, sizeof(vec3)) == 0 &&
+	       memcmp(&a.normal, &b.normal, sizeof(vec3)) == 0 &&
+	       memcmp(&a.uv, &b.uv, sizeof(vec2)) == 0;
+}
+
+static bool check_meshes(const char *tag, const OBJ::Parser &parser, const std::vector<ExpectedMesh> &expected)
+{
+	auto &meshes = parser.get_meshes();
+	if (meshes.size() != expected.size())
+	{
+		LOGE("%s: got %zu meshes, expected %zu.\n", tag, meshes.size(), expected.size());
+		return false;
+	}
+
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		int material = meshes[i].has_material ? int(meshes[i].material_index) : -1;
+		if (material != expected[i].material)
+		{
+			LOGE("%s: mesh %zu has material %d, expected %d.\n", tag, i, material, expected[i].material);
+			return false;
+		}
+
+		auto corners = unroll(meshes[i]);
+		if (corners.size() != expected[i].corners.size())
+		{
+			LOGE("%s: mesh %zu has %zu corners, expected %zu.\n", tag, i, corners.size(), expected[i].corners.size());
+			return false;
+		}
+
+		for (size_t j = 0; j < corners.size(); j++)
+		{
+			if (!corners_equal(corners[j], expected[i].corners[j]))
+			{
+				auto &got = corners[j].position;
+				auto &want = expected[i].corners[j].position;
+				LOGE("%s: mesh %zu, corner %zu: got (%.9g, %.9g, %.9g), expected (%.9g, %.9g, %.9g).\n",
+				     tag, i, j, got.x, got.y, got.z, want.x, want.y, want.z);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static Corner position_corner(float x, float y, float z)
+{
+	Corner corner = {};
+	corner.position = vec3(x, y, z);
+	return corner;
+}
+
+static bool test_comments_and_blank_lines()
+{
+	write_file("tmp://comments.obj",
+	           "# Header comment\n"
+	           "\n"
+	           "   \t \n"
+	           "v 0 0 0   # trailing comment\n"
+	           "\tv\t1 0 0\r\n"
+	           "# v 5 5 5 is commented out and must not be counted\n"
+	           "v 0 1 0\n"
+	           "\r\n"
+	           "#f 1 1 1\n"
+	           "f 1 2 3 # face\n"
+	           "# No newline at the end of the file.");
+
+	OBJ::Parser parser("tmp://comments.obj");
+	std::vector<ExpectedMesh> expected = {
+		{ -1, { position_corner(0, 0, 0), position_corner(1, 0, 0), position_corner(0, 1, 0) } },
+	};
+	return check_meshes("Comments and blank lines", parser, expected);
+}
+
+static bool test_negative_indices()
+{
+	write_file("tmp://negative.obj",
+	           "v 1 0 0\n"
+	           "v 2 0 0\n"
+	           "v 3 0 0\n"
+	           "vt 0.25 0.5\n"
+	           "vn 0 0 1\n"
+	           "f -3/-1/-1 -2/-1/-1 -1/-1/-1\n"
+	           "v 4 0 0\n"
+	           "vt 0.75 1\n"
+	           "vn 0 1 0\n"
+	           // Relative indices resolve against what has been defined so far, not the whole file.
+	           "f -4/-2/-2 -1/-1/-1 2/2/2\n");
+
+	OBJ::Parser parser("tmp://negative.obj");
+
+	auto corner = [](float x, vec2 uv, vec3 n) {
+		Corner c = {};
+		c.position = vec3(x, 0.0f, 0.0f);
+		c.uv = vec2(uv.x, 1.0f - uv.y);
+		c.normal = n;
+		return c;
+	};
+
+	vec2 uv0(0.25f, 0.5f), uv1(0.75f, 1.0f);
+	vec3 n0(0.0f, 0.0f, 1.0f), n1(0.0f, 1.0f, 0.0f);
+	std::vector<ExpectedMesh> expected = {
+		{ -1, {
+			corner(1.0f, uv0, n0), corner(2.0f, uv0, n0), corner(3.0f, uv0, n0),
+			corner(1.0f, uv0, n0), corner(4.0f, uv1, n1), corner(2.0f, uv1, n1),
+		} },
+	};
+	return check_meshes("Negative indices", parser, expected);
+}
+
+static bool test_ngon_triangulation()
+{
+	write_file("tmp://ngon.obj",
+	           "v 0 0 0\nv 1 0 0\nv 2 1 0\nv 1 2 0\nv 0 2 0\nv -1 1 0\n"
+	           "f 1 2 3 4 5 6\n"
+	           "f 6 5 4 3 2\n");
+
+	OBJ::Parser parser("tmp://ngon.obj");
+	const vec3 p[] = {
+		vec3(0, 0, 0), vec3(1, 0, 0), vec3(2, 1, 0), vec3(1, 2, 0), vec3(0, 2, 0), vec3(-1, 1, 0),
+	};
+
+	// Triangle fans around the first vertex of each face.
+	ExpectedMesh mesh = { -1, {} };
+	const unsigned hexagon[] = { 0, 1, 2, 3, 4, 5 };
+	const unsigned pentagon[] = { 5, 4, 3, 2, 1 };
+	for (unsigned i = 2; i < 6; i++)
+		for (unsigned v : { hexagon[0], hexagon[i - 1], hexagon[i] })
+			mesh.corners.push_back(position_corner(p[v].x, p[v].y, p[v].z));
+	for (unsigned i = 2; i < 5; i++)
+		for (unsigned v : { pentagon[0], pentagon[i - 1], pentagon[i] })
+			mesh.corners.push_back(position_corner(p[v].x, p[v].y, p[v].z));
+
+	return check_meshes("N-gon triangulation", parser, { mesh });
+}
+
+static bool test_float_parsing()
+{
+	std::vector<std::string> values = {
+		"0", "-0", "+0.0", "1", "-1", ".5", "5.", "-.25", "+2",
+		"0.1", "0.2", "0.3", "1e-3", "1E+10", "-2.5E-1", "3.4028235e38", "1.17549435e-38",
+		"1e-45", "1.4e-45", "1e-40", "123456789012345678901234", "0.30000001192092896",
+		"7.038531e-26", "16777217", "33554433", "0.000000000000000000000123",
+		"1.00000005960464477539062499", "1.00000005960464477539062501", "1.000000059604644775390625",
+		"inf", "-inf",
+	};
+
+	std::mt19937 rnd(1234);
+	std::uniform_real_distribution<float> mantissa(1.0f, 2.0f);
+	std::uniform_int_distribution<int> exponent(-20, 20);
+	char buffer[64];
+
+	// Typical exporter output.
+	for (unsigned i = 0; i < 20000; i++)
+	{
+		float f = ldexpf(mantissa(rnd), exponent(rnd)) * (i & 1 ? -1.0f : 1.0f);
+		static const char *formats[] = { "%.6f", "%.9g", "%.7e", "%g" };
+		snprintf(buffer, sizeof(buffer), formats[i & 3], f);
+		values.push_back(buffer);
+	}
+
+	// Decimals just off a float rounding tie which still round to the tie in double.
+	// Converting through double and then to float rounds these the wrong way about half the time.
+	unsigned num_ties = 0;
+	for (unsigned i = 0; i < 2000000 && num_ties < 200; i++)
+	{
+		float f = ldexpf(mantissa(rnd), exponent(rnd));
+		double tie = 0.5 * (double(f) + double(nextafterf(f, 2.0f * f)));
+		snprintf(buffer, sizeof(buffer), "%.16g", tie);
+		if (strtod(buffer, nullptr) == tie && strtof(buffer, nullptr) != float(tie))
+		{
+			values.push_back(buffer);
+			num_ties++;
+		}
+	}
+
+	if (num_ties == 0)
+	{
+		LOGE("Float parsing: did not find any decimals on a float rounding tie.\n");
+		return false;
+	}
+
+	std::string obj;
+	ExpectedMesh mesh = { -1, {} };
+	for (auto &value : values)
+	{
+		obj += "v " + value + " 0 " + value + "\nf -1 -1 -1\n";
+		float f = strtof(value.c_str(), nullptr);
+		for (unsigned i = 0; i < 3; i++)
+			mesh.corners.push_back(position_corner(f, 0.0f, f));
+	}
+
+	write_file("tmp://floats.obj", obj);
+	OBJ::Parser parser("tmp://floats.obj");
+	if (!check_meshes("Float parsing", parser, { mesh }))
+		return false;
+
+	LOGI("Float parsing: %zu values, including %u near float rounding ties, match strtof.\n",
+	     values.size(), num_ties);
+	return true;
+}
+
+// Large enough for several 4 MiB parser chunks. Line lengths vary, so chunk boundaries fall in the
+// middle of vertex, face, comment and material lines, and faces refer back across chunks.
+static bool test_chunk_boundaries(ThreadGroup &group)
+{
+	write_file("tmp://chunks.mtl", "newmtl a\nKd 1 0 0\nnewmtl b\nKd 0 1 0\n");
+
+	std::mt19937 rnd(42);
+	std::uniform_real_distribution<float> coord(-1000.0f, 1000.0f);
+	std::uniform_int_distribution<int> choice(0, 99);
+
+	std::string obj = "mtllib chunks.mtl\n";
+	std::vector<vec3> positions;
+	std::vector<ExpectedMesh> expected;
+	int current_material = -1;
+	char buffer[256];
+
+	while (obj.size() < 14 * 1024 * 1024)
+	{
+		int c = choice(rnd);
+		if (c < 60 || positions.size() < 3)
+		{
+			float v[3];
+			obj += "v";
+			for (auto &x : v)
+			{
+				static const char *formats[] = { "%.6f", "%.9g", "%.3e" };
+				snprintf(buffer, sizeof(buffer), formats[choice(rnd) % 3], coord(rnd));
+				x = strtof(buffer, nullptr);
+				obj += " ";
+				obj += buffer;
+			}
+			obj += choice(rnd) < 10 ? "   # vertex\r\n" : "\n";
+			positions.emplace_back(v[0], v[1], v[2]);
+		}
+		else if (c < 90)
+		{
+			unsigned num_vertices = 3 + choice(rnd) % 4;
+			std::vector<size_t> face;
+			std::string line = "f";
+			for (unsigned i = 0; i < num_vertices; i++)
+			{
+				// Reach far enough back to cross into earlier chunks.
+				size_t back = 1 + size_t(choice(rnd)) * size_t(choice(rnd)) * 7 % positions.size();
+				size_t index = positions.size() - back;
+				face.push_back(index);
+				if (choice(rnd) & 1)
+					snprintf(buffer, sizeof(buffer), " -%zu", back);
+				else
+					snprintf(buffer, sizeof(buffer), " %zu", index + 1);
+				line += buffer;
+			}
+			obj += line + "\n";
+
+			if (expected.empty())
+				expected.push_back({ current_material, {} });
+			auto &corners = expected.back().corners;
+			for (size_t i = 2; i < face.size(); i++)
+				for (size_t v : { face[0], face[i - 1], face[i] })
+					corners.push_back(position_corner(positions[v].x, positions[v].y, positions[v].z));
+		}
+		else if (c < 97)
+		{
+			obj += "# A comment line of some length, f 1 2 3, v 1 2 3\n\n";
+		}
+		else
+		{
+			int material = choice(rnd) & 1;
+			obj += material ? "usemtl b\n" : "usemtl a\n";
+			if (material != current_material)
+			{
+				// Switching material starts a new mesh, unless nothing was emitted with the old one.
+				if (!expected.empty() && expected.back().corners.empty())
+					expected.back().material = material;
+				else
+					expected.push_back({ material, {} });
+				current_material = material;
+			}
+		}
+	}
+
+	if (!expected.empty() && expected.back().corners.empty())
+		expected.pop_back();
+
+	write_file("tmp://chunks.obj", obj);
+
+	OBJ::Parser serial("tmp://chunks.obj");
+	if (!check_meshes("Chunk boundaries (serial)", serial, expected))
+		return false;
+
+	OBJ::Parser threaded("tmp://chunks.obj", 1.0f, &group);
+	if (!check_meshes("Chunk boundaries (threaded)", threaded, expected))
+		return false;
+
+	LOGI("Chunk boundaries: %.1f MiB, %zu vertices, %zu meshes match.\n",
+	     double(obj.size()) / (1024.0 * 1024.0), positions.size(), expected.size());
+	return true;
+}
+
+int main()
+{
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT);
+	GRANITE_FILESYSTEM()->register_protocol("tmp", std::make_unique<ScratchFilesystem>());
+
+	ThreadGroup group;
+	group.start(4, 0, {});
+
+	bool ok = false;
+	try
+	{
+		ok = test_comments_and_blank_lines() &&
+		     test_negative_indices() &&
+		     test_ngon_triangulation() &&
+		     test_float_parsing() &&
+		     test_chunk_boundaries(group);
+	}
+	catch (const std::exception &e)
+	{
+		LOGE("Parser threw: %s\n", e.what());
+	}
+
+	group.stop();
+	Global::deinit();
+
+	if (!ok)
+		return EXIT_FAILURE;
+
+	LOGI("All tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,424 @@
+#include "occlusion_culler.hpp"
+#include "scene_formats.hpp"
+#include "transforms.hpp"
+#include "frustum.hpp"
+#include "simd.hpp"
+#include "thread_group.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <vector>
+#include <cmath>
+
+using namespace Granite;
+
+static constexpr unsigned Width = 256;
+static constexpr unsigned Height = 128;
+static constexpr float FovY = 0.5f * pi<float>();
+
+struct View
+{
+	vec3 eye;
+	vec3 forward, right, up;
+	mat4 view_projection;
+};
+
+static View make_view(const vec3 &eye, const vec3 &target)
+{
+	View v;
+	v.eye = eye;
+	v.forward = normalize(target - eye);
+	v.right = normalize(cross(v.forward, vec3(0.0f, 1.0f, 0.0f)));
+	v.up = cross(v.right, v.forward);
+	mat4 view = mat4_cast(look_at(v.forward, vec3(0.0f, 1.0f, 0.0f))) * translate(-eye);
+	v.view_projection = projection(FovY, float(Width) / float(Height), 0.1f, 500.0f) * view;
+	return v;
+}
+
+// Unit cube with counter-clockwise, outwards facing triangles like a glTF mesh.
+static SceneFormats::CollisionMesh make_cube()
+{
+	SceneFormats::CollisionMesh mesh;
+	for (unsigned i = 0; i < 8; i++)
+		mesh.positions.emplace_back(float(i & 1), float((i >> 1) & 1), float((i >> 2) & 1), 1.0f);
+
+	static const unsigned faces[6][4] = {
+		{ 0, 1, 3, 2 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 }, { 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 3, 7, 5 },
+	};
+
+	for (auto &face : faces)
+	{
+		vec3 center(0.0f);
+		for (auto index : face)
+			center += mesh.positions[index].xyz() * 0.25f;
+		vec3 normal = center - vec3(0.5f);
+
+		unsigned tris[2][3] = { { face[0], face[1], face[2] }, { face[0], face[2], face[3] } };
+		for (auto &tri : tris)
+		{
+			vec3 a = mesh.positions[tri[0]].xyz();
+			vec3 b = mesh.positions[tri[1]].xyz();
+			vec3 c = mesh.positions[tri[2]].xyz();
+			if (dot(cross(b - a, c - a), normal) < 0.0f)
+				std::swap(tri[1], tri[2]);
+			mesh.indices.insert(mesh.indices.end(), tri, tri + 3);
+		}
+	}
+
+	return mesh;
+}
+
+// Square in the XY plane at Z = 0 from -1 to 1, facing +Z.
+static SceneFormats::CollisionMesh make_quad()
+{
+	SceneFormats::CollisionMesh mesh;
+	mesh.positions = { vec4(-1.0f, -1.0f, 0.0f, 1.0f), vec4(1.0f, -1.0f, 0.0f, 1.0f),
+	                   vec4(1.0f, 1.0f, 0.0f, 1.0f), vec4(-1.0f, 1.0f, 0.0f, 1.0f) };
+	mesh.indices = { 0, 1, 2, 0, 2, 3 };
+	return mesh;
+}
+
+static mat4 box_transform(const AABB &aabb)
+{
+	return translate(aabb.get_minimum()) * scale(aabb.get_maximum() - aabb.get_minimum());
+}
+
+static bool expect(bool value, const char *desc)
+{
+	if (!value)
+		LOGE("%s\n", desc);
+	return value;
+}
+
+static bool test_simple()
+{
+	auto cube = make_cube();
+	auto quad = make_quad();
+	auto view = make_view(vec3(0.0f), vec3(0.0f, 0.0f, -1.0f));
+
+	OcclusionCullerParameters params;
+	params.view_projection = view.view_projection;
+	params.width = Width;
+	params.height = Height;
+
+	OcclusionCuller culler;
+	culler.begin(params);
+	culler.rasterize();
+	bool ok = expect(culler.test_aabb(AABB(vec3(-1.0f, -1.0f, -20.0f), vec3(1.0f, 1.0f, -18.0f))),
+	                 "Box culled without occluders.");
+
+	// A wall 10 units away, 10 units wide.
+	culler.begin(params);
+	culler.add_occluder(cube, box_transform(AABB(vec3(-5.0f, -5.0f, -11.0f), vec3(5.0f, 5.0f, -10.0f))));
+	culler.rasterize();
+
+	ok = ok && expect(!culler.test_aabb(AABB(vec3(-1.0f, -1.0f, -20.0f), vec3(1.0f, 1.0f, -18.0f))),
+	                  "Box behind the wall is visible.");
+	ok = ok && expect(culler.test_aabb(AABB(vec3(-1.0f, -1.0f, -8.0f), vec3(1.0f, 1.0f, -6.0f))),
+	                  "Box in front of the wall is culled.");
+	ok = ok && expect(culler.test_aabb(AABB(vec3(-1.0f, -1.0f, -12.0f), vec3(1.0f, 1.0f, -9.0f))),
+	                  "Box intersecting the wall is culled.");
+	// Peeks out a full unit past the edge, about 10 pixels at this distance.
+	ok = ok && expect(culler.test_aabb(AABB(vec3(4.0f, -1.0f, -20.0f), vec3(12.0f, 1.0f, -18.0f))),
+	                  "Box peeking out behind the wall is culled.");
+	ok = ok && expect(culler.test_aabb(AABB(vec3(-1.0f, -1.0f, -1.0f), vec3(1.0f, 1.0f, 1.0f))),
+	                  "Box around the camera is culled.");
+
+	// A single-sided quad only occludes from the front.
+	mat4 facing = translate(vec3(0.0f, 0.0f, -10.0f)) * scale(vec3(5.0f));
+	mat4 away = facing * mat4_cast(angleAxis(pi<float>(), vec3(0.0f, 1.0f, 0.0f)));
+	AABB hidden(vec3(-1.0f, -1.0f, -20.0f), vec3(1.0f, 1.0f, -18.0f));
+
+	culler.begin(params);
+	culler.add_occluder(quad, facing);
+	culler.rasterize();
+	ok = ok && expect(!culler.test_aabb(hidden), "Front facing quad does not occlude.");
+
+	culler.begin(params);
+	culler.add_occluder(quad, away);
+	culler.rasterize();
+	ok = ok && expect(culler.test_aabb(hidden), "Back facing quad occludes.");
+
+	culler.begin(params);
+	culler.add_occluder(quad, away, true);
+	culler.rasterize();
+	ok = ok && expect(!culler.test_aabb(hidden), "Double-sided quad does not occlude.");
+
+	// A floor which starts behind the camera, so it is clipped by the near plane.
+	culler.begin(params);
+	culler.add_occluder(quad, translate(vec3(0.0f, -1.0f, -45.0f)) *
+	                          mat4_cast(angleAxis(-0.5f * pi<float>(), vec3(1.0f, 0.0f, 0.0f))) *
+	                          scale(vec3(50.0f)));
+	culler.rasterize();
+	ok = ok && expect(!culler.test_aabb(AABB(vec3(-1.0f, -4.0f, -11.0f), vec3(1.0f, -2.0f, -9.0f))),
+	                  "Box below the floor is visible.");
+	ok = ok && expect(culler.test_aabb(AABB(vec3(-1.0f, -0.5f, -11.0f), vec3(1.0f, 0.5f, -9.0f))),
+	                  "Box above the floor is culled.");
+
+	return ok;
+}
+
+struct City
+{
+	std::vector<AABB> buildings;
+	std::vector<AABB> objects;
+	std::vector<View> views;
+};
+
+// Blocks of buildings along streets, with small objects scattered everywhere, also inside blocks.
+static City make_city(unsigned blocks, unsigned num_objects, unsigned seed)
+{
+	City city;
+	std::mt19937 rnd(seed);
+	std::uniform_real_distribution<float> height(5.0f, 40.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	constexpr float BlockSize = 20.0f;
+	constexpr float Street = 8.0f;
+	float extent = float(blocks) * (BlockSize + Street);
+
+	for (unsigned z = 0; z < blocks; z++)
+	{
+		for (unsigned x = 0; x < blocks; x++)
+		{
+			vec3 base(float(x) * (BlockSize + Street), 0.0f, float(z) * (BlockSize + Street));
+			// Four buildings per block.
+			for (unsigned i = 0; i < 4; i++)
+			{
+				vec3 lo = base + vec3(float(i & 1), 0.0f, float(i >> 1)) * (0.5f * BlockSize);
+				city.buildings.emplace_back(lo, lo + vec3(0.5f * BlockSize - 1.0f, height(rnd), 0.5f * BlockSize - 1.0f));
+			}
+		}
+	}
+
+	for (unsigned i = 0; i < num_objects; i++)
+	{
+		vec3 pos(unit(rnd) * extent, unit(rnd) * 10.0f, unit(rnd) * extent);
+		float size = 0.2f + 2.0f * unit(rnd);
+		city.objects.emplace_back(pos, pos + vec3(size));
+	}
+
+	// Objects flush against building walls, and thin poles and wires touching building corners.
+	// These sit exactly on occluder silhouettes, where a rasterizer which is not conservative culls them.
+	for (auto &building : city.buildings)
+	{
+		vec3 lo = building.get_minimum();
+		vec3 hi = building.get_maximum();
+		float h = unit(rnd) * (hi.y - 1.0f);
+		city.objects.emplace_back(vec3(hi.x, h, lo.z + 1.0f), vec3(hi.x + 0.5f, h + 1.0f, lo.z + 2.0f));
+		city.objects.emplace_back(vec3(lo.x - 0.5f, h, hi.z - 2.0f), vec3(lo.x, h + 1.0f, hi.z - 1.0f));
+		city.objects.emplace_back(vec3(hi.x, 0.0f, hi.z), vec3(hi.x + 0.02f, 6.0f, hi.z + 0.02f));
+		city.objects.emplace_back(vec3(lo.x - 0.02f, h, lo.z - 0.02f), vec3(lo.x, h + 0.02f, hi.z));
+	}
+
+	// Street level cameras at crossings, looking along the streets and diagonally.
+	for (unsigned i = 0; i < 16; i++)
+	{
+		float offset = float(1 + (i % 3)) * (BlockSize + Street) - 0.5f * Street;
+		vec3 eye(offset, 1.8f, offset);
+		float angle = float(i) * 0.4f;
+		city.views.push_back(make_view(eye, eye + vec3(std::cos(angle), -0.05f, std::sin(angle))));
+	}
+
+	return city;
+}
+
+static bool segment_hits_box(const vec3 &from, const vec3 &to, const AABB &aabb)
+{
+	vec3 dir = to - from;
+	float t0 = 0.0f;
+	// Stop just short of the end point, which might lie on an occluder.
+	float t1 = 0.999f;
+	for (unsigned axis = 0; axis < 3; axis++)
+	{
+		float lo = aabb.get_minimum()[axis];
+		float hi = aabb.get_maximum()[axis];
+		if (std::abs(dir[axis]) < 1e-8f)
+		{
+			if (from[axis] < lo || from[axis] > hi)
+				return false;
+			continue;
+		}
+
+		float ta = (lo - from[axis]) / dir[axis];
+		float tb = (hi - from[axis]) / dir[axis];
+		t0 = std::max(t0, std::min(ta, tb));
+		t1 = std::min(t1, std::max(ta, tb));
+		if (t0 > t1)
+			return false;
+	}
+	return true;
+}
+
+static bool point_visible(const City &city, const vec3 &from, const vec3 &to)
+{
+	for (auto &building : city.buildings)
+		if (segment_hits_box(from, to, building))
+			return false;
+	return true;
+}
+
+// Samples the faces of the box including their edges and corners, which is where thin boxes
+// and boxes flush against occluders are visible.
+static bool box_visible(const City &city, const View &view, const AABB &aabb)
+{
+	constexpr unsigned Steps = 5;
+	vec3 lo = aabb.get_minimum();
+	vec3 extent = aabb.get_maximum() - lo;
+
+	for (unsigned axis = 0; axis < 3; axis++)
+	{
+		for (unsigned side = 0; side < 2; side++)
+		{
+			for (unsigned v = 0; v < Steps; v++)
+			{
+				for (unsigned u = 0; u < Steps; u++)
+				{
+					vec3 t;
+					t[axis] = float(side);
+					t[(axis + 1) % 3] = float(u) / float(Steps - 1);
+					t[(axis + 2) % 3] = float(v) / float(Steps - 1);
+					vec3 point = lo + t * extent;
+
+					vec4 clip = view.view_projection * vec4(point, 1.0f);
+					if (clip.w <= 0.0f || any(greaterThan(abs(clip.xy()), vec2(clip.w))))
+						continue;
+					if (point_visible(city, view.eye, point))
+						return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+static bool test_city(ThreadGroup &workers)
+{
+	auto city = make_city(8, 2000, 1);
+	auto cube = make_cube();
+	OcclusionCuller culler, threaded_culler;
+	unsigned culled = 0;
+	unsigned hidden = 0;
+	unsigned tested = 0;
+
+	for (auto &view : city.views)
+	{
+		OcclusionCullerParameters params;
+		params.view_projection = view.view_projection;
+		params.width = Width;
+		params.height = Height;
+
+		culler.begin(params);
+		threaded_culler.begin(params);
+		for (auto &building : city.buildings)
+		{
+			culler.add_occluder(cube, box_transform(building));
+			threaded_culler.add_occluder(cube, box_transform(building));
+		}
+		culler.rasterize();
+		threaded_culler.rasterize(&workers);
+
+		if (!std::equal(culler.get_depth(), culler.get_depth() + culler.get_width() * culler.get_height(),
+		                threaded_culler.get_depth()))
+		{
+			LOGE("Threaded rasterization does not match.\n");
+			return false;
+		}
+
+		Frustum frustum;
+		frustum.build_planes(inverse(view.view_projection));
+
+		for (auto &object : city.objects)
+		{
+			if (!SIMD::frustum_cull(object, frustum.get_planes()))
+				continue;
+			tested++;
+
+			bool visible = culler.test_aabb(object);
+			bool reference = box_visible(city, view, object);
+			if (!visible && reference)
+			{
+				LOGE("Object at (%.2f, %.2f, %.2f) was culled, but is visible.\n",
+				     object.get_minimum().x, object.get_minimum().y, object.get_minimum().z);
+				return false;
+			}
+
+			if (!visible)
+				culled++;
+			if (!reference)
+				hidden++;
+		}
+	}
+
+	LOGI("City: %u objects in frustums, %u culled, %u hidden by ray casting.\n", tested, culled, hidden);
+	return true;
+}
+
+static void bench(const char *desc, ThreadGroup *workers)
+{
+	auto city = make_city(24, 100000, 2);
+	auto cube = make_cube();
+	OcclusionCuller culler;
+
+	constexpr unsigned Iterations = 10;
+	uint64_t raster_time = 0;
+	uint64_t test_time = 0;
+	unsigned tested = 0;
+	unsigned culled = 0;
+
+	for (unsigned iter = 0; iter < Iterations; iter++)
+	{
+		for (auto &view : city.views)
+		{
+			OcclusionCullerParameters params;
+			params.view_projection = view.view_projection;
+			params.width = Width;
+			params.height = Height;
+
+			auto start = Util::get_current_time_nsecs();
+			culler.begin(params);
+			for (auto &building : city.buildings)
+				culler.add_occluder(cube, box_transform(building));
+			culler.rasterize(workers);
+			auto rasterized = Util::get_current_time_nsecs();
+
+			for (auto &object : city.objects)
+			{
+				tested++;
+				if (!culler.test_aabb(object))
+					culled++;
+			}
+			auto end = Util::get_current_time_nsecs();
+
+			raster_time += rasterized - start;
+			test_time += end - rasterized;
+		}
+	}
+
+	unsigned frames = Iterations * unsigned(city.views.size());
+	LOGI("%-22s %u occluders, %u polygons rasterized: %.3f ms raster, %.1f M boxes/s, %.1f %% culled.\n",
+	     desc, culler.get_num_occluders(), culler.get_num_rasterized_polygons(),
+	     1e-6 * double(raster_time) / frames, 1e3 * double(tested) / double(test_time),
+	     100.0 * double(culled) / double(tested));
+}
+
+int main()
+{
+	if (!test_simple())
+		return EXIT_FAILURE;
+
+	ThreadGroup workers;
+	workers.start(std::thread::hardware_concurrency(), 0, {});
+
+	if (!test_city(workers))
+		return EXIT_FAILURE;
+
+	bench("Single thread", nullptr);
+	bench("Workers", &workers);
+
+	LOGI("All tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+#include "thread_group.hpp"
+#include "logging.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+using namespace Granite;
+
+static bool test_coverage(ThreadGroup &group)
+{
+	// Every index runs exactly once, including a partial last chunk.
+	for (size_t grain : { size_t(1), size_t(7), size_t(64), size_t(1000) })
+	{
+		std::vector<std::atomic_uint> hits(1000);
+		std::vector<std::atomic_uint> chunk_hits((hits.size() + grain - 1) / grain);
+		parallel_for_range(&group, 0, hits.size(), grain, "parallel-for-test",
+		                   [&](size_t chunk, size_t begin, size_t end) {
+			chunk_hits[chunk].fetch_add(1, std::memory_order_relaxed);
+			for (size_t i = begin; i < end; i++)
+				hits[i].fetch_add(1, std::memory_order_relaxed);
+		});
+
+		for (auto &h : hits)
+			if (h.load() != 1)
+				return false;
+		for (auto &h : chunk_hits)
+			if (h.load() != 1)
+				return false;
+	}
+
+	return true;
+}
+
+static bool test_nested(ThreadGroup &group)
+{
+	// Far more outer iterations than workers, all of them running a parallel loop from within a task.
+	// Waiting for helper tasks here rather than for chunks would deadlock once every worker waits.
+	std::atomic_uint count{0};
+	parallel_for_range(&group, 0, 64, 1, "parallel-for-outer", [&](size_t, size_t, size_t) {
+		parallel_for_range(&group, 0, 256, 16, "parallel-for-inner", [&](size_t, size_t begin, size_t end) {
+			count.fetch_add(unsigned(end - begin), std::memory_order_relaxed);
+		});
+	});
+	return count.load() == 64 * 256;
+}
+
+static bool test_exception(ThreadGroup &group)
+{
+	// The exception from the lowest chunk wins, regardless of which thread ran it.
+	try
+	{
+		parallel_for_range(&group, 0, 100, 1, "parallel-for-throw", [](size_t chunk, size_t, size_t) {
+			if (chunk % 10 == 3)
+				throw std::runtime_error(std::to_string(chunk));
+		});
+	}
+	catch (const std::runtime_error &e)
+	{
+		return std::string(e.what()) == "3";
+	}
+
+	return false;
+}
+
+int main()
+{
+	ThreadGroup group;
+	group.start(4, 0, {});
+
+	bool success = true;
+	const auto check = [&](bool result, const char *name) {
+		if (!result)
+		{
+			LOGE("%s failed.\n", name);
+			success = false;
+		}
+	};
+
+	check(test_coverage(group), "Coverage");
+	check(test_nested(group), "Nested");
+	check(test_exception(group), "Exception");
+
+	// Without a thread group, everything runs on the calling thread.
+	std::vector<unsigned> serial(10);
+	parallel_for_range(nullptr, 0, serial.size(), 3, "parallel-for-serial", [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			serial[i]++;
+	});
+	for (auto v : serial)
+		if (v != 1)
+			check(false, "Serial");
+
+	group.wait_idle();
+
+	if (success)
+		LOGI("All tests passed.\n");
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
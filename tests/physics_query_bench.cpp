@@ -0,0 +1,182 @@
+#include "physics_system.hpp"
+#include "thread_group.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <thread>
+#include <cmath>
+#include <limits>
+
+using namespace Granite;
+
+// Rolling heightfield stored as a plain triangle mesh, so queries go through the triangle BVH.
+struct TerrainMesh
+{
+	std::vector<vec4> positions;
+	std::vector<uint32_t> indices;
+	AABB aabb;
+};
+
+static TerrainMesh build_terrain(unsigned grid_size, float extent)
+{
+	TerrainMesh terrain;
+	terrain.positions.reserve((grid_size + 1) * (grid_size + 1));
+
+	vec3 lo(std::numeric_limits<float>::max());
+	vec3 hi(-std::numeric_limits<float>::max());
+	for (unsigned z = 0; z <= grid_size; z++)
+	{
+		for (unsigned x = 0; x <= grid_size; x++)
+		{
+			float fx = (float(x) / float(grid_size) - 0.5f) * extent;
+			float fz = (float(z) / float(grid_size) - 0.5f) * extent;
+			float y = 4.0f * std::sin(0.05f * fx) * std::cos(0.07f * fz) + 0.5f * std::sin(0.9f * fx + 0.3f * fz);
+			vec3 pos(fx, y, fz);
+			terrain.positions.emplace_back(pos, 1.0f);
+			lo = min(lo, pos);
+			hi = max(hi, pos);
+		}
+	}
+
+	for (unsigned z = 0; z < grid_size; z++)
+	{
+		for (unsigned x = 0; x < grid_size; x++)
+		{
+			uint32_t i00 = z * (grid_size + 1) + x;
+			uint32_t i10 = i00 + 1;
+			uint32_t i01 = i00 + grid_size + 1;
+			uint32_t i11 = i01 + 1;
+			terrain.indices.insert(terrain.indices.end(), { i00, i01, i10, i10, i01, i11 });
+		}
+	}
+
+	terrain.aabb = AABB(lo, hi);
+	return terrain;
+}
+
+static bool results_match(const RaycastResult &a, const RaycastResult &b)
+{
+	return a.handle == b.handle && std::abs(a.t - b.t) <= 1e-4f * std::max(1.0f, a.t);
+}
+
+int main()
+{
+	constexpr unsigned NumQueries = 10000;
+	constexpr float Extent = 512.0f;
+
+	auto terrain = build_terrain(512, Extent);
+	PhysicsSystem physics;
+
+	PhysicsSystem::CollisionMesh mesh;
+	mesh.indices = terrain.indices.data();
+	mesh.num_triangles = unsigned(terrain.indices.size() / 3);
+	mesh.index_stride_triangle = 3 * sizeof(uint32_t);
+	mesh.positions = terrain.positions.front().data;
+	mesh.num_attributes = unsigned(terrain.positions.size());
+	mesh.position_stride = sizeof(vec4);
+	mesh.aabb = terrain.aabb;
+	unsigned index = physics.register_collision_mesh(mesh);
+	physics.add_mesh(nullptr, index, {});
+
+	LOGI("Level: %u triangles.\n", mesh.num_triangles);
+
+	std::mt19937 rnd(1);
+	std::uniform_real_distribution<float> pos_dist(-0.45f * Extent, 0.45f * Extent);
+	std::uniform_real_distribution<float> dir_dist(-0.5f, 0.5f);
+
+	std::vector<PhysicsSystem::RayQuery> rays(NumQueries);
+	std::vector<PhysicsSystem::SweepQuery> sweeps(NumQueries);
+	for (unsigned i = 0; i < NumQueries; i++)
+	{
+		auto &ray = rays[i];
+		ray.from = vec3(pos_dist(rnd), 20.0f, pos_dist(rnd));
+		ray.dir = normalize(vec3(dir_dist(rnd), -1.0f, dir_dist(rnd)));
+		ray.length = 100.0f;
+
+		auto &sweep = sweeps[i];
+		sweep.type = PhysicsSystem::MeshType::Sphere;
+		sweep.radius = 0.5f;
+		sweep.from = ray.from;
+		sweep.dir = ray.dir;
+		sweep.length = ray.length;
+	}
+
+	std::vector<RaycastResult> reference(NumQueries);
+	std::vector<RaycastResult> serial(NumQueries);
+	std::vector<RaycastResult> parallel(NumQueries);
+
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned i = 0; i < NumQueries; i++)
+		reference[i] = physics.query_closest_hit_ray(rays[i].from, rays[i].dir, rays[i].length, rays[i].mask);
+	auto end = Util::get_current_time_nsecs();
+	LOGI("query_closest_hit_ray loop: %.3f ms.\n", 1e-6 * double(end - start));
+
+	start = Util::get_current_time_nsecs();
+	physics.query_closest_hit_rays(rays.data(), serial.data(), NumQueries);
+	end = Util::get_current_time_nsecs();
+	LOGI("Batched rays, serial: %.3f ms.\n", 1e-6 * double(end - start));
+
+	ThreadGroup workers;
+	workers.start(std::thread::hardware_concurrency(), 0, {});
+
+	start = Util::get_current_time_nsecs();
+	physics.query_closest_hit_rays(rays.data(), parallel.data(), NumQueries, &workers);
+	end = Util::get_current_time_nsecs();
+	LOGI("Batched rays, %u threads: %.3f ms.\n", workers.get_num_threads(), 1e-6 * double(end - start));
+
+	unsigned hits = 0;
+	for (unsigned i = 0; i < NumQueries; i++)
+	{
+		if (!results_match(reference[i], serial[i]) || !results_match(reference[i], parallel[i]))
+		{
+			LOGE("Mismatch for ray %u.\n", i);
+			return EXIT_FAILURE;
+		}
+
+		if (reference[i].handle)
+			hits++;
+	}
+	LOGI("%u / %u rays hit, batched results match.\n", hits, NumQueries);
+
+	start = Util::get_current_time_nsecs();
+	physics.query_closest_hit_sweeps(sweeps.data(), serial.data(), NumQueries);
+	end = Util::get_current_time_nsecs();
+	LOGI("Batched sphere sweeps, serial: %.3f ms.\n", 1e-6 * double(end - start));
+
+	start = Util::get_current_time_nsecs();
+	physics.query_closest_hit_sweeps(sweeps.data(), parallel.data(), NumQueries, &workers);
+	end = Util::get_current_time_nsecs();
+	LOGI("Batched sphere sweeps, %u threads: %.3f ms.\n", workers.get_num_threads(), 1e-6 * double(end - start));
+
+	for (unsigned i = 0; i < NumQueries; i++)
+	{
+		if (!results_match(serial[i], parallel[i]))
+		{
+			LOGE("Mismatch for sweep %u.\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Systems running as tasks issue their own batches on the same group. Those must not wait for workers
+	// which are all busy with the outer tasks.
+	constexpr unsigned NestedBatches = 16;
+	start = Util::get_current_time_nsecs();
+	parallel_for_range(&workers, 0, NestedBatches, 1, "physics-nested-batches", [&](size_t batch, size_t, size_t) {
+		unsigned first = unsigned(batch * NumQueries / NestedBatches);
+		unsigned last = unsigned((batch + 1) * NumQueries / NestedBatches);
+		physics.query_closest_hit_rays(rays.data() + first, parallel.data() + first, last - first, &workers);
+	});
+	end = Util::get_current_time_nsecs();
+	LOGI("Batched rays from %u tasks: %.3f ms.\n", NestedBatches, 1e-6 * double(end - start));
+
+	for (unsigned i = 0; i < NumQueries; i++)
+	{
+		if (!results_match(reference[i], parallel[i]))
+		{
+			LOGE("Mismatch for nested ray %u.\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -1,7 +1,13 @@
 #include "dsp/sinc_resampler.hpp"
 #include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <random>
+#include <algorithm>
 #include "global_managers_init.hpp"
 #include "filesystem.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
 
 using namespace Granite::Audio::DSP;
 
@@ -31,11 +37,175 @@ static void test_reported_sizes()
 	}
 }
 
+static std::vector<float> make_noise(size_t count, unsigned seed)
+{
+	std::mt19937 rnd(seed);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	std::vector<float> samples(count);
+	for (auto &s : samples)
+		s = dist(rnd);
+	return samples;
+}
+
+// Batched channels must match resampling each channel on its own bit for bit,
+// and the precomputed integer-ratio phases must agree with the interpolated kernel up to its interpolation error.
+static void test_batched_channels()
+{
+	constexpr size_t NumFrames = 8 * 1024;
+	constexpr unsigned NumChannels = 7;
+	std::vector<float> inputs[NumChannels];
+	for (unsigned c = 0; c < NumChannels; c++)
+		inputs[c] = make_noise(NumFrames, c + 1);
+
+	SincResampler batched(48000.0f, 44100.0f, SincResampler::Quality::Medium, NumChannels);
+	if (!batched.is_using_exact_phases())
+		exit(EXIT_FAILURE);
+
+	size_t max_output = batched.get_maximum_output_for_input_frames(NumFrames);
+	std::vector<float> batched_out[NumChannels];
+	const float *input_ptrs[NumChannels];
+	float *output_ptrs[NumChannels];
+	for (unsigned c = 0; c < NumChannels; c++)
+	{
+		batched_out[c].resize(max_output);
+		input_ptrs[c] = inputs[c].data();
+		output_ptrs[c] = batched_out[c].data();
+	}
+
+	size_t rendered = batched.process_input_frames(output_ptrs, input_ptrs, NumFrames);
+
+	std::vector<float> single_out(max_output);
+	std::vector<float> interpolated_out(max_output);
+	for (unsigned c = 0; c < NumChannels; c++)
+	{
+		SincResampler single(48000.0f, 44100.0f, SincResampler::Quality::Medium);
+		if (single.process_input_frames(single_out.data(), inputs[c].data(), NumFrames) != rendered)
+			exit(EXIT_FAILURE);
+		if (memcmp(single_out.data(), batched_out[c].data(), rendered * sizeof(float)) != 0)
+		{
+			LOGE("Batched channel %u does not match single channel resampling.\n", c);
+			exit(EXIT_FAILURE);
+		}
+
+		// Nudging the ratio falls back to the interpolated kernel at the same nominal rate.
+		SincResampler interpolated(48000.0f, 44100.0f, SincResampler::Quality::Medium);
+		interpolated.set_sample_rate_ratio(48000.0f / 44100.0f + 1e-7f);
+		interpolated.set_sample_rate_ratio(48000.0f / 44100.0f);
+		if (interpolated.is_using_exact_phases())
+			exit(EXIT_FAILURE);
+
+		size_t interpolated_rendered = interpolated.process_input_frames(interpolated_out.data(), inputs[c].data(), NumFrames);
+		float max_error = 0.0f;
+		for (size_t i = 0; i < std::min(rendered, interpolated_rendered); i++)
+			max_error = std::max(max_error, fabsf(interpolated_out[i] - single_out[i]));
+
+		if (max_error > 5e-3f)
+		{
+			LOGE("Exact phases deviate from interpolated kernel by %f.\n", max_error);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void bench_throughput()
+{
+	struct Ratio
+	{
+		const char *desc;
+		float out_rate, in_rate;
+	};
+	static const Ratio ratios[] = {
+		{ "44.1k -> 48k", 48000.0f, 44100.0f },
+		{ "48k -> 96k", 96000.0f, 48000.0f },
+		{ "48k, 100 ppm drift", 48004.8f, 48000.0f },
+		{ "48k -> 44.1k", 44100.0f, 48000.0f },
+	};
+	static const struct
+	{
+		const char *desc;
+		SincResampler::Quality quality;
+	} qualities[] = {
+		{ "Low", SincResampler::Quality::Low },
+		{ "Medium", SincResampler::Quality::Medium },
+		{ "High", SincResampler::Quality::High },
+	};
+
+	constexpr unsigned NumChannels = 2;
+	constexpr size_t BlockFrames = 256;
+	constexpr size_t NumBlocks = 2000;
+	std::vector<float> inputs[NumChannels];
+	for (unsigned c = 0; c < NumChannels; c++)
+		inputs[c] = make_noise(BlockFrames, c + 1);
+	std::vector<float> outputs[NumChannels];
+
+	for (auto &quality : qualities)
+	{
+		for (auto &ratio : ratios)
+		{
+			SincResampler batched(ratio.out_rate, ratio.in_rate, quality.quality, NumChannels);
+			SincResampler left(ratio.out_rate, ratio.in_rate, quality.quality);
+			SincResampler right(ratio.out_rate, ratio.in_rate, quality.quality);
+
+			size_t max_output = batched.get_maximum_output_for_input_frames(BlockFrames);
+			const float *input_ptrs[NumChannels];
+			float *output_ptrs[NumChannels];
+			for (unsigned c = 0; c < NumChannels; c++)
+			{
+				outputs[c].resize(max_output);
+				input_ptrs[c] = inputs[c].data();
+				output_ptrs[c] = outputs[c].data();
+			}
+
+			size_t rendered = 0;
+			auto start = Util::get_current_time_nsecs();
+			for (size_t i = 0; i < NumBlocks; i++)
+			{
+				rendered += left.process_input_frames(output_ptrs[0], input_ptrs[0], BlockFrames);
+				right.process_input_frames(output_ptrs[1], input_ptrs[1], BlockFrames);
+			}
+			auto end = Util::get_current_time_nsecs();
+			double per_channel_time = 1e-9 * double(end - start);
+
+			start = Util::get_current_time_nsecs();
+			for (size_t i = 0; i < NumBlocks; i++)
+				batched.process_input_frames(output_ptrs, input_ptrs, BlockFrames);
+			end = Util::get_current_time_nsecs();
+			double batched_time = 1e-9 * double(end - start);
+
+			LOGI("%-6s %-18s (%s): per-channel %7.2f M frames/s, stereo batched %7.2f M frames/s.\n",
+			     quality.desc, ratio.desc, batched.is_using_exact_phases() ? "exact" : "interpolated",
+			     1e-6 * double(rendered) / per_channel_time, 1e-6 * double(rendered) / batched_time);
+		}
+	}
+}
+
 int main(int argc, char **argv)
 {
+	const char *program = argv[0];
+	bool bench = argc >= 2 && strcmp(argv[1], "--bench") == 0;
+	if (bench)
+	{
+		argc--;
+		argv++;
+	}
+
 	test_reported_sizes();
+	test_batched_channels();
+	if (bench)
+		bench_throughput();
+
+	// Resampling files is optional, the self-tests are enough for a test run.
+	if (argc == 1)
+	{
+		LOGI("All tests passed.\n");
+		return EXIT_SUCCESS;
+	}
+
 	if (argc != 4)
+	{
+		LOGE("Usage: %s [--bench] [<input> <output upsampled> <output downsampled>]\n", program);
 		return EXIT_FAILURE;
+	}
 
 	Granite::Global::init(Granite::Global::MANAGER_FEATURE_FILESYSTEM_BIT);
 	auto *fs = GRANITE_FILESYSTEM();
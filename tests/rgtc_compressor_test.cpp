@@ -0,0 +1,192 @@
+#include "rgtc_compressor.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <cmath>
+
+using namespace Granite;
+
+enum class Content
+{
+	Gradient,
+	NormalMap,
+	Noise,
+	Outliers
+};
+
+static const char *content_name(Content content)
+{
+	switch (content)
+	{
+	case Content::Gradient:
+		return "Gradient";
+	case Content::NormalMap:
+		return "Normal map";
+	case Content::Noise:
+		return "Noise";
+	case Content::Outliers:
+		return "Mask with outliers";
+	}
+	return "";
+}
+
+// 16 bytes per block, in the order the compressor expects.
+static std::vector<uint8_t> make_blocks(Content content, unsigned num_blocks, unsigned seed)
+{
+	std::mt19937 rnd(seed);
+	std::uniform_int_distribution<int> byte(0, 255);
+	std::normal_distribution<float> jitter(0.0f, 3.0f);
+	std::vector<uint8_t> blocks(num_blocks * 16);
+
+	for (unsigned b = 0; b < num_blocks; b++)
+	{
+		uint8_t *block = &blocks[b * 16];
+		float base = float(byte(rnd));
+		float dx = float(byte(rnd) - 128) / 32.0f;
+		float dy = float(byte(rnd) - 128) / 32.0f;
+
+		for (int i = 0; i < 16; i++)
+		{
+			float x = float(i & 3);
+			float y = float(i >> 2);
+			float v = 0.0f;
+
+			switch (content)
+			{
+			case Content::Gradient:
+				v = base + dx * x + dy * y;
+				break;
+
+			case Content::NormalMap:
+				v = base + dx * x + dy * y + jitter(rnd);
+				break;
+
+			case Content::Noise:
+				v = float(byte(rnd));
+				break;
+
+			case Content::Outliers:
+				v = base + jitter(rnd);
+				// Masks are mostly flat, but have the odd fully on or off texel.
+				if ((rnd() & 7) == 0)
+					v = (rnd() & 1) ? 255.0f : 0.0f;
+				break;
+			}
+
+			block[i] = uint8_t(std::max(0.0f, std::min(255.0f, std::round(v))));
+		}
+	}
+
+	return blocks;
+}
+
+static double psnr(uint64_t error, unsigned num_blocks)
+{
+	if (!error)
+		return INFINITY;
+	double mse = double(error) / (16.0 * num_blocks);
+	return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+static bool test_content(Content content)
+{
+	constexpr unsigned NumBlocks = 20000;
+	auto blocks = make_blocks(content, NumBlocks, unsigned(content) + 1);
+
+	uint64_t reference_error = 0;
+	uint64_t default_error = 0;
+	uint64_t high_error = 0;
+
+	for (unsigned b = 0; b < NumBlocks; b++)
+	{
+		const uint8_t *input = &blocks[b * 16];
+		uint8_t reference[8], fast[8], high[8];
+		compress_rgtc_red_block_reference(reference, input);
+		compress_rgtc_red_block(fast, input, RGTCQuality::Default);
+		compress_rgtc_red_block(high, input, RGTCQuality::High);
+
+		unsigned e_reference = compute_rgtc_red_block_error(reference, input);
+		unsigned e_default = compute_rgtc_red_block_error(fast, input);
+		unsigned e_high = compute_rgtc_red_block_error(high, input);
+
+		if (e_default > e_reference || e_high > e_default)
+		{
+			LOGE("%s: block %u got worse, reference %u, default %u, high %u.\n",
+			     content_name(content), b, e_reference, e_default, e_high);
+			return false;
+		}
+
+		reference_error += e_reference;
+		default_error += e_default;
+		high_error += e_high;
+	}
+
+	LOGI("%-20s PSNR: reference %6.2f dB, default %6.2f dB, high %6.2f dB.\n", content_name(content),
+	     psnr(reference_error, NumBlocks), psnr(default_error, NumBlocks), psnr(high_error, NumBlocks));
+	return true;
+}
+
+// Two channels of the same block must round-trip through the same decoder.
+static bool test_red_green()
+{
+	auto red = make_blocks(Content::NormalMap, 1000, 10);
+	auto green = make_blocks(Content::Outliers, 1000, 11);
+
+	for (unsigned b = 0; b < 1000; b++)
+	{
+		uint8_t rg[16], r[8], g[8];
+		compress_rgtc_red_green_block(rg, &red[b * 16], &green[b * 16]);
+		compress_rgtc_red_block(r, &red[b * 16]);
+		compress_rgtc_red_block(g, &green[b * 16]);
+		if (!std::equal(r, r + 8, rg) || !std::equal(g, g + 8, rg + 8))
+		{
+			LOGE("Red-green block does not match the individual channels.\n");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+template <typename Func>
+static void bench(const char *desc, const std::vector<uint8_t> &blocks, const Func &func)
+{
+	unsigned num_blocks = unsigned(blocks.size() / 16);
+	std::vector<uint8_t> output(num_blocks * 8);
+
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned b = 0; b < num_blocks; b++)
+		func(&output[b * 8], &blocks[b * 16]);
+	auto end = Util::get_current_time_nsecs();
+
+	double seconds = 1e-9 * double(end - start);
+	LOGI("%-20s %7.2f MPix/s.\n", desc, 1e-6 * 16.0 * double(num_blocks) / seconds);
+}
+
+int main()
+{
+	for (auto content : { Content::Gradient, Content::NormalMap, Content::Noise, Content::Outliers })
+		if (!test_content(content))
+			return EXIT_FAILURE;
+
+	if (!test_red_green())
+		return EXIT_FAILURE;
+
+	auto blocks = make_blocks(Content::NormalMap, 100000, 20);
+	bench("Reference", blocks, [](uint8_t *output, const uint8_t *input) {
+		compress_rgtc_red_block_reference(output, input);
+	});
+	bench("Default", blocks, [](uint8_t *output, const uint8_t *input) {
+		compress_rgtc_red_block(output, input, RGTCQuality::Default);
+	});
+
+	blocks.resize(10000 * 16);
+	bench("High", blocks, [](uint8_t *output, const uint8_t *input) {
+		compress_rgtc_red_block(output, input, RGTCQuality::High);
+	});
+
+	LOGI("All tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,334 @@
+#include "arena_allocator.hpp"
+#include "logging.hpp"
+#include <random>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+using namespace Util;
+
+// CPU stand-in for the global buffers of a MeshBufferAllocator. Unlike the mesh allocator,
+// any number of backing buffers can be live, so released backing heaps are visible.
+struct FakeBacking : SliceBackingAllocator
+{
+	std::vector<std::unique_ptr<std::vector<uint32_t>>> buffers;
+	unsigned live_buffers = 0;
+
+	uint32_t allocate(uint32_t count) override
+	{
+		live_buffers++;
+		for (size_t i = 0; i < buffers.size(); i++)
+		{
+			if (!buffers[i])
+			{
+				buffers[i].reset(new std::vector<uint32_t>(count));
+				return uint32_t(i);
+			}
+		}
+
+		buffers.emplace_back(new std::vector<uint32_t>(count));
+		return uint32_t(buffers.size() - 1);
+	}
+
+	void free(uint32_t index) override
+	{
+		buffers[index].reset();
+		live_buffers--;
+	}
+
+	void prime(uint32_t, const void *) override
+	{
+	}
+};
+
+struct TestSliceAllocator : SliceAllocator
+{
+	TestSliceAllocator(uint32_t sub_block_size, uint32_t num_sub_blocks_in_arena_log2)
+	{
+		init(sub_block_size, num_sub_blocks_in_arena_log2, &backing);
+	}
+
+	FakeBacking backing;
+};
+
+struct Live
+{
+	AllocatedSlice slice;
+	uint32_t requested;
+	uint32_t tag;
+	bool movable;
+};
+
+static void write_pattern(FakeBacking &backing, const Live &live)
+{
+	auto &buffer = *backing.buffers[live.slice.buffer_index];
+	for (uint32_t i = 0; i < live.requested; i++)
+		buffer[live.slice.offset + i] = live.tag * 65536 + i;
+}
+
+static bool check_pattern(FakeBacking &backing, const Live &live)
+{
+	auto &buffer = *backing.buffers[live.slice.buffer_index];
+	for (uint32_t i = 0; i < live.requested; i++)
+		if (buffer[live.slice.offset + i] != live.tag * 65536 + i)
+			return false;
+	return true;
+}
+
+static bool ranges_overlap(const AllocatedSlice &a, const AllocatedSlice &b)
+{
+	return a.buffer_index == b.buffer_index && a.offset < b.offset + b.count && b.offset < a.offset + a.count;
+}
+
+static bool check_no_overlap(const std::vector<std::unique_ptr<Live>> &lives)
+{
+	std::vector<const AllocatedSlice *> sorted;
+	for (auto &live : lives)
+		sorted.push_back(&live->slice);
+	std::sort(sorted.begin(), sorted.end(), [](const AllocatedSlice *a, const AllocatedSlice *b) {
+		return a->buffer_index != b->buffer_index ? a->buffer_index < b->buffer_index : a->offset < b->offset;
+	});
+
+	for (size_t i = 1; i < sorted.size(); i++)
+		if (ranges_overlap(*sorted[i - 1], *sorted[i]))
+			return false;
+	return true;
+}
+
+static bool defragment(TestSliceAllocator &allocator, std::vector<std::unique_ptr<Live>> &lives,
+                       SliceDefragmentationPlan &plan, uint64_t max_moved_count = UINT64_MAX)
+{
+	std::vector<AllocatedSlice *> movable;
+	std::vector<AllocatedSlice> pinned;
+	for (auto &live : lives)
+	{
+		if (live->movable)
+			movable.push_back(&live->slice);
+		else
+			pinned.push_back(live->slice);
+	}
+
+	allocator.plan_defragmentation(movable.data(), movable.size(), plan, max_moved_count);
+
+	bool ok = true;
+	allocator.apply_defragmentation(plan, [&](const SliceMove *moves, size_t count) {
+		for (size_t i = 0; i < count; i++)
+		{
+			for (size_t j = 0; j < count; j++)
+			{
+				if (ranges_overlap(moves[i].dst, moves[j].src) || (i != j && ranges_overlap(moves[i].dst, moves[j].dst)))
+				{
+					LOGE("Copies within a pass overlap.\n");
+					ok = false;
+				}
+			}
+
+			auto &buffers = allocator.backing.buffers;
+			auto &src = *buffers[moves[i].src.buffer_index];
+			auto &dst = *buffers[moves[i].dst.buffer_index];
+			std::copy(src.begin() + moves[i].src.offset, src.begin() + moves[i].src.offset + moves[i].src.count,
+			          dst.begin() + moves[i].dst.offset);
+		}
+	});
+
+	size_t pinned_index = 0;
+	for (auto &live : lives)
+	{
+		if (!check_pattern(allocator.backing, *live))
+		{
+			LOGE("Slice contents were not preserved.\n");
+			return false;
+		}
+
+		if (!live->movable)
+		{
+			auto &old = pinned[pinned_index++];
+			if (old.offset != live->slice.offset || old.buffer_index != live->slice.buffer_index)
+			{
+				LOGE("Pinned slice was moved.\n");
+				return false;
+			}
+		}
+	}
+
+	if (!check_no_overlap(lives))
+	{
+		LOGE("Live slices overlap after defragmentation.\n");
+		return false;
+	}
+
+	return ok;
+}
+
+// Streams slices in and out for a number of rounds, optionally defragmenting between rounds.
+static bool churn(bool defrag, unsigned seed)
+{
+	TestSliceAllocator allocator(16, 15);
+	std::vector<std::unique_ptr<Live>> lives;
+	std::mt19937 rnd(seed);
+	std::uniform_int_distribution<uint32_t> small_size(1, 300);
+	std::uniform_int_distribution<uint32_t> large_size(1, 20000);
+	uint32_t tag = 0;
+	unsigned max_buffers = 0;
+	unsigned sum_buffers = 0;
+	uint64_t total_moved = 0;
+	unsigned total_released = 0;
+	unsigned improved_rounds = 0;
+
+	constexpr unsigned Rounds = 50;
+	for (unsigned round = 0; round < Rounds; round++)
+	{
+		// Keep the working set roughly constant, so any growth comes from fragmentation.
+		while (lives.size() < 3000)
+		{
+			std::unique_ptr<Live> live(new Live);
+			live->requested = (rnd() & 15) == 0 ? large_size(rnd) : small_size(rnd);
+			live->tag = tag++;
+			// A few slices stay pinned, like meshes which are still being uploaded.
+			live->movable = (rnd() & 255) != 0;
+			if (!allocator.allocate(live->requested, &live->slice))
+			{
+				LOGE("Allocation failed.\n");
+				return false;
+			}
+			write_pattern(allocator.backing, *live);
+			lives.push_back(std::move(live));
+		}
+
+		max_buffers = std::max(max_buffers, allocator.backing.live_buffers);
+
+		// Drop a random half, like meshes going out of view.
+		std::shuffle(lives.begin(), lives.end(), rnd);
+		for (size_t i = lives.size() / 2; i < lives.size(); i++)
+			allocator.free(lives[i]->slice);
+		lives.resize(lives.size() / 2);
+
+		if (defrag)
+		{
+			auto before = allocator.get_statistics();
+			SliceDefragmentationPlan plan;
+			if (!defragment(allocator, lives, plan))
+				return false;
+			auto after = allocator.get_statistics();
+
+			if (after.used_count != before.used_count ||
+			    after.num_heaps + plan.released_heaps != before.num_heaps ||
+			    before.num_backing_heaps - after.num_backing_heaps != plan.released_backing_heaps)
+			{
+				LOGE("Statistics do not match the plan.\n");
+				return false;
+			}
+
+			// Pinned slices may keep a heap alive, but a pass must never make things worse.
+			if (after.get_fragmentation() > before.get_fragmentation())
+			{
+				LOGE("Fragmentation increased from %.2f to %.2f.\n", before.get_fragmentation(), after.get_fragmentation());
+				return false;
+			}
+
+			if (after.get_fragmentation() < before.get_fragmentation())
+				improved_rounds++;
+
+			total_moved += plan.moved_count;
+			total_released += plan.released_heaps;
+
+			if (round == Rounds - 1)
+			{
+				LOGI("Last round: %zu moves in %zu passes, occupancy %.1f %% -> %.1f %%, fragmentation %.2f -> %.2f.\n",
+				     plan.moves.size(), plan.get_num_passes(),
+				     100.0f * before.get_occupancy(), 100.0f * after.get_occupancy(),
+				     before.get_fragmentation(), after.get_fragmentation());
+			}
+		}
+
+		sum_buffers += allocator.backing.live_buffers;
+	}
+
+	LOGI("%s: peak %u backing buffers, %.1f on average after trimming, %llu elements moved, %u heaps released.\n",
+	     defrag ? "With defragmentation" : "Without defragmentation", max_buffers, double(sum_buffers) / Rounds,
+	     static_cast<unsigned long long>(total_moved), total_released);
+
+	if (defrag && improved_rounds == 0)
+	{
+		LOGE("Defragmentation never reduced fragmentation.\n");
+		return false;
+	}
+
+	for (auto &live : lives)
+		allocator.free(live->slice);
+
+	if (allocator.backing.live_buffers != 0)
+	{
+		LOGE("Backing buffers leaked.\n");
+		return false;
+	}
+
+	return true;
+}
+
+// Two half-empty heaps should be merged into one, releasing the other.
+static bool simple_merge()
+{
+	TestSliceAllocator allocator(1, 5);
+	std::vector<std::unique_ptr<Live>> lives;
+
+	for (uint32_t i = 0; i < 64; i++)
+	{
+		std::unique_ptr<Live> live(new Live);
+		live->requested = 1;
+		live->tag = i;
+		live->movable = true;
+		allocator.allocate(1, &live->slice);
+		write_pattern(allocator.backing, *live);
+		lives.push_back(std::move(live));
+	}
+
+	// Keep every fourth slice, 8 in each of the two heaps.
+	std::vector<std::unique_ptr<Live>> kept;
+	for (auto &live : lives)
+	{
+		if ((live->tag & 3) == 0)
+			kept.push_back(std::move(live));
+		else
+			allocator.free(live->slice);
+	}
+
+	if (allocator.backing.live_buffers != 2)
+		return false;
+
+	// 16 elements fit in one of the two heaps.
+	auto before = allocator.get_statistics();
+	if (before.get_reclaimable_backing_heaps() != 1 || before.get_fragmentation() != 0.5f)
+		return false;
+
+	// Draining either heap takes 8 moves, so a budget of 7 must leave everything in place.
+	SliceDefragmentationPlan plan;
+	if (!defragment(allocator, kept, plan, 7) || !plan.moves.empty())
+		return false;
+
+	if (!defragment(allocator, kept, plan))
+		return false;
+
+	bool ok = plan.moves.size() == 8 && plan.released_backing_heaps == 1 && allocator.backing.live_buffers == 1;
+	auto stats = allocator.get_statistics();
+	ok = ok && stats.used_count == 16 && stats.total_count == 32 && stats.get_fragmentation() == 0.0f;
+
+	for (auto &live : kept)
+		allocator.free(live->slice);
+	return ok && allocator.backing.live_buffers == 0;
+}
+
+int main()
+{
+	if (!simple_merge())
+	{
+		LOGE("Simple merge failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!churn(false, 1) || !churn(true, 1))
+		return EXIT_FAILURE;
+
+	LOGI("All tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+#include "task_coroutine.hpp"
+#include "logging.hpp"
+#include <atomic>
+#include <stdlib.h>
+
+using namespace Granite;
+
+#ifdef GRANITE_HAS_COROUTINES
+static CoTask stage(ThreadGroup &group, std::atomic_uint &counter)
+{
+	co_await resume_on(group, TaskClass::Background);
+	counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+static CoTask chain(ThreadGroup &group, TaskSignal &signal, std::atomic_uint &counter)
+{
+	co_await resume_on(group);
+
+	// Fan out a normal task group and wait for it without blocking a worker.
+	auto work = group.create_task();
+	for (unsigned i = 0; i < 64; i++)
+		work->enqueue_task([&counter]() { counter.fetch_add(1, std::memory_order_relaxed); });
+	co_await std::move(work);
+
+	if (counter.load(std::memory_order_relaxed) != 64)
+		throw std::logic_error("Task group did not complete before resume.");
+
+	// Await another coroutine.
+	co_await stage(group, counter);
+
+	// Await an external signal.
+	co_await resume_when_at_least(group, signal, 1);
+	counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Callers usually keep a reference to a group after submitting it.
+static CoTask await_submitted(TaskGroupHandle submitted, std::atomic_uint &counter)
+{
+	co_await std::move(submitted);
+	if (counter.load(std::memory_order_relaxed) != 1)
+		throw std::logic_error("Submitted task group did not complete before resume.");
+	counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+int main()
+{
+	ThreadGroup group;
+	group.start(4, 1, {});
+
+	TaskSignal signal;
+	std::atomic_uint counter{0};
+
+	// Many more coroutines than worker threads, all suspended at the same time.
+	std::vector<std::atomic_uint> counters(1000);
+	std::vector<CoTask> tasks;
+	tasks.reserve(counters.size());
+	for (auto &c : counters)
+		tasks.push_back(chain(group, signal, c));
+
+	signal.signal_increment();
+
+	for (auto &task : tasks)
+		task.wait();
+
+	for (auto &c : counters)
+	{
+		if (c.load() != 66)
+		{
+			LOGE("Unexpected counter %u.\n", c.load());
+			return EXIT_FAILURE;
+		}
+	}
+
+	// The awaited group may still be running, or have completed before it is awaited.
+	std::vector<std::atomic_uint> submitted_counters(1000);
+	tasks.clear();
+	for (size_t i = 0; i < submitted_counters.size(); i++)
+	{
+		auto &c = submitted_counters[i];
+		auto work = group.create_task([&c]() { c.fetch_add(1, std::memory_order_relaxed); });
+		auto submitted = work;
+		group.submit(work);
+		if (i & 1)
+			submitted->wait();
+		tasks.push_back(await_submitted(std::move(submitted), c));
+	}
+
+	for (auto &task : tasks)
+		task.wait();
+
+	for (auto &c : submitted_counters)
+	{
+		if (c.load() != 2)
+		{
+			LOGE("Unexpected counter %u after awaiting submitted groups.\n", c.load());
+			return EXIT_FAILURE;
+		}
+	}
+
+	CoTask empty;
+	if (!empty.is_done())
+	{
+		LOGE("Empty CoTask is not done.\n");
+		return EXIT_FAILURE;
+	}
+	empty.wait();
+
+	// Detached coroutines must clean up after themselves.
+	stage(group, counter);
+	group.wait_idle();
+
+	LOGI("Coroutine test passed.\n");
+	return EXIT_SUCCESS;
+}
+#else
+int main()
+{
+	LOGW("Coroutines are not supported by this compiler configuration.\n");
+	return EXIT_SUCCESS;
+}
+#endif
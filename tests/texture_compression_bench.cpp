@@ -0,0 +1,223 @@
+#include "texture_compression.hpp"
+#include "global_managers_init.hpp"
+#include "filesystem.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include "math.hpp"
+#include "muglm/muglm_impl.hpp"
+#include <random>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace Granite;
+
+// CPU time of all threads in the process, or 0 where that is not implemented.
+static double get_process_cpu_time()
+{
+#ifndef _WIN32
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0.0;
+	return double(usage.ru_utime.tv_sec) + 1e-6 * double(usage.ru_utime.tv_usec) +
+	       double(usage.ru_stime.tv_sec) + 1e-6 * double(usage.ru_stime.tv_usec);
+#else
+	return 0.0;
+#endif
+}
+
+// Smooth gradients, hard edges and noise, so every path sees both easy and hard blocks.
+static std::shared_ptr<Vulkan::MemoryMappedTexture> create_input(VkFormat format, unsigned width, unsigned height,
+                                                                 unsigned seed)
+{
+	auto texture = std::make_shared<Vulkan::MemoryMappedTexture>();
+	texture->set_2d(format, width, height, 1,
+	                Vulkan::TextureFormatLayout::num_miplevels(width, height));
+	if (!texture->map_write_scratch())
+		return {};
+
+	std::mt19937 rnd(seed);
+	std::uniform_real_distribution<float> noise(0.0f, 1.0f);
+	auto &layout = texture->get_layout();
+
+	for (unsigned level = 0; level < layout.get_levels(); level++)
+	{
+		unsigned level_width = layout.get_width(level);
+		unsigned level_height = layout.get_height(level);
+		for (unsigned y = 0; y < level_height; y++)
+		{
+			for (unsigned x = 0; x < level_width; x++)
+			{
+				float u = float(x) / float(level_width);
+				float v = float(y) / float(level_height);
+				float smooth = 0.5f + 0.5f * std::sin(17.0f * u + 5.0f * v);
+				float edge = ((x / 37 + y / 23) & 1) ? 0.9f : 0.1f;
+				float n = noise(rnd);
+				vec4 color(smooth, edge, 0.7f * smooth + 0.3f * n, n);
+
+				if (format == VK_FORMAT_R16G16B16A16_SFLOAT)
+					*layout.data_2d<u16vec4>(x, y, 0, level) = floatToHalf(4.0f * color);
+				else
+					*layout.data_2d<u8vec4>(x, y, 0, level) = u8vec4(clamp(255.0f * color + 0.5f, vec4(0.0f), vec4(255.0f)));
+			}
+		}
+	}
+
+	return texture;
+}
+
+static TextureMode get_mode(const std::string &name)
+{
+	if (name == "bc4_unorm" || name == "r8_unorm")
+		return TextureMode::Luminance;
+	else if (name == "bc5_unorm" || name == "rg8_unorm")
+		return TextureMode::Normal;
+	else if (name.find("float") != std::string::npos || name == "bc6h")
+		return TextureMode::HDR;
+	else if (name.find("srgb") != std::string::npos)
+		return TextureMode::sRGBA;
+	else
+		return TextureMode::RGBA;
+}
+
+static bool compare_files(const std::string &path, const std::string &reference_path)
+{
+	auto *fs = GRANITE_FILESYSTEM();
+	auto file = fs->open_readonly_mapping(path);
+	auto reference = fs->open_readonly_mapping(reference_path);
+	if (!file || !reference)
+	{
+		LOGE("Failed to open %s or %s.\n", path.c_str(), reference_path.c_str());
+		return false;
+	}
+
+	if (file->get_size() != reference->get_size() ||
+	    memcmp(file->data(), reference->data(), file->get_size()) != 0)
+	{
+		LOGE("%s differs from %s.\n", path.c_str(), reference_path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// Compresses a batch of textures at once, the way the glTF exporter does, and reports throughput.
+// If a reference directory is given, the outputs must match the ones in it byte for byte.
+static bool bench(const std::string &dir, const std::string &reference, const std::string &name,
+                  unsigned size, unsigned count)
+{
+	VkFormat format = string_to_format(name);
+	if (format == VK_FORMAT_UNDEFINED)
+		return false;
+
+	auto mode = get_mode(name);
+	VkFormat input_format = mode == TextureMode::HDR ? VK_FORMAT_R16G16B16A16_SFLOAT : VK_FORMAT_R8G8B8A8_UNORM;
+
+	// Sizes differ a little so levels end in partial blocks and tiles.
+	std::vector<std::shared_ptr<Vulkan::MemoryMappedTexture>> inputs;
+	uint64_t pixels = 0;
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto input = create_input(input_format, size - 2 * i, size - 7 * i, i + 1);
+		if (!input)
+		{
+			LOGE("Failed to create input texture.\n");
+			return false;
+		}
+
+		auto &layout = input->get_layout();
+		for (unsigned level = 0; level < layout.get_levels(); level++)
+			pixels += uint64_t(layout.get_width(level)) * layout.get_height(level);
+		inputs.push_back(std::move(input));
+	}
+
+	auto &group = *GRANITE_THREAD_GROUP();
+	TaskSignal signal;
+	double start_cpu = get_process_cpu_time();
+	auto start_time = Util::get_current_time_nsecs();
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		CompressorArguments args;
+		args.output = dir + "/" + name + "_" + std::to_string(i) + ".gtx";
+		args.format = format;
+		args.mode = mode;
+
+		auto dep = group.create_task();
+		if (!compress_texture(group, args, inputs[i], dep, &signal))
+			return false;
+	}
+
+	inputs.clear();
+	signal.wait_until_at_least(count);
+	group.wait_idle();
+
+	double seconds = 1e-9 * double(Util::get_current_time_nsecs() - start_time);
+	double cpu_seconds = get_process_cpu_time() - start_cpu;
+	unsigned num_threads = group.get_num_threads();
+
+	LOGI("%-16s %.2f MPix in %.3f s, %.1f MPix/s, %.2f of %u worker threads busy.\n",
+	     name.c_str(), 1e-6 * double(pixels), seconds, 1e-6 * double(pixels) / seconds,
+	     cpu_seconds / seconds, num_threads);
+
+	if (!reference.empty())
+	{
+		unsigned mismatches = 0;
+		for (unsigned i = 0; i < count; i++)
+		{
+			auto file_name = "/" + name + "_" + std::to_string(i) + ".gtx";
+			if (!compare_files(dir + file_name, reference + file_name))
+				mismatches++;
+		}
+
+		if (mismatches)
+		{
+			LOGE("%s: %u of %u outputs differ from the reference.\n", name.c_str(), mismatches, count);
+			return false;
+		}
+
+		LOGI("%s: all %u outputs match the reference.\n", name.c_str(), count);
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		LOGE("Usage: %s <output directory> [--reference <directory>] [format...]\n", argv[0]);
+		LOGE("--reference compares outputs byte for byte against an earlier run, e.g. from another build.\n");
+		LOGE("BCn formats other than BC4 and BC5 need ISPC, ASTC needs astcenc or ISPC.\n");
+		return EXIT_FAILURE;
+	}
+
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT | Global::MANAGER_FEATURE_THREAD_GROUP_BIT);
+
+	std::string reference;
+	std::vector<std::string> formats;
+	for (int i = 2; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--reference" && i + 1 < argc)
+			reference = argv[++i];
+		else
+			formats.push_back(argv[i]);
+	}
+	if (formats.empty())
+		formats = { "bc4_unorm", "bc5_unorm", "rgba8_unorm", "r8_unorm", "rgba16_float" };
+
+	constexpr unsigned Size = 2048;
+	constexpr unsigned Count = 8;
+
+	bool success = true;
+	for (auto &format : formats)
+		if (!bench(argv[1], reference, format, Size, Count))
+			success = false;
+
+	Global::deinit();
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,133 @@
+#include "thread_group.hpp"
+#include "object_pool.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace Granite;
+
+struct Payload
+{
+	explicit Payload(unsigned value_)
+		: value(value_)
+	{
+	}
+
+	unsigned value;
+	unsigned padding[15];
+};
+
+// Each thread allocates a batch and hands it to its neighbour to free, so half of all frees are cross-thread.
+template <typename Pool>
+static double run_pool_bench(Pool &pool, unsigned num_threads, unsigned iterations)
+{
+	constexpr unsigned BatchSize = 32;
+	std::vector<std::vector<Payload *>> handoff(num_threads);
+	std::vector<std::mutex> locks(num_threads);
+	std::vector<std::thread> threads;
+
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned t = 0; t < num_threads; t++)
+	{
+		threads.emplace_back([&, t]() {
+			Payload *batch[BatchSize];
+			std::vector<Payload *> to_free;
+			for (unsigned i = 0; i < iterations; i++)
+			{
+				for (auto &p : batch)
+					p = pool.allocate(i);
+
+				{
+					std::lock_guard<std::mutex> holder{locks[(t + 1) % num_threads]};
+					auto &target = handoff[(t + 1) % num_threads];
+					target.insert(target.end(), batch, batch + BatchSize / 2);
+				}
+
+				for (unsigned j = BatchSize / 2; j < BatchSize; j++)
+					pool.free(batch[j]);
+
+				{
+					std::lock_guard<std::mutex> holder{locks[t]};
+					std::swap(to_free, handoff[t]);
+				}
+
+				for (auto *p : to_free)
+					pool.free(p);
+				to_free.clear();
+			}
+		});
+	}
+
+	for (auto &thr : threads)
+		thr.join();
+	auto end = Util::get_current_time_nsecs();
+
+	for (auto &list : handoff)
+		for (auto *p : list)
+			pool.free(p);
+
+	return 1e-9 * double(end - start);
+}
+
+// Every worker spawns tiny tasks of its own, so task allocation and retirement happens on all threads at once.
+static double run_task_bench(ThreadGroup &group, unsigned num_spawners, unsigned tasks_per_spawner)
+{
+	std::atomic_uint counter;
+	counter = 0;
+
+	auto start = Util::get_current_time_nsecs();
+	auto spawners = group.create_task();
+	for (unsigned i = 0; i < num_spawners; i++)
+	{
+		group.enqueue_task(*spawners, [&group, &counter, tasks_per_spawner]() {
+			for (unsigned j = 0; j < tasks_per_spawner; j++)
+			{
+				group.create_task([&counter]() {
+					counter.fetch_add(1, std::memory_order_relaxed);
+				});
+			}
+		});
+	}
+	spawners->set_desc("spawners");
+	spawners->flush();
+	spawners.reset();
+	group.wait_idle();
+	auto end = Util::get_current_time_nsecs();
+
+	if (counter.load() != num_spawners * tasks_per_spawner)
+		LOGE("Expected %u tasks to run, but %u did.\n", num_spawners * tasks_per_spawner, counter.load());
+
+	return 1e-9 * double(end - start);
+}
+
+int main()
+{
+	unsigned num_threads = std::max(4u, std::thread::hardware_concurrency());
+
+	constexpr unsigned PoolIterations = 50000;
+	for (unsigned threads = 1; threads <= num_threads; threads *= 2)
+	{
+		double allocs = 32.0 * PoolIterations * threads;
+
+		Util::ThreadSafeObjectPool<Payload> locked_pool;
+		double locked_time = run_pool_bench(locked_pool, threads, PoolIterations);
+
+		Util::ThreadCachedObjectPool<Payload> cached_pool;
+		double cached_time = run_pool_bench(cached_pool, threads, PoolIterations);
+
+		LOGI("Pool, %2u threads: locked %7.2f M allocs/s, thread cached %7.2f M allocs/s.\n",
+		     threads, 1e-6 * allocs / locked_time, 1e-6 * allocs / cached_time);
+	}
+
+	ThreadGroup group;
+	group.start(num_threads, 0, {});
+
+	constexpr unsigned TasksPerSpawner = 250000;
+	unsigned num_spawners = num_threads;
+	double task_time = run_task_bench(group, num_spawners, TasksPerSpawner);
+	double num_tasks = double(num_spawners) * TasksPerSpawner;
+	LOGI("ThreadGroup, %u threads: %.0f tiny tasks in %.3f s, %.2f M tasks/s.\n",
+	     group.get_num_threads(), num_tasks, task_time, 1e-6 * num_tasks / task_time);
+}
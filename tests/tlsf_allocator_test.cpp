@@ -0,0 +1,242 @@
+#include "tlsf_allocator.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <map>
+#include <vector>
+#include <memory>
+#include <string.h>
+
+using namespace Util;
+
+// CPU stand-in for a VkDeviceMemory chunk.
+struct FakeMemory
+{
+	std::unique_ptr<uint8_t[]> data;
+	uint32_t id = 0;
+};
+
+struct FakeAllocation
+{
+	FakeMemory memory;
+	uint8_t *ptr = nullptr;
+	uint32_t offset = 0;
+	uint32_t size = 0;
+	TLSFArenaHeap<FakeAllocation> *heap = nullptr;
+	TLSFBlock *block = nullptr;
+};
+
+struct FakeAllocator : TLSFArenaAllocator<FakeAllocator, FakeAllocation>
+{
+	unsigned live_backing = 0;
+	unsigned total_backing = 0;
+
+	bool allocate_backing_heap(FakeAllocation *alloc)
+	{
+		alloc->memory.data.reset(new uint8_t[get_heap_size()]);
+		alloc->memory.id = total_backing++;
+		live_backing++;
+		return true;
+	}
+
+	void free_backing_heap(FakeAllocation *alloc)
+	{
+		alloc->memory.data.reset();
+		live_backing--;
+	}
+
+	void prepare_allocation(FakeAllocation *alloc, Heap *heap, TLSFBlock *block)
+	{
+		alloc->heap = heap;
+		alloc->block = block;
+		alloc->offset = block->offset;
+		alloc->size = block->size;
+		alloc->ptr = heap->allocation.memory.data.get() + block->offset;
+		alloc->memory.id = heap->allocation.memory.id;
+	}
+};
+
+struct Live
+{
+	FakeAllocation alloc;
+	uint32_t requested;
+	uint8_t pattern;
+};
+
+static bool check_heap(const TLSFHeap &heap, const std::map<uint32_t, uint32_t> &ranges)
+{
+	uint64_t used = 0;
+	uint32_t prev_end = 0;
+	for (auto &r : ranges)
+	{
+		if (r.first < prev_end || uint64_t(r.first) + r.second > heap.get_size())
+			return false;
+		prev_end = r.first + r.second;
+		used += r.second;
+	}
+	return used == heap.get_used_size() && ranges.size() == heap.get_num_allocations();
+}
+
+static bool stress(FakeAllocator &allocator, unsigned iterations, unsigned seed)
+{
+	std::mt19937 rnd(seed);
+	std::vector<Live> live;
+	// Per backing heap: offset -> size.
+	std::map<uint32_t, std::map<uint32_t, uint32_t>> ranges;
+
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		// Grow a working set, then shrink it, which leaves holes behind.
+		size_t target = i < iterations / 2 ? 300 : 100;
+		bool do_alloc = live.empty() || (live.size() < target ? (rnd() % 4) != 0 : (rnd() % 4) == 0);
+		if (do_alloc)
+		{
+			// Mostly texture sized allocations, with a long tail.
+			uint32_t size = (rnd() % 4 == 0) ? (rnd() % (32u << 20)) + 1 : (rnd() % (4u << 20)) + 1;
+			uint32_t alignment = 1u << (rnd() % 17);
+
+			Live l;
+			l.requested = size;
+			l.pattern = uint8_t(rnd());
+			if (!allocator.allocate(size, alignment, &l.alloc))
+			{
+				LOGE("Allocation of %u bytes failed.\n", size);
+				return false;
+			}
+
+			if ((l.alloc.offset & (alignment - 1)) != 0 || l.alloc.size < size)
+			{
+				LOGE("Bad allocation: offset %u, size %u, alignment %u.\n", l.alloc.offset, l.alloc.size, alignment);
+				return false;
+			}
+
+			auto &heap_ranges = ranges[l.alloc.memory.id];
+			heap_ranges[l.alloc.offset] = l.alloc.size;
+			if (!check_heap(l.alloc.heap->heap, heap_ranges))
+			{
+				LOGE("Overlapping or miscounted allocations.\n");
+				return false;
+			}
+
+			memset(l.alloc.ptr, l.pattern, std::min(l.requested, 4096u));
+			memset(l.alloc.ptr + l.requested - std::min(l.requested, 4096u), l.pattern, std::min(l.requested, 4096u));
+			live.push_back(std::move(l));
+		}
+		else
+		{
+			size_t index = rnd() % live.size();
+			auto &l = live[index];
+			uint32_t check_size = std::min(l.requested, 4096u);
+			for (uint32_t j = 0; j < check_size; j++)
+			{
+				if (l.alloc.ptr[j] != l.pattern || l.alloc.ptr[l.requested - check_size + j] != l.pattern)
+				{
+					LOGE("Allocation was overwritten.\n");
+					return false;
+				}
+			}
+
+			ranges[l.alloc.memory.id].erase(l.alloc.offset);
+			allocator.free(l.alloc.heap, l.alloc.block);
+			live[index] = std::move(live.back());
+			live.pop_back();
+		}
+
+		if (i % (iterations / 4) == 0)
+		{
+			auto stats = allocator.get_statistics();
+			LOGI("  %6u ops: %u heaps, %u allocations, %.1f / %.1f MiB used, %u free blocks, largest free %.1f MiB, fragmentation %.3f.\n",
+			     i, stats.num_heaps, stats.num_allocations,
+			     double(stats.used_size) / (1024.0 * 1024.0), double(stats.total_size) / (1024.0 * 1024.0),
+			     stats.num_free_blocks, double(stats.largest_free_block) / (1024.0 * 1024.0),
+			     stats.get_fragmentation());
+		}
+	}
+
+	for (auto &l : live)
+		allocator.free(l.alloc.heap, l.alloc.block);
+
+	if (allocator.live_backing != 0 || allocator.get_statistics().num_heaps != 0)
+	{
+		LOGE("Backing heaps were not released.\n");
+		return false;
+	}
+
+	LOGI("  Used %u backing heaps over the run.\n", allocator.total_backing);
+	return true;
+}
+
+static bool test_coalescing()
+{
+	ObjectPool<TLSFBlock> pool;
+	TLSFHeap heap;
+	heap.init(&pool, 1u << 20, 256);
+
+	TLSFBlock *blocks[16];
+	for (auto &b : blocks)
+		if (!(b = heap.allocate(64 * 1024, 256)))
+			return false;
+
+	if (heap.allocate(1, 1))
+		return false;
+
+	// Free every other block, then the rest. Everything must merge back into a single free block.
+	for (unsigned i = 0; i < 16; i += 2)
+		heap.free(blocks[i]);
+
+	auto stats = heap.get_statistics();
+	if (stats.num_free_blocks != 8 || stats.largest_free_block != 64 * 1024 || stats.get_fragmentation() < 0.8f)
+		return false;
+
+	for (unsigned i = 1; i < 16; i += 2)
+		heap.free(blocks[i]);
+
+	stats = heap.get_statistics();
+	return stats.num_free_blocks == 1 && stats.largest_free_block == (1u << 20) && heap.empty();
+}
+
+static void bench()
+{
+	constexpr unsigned Count = 4096;
+	constexpr unsigned Rounds = 256;
+	ObjectPool<TLSFBlock> pool;
+	TLSFHeap heap;
+	heap.init(&pool, 1u << 30, 4096);
+
+	std::mt19937 rnd(3);
+	std::vector<uint32_t> sizes(Count);
+	for (auto &s : sizes)
+		s = (rnd() % (256u * 1024u)) + 1;
+
+	std::vector<TLSFBlock *> blocks(Count);
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned round = 0; round < Rounds; round++)
+	{
+		for (unsigned i = 0; i < Count; i++)
+			blocks[i] = heap.allocate(sizes[(i + round) % Count], 4096);
+		// Free in a scrambled order so coalescing sees every neighbour combination.
+		for (unsigned i = 0; i < Count; i++)
+			heap.free(blocks[(i * 2654435761u) % Count]);
+	}
+	auto end = Util::get_current_time_nsecs();
+
+	LOGI("TLSF: %.1f ns per allocate + free pair.\n", double(end - start) / double(Count * Rounds));
+}
+
+int main()
+{
+	if (!test_coalescing())
+	{
+		LOGE("Coalescing test failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	FakeAllocator allocator;
+	allocator.set_heap_size(256u << 20, 4096);
+	LOGI("Stress test, 256 MiB heaps:\n");
+	if (!stress(allocator, 200000, 1))
+		return EXIT_FAILURE;
+
+	bench();
+	return EXIT_SUCCESS;
+}
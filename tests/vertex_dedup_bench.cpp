@@ -0,0 +1,75 @@
+#include "scene_formats.hpp"
+#include "thread_group.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <string.h>
+#include <thread>
+
+using namespace Granite;
+
+// Synthetic mesh with roughly 3 references per unique vertex, similar to an unrolled triangle soup.
+static SceneFormats::Mesh build_synthetic_mesh(unsigned vertex_count)
+{
+	SceneFormats::Mesh mesh;
+	mesh.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	mesh.position_stride = sizeof(vec3);
+	mesh.attribute_stride = sizeof(vec3) + sizeof(vec2);
+	mesh.attribute_layout[Util::ecast(MeshAttribute::Position)].format = VK_FORMAT_R32G32B32_SFLOAT;
+	mesh.attribute_layout[Util::ecast(MeshAttribute::Normal)].format = VK_FORMAT_R32G32B32_SFLOAT;
+	mesh.attribute_layout[Util::ecast(MeshAttribute::UV)].format = VK_FORMAT_R32G32_SFLOAT;
+	mesh.attribute_layout[Util::ecast(MeshAttribute::UV)].offset = sizeof(vec3);
+
+	mesh.positions.resize(vertex_count * mesh.position_stride);
+	mesh.attributes.resize(vertex_count * mesh.attribute_stride);
+
+	std::mt19937 rnd(1);
+	unsigned unique_count = vertex_count / 3;
+	for (unsigned i = 0; i < vertex_count; i++)
+	{
+		unsigned key = rnd() % unique_count;
+		vec3 pos(float(key & 1023), float((key >> 10) & 1023), float(key >> 20));
+		vec3 normal(0.0f, 1.0f, 0.0f);
+		vec2 uv(float(key & 1023) / 1024.0f, 0.5f);
+		memcpy(mesh.positions.data() + i * mesh.position_stride, pos.data, sizeof(vec3));
+		memcpy(mesh.attributes.data() + i * mesh.attribute_stride, normal.data, sizeof(vec3));
+		memcpy(mesh.attributes.data() + i * mesh.attribute_stride + sizeof(vec3), uv.data, sizeof(vec2));
+	}
+
+	mesh.count = vertex_count;
+	return mesh;
+}
+
+int main()
+{
+	constexpr unsigned VertexCount = 5000000;
+	auto reference = build_synthetic_mesh(VertexCount);
+	auto parallel = reference;
+
+	ThreadGroup workers;
+	workers.start(std::thread::hardware_concurrency(), 0, {});
+
+	auto start = Util::get_current_time_nsecs();
+	SceneFormats::mesh_deduplicate_vertices(reference);
+	auto end = Util::get_current_time_nsecs();
+	LOGI("Serial: %.3f ms.\n", 1e-6 * double(end - start));
+
+	start = Util::get_current_time_nsecs();
+	SceneFormats::mesh_deduplicate_vertices(parallel, &workers);
+	end = Util::get_current_time_nsecs();
+	LOGI("Parallel (%u threads): %.3f ms.\n", workers.get_num_threads(), 1e-6 * double(end - start));
+
+	LOGI("%u vertices -> %u unique.\n", VertexCount, unsigned(reference.positions.size() / reference.position_stride));
+
+	if (reference.positions != parallel.positions ||
+	    reference.attributes != parallel.attributes ||
+	    reference.indices != parallel.indices ||
+	    reference.count != parallel.count)
+	{
+		LOGE("Mismatch between serial and parallel deduplication.\n");
+		return EXIT_FAILURE;
+	}
+
+	LOGI("Serial and parallel results are identical.\n");
+	return EXIT_SUCCESS;
+}
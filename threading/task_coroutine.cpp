@@ -0,0 +1,95 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "task_coroutine.hpp"
+#include "object_pool.hpp"
+#include <stdint.h>
+
+namespace Granite
+{
+namespace Internal
+{
+template <size_t Size>
+struct alignas(16) CoroutineFrame
+{
+	// Avoid zero-filling the frame on allocation.
+	CoroutineFrame()
+	{
+	}
+
+	uint8_t data[Size];
+};
+
+// Coroutine frames are typically a few hundred bytes.
+// Anything larger than the largest class goes to the general heap.
+struct CoroutineFramePools
+{
+	Util::ThreadSafeObjectPool<CoroutineFrame<128>> pool_128;
+	Util::ThreadSafeObjectPool<CoroutineFrame<256>> pool_256;
+	Util::ThreadSafeObjectPool<CoroutineFrame<512>> pool_512;
+	Util::ThreadSafeObjectPool<CoroutineFrame<1024>> pool_1024;
+	Util::ThreadSafeObjectPool<CoroutineFrame<2048>> pool_2048;
+};
+
+static CoroutineFramePools &get_frame_pools()
+{
+	// Intentionally leaked, detached coroutines may still be freed during static destruction.
+	static auto *pools = new CoroutineFramePools;
+	return *pools;
+}
+
+void *allocate_coroutine_frame(size_t size)
+{
+	auto &pools = get_frame_pools();
+	if (size <= 128)
+		return pools.pool_128.allocate();
+	else if (size <= 256)
+		return pools.pool_256.allocate();
+	else if (size <= 512)
+		return pools.pool_512.allocate();
+	else if (size <= 1024)
+		return pools.pool_1024.allocate();
+	else if (size <= 2048)
+		return pools.pool_2048.allocate();
+	else
+		return ::operator new(size);
+}
+
+void free_coroutine_frame(void *ptr, size_t size)
+{
+	auto &pools = get_frame_pools();
+	if (size <= 128)
+		pools.pool_128.free(static_cast<CoroutineFrame<128> *>(ptr));
+	else if (size <= 256)
+		pools.pool_256.free(static_cast<CoroutineFrame<256> *>(ptr));
+	else if (size <= 512)
+		pools.pool_512.free(static_cast<CoroutineFrame<512> *>(ptr));
+	else if (size <= 1024)
+		pools.pool_1024.free(static_cast<CoroutineFrame<1024> *>(ptr));
+	else if (size <= 2048)
+		pools.pool_2048.free(static_cast<CoroutineFrame<2048> *>(ptr));
+	else
+		::operator delete(ptr);
+}
+}
+}
@@ -0,0 +1,360 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "thread_group.hpp"
+
+namespace Granite
+{
+namespace Internal
+{
+// Coroutine frames are allocated from size-classed object pools rather than the general heap.
+void *allocate_coroutine_frame(size_t size);
+void free_coroutine_frame(void *ptr, size_t size);
+}
+}
+
+// The rest of Granite is C++14. Coroutine support is only visible to translation units built as C++20.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define GRANITE_HAS_COROUTINES
+#endif
+#endif
+
+#ifdef GRANITE_HAS_COROUTINES
+#include <coroutine>
+#include <exception>
+#include <atomic>
+
+namespace Granite
+{
+// A coroutine which starts running eagerly on the calling thread.
+// It can be awaited by another coroutine, or waited on with wait().
+// If the CoTask object is destroyed before the coroutine completes, the coroutine keeps running detached.
+class CoTask
+{
+	enum : uintptr_t { Running = 0, Done = 1 };
+
+public:
+	struct promise_type;
+	using Handle = std::coroutine_handle<promise_type>;
+
+	struct FinalAwaiter
+	{
+		bool await_ready() noexcept
+		{
+			return false;
+		}
+
+		std::coroutine_handle<> await_suspend(Handle handle) noexcept
+		{
+			auto &promise = handle.promise();
+
+			{
+				std::lock_guard<std::mutex> holder{promise.lock};
+				promise.done = true;
+				promise.cond.notify_all();
+			}
+
+			auto continuation = promise.state.exchange(Done, std::memory_order_acq_rel);
+
+			// If the owning CoTask is already gone, nobody can observe us anymore.
+			if (promise.references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				handle.destroy();
+				return std::noop_coroutine();
+			}
+
+			if (continuation != Running)
+				return std::coroutine_handle<>::from_address(reinterpret_cast<void *>(continuation));
+			else
+				return std::noop_coroutine();
+		}
+
+		void await_resume() noexcept
+		{
+		}
+	};
+
+	struct promise_type
+	{
+		CoTask get_return_object()
+		{
+			return CoTask(Handle::from_promise(*this));
+		}
+
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		FinalAwaiter final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_void() noexcept
+		{
+		}
+
+		void unhandled_exception() noexcept
+		{
+			exception = std::current_exception();
+		}
+
+		static void *operator new(size_t size)
+		{
+			return Internal::allocate_coroutine_frame(size);
+		}
+
+		static void operator delete(void *ptr, size_t size)
+		{
+			Internal::free_coroutine_frame(ptr, size);
+		}
+
+		// Running, Done, or the address of an awaiting coroutine.
+		std::atomic<uintptr_t> state{Running};
+		// One reference for the CoTask object and one for the running coroutine.
+		std::atomic_uint references{2};
+		std::exception_ptr exception;
+
+		std::mutex lock;
+		std::condition_variable cond;
+		bool done = false;
+	};
+
+	CoTask() = default;
+
+	CoTask(CoTask &&other) noexcept
+		: handle(other.handle)
+	{
+		other.handle = {};
+	}
+
+	CoTask &operator=(CoTask &&other) noexcept
+	{
+		if (this != &other)
+		{
+			release();
+			handle = other.handle;
+			other.handle = {};
+		}
+		return *this;
+	}
+
+	CoTask(const CoTask &) = delete;
+	void operator=(const CoTask &) = delete;
+
+	~CoTask()
+	{
+		release();
+	}
+
+	// A default-constructed CoTask has nothing to run and counts as done.
+	bool is_done() const
+	{
+		return !handle || handle.promise().state.load(std::memory_order_acquire) == Done;
+	}
+
+	// Blocks the calling thread. Only intended for joining from outside the thread group,
+	// coroutines should co_await instead.
+	void wait()
+	{
+		if (!handle)
+			return;
+
+		auto &promise = handle.promise();
+		{
+			std::unique_lock<std::mutex> holder{promise.lock};
+			promise.cond.wait(holder, [&]() { return promise.done; });
+		}
+
+		if (promise.exception)
+			std::rethrow_exception(promise.exception);
+	}
+
+	struct Awaiter
+	{
+		Handle handle;
+
+		bool await_ready() noexcept
+		{
+			return handle.promise().state.load(std::memory_order_acquire) == Done;
+		}
+
+		bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			uintptr_t expected = Running;
+			// If this fails, the coroutine completed in the meantime and we can continue immediately.
+			return handle.promise().state.compare_exchange_strong(
+					expected, reinterpret_cast<uintptr_t>(awaiting.address()),
+					std::memory_order_acq_rel, std::memory_order_acquire);
+		}
+
+		void await_resume()
+		{
+			if (handle.promise().exception)
+				std::rethrow_exception(handle.promise().exception);
+		}
+	};
+
+	// The CoTask must outlive the suspension, so only allow awaiting named or temporary tasks by rvalue.
+	Awaiter operator co_await() &&
+	{
+		return { handle };
+	}
+
+private:
+	explicit CoTask(Handle handle_)
+		: handle(handle_)
+	{
+	}
+
+	void release()
+	{
+		if (handle && handle.promise().references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			handle.destroy();
+		handle = {};
+	}
+
+	Handle handle;
+};
+
+namespace Internal
+{
+inline void resume_coroutine_on(ThreadGroup &group, TaskClass task_class, std::coroutine_handle<> handle)
+{
+	auto task = group.create_task([handle]() { handle.resume(); });
+	task->set_task_class(task_class);
+	task->set_desc("coroutine-resume");
+	group.submit(task);
+}
+}
+
+// co_await resume_on(group) moves the rest of the coroutine onto a worker thread.
+struct ResumeOnAwaiter
+{
+	ThreadGroup &group;
+	TaskClass task_class;
+
+	bool await_ready() noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		Internal::resume_coroutine_on(group, task_class, handle);
+	}
+
+	void await_resume() noexcept
+	{
+	}
+};
+
+inline ResumeOnAwaiter resume_on(ThreadGroup &group, TaskClass task_class = TaskClass::Foreground)
+{
+	return { group, task_class };
+}
+
+// Suspends until the task group has completed, then resumes on the task group's thread group.
+// Awaiting a group which has not been flushed yet submits it. A group which was already
+// flushed can be awaited as well, even if it has completed in the meantime.
+struct TaskGroupAwaiter
+{
+	TaskGroupHandle group;
+	TaskClass task_class;
+
+	bool await_ready() noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		// Nothing below may throw once the resume task exists,
+		// or the coroutine would be resumed both here and on a worker.
+		auto *thread_group = group->get_thread_group();
+		auto awaited = std::move(group);
+		bool submit_awaited = !awaited->flushed;
+
+		auto resume = thread_group->create_task([handle]() { handle.resume(); });
+		resume->set_task_class(task_class);
+		resume->set_desc("coroutine-resume");
+		thread_group->add_dependency(*resume, *awaited);
+
+		// From here on the coroutine may resume on a worker and destroy this awaiter.
+		thread_group->submit(resume);
+		if (submit_awaited)
+			thread_group->submit(awaited);
+	}
+
+	void await_resume() noexcept
+	{
+	}
+};
+
+inline TaskGroupAwaiter resume_after(TaskGroupHandle group, TaskClass task_class = TaskClass::Foreground)
+{
+	return { std::move(group), task_class };
+}
+
+inline TaskGroupAwaiter operator co_await(TaskGroupHandle &&group)
+{
+	return { std::move(group), TaskClass::Foreground };
+}
+
+// Suspends until the signal has reached count, then resumes on the thread group.
+struct TaskSignalAwaiter
+{
+	ThreadGroup &group;
+	TaskSignal &signal;
+	uint64_t count;
+	TaskClass task_class;
+
+	bool await_ready()
+	{
+		return signal.get_count() >= count;
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		auto *thread_group = &group;
+		auto cls = task_class;
+		signal.call_when_at_least(count, [thread_group, cls, handle]() {
+			Internal::resume_coroutine_on(*thread_group, cls, handle);
+		});
+	}
+
+	void await_resume() noexcept
+	{
+	}
+};
+
+inline TaskSignalAwaiter resume_when_at_least(ThreadGroup &group, TaskSignal &signal, uint64_t count,
+                                              TaskClass task_class = TaskClass::Foreground)
+{
+	return { group, signal, count, task_class };
+}
+}
+#endif
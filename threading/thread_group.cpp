@@ -41,9 +41,17 @@ void TaskDeps::notify_dependees()
 	if (signal)
 		signal->signal_increment();
 
-	for (auto &dep : pending)
+	// Once flushed, dependees can be added from other threads, see ThreadGroup::add_dependency().
+	Util::SmallVector<Util::IntrusivePtr<TaskDeps>> dependees;
+	{
+		std::lock_guard<std::mutex> holder{cond_lock};
+		dependees = std::move(pending);
+		pending.clear();
+		dependees_notified = true;
+	}
+
+	for (auto &dep : dependees)
 		dep->dependency_satisfied();
-	pending.clear();
 
 	{
 		std::lock_guard<std::mutex> holder{cond_lock};
@@ -215,13 +223,26 @@ void ThreadGroup::submit(TaskGroupHandle &group)
 
 void ThreadGroup::add_dependency(TaskGroup &dependee, TaskGroup &dependency)
 {
-	if (dependency.flushed)
-		throw std::logic_error("Cannot wait for task group which has been flushed.");
 	if (dependee.flushed)
 		throw std::logic_error("Cannot add dependency to task group which has been flushed.");
 
-	dependency.deps->pending.push_back(dependee.deps);
-	dependee.deps->dependency_count.fetch_add(1, std::memory_order_relaxed);
+	if (dependency.flushed)
+	{
+		// The dependency may be completing on another thread right now.
+		// If it already has, there is nothing to wait for.
+		auto &deps = *dependency.deps;
+		std::lock_guard<std::mutex> holder{deps.cond_lock};
+		if (!deps.dependees_notified)
+		{
+			dependee.deps->dependency_count.fetch_add(1, std::memory_order_relaxed);
+			deps.pending.push_back(dependee.deps);
+		}
+	}
+	else
+	{
+		dependency.deps->pending.push_back(dependee.deps);
+		dependee.deps->dependency_count.fetch_add(1, std::memory_order_relaxed);
+	}
 }
 
 void ThreadGroup::move_to_ready_tasks(const Util::SmallVector<Internal::Task *> &list)
@@ -293,9 +314,43 @@ void ThreadGroup::free_task_deps(Internal::TaskDeps *deps)
 
 void TaskSignal::signal_increment()
 {
-	std::lock_guard<std::mutex> holder{lock};
-	counter++;
-	cond.notify_all();
+	std::vector<std::function<void ()>> ready;
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		counter++;
+		cond.notify_all();
+
+		size_t write_index = 0;
+		for (size_t i = 0; i < waiters.size(); i++)
+		{
+			if (counter >= waiters[i].first)
+				ready.push_back(std::move(waiters[i].second));
+			else if (i != write_index)
+				waiters[write_index++] = std::move(waiters[i]);
+			else
+				write_index++;
+		}
+		waiters.resize(write_index);
+	}
+
+	// Callbacks may signal or wait on this signal again, so call them outside the lock.
+	for (auto &func : ready)
+		func();
+}
+
+void TaskSignal::call_when_at_least(uint64_t count, std::function<void ()> func)
+{
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		if (counter < count)
+		{
+			waiters.emplace_back(count, std::move(func));
+			return;
+		}
+	}
+
+	func();
 }
 
 void TaskSignal::wait_until_at_least(uint64_t count)
@@ -29,6 +29,10 @@
 #include <queue>
 #include <future>
 #include <memory>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include "object_pool.hpp"
 #include "variant.hpp"
 #include "intrusive.hpp"
@@ -50,6 +54,14 @@ struct TaskSignal
 	void signal_increment();
 	void wait_until_at_least(uint64_t count);
 	uint64_t get_count();
+
+	// Non-blocking alternative to wait_until_at_least().
+	// func is called from signal_increment() once the counter reaches count,
+	// or immediately on the calling thread if it already has.
+	void call_when_at_least(uint64_t count, std::function<void ()> func);
+
+private:
+	std::vector<std::pair<uint64_t, std::function<void ()>>> waiters;
 };
 
 enum class TaskClass : uint8_t
@@ -99,6 +111,7 @@ struct TaskDeps : Util::IntrusivePtrEnabled<TaskDeps, TaskDepsDeleter, Util::Mul
 
 	std::condition_variable cond;
 	std::mutex cond_lock;
+	bool dependees_notified = false;
 	bool done = false;
 	TaskClass task_class = TaskClass::Foreground;
 
@@ -176,6 +189,8 @@ public:
 
 	void move_to_ready_tasks(const Util::SmallVector<Internal::Task *> &list);
 
+	// dependee must not be flushed yet. dependency may be, in which case it is fine for it to
+	// have completed already.
 	void add_dependency(TaskGroup &dependee, TaskGroup &dependency);
 
 	void free_task_group(TaskGroup *group);
@@ -191,9 +206,9 @@ public:
 	static void set_async_main_thread();
 
 private:
-	Util::ThreadSafeObjectPool<Internal::Task> task_pool;
-	Util::ThreadSafeObjectPool<TaskGroup> task_group_pool;
-	Util::ThreadSafeObjectPool<Internal::TaskDeps> task_deps_pool;
+	Util::ThreadCachedObjectPool<Internal::Task> task_pool;
+	Util::ThreadCachedObjectPool<TaskGroup> task_group_pool;
+	Util::ThreadCachedObjectPool<Internal::TaskDeps> task_deps_pool;
 
 	struct
 	{
@@ -241,4 +256,102 @@ void TaskGroup::enqueue_task(Func&& func)
 {
 	group->enqueue_task(*this, std::forward<Func>(func));
 }
+
+namespace Internal
+{
+struct ParallelForState
+{
+	std::atomic<size_t> next_chunk;
+	size_t num_chunks = 0;
+	size_t begin = 0;
+	size_t end = 0;
+	size_t grain_size = 0;
+
+	std::mutex lock;
+	std::condition_variable cond;
+	size_t completed_chunks = 0;
+	std::exception_ptr exception;
+	size_t exception_chunk = 0;
+
+	template <typename Func>
+	void run_chunks(const Func &func)
+	{
+		size_t completed = 0;
+		size_t i;
+		while ((i = next_chunk.fetch_add(1, std::memory_order_relaxed)) < num_chunks)
+		{
+			try
+			{
+				func(i, begin + i * grain_size, std::min(begin + (i + 1) * grain_size, end));
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> holder{lock};
+				if (!exception || i < exception_chunk)
+				{
+					exception = std::current_exception();
+					exception_chunk = i;
+				}
+			}
+			completed++;
+		}
+
+		if (completed)
+		{
+			std::lock_guard<std::mutex> holder{lock};
+			completed_chunks += completed;
+			if (completed_chunks == num_chunks)
+				cond.notify_all();
+		}
+	}
+};
+}
+
+// Splits [begin, end) into chunks of grain_size and calls func(chunk_index, chunk_begin, chunk_end) for each.
+// The calling thread works through chunks alongside helper tasks, and returns once every chunk has run.
+// It never waits for helpers which did not get to start, so this is safe to call from within a task.
+// If chunks throw, the exception from the lowest chunk index is rethrown on the calling thread.
+template <typename Func>
+void parallel_for_range(ThreadGroup *group, size_t begin, size_t end, size_t grain_size,
+                        const char *desc, const Func &func)
+{
+	if (end <= begin)
+		return;
+
+	grain_size = std::max<size_t>(grain_size, 1);
+	size_t num_chunks = (end - begin + grain_size - 1) / grain_size;
+	size_t num_helpers = group ? std::min<size_t>(num_chunks - 1, group->get_num_threads()) : 0;
+
+	if (num_helpers == 0)
+	{
+		for (size_t i = 0; i < num_chunks; i++)
+			func(i, begin + i * grain_size, std::min(begin + (i + 1) * grain_size, end));
+		return;
+	}
+
+	// Helpers may start after we return, so the shared state lives on the heap.
+	// Once all chunks are taken, they return without touching func.
+	auto state = std::make_shared<Internal::ParallelForState>();
+	state->next_chunk.store(0, std::memory_order_relaxed);
+	state->num_chunks = num_chunks;
+	state->begin = begin;
+	state->end = end;
+	state->grain_size = grain_size;
+
+	auto task = group->create_task();
+	task->set_desc(desc);
+	for (size_t i = 0; i < num_helpers; i++)
+		group->enqueue_task(*task, [state, &func]() { state->run_chunks(func); });
+	group->submit(task);
+
+	state->run_chunks(func);
+
+	{
+		std::unique_lock<std::mutex> holder{state->lock};
+		state->cond.wait(holder, [&]() { return state->completed_chunks == num_chunks; });
+	}
+
+	if (state->exception)
+		std::rethrow_exception(state->exception);
+}
 }
\ No newline at end of file
@@ -27,6 +27,10 @@
 #include "cli_parser.hpp"
 #include "rapidjson_wrapper.hpp"
 #include "global_managers_init.hpp"
+#include "thread_group.hpp"
+#ifdef HAVE_GRANITE_PHYSICS
+#include "physics_system.hpp"
+#endif
 
 using namespace Granite;
 using namespace Util;
@@ -46,6 +50,35 @@ static SceneFormats::TextureCompressionFamily string_to_compression(const std::s
 	}
 }
 
+#ifdef HAVE_GRANITE_PHYSICS
+// Collision meshes are extracted from the repacked file, since that's what the runtime will load and hash.
+static bool export_collision_bvh_caches(const std::string &path, const std::string &directory)
+{
+	GLTF::Parser parser(path);
+	for (auto &mesh : parser.get_meshes())
+	{
+		SceneFormats::CollisionMesh collision_mesh;
+		if (!SceneFormats::extract_collision_mesh(collision_mesh, mesh))
+			continue;
+
+		PhysicsSystem::CollisionMesh c;
+		c.indices = collision_mesh.indices.data();
+		c.num_triangles = collision_mesh.indices.size() / 3;
+		c.index_stride_triangle = 3 * sizeof(uint32_t);
+		c.num_attributes = collision_mesh.positions.size();
+		c.positions = collision_mesh.positions.front().data;
+		c.position_stride = sizeof(vec4);
+		c.aabb = mesh.static_aabb;
+		if (!PhysicsSystem::write_collision_bvh_cache(c, directory))
+			return false;
+
+		LOGI("Wrote collision BVH cache %s.\n", PhysicsSystem::get_collision_bvh_cache_path(c, directory).c_str());
+	}
+
+	return true;
+}
+#endif
+
 static void print_help()
 {
 	LOGI("Usage: [--output <out.glb>] [--texcomp <type>]\n");
@@ -67,6 +100,9 @@ static void print_help()
 	LOGI("[--flip-tangent-w]\n");
 	LOGI("[--renormalize-normals]\n");
 	LOGI("[--gltf]\n");
+#ifdef HAVE_GRANITE_PHYSICS
+	LOGI("[--collision-bvh-cache <directory>]\n");
+#endif
 }
 
 int main(int argc, char *argv[])
@@ -88,6 +124,7 @@ int main(int argc, char *argv[])
 	bool animate_cameras = false;
 	bool flip_tangent_w = false;
 	bool renormalize_normals = false;
+	std::string collision_bvh_cache;
 	float animate_cameras_speed = 1.0f;
 	float animate_cameras_sharpness = 0.0f;
 
@@ -110,6 +147,9 @@ int main(int argc, char *argv[])
 	cbs.add("--flip-tangent-w", [&](CLIParser &) { flip_tangent_w = true; });
 	cbs.add("--renormalize-normals", [&](CLIParser &) { renormalize_normals = true; });
 	cbs.add("--gltf", [&](CLIParser &) { options.gltf = true; });
+#ifdef HAVE_GRANITE_PHYSICS
+	cbs.add("--collision-bvh-cache", [&](CLIParser &parser) { collision_bvh_cache = parser.next_string(); });
+#endif
 
 	cbs.add("--fog-color", [&](CLIParser &parser) {
 		for (unsigned i = 0; i < 3; i++)
@@ -148,7 +188,7 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	GLTF::Parser parser(args.input);
+	GLTF::Parser parser(args.input, GRANITE_THREAD_GROUP());
 	std::vector<SceneFormats::Node> nodes;
 
 	SceneFormats::SceneInformation info;
@@ -418,5 +458,13 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+#ifdef HAVE_GRANITE_PHYSICS
+	if (!collision_bvh_cache.empty() && !export_collision_bvh_caches(args.output, collision_bvh_cache))
+	{
+		LOGE("Failed to export collision BVH caches.\n");
+		return 1;
+	}
+#endif
+
 	return 0;
 }
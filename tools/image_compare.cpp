@@ -29,13 +29,20 @@
 #include "texture_files.hpp"
 #include "thread_group.hpp"
 #include "global_managers_init.hpp"
+#include "rapidjson_wrapper.hpp"
 #include <algorithm>
+#include <cmath>
 #include <string.h>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using namespace Util;
 using namespace Granite;
 using namespace Vulkan;
+using namespace rapidjson;
 
 static void save_diff_image(const std::string &path,
                             const MemoryMappedTexture &a,
@@ -77,47 +84,477 @@ static void save_diff_image(const std::string &path,
 		LOGE("Failed to save diff-png to %s.\n", path.c_str());
 }
 
-static double compare_images(const MemoryMappedTexture &a, const MemoryMappedTexture &b)
+struct ImageMetrics
+{
+	uint64_t squared_error = 0;
+	uint64_t num_pixels = 0;
+	unsigned max_error = 0;
+	double ssim_sum = 0.0;
+	uint64_t ssim_windows = 0;
+	bool valid = false;
+
+	void merge(const ImageMetrics &other)
+	{
+		squared_error += other.squared_error;
+		num_pixels += other.num_pixels;
+		max_error = std::max(max_error, other.max_error);
+		ssim_sum += other.ssim_sum;
+		ssim_windows += other.ssim_windows;
+	}
+
+	// Infinite for identical images.
+	double get_psnr() const
+	{
+		double peak_energy = 255.0 * 255.0 * double(num_pixels) * 3.0;
+		return 10.0 * std::log10(peak_energy / double(squared_error));
+	}
+
+	// Images smaller than a single window are only compared by PSNR.
+	double get_ssim() const
+	{
+		return ssim_windows ? ssim_sum / double(ssim_windows) : 1.0;
+	}
+};
+
+// SSIM is evaluated on luma over non-overlapping windows of this size.
+static constexpr unsigned SSIMWindowSize = 8;
+// Rows per parallel work unit, a multiple of the SSIM window.
+static constexpr unsigned RowsPerTask = 8 * SSIMWindowSize;
+
+// Squared error and max abs error of the RGB channels, alpha is ignored.
+static void accumulate_row_error(const uint8_t *a, const uint8_t *b, unsigned width, ImageMetrics &metrics)
 {
+	unsigned x = 0;
+	uint64_t squared_error = 0;
+	unsigned max_error = 0;
+
+#if defined(__SSE2__)
+	const __m128i rgb_mask = _mm_set1_epi32(0x00ffffff);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i max_diff = zero;
+
+	while (x + 4 <= width)
+	{
+		// Each lane grows by at most 4 * 255^2 per iteration, so flush well before it can overflow.
+		__m128i acc = zero;
+		unsigned end = std::min(width & ~3u, x + 4 * 2048);
+		for (; x < end; x += 4)
+		{
+			__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 4 * x));
+			__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 4 * x));
+			__m128i diff = _mm_and_si128(_mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va)), rgb_mask);
+			max_diff = _mm_max_epu8(max_diff, diff);
+
+			__m128i lo = _mm_unpacklo_epi8(diff, zero);
+			__m128i hi = _mm_unpackhi_epi8(diff, zero);
+			acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+		}
+
+		alignas(16) uint32_t lanes[4];
+		_mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+		squared_error += uint64_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+	}
+
+	max_diff = _mm_max_epu8(max_diff, _mm_srli_si128(max_diff, 8));
+	max_diff = _mm_max_epu8(max_diff, _mm_srli_si128(max_diff, 4));
+	max_diff = _mm_max_epu8(max_diff, _mm_srli_si128(max_diff, 2));
+	max_diff = _mm_max_epu8(max_diff, _mm_srli_si128(max_diff, 1));
+	max_error = unsigned(_mm_cvtsi128_si32(max_diff) & 0xff);
+#endif
+
+	for (; x < width; x++)
+	{
+		for (unsigned c = 0; c < 3; c++)
+		{
+			int diff = int(a[4 * x + c]) - int(b[4 * x + c]);
+			squared_error += unsigned(diff * diff);
+			max_error = std::max(max_error, unsigned(std::abs(diff)));
+		}
+	}
+
+	metrics.squared_error += squared_error;
+	metrics.max_error = std::max(metrics.max_error, max_error);
+}
+
+// Rec. 709 luma in 8-bit fixed point, applied to the stored values as-is.
+static void compute_luma_row(uint8_t *luma, const uint8_t *rgba, unsigned width)
+{
+	unsigned x = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weights = _mm_setr_epi16(54, 183, 19, 0, 54, 183, 19, 0);
+	const __m128i round = _mm_set1_epi32(128);
+
+	const auto luma4 = [&](const uint8_t *src) -> __m128i {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		// Yields r * 54 + g * 183 and b * 19 for each pixel, then adds the pairs.
+		__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights);
+		__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights);
+		lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+		hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+		__m128i y = _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0)),
+		                               _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0)));
+		return _mm_srli_epi32(_mm_add_epi32(y, round), 8);
+	};
+
+	for (; x + 8 <= width; x += 8)
+	{
+		__m128i y16 = _mm_packs_epi32(luma4(rgba + 4 * x), luma4(rgba + 4 * x + 16));
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(luma + x), _mm_packus_epi16(y16, y16));
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		auto *p = rgba + 4 * x;
+		luma[x] = uint8_t((p[0] * 54 + p[1] * 183 + p[2] * 19 + 128) >> 8);
+	}
+}
+
+static double compute_window_ssim(uint32_t sum_a, uint32_t sum_b, uint32_t sum_aa, uint32_t sum_bb, uint32_t sum_ab)
+{
+	constexpr double C1 = (0.01 * 255.0) * (0.01 * 255.0);
+	constexpr double C2 = (0.03 * 255.0) * (0.03 * 255.0);
+	constexpr double inv_n = 1.0 / double(SSIMWindowSize * SSIMWindowSize);
+
+	double mean_a = sum_a * inv_n;
+	double mean_b = sum_b * inv_n;
+	double var_a = sum_aa * inv_n - mean_a * mean_a;
+	double var_b = sum_bb * inv_n - mean_b * mean_b;
+	double cov = sum_ab * inv_n - mean_a * mean_b;
+
+	return ((2.0 * mean_a * mean_b + C1) * (2.0 * cov + C2)) /
+	       ((mean_a * mean_a + mean_b * mean_b + C1) * (var_a + var_b + C2));
+}
+
+// SSIM for a row of windows, given SSIMWindowSize rows of luma.
+static void accumulate_window_row_ssim(const uint8_t *luma_a, const uint8_t *luma_b, unsigned width,
+                                       ImageMetrics &metrics)
+{
+	unsigned x = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+
+	const auto hsum = [](__m128i v) -> uint32_t {
+		v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+		v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+		return uint32_t(_mm_cvtsi128_si32(v));
+	};
+
+	// Two windows side by side fill a register.
+	for (; x + 2 * SSIMWindowSize <= width; x += 2 * SSIMWindowSize)
+	{
+		__m128i sum_a = zero, sum_b = zero;
+		__m128i sum_aa[2] = { zero, zero };
+		__m128i sum_bb[2] = { zero, zero };
+		__m128i sum_ab[2] = { zero, zero };
+
+		for (unsigned y = 0; y < SSIMWindowSize; y++)
+		{
+			__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(luma_a + y * width + x));
+			__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(luma_b + y * width + x));
+			sum_a = _mm_add_epi64(sum_a, _mm_sad_epu8(va, zero));
+			sum_b = _mm_add_epi64(sum_b, _mm_sad_epu8(vb, zero));
+
+			__m128i a16[2] = { _mm_unpacklo_epi8(va, zero), _mm_unpackhi_epi8(va, zero) };
+			__m128i b16[2] = { _mm_unpacklo_epi8(vb, zero), _mm_unpackhi_epi8(vb, zero) };
+			for (unsigned i = 0; i < 2; i++)
+			{
+				sum_aa[i] = _mm_add_epi32(sum_aa[i], _mm_madd_epi16(a16[i], a16[i]));
+				sum_bb[i] = _mm_add_epi32(sum_bb[i], _mm_madd_epi16(b16[i], b16[i]));
+				sum_ab[i] = _mm_add_epi32(sum_ab[i], _mm_madd_epi16(a16[i], b16[i]));
+			}
+		}
+
+		alignas(16) uint64_t sums_a[2], sums_b[2];
+		_mm_store_si128(reinterpret_cast<__m128i *>(sums_a), sum_a);
+		_mm_store_si128(reinterpret_cast<__m128i *>(sums_b), sum_b);
+
+		for (unsigned i = 0; i < 2; i++)
+		{
+			metrics.ssim_sum += compute_window_ssim(uint32_t(sums_a[i]), uint32_t(sums_b[i]),
+			                                        hsum(sum_aa[i]), hsum(sum_bb[i]), hsum(sum_ab[i]));
+		}
+		metrics.ssim_windows += 2;
+	}
+#endif
+
+	for (; x + SSIMWindowSize <= width; x += SSIMWindowSize)
+	{
+		uint32_t sum_a = 0, sum_b = 0, sum_aa = 0, sum_bb = 0, sum_ab = 0;
+		for (unsigned y = 0; y < SSIMWindowSize; y++)
+		{
+			for (unsigned i = 0; i < SSIMWindowSize; i++)
+			{
+				uint32_t a = luma_a[y * width + x + i];
+				uint32_t b = luma_b[y * width + x + i];
+				sum_a += a;
+				sum_b += b;
+				sum_aa += a * a;
+				sum_bb += b * b;
+				sum_ab += a * b;
+			}
+		}
+
+		metrics.ssim_sum += compute_window_ssim(sum_a, sum_b, sum_aa, sum_bb, sum_ab);
+		metrics.ssim_windows++;
+	}
+}
+
+// Compares rows [y_begin, y_end). y_begin must be a multiple of the SSIM window size,
+// and windows which do not fit in the range are skipped.
+static void compare_rows(const uint8_t *a, const uint8_t *b, unsigned width, unsigned y_begin, unsigned y_end,
+                         ImageMetrics &metrics)
+{
+	std::vector<uint8_t> luma_a(width * SSIMWindowSize);
+	std::vector<uint8_t> luma_b(width * SSIMWindowSize);
+	size_t stride = size_t(width) * 4;
+
+	for (unsigned y = y_begin; y < y_end; y++)
+	{
+		const uint8_t *row_a = a + y * stride;
+		const uint8_t *row_b = b + y * stride;
+		accumulate_row_error(row_a, row_b, width, metrics);
+
+		unsigned window_row = (y - y_begin) % SSIMWindowSize;
+		if (y - window_row + SSIMWindowSize <= y_end)
+		{
+			compute_luma_row(luma_a.data() + window_row * width, row_a, width);
+			compute_luma_row(luma_b.data() + window_row * width, row_b, width);
+			if (window_row == SSIMWindowSize - 1)
+				accumulate_window_row_ssim(luma_a.data(), luma_b.data(), width, metrics);
+		}
+	}
+
+	metrics.num_pixels += uint64_t(y_end - y_begin) * width;
+}
+
+// Splits the image in bands of rows over workers if given, otherwise runs on the calling thread.
+static ImageMetrics compare_images(const MemoryMappedTexture &a, const MemoryMappedTexture &b, ThreadGroup *workers)
+{
+	ImageMetrics metrics;
+
 	if (a.get_layout().get_format() != b.get_layout().get_format())
 	{
 		LOGE("Format mismatch.\n");
-		return 0.0;
+		return metrics;
 	}
 
 	if (a.get_layout().get_format() != VK_FORMAT_R8G8B8A8_SRGB &&
 	    a.get_layout().get_format() != VK_FORMAT_R8G8B8A8_UNORM)
 	{
 		LOGE("Unsupported format.\n");
-		return 0.0;
+		return metrics;
 	}
 
 	if (a.get_layout().get_width() != b.get_layout().get_width() ||
 	    a.get_layout().get_height() != b.get_layout().get_height())
 	{
 		LOGE("Dimension mismatch.\n");
-		return 0.0;
+		return metrics;
 	}
 
-	int width = a.get_layout().get_width();
-	int height = a.get_layout().get_height();
+	unsigned width = a.get_layout().get_width();
+	unsigned height = a.get_layout().get_height();
 
 	auto *src_a = static_cast<const uint8_t *>(a.get_layout().data());
 	auto *src_b = static_cast<const uint8_t *>(b.get_layout().data());
 
-	double peak_energy = 255.0 * 255.0 * width * height * 3.0;
-	double error_energy = 0.0;
-	for (int pix = 0; pix < width * height; pix++, src_a += 4, src_b += 4)
+	unsigned num_bands = (height + RowsPerTask - 1) / RowsPerTask;
+	std::vector<ImageMetrics> bands(num_bands);
+
+	if (workers && num_bands > 1)
 	{
-		int diff_r = src_a[0] - src_b[0];
-		int diff_g = src_a[1] - src_b[1];
-		int diff_b = src_a[2] - src_b[2];
-		error_energy += diff_r * diff_r;
-		error_energy += diff_g * diff_g;
-		error_energy += diff_b * diff_b;
+		auto task = workers->create_task();
+		for (unsigned i = 0; i < num_bands; i++)
+		{
+			task->enqueue_task([&bands, src_a, src_b, width, height, i]() {
+				compare_rows(src_a, src_b, width, i * RowsPerTask, std::min(height, (i + 1) * RowsPerTask), bands[i]);
+			});
+		}
+		task->flush();
+		task->wait();
+	}
+	else
+	{
+		for (unsigned i = 0; i < num_bands; i++)
+			compare_rows(src_a, src_b, width, i * RowsPerTask, std::min(height, (i + 1) * RowsPerTask), bands[i]);
 	}
 
-	return 10.0 * muglm::log10(peak_energy / error_energy);
+	for (auto &band : bands)
+		metrics.merge(band);
+	metrics.valid = true;
+	return metrics;
+}
+
+struct Thresholds
+{
+	double psnr = -1.0;
+	double ssim = -1.0;
+};
+
+static bool passes(const ImageMetrics &metrics, const Thresholds &thresholds)
+{
+	if (!metrics.valid)
+		return false;
+	if (thresholds.psnr >= 0.0 && metrics.get_psnr() < thresholds.psnr)
+		return false;
+	if (thresholds.ssim >= 0.0 && metrics.get_ssim() < thresholds.ssim)
+		return false;
+	return true;
+}
+
+static void log_metrics(const char *prefix, const ImageMetrics &metrics)
+{
+	LOGI("%sPSNR: %.2f dB, SSIM: %.5f, max error: %u\n", prefix,
+	     metrics.get_psnr(), metrics.get_ssim(), metrics.max_error);
+}
+
+static Value metrics_to_json(const ImageMetrics &metrics, Document::AllocatorType &allocator)
+{
+	Value value(kObjectType);
+	// JSON has no infinity, identical images are reported with a null PSNR.
+	if (metrics.squared_error)
+		value.AddMember("psnr", metrics.get_psnr(), allocator);
+	else
+		value.AddMember("psnr", Value(kNullType), allocator);
+	value.AddMember("ssim", metrics.get_ssim(), allocator);
+	value.AddMember("maxError", metrics.max_error, allocator);
+	return value;
+}
+
+// Pairs where either image fails to load are skipped, unless strict is set, in which case they count as failures.
+static bool compare_directories(ThreadGroup &workers, const std::string &dir_a, const std::string &dir_b,
+                                const Thresholds &thresholds, const std::string &json_path, bool strict)
+{
+	auto a_list = GRANITE_FILESYSTEM()->list(dir_a);
+	auto b_list = GRANITE_FILESYSTEM()->list(dir_b);
+
+	std::sort(begin(a_list), end(a_list), [](const ListEntry &a, const ListEntry &b) {
+		return strcmp(a.path.c_str(), b.path.c_str()) < 0;
+	});
+	std::sort(begin(b_list), end(b_list), [](const ListEntry &a, const ListEntry &b) {
+		return strcmp(a.path.c_str(), b.path.c_str()) < 0;
+	});
+
+	if (a_list.size() != b_list.size())
+	{
+		LOGE("Folder size is not identical.\n");
+		return false;
+	}
+
+	std::vector<ImageMetrics> metrics(a_list.size());
+	// Not vector<bool>, since workers write neighbouring entries concurrently.
+	std::vector<uint8_t> loaded(a_list.size());
+	auto task = workers.create_task();
+
+	// There are usually many more images than workers, so images are compared in parallel,
+	// rather than splitting each image.
+	for (unsigned i = 0; i < a_list.size(); i++)
+	{
+		task->enqueue_task([&a_list, &b_list, &metrics, &loaded, i]() {
+			auto a = load_texture_from_file(*GRANITE_FILESYSTEM(), a_list[i].path);
+			auto b = load_texture_from_file(*GRANITE_FILESYSTEM(), b_list[i].path);
+			if (!a.empty() && !b.empty())
+			{
+				loaded[i] = 1;
+				metrics[i] = compare_images(a, b, nullptr);
+			}
+		});
+	}
+
+	task->flush();
+	task->wait();
+
+	Document doc;
+	doc.SetObject();
+	auto &allocator = doc.GetAllocator();
+	Value results(kArrayType);
+
+	unsigned num_compared = 0;
+	unsigned num_failed = 0;
+	unsigned num_skipped = 0;
+	double min_psnr = INFINITY;
+	double min_ssim = 1.0;
+	double sum_ssim = 0.0;
+
+	for (unsigned i = 0; i < a_list.size(); i++)
+	{
+		auto &m = metrics[i];
+
+		Value result(kObjectType);
+		result.AddMember("a", a_list[i].path, allocator);
+		result.AddMember("b", b_list[i].path, allocator);
+
+		if (!loaded[i] && !strict)
+		{
+			LOGW("%s | %s | Failed to load, skipping.\n", a_list[i].path.c_str(), b_list[i].path.c_str());
+			num_skipped++;
+			result.AddMember("skipped", true, allocator);
+			results.PushBack(result, allocator);
+			continue;
+		}
+
+		bool pass = passes(m, thresholds);
+
+		if (m.valid)
+		{
+			auto prefix = a_list[i].path + " | " + b_list[i].path + " | ";
+			log_metrics(prefix.c_str(), m);
+
+			num_compared++;
+			min_psnr = std::min(min_psnr, m.get_psnr());
+			min_ssim = std::min(min_ssim, m.get_ssim());
+			sum_ssim += m.get_ssim();
+			result.AddMember("metrics", metrics_to_json(m, allocator), allocator);
+		}
+		else
+			LOGE("%s | %s | Could not be compared.\n", a_list[i].path.c_str(), b_list[i].path.c_str());
+
+		if (!pass)
+		{
+			if (m.valid)
+				LOGE("%s does not meet the thresholds, failure!\n", a_list[i].path.c_str());
+			num_failed++;
+		}
+
+		result.AddMember("pass", pass, allocator);
+		results.PushBack(result, allocator);
+	}
+
+	LOGI("Compared %u images, %u failed, %u skipped.\n", num_compared, num_failed, num_skipped);
+
+	if (!json_path.empty())
+	{
+		Value summary(kObjectType);
+		summary.AddMember("images", unsigned(a_list.size()), allocator);
+		summary.AddMember("compared", num_compared, allocator);
+		summary.AddMember("failed", num_failed, allocator);
+		summary.AddMember("skipped", num_skipped, allocator);
+		if (num_compared && std::isfinite(min_psnr))
+			summary.AddMember("minPsnr", min_psnr, allocator);
+		else
+			summary.AddMember("minPsnr", Value(kNullType), allocator);
+		summary.AddMember("minSsim", min_ssim, allocator);
+		summary.AddMember("meanSsim", num_compared ? sum_ssim / num_compared : 1.0, allocator);
+
+		doc.AddMember("summary", summary, allocator);
+		doc.AddMember("results", results, allocator);
+
+		StringBuffer buffer;
+		PrettyWriter<StringBuffer> writer(buffer);
+		doc.Accept(writer);
+
+		if (!GRANITE_FILESYSTEM()->write_string_to_file(json_path, buffer.GetString()))
+		{
+			LOGE("Failed to write JSON summary to %s.\n", json_path.c_str());
+			return false;
+		}
+	}
+
+	return num_failed == 0;
 }
 
 int main(int argc, char *argv[])
@@ -128,16 +565,27 @@ int main(int argc, char *argv[])
 	{
 		std::vector<std::string> inputs;
 		std::string diff;
-		double threshold = -1.0;
+		std::string json;
+		Thresholds thresholds;
+		bool strict = false;
 	} args;
 	CLICallbacks cbs;
 
 	cbs.add("--threshold", [&](CLIParser &parser) {
-		args.threshold = parser.next_double();
+		args.thresholds.psnr = parser.next_double();
+	});
+	cbs.add("--ssim-threshold", [&](CLIParser &parser) {
+		args.thresholds.ssim = parser.next_double();
 	});
 	cbs.add("--diff", [&](CLIParser &parser) {
 		args.diff = parser.next_string();
 	});
+	cbs.add("--json", [&](CLIParser &parser) {
+		args.json = parser.next_string();
+	});
+	cbs.add("--strict", [&](CLIParser &) {
+		args.strict = true;
+	});
 	cbs.default_handler = [&](const char *arg) {
 		args.inputs.push_back(arg);
 	};
@@ -162,62 +610,8 @@ int main(int argc, char *argv[])
 	if (GRANITE_FILESYSTEM()->stat(args.inputs[0], a_stat) && a_stat.type == PathType::Directory &&
 	    GRANITE_FILESYSTEM()->stat(args.inputs[1], b_stat) && b_stat.type == PathType::Directory)
 	{
-		auto a_list = GRANITE_FILESYSTEM()->list(args.inputs[0]);
-		auto b_list = GRANITE_FILESYSTEM()->list(args.inputs[1]);
-
-		std::sort(begin(a_list), end(a_list), [](const ListEntry &a, const ListEntry &b) {
-			return strcmp(a.path.c_str(), b.path.c_str()) < 0;
-		});
-		std::sort(begin(b_list), end(b_list), [](const ListEntry &a, const ListEntry &b) {
-			return strcmp(a.path.c_str(), b.path.c_str()) < 0;
-		});
-
-		if (a_list.size() != b_list.size())
-		{
-			LOGE("Folder size is not identical.\n");
+		if (!compare_directories(workers, args.inputs[0], args.inputs[1], args.thresholds, args.json, args.strict))
 			return 1;
-		}
-
-		std::vector<double> psnrs(a_list.size());
-		std::vector<bool> ignore(a_list.size());
-
-		auto task = workers.create_task();
-
-		for (unsigned i = 0; i < a_list.size(); i++)
-		{
-			task->enqueue_task([&a_list, &b_list, &psnrs, &ignore, i]() {
-				auto a = load_texture_from_file(*GRANITE_FILESYSTEM(), a_list[i].path);
-				auto b = load_texture_from_file(*GRANITE_FILESYSTEM(), b_list[i].path);
-				if (a.empty() || b.empty())
-				{
-					psnrs[i] = 0.0;
-					ignore[i] = true;
-				}
-
-				psnrs[i] = compare_images(a, b);
-
-			});
-		}
-
-		task->flush();
-		task->wait();
-
-		for (unsigned i = 0; i < a_list.size(); i++)
-		{
-			if (ignore[i])
-				continue;
-
-			LOGI("%s | %s | PSNR: %.f dB\n", a_list[i].path.c_str(), b_list[i].path.c_str(), psnrs[i]);
-
-			if (args.threshold >= 0.0)
-			{
-				if (psnrs[i] < args.threshold)
-				{
-					LOGE("PSNR is too low, failure!\n");
-					return 1;
-				}
-			}
-		}
 	}
 	else
 	{
@@ -241,16 +635,16 @@ int main(int argc, char *argv[])
 			save_diff_image(args.diff, a, b);
 		}
 
-		double psnr = compare_images(a, b);
-		LOGI("PSNR: %.f dB\n", psnr);
+		auto metrics = compare_images(a, b, &workers);
+		if (!metrics.valid)
+			return 1;
+
+		log_metrics("", metrics);
 
-		if (args.threshold >= 0.0)
+		if (!passes(metrics, args.thresholds))
 		{
-			if (psnr < args.threshold)
-			{
-				LOGE("PSNR is too low, failure!\n");
-				return 1;
-			}
+			LOGE("Images do not meet the thresholds, failure!\n");
+			return 1;
 		}
 	}
 
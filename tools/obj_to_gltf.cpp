@@ -25,6 +25,7 @@
 #include "cli_parser.hpp"
 #include "obj.hpp"
 #include "global_managers_init.hpp"
+#include "thread_group.hpp"
 
 using namespace Util;
 using namespace Granite;
@@ -62,7 +63,7 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	OBJ::Parser parser(args.input, args.scale);
+	OBJ::Parser parser(args.input, args.scale, GRANITE_THREAD_GROUP());
 
 	SceneFormats::SceneInformation info;
 	info.materials = parser.get_materials();
@@ -0,0 +1,420 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "scene_loader.hpp"
+#include "animation_system.hpp"
+#include "render_context.hpp"
+#include "render_queue.hpp"
+#include "render_graph.hpp"
+#include "render_components.hpp"
+#include "occlusion_culler.hpp"
+#include "thread_group.hpp"
+#include "global_managers_init.hpp"
+#include "filesystem.hpp"
+#include "cli_parser.hpp"
+#include "rapidjson_wrapper.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <float.h>
+#include <cmath>
+
+using namespace Granite;
+using namespace Util;
+using namespace rapidjson;
+
+// Engine-side CPU cost of a frame, without a Vulkan device.
+// Meshes are device-latched, so loading a scene only parses it and builds the node tree.
+// The render queue never gets a device either, so the scene's own renderables push render infos
+// without buffers or programs. Those are sorted like in a real frame, but never dispatched.
+// The stat file matches what gltf-viewer-headless writes with --stat, so tools/sweep_scene.py can drive both.
+
+enum class FrameStage
+{
+	Animation,
+	TransformUpdate,
+	Occlusion,
+	Visibility,
+	RenderQueue,
+	RenderGraphBake,
+	Count
+};
+
+static const char *stage_names[] = {
+	"animation",
+	"transformUpdate",
+	"occlusion",
+	"visibility",
+	"renderQueue",
+	"renderGraphBake",
+};
+static_assert(sizeof(stage_names) / sizeof(stage_names[0]) == size_t(FrameStage::Count), "Stage names mismatch.");
+
+struct StageSamples
+{
+	std::vector<double> usec;
+
+	double percentile(double p) const
+	{
+		if (usec.empty())
+			return 0.0;
+		std::vector<double> sorted = usec;
+		std::sort(sorted.begin(), sorted.end());
+		// Nearest-rank.
+		size_t rank = size_t(std::ceil(p * double(sorted.size())));
+		return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+	}
+
+	double average() const
+	{
+		double sum = 0.0;
+		for (auto u : usec)
+			sum += u;
+		return usec.empty() ? 0.0 : sum / double(usec.size());
+	}
+};
+
+// Roughly the shape of the deferred renderer: shadows, G-buffer, lighting, a bloom chain and tonemapping.
+static void build_render_graph(RenderGraph &graph, unsigned width, unsigned height)
+{
+	graph.reset();
+
+	ResourceDimensions dim;
+	dim.width = width;
+	dim.height = height;
+	dim.format = VK_FORMAT_B8G8R8A8_SRGB;
+	graph.set_backbuffer_dimensions(dim);
+
+	AttachmentInfo shadow;
+	shadow.size_class = SizeClass::Absolute;
+	shadow.size_x = 2048.0f;
+	shadow.size_y = 2048.0f;
+	shadow.format = VK_FORMAT_D16_UNORM;
+	graph.add_pass("shadow-main", RENDER_GRAPH_QUEUE_GRAPHICS_BIT).set_depth_stencil_output("shadow-main", shadow);
+
+	AttachmentInfo emissive, albedo, normal, pbr, depth;
+	emissive.format = VK_FORMAT_B10G11R11_UFLOAT_PACK32;
+	albedo.format = VK_FORMAT_R8G8B8A8_SRGB;
+	normal.format = VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+	pbr.format = VK_FORMAT_R8G8_UNORM;
+	depth.format = VK_FORMAT_D32_SFLOAT;
+
+	auto &gbuffer = graph.add_pass("gbuffer", RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+	gbuffer.add_color_output("emissive", emissive);
+	gbuffer.add_color_output("albedo", albedo);
+	gbuffer.add_color_output("normal", normal);
+	gbuffer.add_color_output("pbr", pbr);
+	gbuffer.set_depth_stencil_output("depth", depth);
+
+	auto &lighting = graph.add_pass("lighting", RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+	lighting.add_color_output("HDR", emissive, "emissive");
+	lighting.add_attachment_input("albedo");
+	lighting.add_attachment_input("normal");
+	lighting.add_attachment_input("pbr");
+	lighting.set_depth_stencil_input("depth");
+	lighting.add_texture_input("shadow-main");
+
+	constexpr unsigned BloomLevels = 4;
+	AttachmentInfo bloom;
+	bloom.format = VK_FORMAT_B10G11R11_UFLOAT_PACK32;
+	std::string prev = "HDR";
+	for (unsigned i = 0; i < BloomLevels; i++)
+	{
+		bloom.size_x = bloom.size_y = 1.0f / float(2u << i);
+		auto name = "bloom-down-" + std::to_string(i);
+		auto &pass = graph.add_pass(name, RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+		pass.add_color_output(name, bloom);
+		pass.add_texture_input(prev);
+		prev = name;
+	}
+
+	for (unsigned i = BloomLevels - 1; i; i--)
+	{
+		bloom.size_x = bloom.size_y = 1.0f / float(1u << i);
+		auto name = "bloom-up-" + std::to_string(i - 1);
+		auto &pass = graph.add_pass(name, RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+		pass.add_color_output(name, bloom);
+		pass.add_texture_input(prev);
+		prev = name;
+	}
+
+	AttachmentInfo backbuffer;
+	auto &tonemap = graph.add_pass("tonemap", RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+	tonemap.add_color_output("tonemapped", backbuffer);
+	tonemap.add_texture_input("HDR");
+	tonemap.add_texture_input(prev);
+
+	graph.set_backbuffer_source("tonemapped");
+	graph.bake();
+}
+
+static void print_help()
+{
+	LOGI("Usage: scene-cpu-bench <scene.gltf/glb/scene>\n"
+	     "\t[--frames <frames>] [--width <width>] [--height <height>]\n"
+	     "\t[--cameras <number of orbiting cameras>] [--camera-index <scene camera>]\n"
+	     "\t[--occluder-triangles <max triangles of meshes used as occluders>]\n"
+	     "\t[--occlusion-resolution <width> <height>]\n"
+	     "\t[--stat <output.json>]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct
+	{
+		std::string scene;
+		std::string stat;
+		unsigned frames = 1000;
+		unsigned width = 1280;
+		unsigned height = 720;
+		unsigned orbit_cameras = 4;
+		int camera_index = -1;
+		unsigned occluder_triangles = 0;
+		unsigned occlusion_width = 256;
+		unsigned occlusion_height = 128;
+	} args;
+
+	CLICallbacks cbs;
+	cbs.add("--frames", [&](CLIParser &parser) { args.frames = parser.next_uint(); });
+	cbs.add("--width", [&](CLIParser &parser) { args.width = parser.next_uint(); });
+	cbs.add("--height", [&](CLIParser &parser) { args.height = parser.next_uint(); });
+	cbs.add("--cameras", [&](CLIParser &parser) { args.orbit_cameras = parser.next_uint(); });
+	cbs.add("--camera-index", [&](CLIParser &parser) { args.camera_index = int(parser.next_uint()); });
+	cbs.add("--occluder-triangles", [&](CLIParser &parser) { args.occluder_triangles = parser.next_uint(); });
+	cbs.add("--occlusion-resolution", [&](CLIParser &parser) {
+		args.occlusion_width = parser.next_uint();
+		args.occlusion_height = parser.next_uint();
+	});
+	cbs.add("--stat", [&](CLIParser &parser) { args.stat = parser.next_string(); });
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.default_handler = [&](const char *arg) { args.scene = arg; };
+	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (args.scene.empty() || args.frames == 0)
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT |
+	             Global::MANAGER_FEATURE_EVENT_BIT |
+	             Global::MANAGER_FEATURE_THREAD_GROUP_BIT |
+	             Global::MANAGER_FEATURE_ASSET_MANAGER_BIT);
+
+	SceneLoader loader;
+	loader.set_occluder_triangle_limit(args.occluder_triangles);
+	try
+	{
+		loader.load_scene(args.scene);
+	}
+	catch (const std::exception &e)
+	{
+		LOGE("Failed to load scene: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	auto &scene = loader.get_scene();
+	auto &animation_system = loader.get_animation_system();
+	scene.update_all_transforms();
+
+	AABB aabb(vec3(FLT_MAX), vec3(-FLT_MAX));
+	auto &objects = scene.get_entity_pool().get_component_group<RenderInfoComponent, RenderableComponent>();
+	for (auto &obj : objects)
+		if (get_component<RenderInfoComponent>(obj)->has_scene_node())
+			aabb.expand(get_component<RenderInfoComponent>(obj)->get_aabb());
+	if (objects.empty())
+		aabb = AABB(vec3(-1.0f), vec3(1.0f));
+
+	float aspect = float(args.width) / float(args.height);
+	std::vector<Camera> cameras;
+
+	auto &scene_cameras = scene.get_entity_pool().get_component_group<CameraComponent>();
+	for (unsigned i = 0; i < scene_cameras.size(); i++)
+	{
+		if (args.camera_index < 0 || unsigned(args.camera_index) == i)
+		{
+			cameras.push_back(get_component<CameraComponent>(scene_cameras[i])->camera);
+			cameras.back().set_aspect(aspect);
+		}
+	}
+
+	// Cameras around the scene looking inwards, so most of it is in view from all directions.
+	vec3 center = aabb.get_center();
+	float radius = aabb.get_radius();
+	for (unsigned i = 0; i < args.orbit_cameras; i++)
+	{
+		float angle = 2.0f * pi<float>() * float(i) / float(args.orbit_cameras);
+		Camera cam;
+		cam.set_aspect(aspect);
+		cam.set_depth_range(0.01f * radius, 4.0f * radius);
+		cam.look_at(center + radius * vec3(1.5f * muglm::cos(angle), 0.5f, 1.5f * muglm::sin(angle)), center);
+		cameras.push_back(cam);
+	}
+
+	if (cameras.empty())
+	{
+		LOGE("No cameras to render from.\n");
+		return EXIT_FAILURE;
+	}
+
+	LOGI("Benchmarking %u frames from %u cameras.\n", args.frames, unsigned(cameras.size()));
+
+	StageSamples samples[ecast(FrameStage::Count)];
+	for (auto &s : samples)
+		s.usec.reserve(args.frames);
+
+	RenderContext context;
+	RenderQueue queue;
+	RenderGraph graph;
+	VisibilityList opaque, transparent;
+	std::vector<VisibilityList> opaque_per_camera(cameras.size());
+	std::vector<VisibilityList> transparent_per_camera(cameras.size());
+	std::vector<OcclusionCuller> cullers(args.occluder_triangles ? cameras.size() : 0);
+
+	const double frame_time = 1.0 / 60.0;
+	double elapsed_time = 0.0;
+	size_t visible = 0;
+
+	for (unsigned frame = 0; frame < args.frames; frame++)
+	{
+		elapsed_time += frame_time;
+
+		auto t0 = get_current_time_nsecs();
+		animation_system.animate(frame_time, elapsed_time);
+		auto t1 = get_current_time_nsecs();
+		scene.update_all_transforms();
+		auto t2 = get_current_time_nsecs();
+
+		for (size_t i = 0; i < cullers.size(); i++)
+		{
+			context.set_camera(cameras[i]);
+			OcclusionCullerParameters params;
+			params.view_projection = context.get_render_parameters().view_projection;
+			params.width = args.occlusion_width;
+			params.height = args.occlusion_height;
+			cullers[i].begin(params);
+			scene.gather_occluders(cullers[i]);
+			cullers[i].rasterize(GRANITE_THREAD_GROUP());
+		}
+		auto t3 = get_current_time_nsecs();
+
+		for (size_t i = 0; i < cameras.size(); i++)
+		{
+			context.set_camera(cameras[i]);
+			opaque_per_camera[i].clear();
+			transparent_per_camera[i].clear();
+			if (cullers.empty())
+			{
+				scene.gather_visible_opaque_renderables(context.get_visibility_frustum(), opaque_per_camera[i]);
+				scene.gather_visible_transparent_renderables(context.get_visibility_frustum(), transparent_per_camera[i]);
+			}
+			else
+			{
+				scene.gather_visible_opaque_renderables(context.get_visibility_frustum(), cullers[i],
+				                                        opaque_per_camera[i]);
+				scene.gather_visible_transparent_renderables(context.get_visibility_frustum(), cullers[i],
+				                                             transparent_per_camera[i]);
+			}
+		}
+		auto t4 = get_current_time_nsecs();
+
+		visible = 0;
+		for (size_t i = 0; i < cameras.size(); i++)
+		{
+			context.set_camera(cameras[i]);
+			queue.reset();
+			queue.push_renderables(context, opaque_per_camera[i].data(), opaque_per_camera[i].size());
+			queue.push_renderables(context, transparent_per_camera[i].data(), transparent_per_camera[i].size());
+			queue.sort();
+			visible += opaque_per_camera[i].size() + transparent_per_camera[i].size();
+		}
+		auto t5 = get_current_time_nsecs();
+
+		build_render_graph(graph, args.width, args.height);
+		auto t6 = get_current_time_nsecs();
+
+		samples[ecast(FrameStage::Animation)].usec.push_back(1e-3 * double(t1 - t0));
+		samples[ecast(FrameStage::TransformUpdate)].usec.push_back(1e-3 * double(t2 - t1));
+		samples[ecast(FrameStage::Occlusion)].usec.push_back(1e-3 * double(t3 - t2));
+		samples[ecast(FrameStage::Visibility)].usec.push_back(1e-3 * double(t4 - t3));
+		samples[ecast(FrameStage::RenderQueue)].usec.push_back(1e-3 * double(t5 - t4));
+		samples[ecast(FrameStage::RenderGraphBake)].usec.push_back(1e-3 * double(t6 - t5));
+	}
+
+	double total_usec = 0.0;
+	for (unsigned i = 0; i < ecast(FrameStage::Count); i++)
+	{
+		auto &s = samples[i];
+		total_usec += s.average();
+		LOGI("%16s: avg %9.3f us, p50 %9.3f us, p95 %9.3f us, p99 %9.3f us\n",
+		     stage_names[i], s.average(), s.percentile(0.50), s.percentile(0.95), s.percentile(0.99));
+	}
+	LOGI("Average frame time: %.3f usec, %zu renderables visible over all cameras in last frame.\n",
+	     total_usec, visible);
+	if (!cullers.empty())
+	{
+		LOGI("Occlusion: %u occluders, %u triangles, %u polygons rasterized for the first camera.\n",
+		     cullers.front().get_num_occluders(), cullers.front().get_num_triangles(),
+		     cullers.front().get_num_rasterized_polygons());
+	}
+
+	if (!args.stat.empty())
+	{
+		Document doc;
+		doc.SetObject();
+		auto &allocator = doc.GetAllocator();
+
+		doc.AddMember("averageFrameTimeUs", total_usec, allocator);
+		doc.AddMember("gpu", StringRef("CPU"), allocator);
+		doc.AddMember("driverVersion", 0, allocator);
+
+		Value report_objs(kObjectType);
+		for (unsigned i = 0; i < ecast(FrameStage::Count); i++)
+		{
+			auto &s = samples[i];
+			Value report_obj(kObjectType);
+			report_obj.AddMember("averageUs", s.average(), allocator);
+			report_obj.AddMember("p50Us", s.percentile(0.50), allocator);
+			report_obj.AddMember("p95Us", s.percentile(0.95), allocator);
+			report_obj.AddMember("p99Us", s.percentile(0.99), allocator);
+			report_objs.AddMember(StringRef(stage_names[i]), report_obj, allocator);
+		}
+		doc.AddMember("performance", report_objs, allocator);
+
+		StringBuffer buffer;
+		PrettyWriter<StringBuffer> writer(buffer);
+		doc.Accept(writer);
+
+		if (!GRANITE_FILESYSTEM()->write_string_to_file(args.stat, buffer.GetString()))
+		{
+			LOGE("Failed to write stat file to disk.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
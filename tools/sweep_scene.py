@@ -77,12 +77,18 @@ def main():
                         type = int,
                         default = -1,
                         help = 'Camera index')
+    parser.add_argument('--cpu',
+                        help = 'Measure engine-side CPU stages with scene-cpu-bench, no GPU needed. Configs are ignored',
+                        action = 'store_true')
 
     args = parser.parse_args()
 
     f, stat_file = tempfile.mkstemp()
     os.close(f)
 
+    if args.cpu and args.configs is None:
+        args.configs = ['cpu']
+
     if args.configs is None:
         print('Not running any configs, exiting.')
         sys.exit(0)
@@ -91,13 +97,14 @@ def main():
         sys.stderr.write('Need width, height and frames.\n')
         sys.exit(1)
 
-    binary = args.viewer_binary if args.viewer_binary is not None else './viewer/gltf-viewer-headless'
+    default_binary = './tools/scene-cpu-bench' if args.cpu else './viewer/gltf-viewer-headless'
+    binary = args.viewer_binary if args.viewer_binary is not None else default_binary
     base_sweep = [binary, args.scene,
             '--frames', str(args.frames),
             '--width', str(args.width),
             '--height', str(args.height),
             '--stat', stat_file]
-    if args.timestamp:
+    if args.timestamp and not args.cpu:
         base_sweep.append('--timestamp')
     if args.camera_index >= 0:
         base_sweep.append('--camera-index')
@@ -109,10 +116,10 @@ def main():
     gpu = None
     version = None
     for config in args.configs:
-        sweep = base_sweep + ['--config', config]
+        sweep = base_sweep if args.cpu else base_sweep + ['--config', config]
         base_config = os.path.splitext(os.path.basename(config))[0]
 
-        if args.png_result_dir:
+        if args.png_result_dir and not args.cpu:
             sweep.append('--png-reference-path')
             sweep.append(os.path.join(args.png_result_dir, base_config + '.png'))
 
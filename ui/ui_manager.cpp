@@ -22,6 +22,7 @@
 
 #include "ui_manager.hpp"
 #include "window.hpp"
+#include "thread_group.hpp"
 
 using namespace Util;
 
@@ -53,6 +54,10 @@ void UIManager::remove_child(Widget *widget)
 
 void UIManager::render(Vulkan::CommandBuffer &cmd)
 {
+	// Recorded text refers to the old atlas image, and may be missing glyphs which just arrived.
+	if (sdf_atlas && sdf_atlas->begin_frame())
+		renderer.invalidate_caches();
+
 	renderer.begin();
 
 	const float max_layers = 20000.0f; // Roughly for D16 with some headroom for quantization errors.
@@ -85,7 +90,7 @@ void UIManager::render(Vulkan::CommandBuffer &cmd)
 		}
 
 		renderer.push_scissor(window->get_floating_position(), window_size);
-		float min_layer = widget->render(renderer, minimum_layer, window_pos, window_size);
+		float min_layer = widget->render_cached(renderer, minimum_layer, window_pos, window_size);
 		renderer.pop_scissor();
 
 		minimum_layer = min(min_layer, minimum_layer);
@@ -123,11 +128,31 @@ Font& UIManager::get_font(FontSize size)
 			break;
 		}
 
-		font.reset(new Font("builtin://fonts/font.ttf", pix_size));
+		if (use_sdf_fonts)
+		{
+			// Every size renders from the same distance field atlas.
+			if (!sdf_atlas)
+				sdf_atlas = std::make_shared<SDFFontAtlas>("builtin://fonts/font.ttf", 32.0f, 4, 1024, GRANITE_THREAD_GROUP());
+			font.reset(new Font(sdf_atlas, pix_size));
+		}
+		else
+			font.reset(new Font("builtin://fonts/font.ttf", pix_size));
 	}
 	return *font;
 }
 
+void UIManager::set_use_sdf_fonts(bool enable)
+{
+	if (enable == use_sdf_fonts)
+		return;
+
+	use_sdf_fonts = enable;
+	for (auto &font : fonts)
+		font.reset();
+	if (!enable)
+		sdf_atlas.reset();
+}
+
 bool UIManager::filter_input_event(const TouchUpEvent &e)
 {
 	if (e.get_id() != touch_emulation_id)
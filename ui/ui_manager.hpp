@@ -59,6 +59,10 @@ public:
 	void render(Vulkan::CommandBuffer &cmd);
 	Font &get_font(FontSize size);
 
+	// Bitmap fonts baked per size are the default.
+	// SDF fonts share one lazily populated glyph atlas across all sizes.
+	void set_use_sdf_fonts(bool enable);
+
 	void reset_children();
 	void remove_child(Widget *widget);
 
@@ -71,6 +75,8 @@ private:
 	FlatRenderer renderer;
 	std::vector<WidgetHandle> widgets;
 	std::unique_ptr<Font> fonts[Util::ecast(FontSize::Count)];
+	std::shared_ptr<SDFFontAtlas> sdf_atlas;
+	bool use_sdf_fonts = false;
 	//Font::Alignment alignment = Font::Alignment::Center;
 
 	Widget *drag_receiver = nullptr;
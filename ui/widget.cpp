@@ -55,7 +55,7 @@ float Widget::render_children(FlatRenderer &renderer, float layer, vec2 offset)
 			}
 
 			renderer.push_scissor(child.offset + offset, child.size);
-			float min_layer = child.widget->render(renderer, layer - 1.0f, child.offset + offset, child.size);
+			float min_layer = child.widget->render_cached(renderer, layer - 1.0f, child.offset + offset, child.size);
 			minimum_layer = std::min(minimum_layer, min_layer);
 			renderer.pop_scissor();
 		}
@@ -99,33 +99,33 @@ Util::IntrusivePtr<Widget> Widget::remove_child(const Widget &widget)
 	auto res = itr->widget;
 	children.erase(itr);
 	res->parent = nullptr;
+	geometry_changed();
 	return res;
 }
 
-bool Widget::get_needs_redraw() const
-{
-	if (needs_redraw)
-		return true;
-
-	for (auto &child : children)
-	{
-		if (child.widget->needs_redraw)
-			return true;
-	}
-
-	return false;
-}
-
 void Widget::geometry_changed()
 {
 	needs_redraw = true;
 	needs_reconfigure = true;
+	needs_canvas_reconfigure = true;
 	if (parent)
 		parent->geometry_changed();
 }
 
+void Widget::redraw_changed()
+{
+	// Parents replay their children's geometry as part of their own, so they have to record again.
+	needs_redraw = true;
+	if (parent)
+		parent->redraw_changed();
+}
+
 void Widget::reconfigure_geometry()
 {
+	// A widget whose geometry changed marks all of its parents, so a clean widget has a clean subtree.
+	if (!needs_reconfigure)
+		return;
+
 	for (auto &child : children)
 		child.widget->reconfigure_geometry();
 	reconfigure();
@@ -134,9 +134,40 @@ void Widget::reconfigure_geometry()
 
 void Widget::reconfigure_geometry_to_canvas(vec2 offset, vec2 size)
 {
+	if (!needs_canvas_reconfigure && all(equal(offset, canvas_offset)) && all(equal(size, canvas_size)))
+		return;
+
 	reconfigure_to_canvas(offset, size);
+	canvas_offset = offset;
+	canvas_size = size;
+	needs_canvas_reconfigure = false;
+
 	for (auto &child : children)
 		child.widget->reconfigure_geometry_to_canvas(child.offset + offset, child.size);
 }
+
+float Widget::render_cached(FlatRenderer &renderer, float layer, vec2 offset, vec2 size)
+{
+	bool same_placement = all(equal(offset, render_cache.offset)) && all(equal(size, render_cache.size)) &&
+	                      layer == render_cache.layer;
+
+	if (!needs_redraw && same_placement)
+	{
+		if (render_cache.uncacheable)
+			return render(renderer, layer, offset, size);
+		if (renderer.replay(render_cache.geometry))
+			return render_cache.minimum_layer;
+	}
+
+	renderer.begin_recording();
+	float minimum_layer = render(renderer, layer, offset, size);
+	render_cache.uncacheable = !renderer.end_recording(render_cache.geometry);
+	render_cache.offset = offset;
+	render_cache.size = size;
+	render_cache.layer = layer;
+	render_cache.minimum_layer = minimum_layer;
+	needs_redraw = false;
+	return minimum_layer;
+}
 }
 }
\ No newline at end of file
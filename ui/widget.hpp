@@ -25,6 +25,7 @@
 #include "math.hpp"
 #include <vector>
 #include "resource_manager.hpp"
+#include "flat_renderer_cache.hpp"
 
 namespace Granite
 {
@@ -126,16 +127,22 @@ public:
 	void set_background_color(vec4 color)
 	{
 		bg_color = color;
-		needs_redraw = true;
+		redraw_changed();
 	}
 
 	void set_background_image(AssetID texture)
 	{
 		bg_image = texture;
-		needs_redraw = true;
+		redraw_changed();
 	}
 
-	bool get_needs_redraw() const;
+	// True if anything in the subtree changed since it was last rendered.
+	bool get_needs_redraw() const
+	{
+		return needs_redraw;
+	}
+
+	// Only subtrees which changed since the last call are laid out again.
 	void reconfigure_geometry();
 	void reconfigure_geometry_to_canvas(vec2 offset, vec2 size);
 
@@ -144,6 +151,10 @@ public:
 		return layer;
 	}
 
+	// Replays the geometry recorded in an earlier frame if nothing in the subtree changed,
+	// otherwise renders and records it.
+	float render_cached(FlatRenderer &renderer, float layer, vec2 offset, vec2 size);
+
 	virtual Widget *on_mouse_button_pressed(vec2);
 
 	virtual void on_mouse_button_released(vec2)
@@ -177,7 +188,10 @@ public:
 	}
 
 protected:
+	// Layout and appearance changed.
 	void geometry_changed();
+	// Only appearance changed, layout is still valid.
+	void redraw_changed();
 
 	vec2 floating_position = vec2(0.0f);
 	vec4 bg_color = vec4(1.0f, 1.0f, 1.0f, 0.0f);
@@ -205,7 +219,21 @@ protected:
 		Util::IntrusivePtr<Widget> widget;
 	};
 	std::vector<Child> children;
-	bool needs_reconfigure = false;
+	bool needs_reconfigure = true;
+	bool needs_canvas_reconfigure = true;
+	vec2 canvas_offset = vec2(0.0f);
+	vec2 canvas_size = vec2(0.0f);
+
+	struct
+	{
+		FlatRendererCache geometry;
+		vec2 offset = vec2(0.0f);
+		vec2 size = vec2(0.0f);
+		float layer = 0.0f;
+		float minimum_layer = 0.0f;
+		// Set when the subtree emitted something which cannot be replayed, like images.
+		bool uncacheable = false;
+	} render_cache;
 
 	virtual void reconfigure() = 0;
 	virtual void reconfigure_to_canvas(vec2 offset, vec2 size) = 0;
@@ -23,6 +23,8 @@
 #include "arena_allocator.hpp"
 #include "bitops.hpp"
 #include <assert.h>
+#include <algorithm>
+#include <unordered_map>
 
 namespace Util
 {
@@ -50,6 +52,13 @@ void LegionAllocator::allocate(uint32_t num_blocks, uint32_t &out_mask, uint32_t
 	out_offset = b;
 }
 
+void LegionAllocator::reserve(uint32_t mask)
+{
+	assert((free_blocks[0] & mask) == mask);
+	free_blocks[0] &= ~mask;
+	update_longest_run();
+}
+
 void LegionAllocator::free(uint32_t mask)
 {
 	assert((free_blocks[0] & mask) == 0);
@@ -175,6 +184,400 @@ bool SliceAllocator::allocate(uint32_t count, Util::AllocatedSlice *slice)
 	return false;
 }
 
+SliceAllocatorStatistics SliceAllocator::get_statistics() const
+{
+	SliceAllocatorStatistics stats = {};
+	uint64_t free_count = 0;
+
+	for (auto &alloc : allocators)
+	{
+		uint32_t sub_block_size = alloc.get_sub_block_size();
+		alloc.for_each_heap([&](Util::IntrusiveList<SliceSubAllocator::MiniHeap>::Iterator itr) {
+			auto &heap = itr->heap;
+			stats.num_heaps++;
+			free_count += uint64_t(popcount32(heap.get_free_mask())) * sub_block_size;
+			stats.largest_free_block = std::max(stats.largest_free_block, heap.get_longest_run() * sub_block_size);
+
+			// Heaps of the top level are the ones backed by the global allocator.
+			if (!alloc.parent)
+			{
+				stats.num_backing_heaps++;
+				stats.total_count += alloc.get_max_allocation_size();
+			}
+		});
+	}
+
+	stats.used_count = stats.total_count - free_count;
+	return stats;
+}
+
+namespace
+{
+struct DefragSlice
+{
+	AllocatedSlice *slice;
+	// Where the slice lives once earlier moves in the plan have been applied.
+	AllocatedSlice current;
+};
+
+struct DefragHeap
+{
+	Util::IntrusiveList<SliceSubAllocator::MiniHeap>::Iterator heap;
+	// Where the heap lives once earlier moves in the plan have been applied.
+	AllocatedSlice allocation;
+	DefragHeap *parent = nullptr;
+	std::vector<DefragHeap *> children;
+	std::vector<DefragSlice *> slices;
+	uint32_t free_mask = 0;
+	// Sub-blocks owned by slices the caller allows us to move.
+	uint32_t movable_mask = 0;
+	// A heap cannot be drained in the same pass as it receives data.
+	unsigned destination_pass = UINT32_MAX;
+	bool released = false;
+
+	uint32_t get_used_count() const
+	{
+		return popcount32(~free_mask);
+	}
+};
+
+struct DefragItem
+{
+	DefragSlice *slice;
+	DefragHeap *child;
+	uint32_t num_blocks;
+};
+
+struct DefragPlacement
+{
+	const DefragItem *item;
+	DefragHeap *target;
+	uint32_t free_mask;
+	uint32_t mask;
+};
+
+// Lowest position of a free run of num_blocks, or 32 if there is none.
+uint32_t find_free_run(uint32_t free_mask, uint32_t num_blocks)
+{
+	uint32_t candidates = free_mask;
+	for (uint32_t i = 1; i < num_blocks && candidates; i++)
+		candidates &= free_mask >> i;
+	return trailing_zeroes(candidates);
+}
+
+uint32_t run_mask(uint32_t offset, uint32_t num_blocks)
+{
+	uint32_t mask = num_blocks == LegionAllocator::NumSubBlocks ? ~0u : ((1u << num_blocks) - 1u);
+	return mask << offset;
+}
+
+// A heap can move as a whole if everything below it is movable.
+bool is_relocatable(const DefragHeap &heap)
+{
+	uint32_t covered = heap.movable_mask;
+	for (auto *child : heap.children)
+	{
+		if (!is_relocatable(*child))
+			return false;
+		covered |= child->allocation.mask;
+	}
+
+	return covered == ~heap.free_mask;
+}
+
+uint64_t get_subtree_count(const DefragHeap &heap)
+{
+	uint64_t count = 0;
+	for (auto *slice : heap.slices)
+		count += slice->current.count;
+	for (auto *child : heap.children)
+		count += get_subtree_count(*child);
+	return count;
+}
+
+// Moves every slice below heap along with it. Offsets are absolute, so everything shifts by the same amount.
+void relocate_subtree(DefragHeap &heap, uint32_t buffer_index, uint32_t offset, SliceDefragmentationPlan &plan)
+{
+	uint32_t old_offset = heap.allocation.offset;
+
+	for (auto *slice : heap.slices)
+	{
+		SliceMove move;
+		move.slice = slice->slice;
+		move.src = slice->current;
+		move.dst = slice->current;
+		move.dst.buffer_index = buffer_index;
+		move.dst.offset = move.src.offset - old_offset + offset;
+		plan.moves.push_back(move);
+		plan.moved_count += move.src.count;
+		slice->current = move.dst;
+	}
+
+	for (auto *child : heap.children)
+	{
+		SliceHeapMove move;
+		move.heap = child->heap;
+		move.dst = child->allocation;
+		move.dst.buffer_index = buffer_index;
+		move.dst.offset = move.dst.offset - old_offset + offset;
+		plan.heap_moves.push_back(move);
+		relocate_subtree(*child, buffer_index, move.dst.offset, plan);
+		child->allocation = move.dst;
+	}
+}
+}
+
+void SliceAllocator::plan_defragmentation(AllocatedSlice * const *live_slices, size_t count,
+                                          SliceDefragmentationPlan &plan, uint64_t max_moved_count) const
+{
+	plan.moves.clear();
+	plan.pass_offsets.clear();
+	plan.heap_moves.clear();
+	plan.heap_pass_offsets.clear();
+	plan.moved_count = 0;
+	plan.released_heaps = 0;
+	plan.released_backing_heaps = 0;
+
+	// Snapshot of every heap. Planning works on this copy, so the effect of earlier moves
+	// can be propagated up the hierarchy without touching the real allocator.
+	std::vector<DefragHeap> heaps;
+	std::vector<DefragSlice> slices;
+	std::vector<DefragHeap *> levels[SliceAllocatorCount];
+	std::unordered_map<const SliceSubAllocator::MiniHeap *, DefragHeap *> heap_lookup;
+
+	size_t num_heaps = 0;
+	for (auto &alloc : allocators)
+		alloc.for_each_heap([&](Util::IntrusiveList<SliceSubAllocator::MiniHeap>::Iterator) { num_heaps++; });
+	heaps.reserve(num_heaps);
+	slices.reserve(count);
+
+	for (unsigned level = 0; level < SliceAllocatorCount; level++)
+	{
+		allocators[level].for_each_heap([&](Util::IntrusiveList<SliceSubAllocator::MiniHeap>::Iterator itr) {
+			heaps.emplace_back();
+			auto &heap = heaps.back();
+			heap.heap = itr;
+			heap.allocation = itr->allocation;
+			heap.free_mask = itr->heap.get_free_mask();
+			heap_lookup[itr.get()] = &heap;
+			levels[level].push_back(&heap);
+		});
+	}
+
+	for (auto &heap : heaps)
+	{
+		if (heap.allocation.alloc)
+		{
+			heap.parent = heap_lookup[heap.allocation.heap.get()];
+			heap.parent->children.push_back(&heap);
+		}
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		auto *slice = live_slices[i];
+		if (!slice || !slice->alloc)
+			continue;
+
+		auto itr = heap_lookup.find(slice->heap.get());
+		if (itr == heap_lookup.end())
+			continue;
+
+		auto &heap = *itr->second;
+		assert((heap.free_mask & slice->mask) == 0);
+		heap.movable_mask |= slice->mask;
+		slices.push_back({ slice, *slice });
+		heap.slices.push_back(&slices.back());
+	}
+
+	std::vector<DefragItem> items;
+	std::vector<DefragPlacement> placements;
+
+	for (unsigned level = 0; level < SliceAllocatorCount; level++)
+	{
+		plan.pass_offsets.push_back(plan.moves.size());
+		plan.heap_pass_offsets.push_back(plan.heap_moves.size());
+		auto &level_heaps = levels[level];
+		uint32_t sub_block_size_log2 = floor_log2(allocators[level].get_sub_block_size());
+
+		// Drain the emptiest heaps first, into the fullest heaps which can take their contents.
+		std::stable_sort(level_heaps.begin(), level_heaps.end(), [](const DefragHeap *a, const DefragHeap *b) {
+			return a->get_used_count() < b->get_used_count();
+		});
+
+		for (auto *source : level_heaps)
+		{
+			if (source->released || source->destination_pass == level || !is_relocatable(*source))
+				continue;
+			if (get_subtree_count(*source) > max_moved_count - plan.moved_count)
+				continue;
+
+			items.clear();
+			for (auto *slice : source->slices)
+				items.push_back({ slice, nullptr, popcount32(slice->current.mask) });
+			for (auto *child : source->children)
+				items.push_back({ nullptr, child, popcount32(child->allocation.mask) });
+
+			// Placing large items first makes it more likely that everything fits.
+			std::stable_sort(items.begin(), items.end(), [](const DefragItem &a, const DefragItem &b) {
+				return a.num_blocks > b.num_blocks;
+			});
+
+			placements.clear();
+			bool success = true;
+
+			for (auto &item : items)
+			{
+				DefragHeap *target = nullptr;
+				uint32_t offset = LegionAllocator::NumSubBlocks;
+
+				for (auto itr = level_heaps.rbegin(); itr != level_heaps.rend() && !target; ++itr)
+				{
+					auto *candidate = *itr;
+					if (candidate == source || candidate->released)
+						continue;
+
+					offset = find_free_run(candidate->free_mask, item.num_blocks);
+					if (offset < LegionAllocator::NumSubBlocks)
+						target = candidate;
+				}
+
+				if (!target)
+				{
+					success = false;
+					break;
+				}
+
+				uint32_t mask = run_mask(offset, item.num_blocks);
+				placements.push_back({ &item, target, target->free_mask, mask });
+				target->free_mask &= ~mask;
+			}
+
+			if (!success)
+			{
+				for (auto itr = placements.rbegin(); itr != placements.rend(); ++itr)
+					itr->target->free_mask = itr->free_mask;
+				continue;
+			}
+
+			for (auto &placement : placements)
+			{
+				auto *target = placement.target;
+				target->destination_pass = level;
+
+				AllocatedSlice dst;
+				dst.buffer_index = target->allocation.buffer_index;
+				dst.offset = target->allocation.offset + (trailing_zeroes(placement.mask) << sub_block_size_log2);
+				dst.count = placement.item->num_blocks << sub_block_size_log2;
+				dst.mask = placement.mask;
+				dst.alloc = const_cast<SliceSubAllocator *>(&allocators[level]);
+				dst.heap = target->heap;
+
+				if (placement.item->slice)
+				{
+					auto *slice = placement.item->slice;
+					SliceMove move;
+					move.slice = slice->slice;
+					move.src = slice->current;
+					move.dst = dst;
+					plan.moves.push_back(move);
+					plan.moved_count += move.src.count;
+
+					slice->current = dst;
+					target->slices.push_back(slice);
+					target->movable_mask |= dst.mask;
+				}
+				else
+				{
+					auto *child = placement.item->child;
+					SliceHeapMove move;
+					move.heap = child->heap;
+					move.dst = dst;
+					move.reallocate = true;
+					plan.heap_moves.push_back(move);
+					relocate_subtree(*child, dst.buffer_index, dst.offset, plan);
+
+					child->allocation = dst;
+					child->parent = target;
+					target->children.push_back(child);
+				}
+			}
+
+			source->slices.clear();
+			source->children.clear();
+			source->movable_mask = 0;
+			source->free_mask = ~0u;
+
+			// Releasing a heap frees its range in the parent, which may drain the parent in turn.
+			for (auto *heap = source; heap && heap->free_mask == ~0u; heap = heap->parent)
+			{
+				heap->released = true;
+				plan.released_heaps++;
+
+				if (heap->parent)
+				{
+					auto &siblings = heap->parent->children;
+					siblings.erase(std::find(siblings.begin(), siblings.end(), heap));
+					heap->parent->free_mask |= heap->allocation.mask;
+				}
+				else
+					plan.released_backing_heaps++;
+			}
+		}
+	}
+
+	plan.pass_offsets.push_back(plan.moves.size());
+	plan.heap_pass_offsets.push_back(plan.heap_moves.size());
+}
+
+void SliceAllocator::begin_defragmentation_pass(const SliceDefragmentationPlan &plan, size_t pass)
+{
+	AllocatedSlice slice;
+
+	for (size_t i = plan.pass_offsets[pass]; i < plan.pass_offsets[pass + 1]; i++)
+	{
+		// Slices in a moved heap keep their place in the heap.
+		auto &move = plan.moves[i];
+		if (move.src.heap != move.dst.heap)
+		{
+			move.dst.alloc->allocate_at(move.dst.heap, move.dst.mask, &slice);
+			assert(slice.offset == move.dst.offset && slice.count == move.dst.count);
+		}
+	}
+
+	for (size_t i = plan.heap_pass_offsets[pass]; i < plan.heap_pass_offsets[pass + 1]; i++)
+	{
+		auto &move = plan.heap_moves[i];
+		if (move.reallocate)
+		{
+			move.dst.alloc->allocate_at(move.dst.heap, move.dst.mask, &slice);
+			assert(slice.offset == move.dst.offset && slice.count == move.dst.count);
+		}
+	}
+}
+
+void SliceAllocator::end_defragmentation_pass(const SliceDefragmentationPlan &plan, size_t pass)
+{
+	for (size_t i = plan.pass_offsets[pass]; i < plan.pass_offsets[pass + 1]; i++)
+	{
+		auto &move = plan.moves[i];
+		if (move.src.heap != move.dst.heap)
+			free(move.src);
+		*move.slice = move.dst;
+	}
+
+	for (size_t i = plan.heap_pass_offsets[pass]; i < plan.heap_pass_offsets[pass + 1]; i++)
+	{
+		auto &move = plan.heap_moves[i];
+		auto heap = move.heap;
+		auto &allocation = heap->allocation;
+		AllocatedSlice old_allocation = allocation;
+		allocation = move.dst;
+		if (move.reallocate)
+			free(old_allocation);
+	}
+}
+
 void SliceBackingAllocatorVA::free(uint32_t)
 {
 	allocated = false;
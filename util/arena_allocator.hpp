@@ -23,7 +23,9 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <assert.h>
+#include <vector>
 #include "intrusive_list.hpp"
 #include "logging.hpp"
 #include "object_pool.hpp"
@@ -73,7 +75,14 @@ public:
 		return longest_run;
 	}
 
+	inline uint32_t get_free_mask() const
+	{
+		return free_blocks[0];
+	}
+
 	void allocate(uint32_t num_blocks, uint32_t &mask, uint32_t &offset);
+	// Allocates a specific run of sub-blocks, which must be free.
+	void reserve(uint32_t mask);
 	void free(uint32_t mask);
 
 private:
@@ -162,24 +171,7 @@ public:
 
 			auto &heap = *itr;
 			static_cast<DerivedAllocator *>(this)->prepare_allocation(alloc, itr, suballocate(num_blocks, heap));
-
-			unsigned new_index = heap.heap.get_longest_run() - 1;
-
-			if (heap.heap.full())
-			{
-				heap_arena.full_heaps.move_to_front(heap_arena.heaps[index], itr);
-				if (!heap_arena.heaps[index].begin())
-					heap_arena.heap_availability_mask &= ~(1u << index);
-			}
-			else if (new_index != index)
-			{
-				auto &new_heap = heap_arena.heaps[new_index];
-				new_heap.move_to_front(heap_arena.heaps[index], itr);
-				heap_arena.heap_availability_mask |= 1u << new_index;
-				if (!heap_arena.heaps[index].begin())
-					heap_arena.heap_availability_mask &= ~(1u << index);
-			}
-
+			update_heap_after_allocation(itr, index);
 			return true;
 		}
 
@@ -252,6 +244,33 @@ public:
 		}
 	}
 
+	// Allocates exactly the sub-blocks in mask from a live heap.
+	// Used to apply placements which were computed ahead of time.
+	inline void allocate_at(typename IntrusiveList<MiniHeap>::Iterator itr, uint32_t mask, BackingAllocation *alloc)
+	{
+		auto &heap = *itr;
+		assert(!heap.heap.full());
+		unsigned index = heap.heap.get_longest_run() - 1;
+		heap.heap.reserve(mask);
+
+		SuballocationResult res = {};
+		res.offset = trailing_zeroes(mask) << sub_block_size_log2;
+		res.size = popcount32(mask) << sub_block_size_log2;
+		res.mask = mask;
+		static_cast<DerivedAllocator *>(this)->prepare_allocation(alloc, itr, res);
+		update_heap_after_allocation(itr, index);
+	}
+
+	template <typename Func>
+	inline void for_each_heap(const Func &func) const
+	{
+		for (auto &list : heap_arena.heaps)
+			for (auto itr = list.begin(); itr != list.end(); ++itr)
+				func(itr);
+		for (auto itr = heap_arena.full_heaps.begin(); itr != heap_arena.full_heaps.end(); ++itr)
+			func(itr);
+	}
+
 	inline void set_object_pool(ObjectPool<MiniHeap> *object_pool_)
 	{
 		object_pool = object_pool_;
@@ -273,6 +292,28 @@ private:
 		res.offset <<= sub_block_size_log2;
 		return res;
 	}
+
+	// Moves a heap which lived in heaps[index] to the list matching its new longest run.
+	inline void update_heap_after_allocation(typename IntrusiveList<MiniHeap>::Iterator itr, unsigned index)
+	{
+		auto &heap = *itr;
+		unsigned new_index = heap.heap.get_longest_run() - 1;
+
+		if (heap.heap.full())
+		{
+			heap_arena.full_heaps.move_to_front(heap_arena.heaps[index], itr);
+			if (!heap_arena.heaps[index].begin())
+				heap_arena.heap_availability_mask &= ~(1u << index);
+		}
+		else if (new_index != index)
+		{
+			auto &new_heap = heap_arena.heaps[new_index];
+			new_heap.move_to_front(heap_arena.heaps[index], itr);
+			heap_arena.heap_availability_mask |= 1u << new_index;
+			if (!heap_arena.heaps[index].begin())
+				heap_arena.heap_availability_mask &= ~(1u << index);
+		}
+	}
 };
 
 struct SliceSubAllocator;
@@ -316,6 +357,81 @@ struct SliceSubAllocator : Util::ArenaAllocator<SliceSubAllocator, AllocatedSlic
 	                        const Util::SuballocationResult &suballoc);
 };
 
+struct SliceAllocatorStatistics
+{
+	// All counts are in elements.
+	uint64_t total_count = 0;
+	uint64_t used_count = 0;
+	// Largest slice which can be allocated without a new backing heap.
+	uint32_t largest_free_block = 0;
+	uint32_t num_backing_heaps = 0;
+	// Heaps on all levels of the hierarchy, including backing heaps.
+	uint32_t num_heaps = 0;
+
+	inline float get_occupancy() const
+	{
+		if (total_count == 0)
+			return 0.0f;
+		return float(double(used_count) / double(total_count));
+	}
+
+	// Backing heaps which could be released if all used elements were packed tightly.
+	inline uint32_t get_reclaimable_backing_heaps() const
+	{
+		if (num_backing_heaps == 0)
+			return 0;
+		uint64_t heap_count = total_count / num_backing_heaps;
+		uint64_t needed = (used_count + heap_count - 1) / heap_count;
+		return num_backing_heaps - uint32_t(needed);
+	}
+
+	// Fraction of backing heaps which only exist because free space is scattered across them.
+	// 0 when used elements fit in no fewer heaps than are allocated.
+	inline float get_fragmentation() const
+	{
+		if (num_backing_heaps == 0)
+			return 0.0f;
+		return float(get_reclaimable_backing_heaps()) / float(num_backing_heaps);
+	}
+};
+
+struct SliceMove
+{
+	// Owned by the caller. Rewritten to dst when the move is applied.
+	AllocatedSlice *slice = nullptr;
+	AllocatedSlice src;
+	AllocatedSlice dst;
+};
+
+// A heap which moves to a new range in its parent heap as a whole.
+// Slices inside keep their heap and mask, only offsets change.
+struct SliceHeapMove
+{
+	Util::IntrusiveList<Util::LegionHeap<AllocatedSlice>>::Iterator heap;
+	AllocatedSlice dst;
+	// Set for the root of a moved subtree, which needs a new range in the parent.
+	// Heaps further down only have their offsets patched.
+	bool reallocate = false;
+};
+
+struct SliceDefragmentationPlan
+{
+	// Moves of pass i are [pass_offsets[i], pass_offsets[i + 1]), likewise for heap moves.
+	// Copies within a pass never overlap, but a pass may copy into space vacated by an earlier pass.
+	std::vector<SliceMove> moves;
+	std::vector<size_t> pass_offsets;
+	std::vector<SliceHeapMove> heap_moves;
+	std::vector<size_t> heap_pass_offsets;
+	uint64_t moved_count = 0;
+	uint32_t released_heaps = 0;
+	uint32_t released_backing_heaps = 0;
+
+	inline size_t get_num_passes() const
+	{
+		return pass_offsets.empty() ? 0 : pass_offsets.size() - 1;
+	}
+};
+
 class SliceAllocator
 {
 public:
@@ -323,6 +439,38 @@ public:
 	void free(const Util::AllocatedSlice &slice);
 	void prime(const void *opaque_meta);
 
+	SliceAllocatorStatistics get_statistics() const;
+
+	// Computes which slices to move so that sparse heaps drain and are released.
+	// Pass i drains heaps of hierarchy level i, either by moving slices into other heaps of the level,
+	// or by moving a whole child heap to another parent heap.
+	// Only slices passed in are considered movable, and a heap is only evacuated if everything
+	// in it can move, so no copy is wasted on a heap which stays alive.
+	// Heaps are skipped once draining them would move more than max_moved_count elements in total.
+	// This does not modify the allocator. The plan is invalidated by any allocate() or free().
+	void plan_defragmentation(AllocatedSlice * const *live_slices, size_t count,
+	                          SliceDefragmentationPlan &plan, uint64_t max_moved_count = UINT64_MAX) const;
+
+	// For each pass: allocates the destinations, calls copy_pass(const SliceMove *moves, size_t count)
+	// which must copy src.count elements from src to dst for every move,
+	// then frees the sources and patches the slices.
+	// A copy pass must complete (or be ordered with a barrier) before copies of the next pass.
+	template <typename Func>
+	void apply_defragmentation(const SliceDefragmentationPlan &plan, const Func &copy_pass)
+	{
+		for (size_t pass = 0; pass < plan.get_num_passes(); pass++)
+		{
+			size_t begin = plan.pass_offsets[pass];
+			size_t end = plan.pass_offsets[pass + 1];
+			if (begin == end)
+				continue;
+
+			begin_defragmentation_pass(plan, pass);
+			copy_pass(plan.moves.data() + begin, end - begin);
+			end_defragmentation_pass(plan, pass);
+		}
+	}
+
 protected:
 	SliceAllocator() = default;
 	void init(uint32_t sub_block_size, uint32_t num_sub_blocks_in_arena_log2, SliceBackingAllocator *alloc);
@@ -332,5 +480,8 @@ private:
 	SliceBackingAllocator *global_allocator = nullptr;
 	enum { SliceAllocatorCount = 5 };
 	Util::SliceSubAllocator allocators[SliceAllocatorCount];
+
+	void begin_defragmentation_pass(const SliceDefragmentationPlan &plan, size_t pass);
+	void end_defragmentation_pass(const SliceDefragmentationPlan &plan, size_t pass);
 };
 }
\ No newline at end of file
@@ -0,0 +1,994 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "async_logger.hpp"
+#include "message_queue.hpp"
+#include "thread_name.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef ANDROID
+#include <android/log.h>
+#endif
+
+namespace Util
+{
+// Longest formatted message, or captured argument blob for binary records.
+static constexpr size_t MaxMessageSize = 8 * 1024;
+
+struct AsyncLogger::ThreadBuffer
+{
+	LockFreeRingBuffer<char> ring;
+	std::atomic_uint64_t dropped;
+	std::atomic_bool in_use;
+};
+
+enum class RecordType : uint32_t
+{
+	Text,
+	Binary
+};
+
+struct RecordHeader
+{
+	uint32_t size;
+	RecordType type;
+	const char *tag;
+	const char *fmt;
+};
+
+static std::atomic_uint64_t next_logger_id;
+static std::atomic<AsyncLogger *> exit_handler_logger;
+
+namespace
+{
+struct ThreadState
+{
+	uint64_t logger_id = 0;
+	std::shared_ptr<AsyncLogger::ThreadBuffer> buffer;
+
+	void release()
+	{
+		// Whatever is still in the ring gets drained, but another thread is now free to take it over.
+		if (buffer)
+			buffer->in_use.store(false, std::memory_order_release);
+		buffer.reset();
+		logger_id = 0;
+	}
+
+	~ThreadState()
+	{
+		release();
+	}
+};
+
+enum class ArgClass
+{
+	None,
+	Signed,
+	Unsigned,
+	Char,
+	Float,
+	String,
+	Pointer
+};
+
+enum class LengthModifier
+{
+	None,
+	HH,
+	H,
+	L,
+	LL,
+	J,
+	Z,
+	T
+};
+
+struct FormatSpec
+{
+	const char *flags;
+	unsigned flags_len;
+	int width;
+	int precision;
+	bool width_star;
+	bool precision_star;
+	LengthModifier length;
+	ArgClass arg_class;
+	char conversion;
+	const char *end;
+};
+
+class BlobWriter
+{
+public:
+	BlobWriter(char *data_, size_t size_)
+		: data(data_), size(size_)
+	{
+	}
+
+	template <typename T>
+	void write(T value)
+	{
+		write_bytes(&value, sizeof(value));
+	}
+
+	void write_bytes(const void *ptr, size_t len)
+	{
+		if (len > size - offset)
+		{
+			overflow = true;
+			return;
+		}
+		memcpy(data + offset, ptr, len);
+		offset += len;
+	}
+
+	size_t get_size() const
+	{
+		return offset;
+	}
+
+	bool has_overflow() const
+	{
+		return overflow;
+	}
+
+private:
+	char *data;
+	size_t size;
+	size_t offset = 0;
+	bool overflow = false;
+};
+
+class BlobReader
+{
+public:
+	BlobReader(const char *data_, size_t size_)
+		: data(data_), size(size_)
+	{
+	}
+
+	template <typename T>
+	T read()
+	{
+		T value = {};
+		if (sizeof(T) <= size - offset)
+		{
+			memcpy(&value, data + offset, sizeof(T));
+			offset += sizeof(T);
+		}
+		return value;
+	}
+
+	const char *read_bytes(size_t len)
+	{
+		len = std::min(len, size - offset);
+		const char *ptr = data + offset;
+		offset += len;
+		return ptr;
+	}
+
+private:
+	const char *data;
+	size_t size;
+	size_t offset = 0;
+};
+}
+
+static thread_local ThreadState thread_state;
+
+static bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// fmt points to the '%'. Returns false for anything we cannot capture and replay, e.g. %n or long double.
+static bool parse_format_spec(const char *fmt, FormatSpec &spec)
+{
+	spec = {};
+	spec.width = -1;
+	spec.precision = -1;
+
+	const char *p = fmt + 1;
+	spec.flags = p;
+	while (*p != '\0' && strchr("-+ #0", *p))
+		p++;
+	spec.flags_len = unsigned(p - spec.flags);
+	if (spec.flags_len > 8)
+		return false;
+
+	if (*p == '*')
+	{
+		spec.width_star = true;
+		p++;
+	}
+	else if (is_digit(*p))
+	{
+		spec.width = 0;
+		while (is_digit(*p))
+			spec.width = spec.width * 10 + (*p++ - '0');
+	}
+
+	if (*p == '.')
+	{
+		p++;
+		if (*p == '*')
+		{
+			spec.precision_star = true;
+			p++;
+		}
+		else
+		{
+			spec.precision = 0;
+			while (is_digit(*p))
+				spec.precision = spec.precision * 10 + (*p++ - '0');
+		}
+	}
+
+	if (p[0] == 'h' && p[1] == 'h')
+	{
+		spec.length = LengthModifier::HH;
+		p += 2;
+	}
+	else if (p[0] == 'l' && p[1] == 'l')
+	{
+		spec.length = LengthModifier::LL;
+		p += 2;
+	}
+	else if (*p == 'h' || *p == 'l' || *p == 'j' || *p == 'z' || *p == 't')
+	{
+		switch (*p)
+		{
+		case 'h': spec.length = LengthModifier::H; break;
+		case 'l': spec.length = LengthModifier::L; break;
+		case 'j': spec.length = LengthModifier::J; break;
+		case 'z': spec.length = LengthModifier::Z; break;
+		default: spec.length = LengthModifier::T; break;
+		}
+		p++;
+	}
+
+	spec.conversion = *p;
+	if (spec.conversion == '\0')
+		return false;
+	spec.end = p + 1;
+
+	switch (spec.conversion)
+	{
+	case 'd':
+	case 'i':
+		spec.arg_class = ArgClass::Signed;
+		return true;
+
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		spec.arg_class = ArgClass::Unsigned;
+		return true;
+
+	case 'c':
+		spec.arg_class = ArgClass::Char;
+		return spec.length == LengthModifier::None;
+
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		spec.arg_class = ArgClass::Float;
+		return spec.length == LengthModifier::None || spec.length == LengthModifier::L;
+
+	case 's':
+		spec.arg_class = ArgClass::String;
+		return spec.length == LengthModifier::None;
+
+	case 'p':
+		spec.arg_class = ArgClass::Pointer;
+		return spec.length == LengthModifier::None;
+
+	case '%':
+		spec.arg_class = ArgClass::None;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Captures the arguments in the order the format string consumes them.
+static bool capture_arguments(BlobWriter &writer, const char *fmt, va_list va)
+{
+	for (const char *p = fmt; *p != '\0'; )
+	{
+		if (*p != '%')
+		{
+			p++;
+			continue;
+		}
+
+		FormatSpec spec;
+		if (!parse_format_spec(p, spec))
+			return false;
+		p = spec.end;
+
+		if (spec.width_star)
+			writer.write<int32_t>(va_arg(va, int));
+
+		int precision = spec.precision;
+		if (spec.precision_star)
+		{
+			precision = va_arg(va, int);
+			writer.write<int32_t>(precision);
+		}
+
+		switch (spec.arg_class)
+		{
+		case ArgClass::Signed:
+		{
+			int64_t value;
+			switch (spec.length)
+			{
+			case LengthModifier::HH: value = static_cast<signed char>(va_arg(va, int)); break;
+			case LengthModifier::H: value = static_cast<short>(va_arg(va, int)); break;
+			case LengthModifier::L: value = va_arg(va, long); break;
+			case LengthModifier::LL: value = va_arg(va, long long); break;
+			case LengthModifier::J: value = va_arg(va, intmax_t); break;
+			case LengthModifier::Z: value = static_cast<int64_t>(va_arg(va, size_t)); break;
+			case LengthModifier::T: value = va_arg(va, ptrdiff_t); break;
+			default: value = va_arg(va, int); break;
+			}
+			writer.write(value);
+			break;
+		}
+
+		case ArgClass::Unsigned:
+		{
+			uint64_t value;
+			switch (spec.length)
+			{
+			case LengthModifier::HH: value = static_cast<unsigned char>(va_arg(va, unsigned)); break;
+			case LengthModifier::H: value = static_cast<unsigned short>(va_arg(va, unsigned)); break;
+			case LengthModifier::L: value = va_arg(va, unsigned long); break;
+			case LengthModifier::LL: value = va_arg(va, unsigned long long); break;
+			case LengthModifier::J: value = va_arg(va, uintmax_t); break;
+			case LengthModifier::Z: value = va_arg(va, size_t); break;
+			case LengthModifier::T: value = static_cast<uint64_t>(va_arg(va, ptrdiff_t)); break;
+			default: value = va_arg(va, unsigned); break;
+			}
+			writer.write(value);
+			break;
+		}
+
+		case ArgClass::Char:
+			writer.write<int32_t>(va_arg(va, int));
+			break;
+
+		case ArgClass::Float:
+			writer.write(va_arg(va, double));
+			break;
+
+		case ArgClass::Pointer:
+			writer.write<uint64_t>(reinterpret_cast<uintptr_t>(va_arg(va, void *)));
+			break;
+
+		case ArgClass::String:
+		{
+			// The string may be gone by the time we format, so it has to be copied.
+			const char *str = va_arg(va, const char *);
+			if (!str)
+				str = "(null)";
+			size_t len = 0;
+			size_t max_len = precision >= 0 ? std::min<size_t>(precision, MaxMessageSize) : MaxMessageSize;
+			while (len < max_len && str[len] != '\0')
+				len++;
+			writer.write<uint32_t>(uint32_t(len));
+			writer.write_bytes(str, len);
+			break;
+		}
+
+		default:
+			break;
+		}
+
+		if (writer.has_overflow())
+			return false;
+	}
+
+	return true;
+}
+
+// Replays a format string against captured arguments, one conversion at a time.
+static size_t format_captured(char *out, size_t capacity, const char *fmt, const char *blob, size_t blob_size)
+{
+	BlobReader reader(blob, blob_size);
+	size_t offset = 0;
+
+	const auto append = [&](const char *str, size_t len) {
+		len = std::min(len, capacity - 1 - offset);
+		memcpy(out + offset, str, len);
+		offset += len;
+	};
+
+	const char *p = fmt;
+	while (*p != '\0' && offset + 1 < capacity)
+	{
+		const char *next = strchr(p, '%');
+		if (!next)
+		{
+			append(p, strlen(p));
+			break;
+		}
+
+		append(p, size_t(next - p));
+
+		FormatSpec spec;
+		if (!parse_format_spec(next, spec))
+			break;
+		p = spec.end;
+
+		int width = spec.width_star ? reader.read<int32_t>() : spec.width;
+		int precision = spec.precision_star ? reader.read<int32_t>() : spec.precision;
+
+		if (spec.arg_class == ArgClass::None)
+		{
+			append("%", 1);
+			continue;
+		}
+
+		// Rebuild the conversion with widths resolved, and integers widened to what was captured.
+		char conv[64];
+		size_t len = 0;
+		conv[len++] = '%';
+		memcpy(conv + len, spec.flags, spec.flags_len);
+		len += spec.flags_len;
+		if (width < 0 && spec.width_star)
+			conv[len++] = '-';
+
+		int written;
+		if (width != -1 || spec.width_star)
+		{
+			written = snprintf(conv + len, sizeof(conv) - len, "%d", width < 0 ? -width : width);
+			len += size_t(std::max(written, 0));
+		}
+
+		const char *string_arg = nullptr;
+		if (spec.arg_class == ArgClass::String)
+		{
+			uint32_t string_len = reader.read<uint32_t>();
+			string_arg = reader.read_bytes(string_len);
+			precision = int(string_len);
+		}
+
+		if (precision >= 0)
+		{
+			written = snprintf(conv + len, sizeof(conv) - len, ".%d", precision);
+			len += size_t(std::max(written, 0));
+		}
+
+		if (spec.arg_class == ArgClass::Signed || spec.arg_class == ArgClass::Unsigned)
+		{
+			conv[len++] = 'l';
+			conv[len++] = 'l';
+		}
+		conv[len++] = spec.conversion;
+		conv[len] = '\0';
+
+		char *dst = out + offset;
+		size_t avail = capacity - offset;
+
+		switch (spec.arg_class)
+		{
+		case ArgClass::Signed:
+			written = snprintf(dst, avail, conv, static_cast<long long>(reader.read<int64_t>()));
+			break;
+		case ArgClass::Unsigned:
+			written = snprintf(dst, avail, conv, static_cast<unsigned long long>(reader.read<uint64_t>()));
+			break;
+		case ArgClass::Char:
+			written = snprintf(dst, avail, conv, int(reader.read<int32_t>()));
+			break;
+		case ArgClass::Float:
+			written = snprintf(dst, avail, conv, reader.read<double>());
+			break;
+		case ArgClass::Pointer:
+			written = snprintf(dst, avail, conv, reinterpret_cast<void *>(uintptr_t(reader.read<uint64_t>())));
+			break;
+		case ArgClass::String:
+			written = snprintf(dst, avail, conv, string_arg);
+			break;
+		default:
+			written = 0;
+			break;
+		}
+
+		offset += std::min<size_t>(size_t(std::max(written, 0)), avail - 1);
+	}
+
+	out[offset] = '\0';
+	return offset;
+}
+
+AsyncLogger::AsyncLogger(const AsyncLoggerOptions &options_)
+	: options(options_)
+{
+	logger_id = next_logger_id.fetch_add(1, std::memory_order_relaxed) + 1;
+
+	if (!options.output)
+		options.output = stderr;
+#ifdef _WIN32
+	output_fd = _fileno(options.output);
+#else
+	output_fd = fileno(options.output);
+#endif
+	options.thread_buffer_size = std::max(options.thread_buffer_size, 4 * (sizeof(RecordHeader) + MaxMessageSize));
+
+	thread_buffer_count.store(0, std::memory_order_relaxed);
+	total_dropped.store(0, std::memory_order_relaxed);
+	total_suppressed.store(0, std::memory_order_relaxed);
+	drain_lock.clear(std::memory_order_relaxed);
+
+	call_sites.reset(new CallSite[RateLimitTableSize]);
+	for (unsigned i = 0; i < RateLimitTableSize; i++)
+	{
+		call_sites[i].fmt.store(nullptr, std::memory_order_relaxed);
+		call_sites[i].window_start.store(0, std::memory_order_relaxed);
+		call_sites[i].count.store(0, std::memory_order_relaxed);
+		call_sites[i].suppressed.store(0, std::memory_order_relaxed);
+	}
+
+	record_buffer.reset(new char[MaxMessageSize]);
+	// Leave room for a terminator, which OutputDebugStringA and Android need.
+	output_buffer.reset(new char[OutputBufferSize + 1]);
+
+	worker = std::thread(&AsyncLogger::drain_loop, this);
+}
+
+AsyncLogger::~AsyncLogger()
+{
+	AsyncLogger *expected = this;
+	exit_handler_logger.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+
+	{
+		std::lock_guard<std::mutex> holder{drain_mutex};
+		dead = true;
+		drain_cond.notify_one();
+	}
+	worker.join();
+
+	// Pick up anything logged after the worker's last pass.
+	drain_all();
+}
+
+AsyncLogger::ThreadBuffer *AsyncLogger::get_thread_buffer()
+{
+	if (thread_state.logger_id == logger_id)
+		return thread_state.buffer.get();
+
+	// First message from this thread, so taking a lock is fine.
+	thread_state.release();
+	std::lock_guard<std::mutex> holder{register_lock};
+	unsigned count = thread_buffer_count.load(std::memory_order_relaxed);
+
+	// Take over rings from threads which have exited, so short-lived threads don't use up all slots.
+	std::shared_ptr<ThreadBuffer> buffer;
+	for (unsigned i = 0; i < count && !buffer; i++)
+	{
+		bool expected = false;
+		if (thread_buffers[i]->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+			buffer = thread_buffers[i];
+	}
+
+	if (!buffer)
+	{
+		if (count == MaxThreadBuffers)
+			return nullptr;
+
+		buffer = std::make_shared<ThreadBuffer>();
+		buffer->ring.reset(options.thread_buffer_size);
+		buffer->dropped.store(0, std::memory_order_relaxed);
+		buffer->in_use.store(true, std::memory_order_relaxed);
+		thread_buffers[count] = buffer;
+		thread_buffer_count.store(count + 1, std::memory_order_release);
+	}
+
+	thread_state.logger_id = logger_id;
+	thread_state.buffer = std::move(buffer);
+	return thread_state.buffer.get();
+}
+
+bool AsyncLogger::push_record(ThreadBuffer &buffer, const void *data, size_t size)
+{
+	// Never wait for the drain thread. If it has fallen this far behind, drop the message and say so later.
+	if (!buffer.ring.write_and_move(static_cast<char *>(const_cast<void *>(data)), size))
+	{
+		buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+		total_dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	return true;
+}
+
+bool AsyncLogger::push_text(ThreadBuffer &buffer, const char *tag, const char *fmt, va_list va)
+{
+	char record[sizeof(RecordHeader) + MaxMessageSize];
+	int len = vsnprintf(record + sizeof(RecordHeader), MaxMessageSize, fmt, va);
+	if (len < 0)
+		return false;
+
+	RecordHeader header = {};
+	header.size = uint32_t(std::min<size_t>(size_t(len), MaxMessageSize - 1));
+	header.type = RecordType::Text;
+	header.tag = tag;
+	memcpy(record, &header, sizeof(header));
+	return push_record(buffer, record, sizeof(header) + header.size);
+}
+
+bool AsyncLogger::push_binary(ThreadBuffer &buffer, const char *tag, const char *fmt, va_list va)
+{
+	char record[sizeof(RecordHeader) + MaxMessageSize];
+	BlobWriter writer(record + sizeof(RecordHeader), MaxMessageSize);
+
+	va_list va_capture;
+	va_copy(va_capture, va);
+	bool captured = capture_arguments(writer, fmt, va_capture);
+	va_end(va_capture);
+	if (!captured)
+		return false;
+
+	RecordHeader header = {};
+	header.size = uint32_t(writer.get_size());
+	header.type = RecordType::Binary;
+	header.tag = tag;
+	header.fmt = fmt;
+	memcpy(record, &header, sizeof(header));
+
+	// A full ring still counts as handled, the message is dropped either way.
+	push_record(buffer, record, sizeof(header) + header.size);
+	return true;
+}
+
+bool AsyncLogger::check_rate_limit(ThreadBuffer &buffer, const char *fmt)
+{
+	if (!options.rate_limit_messages)
+		return true;
+
+	// String literals are unique per call site, so the format pointer identifies it.
+	uint64_t hash = uint64_t(reinterpret_cast<uintptr_t>(fmt)) * 0x9e3779b97f4a7c15ull;
+	unsigned index = unsigned(hash >> 54) & (RateLimitTableSize - 1);
+
+	CallSite *site = nullptr;
+	for (unsigned i = 0; i < 16 && !site; i++)
+	{
+		auto &candidate = call_sites[(index + i) & (RateLimitTableSize - 1)];
+		const char *current = candidate.fmt.load(std::memory_order_acquire);
+		if (current == fmt ||
+		    (!current && (candidate.fmt.compare_exchange_strong(current, fmt, std::memory_order_acq_rel) || current == fmt)))
+		{
+			site = &candidate;
+		}
+	}
+
+	// Too many call sites hashed here, so this one is not limited.
+	if (!site)
+		return true;
+
+	uint64_t now = get_current_time_nsecs();
+	uint64_t window = uint64_t(options.rate_limit_window_ms) * 1000000ull;
+	uint64_t start = site->window_start.load(std::memory_order_relaxed);
+	if (now - start >= window && site->window_start.compare_exchange_strong(start, now, std::memory_order_relaxed))
+	{
+		site->count.store(0, std::memory_order_relaxed);
+		unsigned suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+		if (suppressed)
+		{
+			size_t fmt_len = strlen(fmt);
+			while (fmt_len && fmt[fmt_len - 1] == '\n')
+				fmt_len--;
+
+			char record[sizeof(RecordHeader) + 512];
+			int len = snprintf(record + sizeof(RecordHeader), 512, "Suppressed %u messages logged with \"%.*s\".\n",
+			                   suppressed, int(std::min<size_t>(fmt_len, 256)), fmt);
+
+			RecordHeader header = {};
+			header.size = uint32_t(std::min(std::max(len, 0), 511));
+			header.type = RecordType::Text;
+			header.tag = "[WARN]: ";
+			memcpy(record, &header, sizeof(header));
+			push_record(buffer, record, sizeof(header) + header.size);
+		}
+	}
+
+	if (site->count.fetch_add(1, std::memory_order_relaxed) < options.rate_limit_messages)
+		return true;
+
+	site->suppressed.fetch_add(1, std::memory_order_relaxed);
+	total_suppressed.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+bool AsyncLogger::log(const char *tag, const char *fmt, va_list va)
+{
+	auto *buffer = get_thread_buffer();
+	if (!buffer)
+		return false;
+
+	if (!check_rate_limit(*buffer, fmt))
+		return true;
+
+	if (options.mode == AsyncLoggerOptions::Mode::Binary && push_binary(*buffer, tag, fmt, va))
+		return true;
+
+	push_text(*buffer, tag, fmt, va);
+	return true;
+}
+
+void AsyncLogger::flush()
+{
+	std::unique_lock<std::mutex> holder{drain_mutex};
+	uint64_t ticket = ++flush_requested;
+	drain_cond.notify_one();
+	flush_done_cond.wait(holder, [&]() { return flush_completed >= ticket; });
+}
+
+void AsyncLogger::drain_loop()
+{
+	set_current_thread_name("async-logger");
+
+	std::unique_lock<std::mutex> holder{drain_mutex};
+	while (!dead)
+	{
+		drain_cond.wait_for(holder, std::chrono::milliseconds(options.drain_interval_ms), [this]() {
+			return dead || flush_requested != flush_completed;
+		});
+
+		uint64_t target = flush_requested;
+		holder.unlock();
+		drain_all();
+		holder.lock();
+
+		flush_completed = target;
+		flush_done_cond.notify_all();
+	}
+}
+
+void AsyncLogger::drain_record(const char *tag, const char *fmt, bool binary, const char *payload, size_t size)
+{
+	size_t tag_len = strlen(tag);
+	if (OutputBufferSize - output_size < tag_len + MaxMessageSize)
+		emit_output();
+
+	size_t record_start = output_size;
+	memcpy(output_buffer.get() + output_size, tag, tag_len);
+	output_size += tag_len;
+
+	if (binary)
+	{
+		output_size += format_captured(output_buffer.get() + output_size, MaxMessageSize, fmt, payload, size);
+	}
+	else
+	{
+		memcpy(output_buffer.get() + output_size, payload, size);
+		output_size += size;
+	}
+
+#ifdef ANDROID
+	// logcat wants one message at a time, with the priority as a separate field.
+	int prio = ANDROID_LOG_INFO;
+	if (strncmp(tag, "[ERROR]", 7) == 0)
+		prio = ANDROID_LOG_ERROR;
+	else if (strncmp(tag, "[WARN]", 6) == 0)
+		prio = ANDROID_LOG_WARN;
+	output_buffer[output_size] = '\0';
+	__android_log_write(prio, "Granite", output_buffer.get() + record_start + tag_len);
+	output_size = record_start;
+#else
+	(void)record_start;
+#endif
+}
+
+void AsyncLogger::emit_output()
+{
+	if (!output_size)
+		return;
+
+#ifdef _WIN32
+	if (IsDebuggerPresent())
+	{
+		output_buffer[output_size] = '\0';
+		OutputDebugStringA(output_buffer.get());
+	}
+#endif
+
+	fwrite(output_buffer.get(), 1, output_size, options.output);
+	fflush(options.output);
+	output_size = 0;
+}
+
+void AsyncLogger::drain_all()
+{
+	while (drain_lock.test_and_set(std::memory_order_acquire))
+		std::this_thread::yield();
+
+	unsigned count = thread_buffer_count.load(std::memory_order_acquire);
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto &buffer = *thread_buffers[i];
+		uint64_t dropped = buffer.dropped.exchange(0, std::memory_order_relaxed);
+
+		// Records are pushed in one go, so a visible header means the payload is there as well.
+		char header_data[sizeof(RecordHeader)];
+		while (buffer.ring.read_and_move(header_data, sizeof(header_data)))
+		{
+			RecordHeader header;
+			memcpy(&header, header_data, sizeof(header));
+			buffer.ring.read_and_move(record_buffer.get(), header.size);
+			drain_record(header.tag, header.fmt, header.type == RecordType::Binary, record_buffer.get(), header.size);
+		}
+
+		if (dropped)
+		{
+			char note[128];
+			int len = snprintf(note, sizeof(note), "Dropped %llu messages, thread log buffer was full.\n",
+			                   static_cast<unsigned long long>(dropped));
+			drain_record("[WARN]: ", nullptr, false, note, size_t(std::min(std::max(len, 0), int(sizeof(note)) - 1)));
+		}
+	}
+
+	emit_output();
+	drain_lock.clear(std::memory_order_release);
+}
+
+static void write_crash_output(int fd, const char *data, size_t size)
+{
+	while (size)
+	{
+#ifdef _WIN32
+		int written = _write(fd, data, unsigned(size));
+#else
+		ssize_t written = write(fd, data, size);
+#endif
+		if (written <= 0)
+			return;
+		data += written;
+		size -= size_t(written);
+	}
+}
+
+// Runs in a signal handler, so no stdio, no formatting and no waiting.
+// Holding drain_lock keeps every other consumer out of the rings. If we cannot take it, someone is
+// in the middle of draining, possibly the crashing thread itself, and the rings are left alone.
+// The lock is held until the previous handler returns, which it normally never does.
+bool AsyncLogger::drain_on_crash()
+{
+	if (drain_lock.test_and_set(std::memory_order_acquire))
+		return false;
+
+	unsigned count = thread_buffer_count.load(std::memory_order_acquire);
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto &buffer = *thread_buffers[i];
+		char header_data[sizeof(RecordHeader)];
+		while (buffer.ring.read_and_move(header_data, sizeof(header_data)))
+		{
+			RecordHeader header;
+			memcpy(&header, header_data, sizeof(header));
+			buffer.ring.read_and_move(record_buffer.get(), header.size);
+
+			// Binary records would need printf to format, so only their format string is written.
+			write_crash_output(output_fd, header.tag, strlen(header.tag));
+			if (header.type == RecordType::Binary)
+				write_crash_output(output_fd, header.fmt, strlen(header.fmt));
+			else
+				write_crash_output(output_fd, record_buffer.get(), header.size);
+		}
+	}
+
+	return true;
+}
+
+static const int crash_signals[] = { SIGSEGV, SIGILL, SIGFPE, SIGABRT,
+#ifndef _WIN32
+                                     SIGBUS,
+#endif
+};
+
+#ifdef _WIN32
+using SignalHandler = void (*)(int);
+static SignalHandler previous_crash_handlers[sizeof(crash_signals) / sizeof(crash_signals[0])];
+#else
+static struct sigaction previous_crash_handlers[sizeof(crash_signals) / sizeof(crash_signals[0])];
+#endif
+
+// If the logger is destroyed on another thread between the load and flush(), this is a use after free.
+// install_exit_handlers() documents that the owner must not let that happen.
+void AsyncLogger::flush_on_exit()
+{
+	auto *logger = exit_handler_logger.load(std::memory_order_acquire);
+	if (logger)
+		logger->flush();
+}
+
+void AsyncLogger::crash_signal_handler(int sig)
+{
+	auto *logger = exit_handler_logger.exchange(nullptr, std::memory_order_acq_rel);
+	bool drained = logger && logger->drain_on_crash();
+
+	// Hand over to whoever was installed before us. The signal is blocked while we're in here,
+	// so the re-raise is delivered to the previous handler once we return.
+	for (size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++)
+	{
+		if (crash_signals[i] == sig)
+		{
+#ifdef _WIN32
+			signal(sig, previous_crash_handlers[i]);
+#else
+			sigaction(sig, &previous_crash_handlers[i], nullptr);
+#endif
+		}
+	}
+
+	raise(sig);
+
+	if (drained)
+		logger->drain_lock.clear(std::memory_order_release);
+}
+
+void AsyncLogger::install_exit_handlers()
+{
+	exit_handler_logger.store(this, std::memory_order_release);
+
+	static std::once_flag installed;
+	std::call_once(installed, []() {
+		atexit(flush_on_exit);
+
+		for (size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++)
+		{
+#ifdef _WIN32
+			previous_crash_handlers[i] = signal(crash_signals[i], crash_signal_handler);
+#else
+			struct sigaction action = {};
+			action.sa_handler = crash_signal_handler;
+			sigemptyset(&action.sa_mask);
+			sigaction(crash_signals[i], &action, &previous_crash_handlers[i]);
+#endif
+		}
+	});
+}
+}
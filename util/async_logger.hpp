@@ -0,0 +1,157 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "logging.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+
+namespace Util
+{
+struct AsyncLoggerOptions
+{
+	enum class Mode
+	{
+		// Messages are formatted on the logging thread, and only the copy to stderr is deferred.
+		Text,
+		// Arguments are captured raw and formatted on the drain thread.
+		// Format strings which use conversions that cannot be captured fall back to Text.
+		Binary
+	};
+
+	Mode mode = Mode::Text;
+
+	// Each thread which logs gets a ring of this size. Messages which do not fit are dropped and counted.
+	size_t thread_buffer_size = 256 * 1024;
+
+	// Per call site, allow at most rate_limit_messages in any rate_limit_window_ms window. 0 disables.
+	unsigned rate_limit_messages = 0;
+	unsigned rate_limit_window_ms = 1000;
+
+	// How often the drain thread wakes up on its own.
+	unsigned drain_interval_ms = 5;
+
+	// Defaults to stderr.
+	FILE *output = nullptr;
+};
+
+// A LoggingInterface which never blocks the logging thread.
+// Every thread logs into a ring buffer of its own, and a background thread drains them all.
+// Messages from one thread keep their order, but messages from different threads may be interleaved differently
+// than they were logged.
+// Format strings and tags must outlive the logger, which holds for the LOGx macros.
+class AsyncLogger final : public LoggingInterface
+{
+public:
+	explicit AsyncLogger(const AsyncLoggerOptions &options = {});
+	~AsyncLogger();
+
+	AsyncLogger(const AsyncLogger &) = delete;
+	void operator=(const AsyncLogger &) = delete;
+
+	bool log(const char *tag, const char *fmt, va_list va) override;
+
+	// Blocks until everything logged before the call has been written out.
+	void flush();
+
+	// Flushes on exit() and on fatal signals, then lets the previous handlers run.
+	// The handlers are process-wide, so the last logger to call this is the one which gets flushed.
+	// On a fatal signal only text records are written out, with write(2) and nothing else,
+	// and only if no other thread is draining at that moment.
+	// The handlers reach the logger through a global pointer which the destructor clears,
+	// so the logger must not be destroyed while another thread calls exit() or crashes.
+	void install_exit_handlers();
+
+	uint64_t get_dropped_count() const
+	{
+		return total_dropped.load(std::memory_order_relaxed);
+	}
+
+	uint64_t get_suppressed_count() const
+	{
+		return total_suppressed.load(std::memory_order_relaxed);
+	}
+
+	struct ThreadBuffer;
+
+private:
+	AsyncLoggerOptions options;
+	uint64_t logger_id;
+
+	enum { MaxThreadBuffers = 256, RateLimitTableSize = 1024, OutputBufferSize = 64 * 1024 };
+
+	// Slots are only appended to, so the drain thread can walk them without taking the lock.
+	std::shared_ptr<ThreadBuffer> thread_buffers[MaxThreadBuffers];
+	std::atomic_uint thread_buffer_count;
+	std::mutex register_lock;
+
+	struct CallSite
+	{
+		std::atomic<const char *> fmt;
+		std::atomic_uint64_t window_start;
+		std::atomic_uint count;
+		std::atomic_uint suppressed;
+	};
+	std::unique_ptr<CallSite[]> call_sites;
+
+	std::atomic_uint64_t total_dropped;
+	std::atomic_uint64_t total_suppressed;
+
+	std::thread worker;
+	std::mutex drain_mutex;
+	std::condition_variable drain_cond;
+	std::condition_variable flush_done_cond;
+	uint64_t flush_requested = 0;
+	uint64_t flush_completed = 0;
+	bool dead = false;
+
+	// Held by whoever is draining right now, which is either the worker, flush() or a crash.
+	// It is the only consumer of the thread rings, so a crash which cannot take it leaves them alone.
+	std::atomic_flag drain_lock;
+	int output_fd = -1;
+
+	// Only touched while holding drain_lock, so draining never allocates.
+	std::unique_ptr<char[]> record_buffer;
+	std::unique_ptr<char[]> output_buffer;
+	size_t output_size = 0;
+
+	ThreadBuffer *get_thread_buffer();
+	bool check_rate_limit(ThreadBuffer &buffer, const char *fmt);
+	bool push_text(ThreadBuffer &buffer, const char *tag, const char *fmt, va_list va);
+	bool push_binary(ThreadBuffer &buffer, const char *tag, const char *fmt, va_list va);
+	bool push_record(ThreadBuffer &buffer, const void *data, size_t size);
+
+	void drain_loop();
+	void drain_all();
+	bool drain_on_crash();
+	void drain_record(const char *tag, const char *fmt, bool binary, const char *payload, size_t size);
+	void emit_output();
+
+	static void flush_on_exit();
+	static void crash_signal_handler(int sig);
+};
+}
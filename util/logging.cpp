@@ -21,6 +21,7 @@
  */
 
 #include "logging.hpp"
+#include <atomic>
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -30,16 +31,31 @@
 namespace Util
 {
 static thread_local LoggingInterface *logging_iface;
+static std::atomic<LoggingInterface *> global_logging_iface;
 
 bool interface_log(const char *tag, const char *fmt, ...)
 {
-	if (!logging_iface)
-		return false;
+	bool ret = false;
+	if (logging_iface)
+	{
+		va_list va;
+		va_start(va, fmt);
+		ret = logging_iface->log(tag, fmt, va);
+		va_end(va);
+	}
+
+	if (!ret)
+	{
+		auto *global_iface = global_logging_iface.load(std::memory_order_acquire);
+		if (global_iface)
+		{
+			va_list va;
+			va_start(va, fmt);
+			ret = global_iface->log(tag, fmt, va);
+			va_end(va);
+		}
+	}
 
-	va_list va;
-	va_start(va, fmt);
-	bool ret = logging_iface->log(tag, fmt, va);
-	va_end(va);
 	return ret;
 }
 
@@ -48,6 +64,11 @@ void set_thread_logging_interface(LoggingInterface *iface)
 	logging_iface = iface;
 }
 
+void set_global_logging_interface(LoggingInterface *iface)
+{
+	global_logging_iface.store(iface, std::memory_order_release);
+}
+
 #ifdef _WIN32
 void debug_output_log(const char *tag, const char *fmt, ...)
 {
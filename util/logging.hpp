@@ -37,6 +37,9 @@ public:
 
 bool interface_log(const char *tag, const char *fmt, ...);
 void set_thread_logging_interface(LoggingInterface *iface);
+
+// Used by any thread whose own interface is unset or declines the message.
+void set_global_logging_interface(LoggingInterface *iface);
 }
 
 #if defined(_WIN32)
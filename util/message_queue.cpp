@@ -100,6 +100,107 @@ MessageQueuePayload LockFreeMessageQueue::allocate_write_payload(size_t size) no
 	return payload;
 }
 
+LockFreeMPMCMessageQueue::LockFreeMPMCMessageQueue()
+{
+	// Same size classes and ring depths as LockFreeMessageQueue.
+	for (unsigned i = 0; i < NumPayloadClasses; i++)
+		payload_capacity[i] = 256u << i;
+	for (unsigned i = 0; i < NumPayloadClasses; i++)
+		write_ring[i].reset((16u * 1024u) >> i);
+	read_ring.reset(32 * 1024);
+
+	for (unsigned i = 0; i < NumPayloadClasses; i++)
+	{
+		unsigned count = 512u >> i;
+		for (unsigned j = 0; j < count; j++)
+		{
+			MessageQueuePayload payload;
+			payload.set_payload_data(memalign_calloc(64, payload_capacity[i]), payload_capacity[i]);
+			recycle_payload(std::move(payload));
+		}
+	}
+}
+
+int LockFreeMPMCMessageQueue::get_payload_class(size_t capacity) const noexcept
+{
+	for (int i = 0; i < NumPayloadClasses; i++)
+		if (capacity == payload_capacity[i])
+			return i;
+	return -1;
+}
+
+size_t LockFreeMPMCMessageQueue::available_read_messages() const noexcept
+{
+	return read_ring.read_avail();
+}
+
+MessageQueuePayload LockFreeMPMCMessageQueue::read_message() noexcept
+{
+	MessageQueuePayload payload;
+	read_ring.read_and_move(payload);
+	return payload;
+}
+
+size_t LockFreeMPMCMessageQueue::read_messages(MessageQueuePayload *payloads, size_t count) noexcept
+{
+	return read_ring.read_and_move(payloads, count);
+}
+
+bool LockFreeMPMCMessageQueue::push_written_payload(MessageQueuePayload payload) noexcept
+{
+	return read_ring.write_and_move(std::move(payload));
+}
+
+size_t LockFreeMPMCMessageQueue::push_written_payloads(MessageQueuePayload *payloads, size_t count) noexcept
+{
+	return read_ring.write_and_move(payloads, count);
+}
+
+void LockFreeMPMCMessageQueue::recycle_payload(MessageQueuePayload payload) noexcept
+{
+	// Odd-sized payloads and payloads which don't fit in a full pool are just freed.
+	int payload_class = get_payload_class(payload.get_capacity());
+	if (payload_class >= 0)
+		write_ring[payload_class].write_and_move(std::move(payload));
+}
+
+void LockFreeMPMCMessageQueue::recycle_payloads(MessageQueuePayload *payloads, size_t count) noexcept
+{
+	// Push runs of the same size class together, which is the common case when draining a queue.
+	size_t i = 0;
+	while (i < count)
+	{
+		int payload_class = get_payload_class(payloads[i].get_capacity());
+		size_t run = 1;
+		while (i + run < count && get_payload_class(payloads[i + run].get_capacity()) == payload_class)
+			run++;
+
+		if (payload_class >= 0)
+			write_ring[payload_class].write_and_move(payloads + i, run);
+		for (size_t j = i; j < i + run; j++)
+			payloads[j] = {};
+
+		i += run;
+	}
+}
+
+MessageQueuePayload LockFreeMPMCMessageQueue::allocate_write_payload(size_t size) noexcept
+{
+	MessageQueuePayload payload;
+	for (unsigned i = 0; i < NumPayloadClasses; i++)
+	{
+		if (size <= payload_capacity[i])
+		{
+			if (!write_ring[i].read_and_move(payload))
+				payload.set_payload_data(memalign_calloc(64, payload_capacity[i]), payload_capacity[i]);
+			return payload;
+		}
+	}
+
+	payload.set_payload_data(memalign_calloc(64, size), size);
+	return payload;
+}
+
 MessageQueue::MessageQueue()
 {
 	corked.store(true);
@@ -124,32 +225,27 @@ MessageQueuePayload MessageQueue::allocate_write_payload(size_t size) noexcept
 {
 	if (corked.load(std::memory_order_relaxed))
 		return {};
-	std::lock_guard<std::mutex> holder{lock};
-	return LockFreeMessageQueue::allocate_write_payload(size);
+	return LockFreeMPMCMessageQueue::allocate_write_payload(size);
 }
 
 bool MessageQueue::push_written_payload(MessageQueuePayload payload) noexcept
 {
-	std::lock_guard<std::mutex> holder{lock};
-	return LockFreeMessageQueue::push_written_payload(std::move(payload));
+	return LockFreeMPMCMessageQueue::push_written_payload(std::move(payload));
 }
 
 size_t MessageQueue::available_read_messages() const noexcept
 {
-	std::lock_guard<std::mutex> holder{lock};
-	return LockFreeMessageQueue::available_read_messages();
+	return LockFreeMPMCMessageQueue::available_read_messages();
 }
 
 MessageQueuePayload MessageQueue::read_message() noexcept
 {
-	std::lock_guard<std::mutex> holder{lock};
-	return LockFreeMessageQueue::read_message();
+	return LockFreeMPMCMessageQueue::read_message();
 }
 
 void MessageQueue::recycle_payload(MessageQueuePayload payload) noexcept
 {
-	std::lock_guard<std::mutex> holder{lock};
-	return LockFreeMessageQueue::recycle_payload(std::move(payload));
+	LockFreeMPMCMessageQueue::recycle_payload(std::move(payload));
 }
 
 bool MessageQueue::log(const char *tag, const char *fmt, va_list va)
@@ -26,6 +26,7 @@
 #include <vector>
 #include <utility>
 #include <stddef.h>
+#include <stdint.h>
 #include <assert.h>
 #include <memory>
 #include <mutex>
@@ -71,8 +72,8 @@ public:
 
 	bool write_and_move(T *values, size_t count) noexcept
 	{
-		size_t current_written = read_count.load(std::memory_order_relaxed);
-		size_t current_read = write_count.load(std::memory_order_acquire);
+		size_t current_written = write_count.load(std::memory_order_relaxed);
+		size_t current_read = read_count.load(std::memory_order_acquire);
 		if (count > ring.size() - (current_written - current_read))
 			return false;
 
@@ -135,6 +136,158 @@ private:
 	std::vector<T> ring;
 };
 
+// Bounded queue for any number of concurrent readers and writers.
+// Each slot carries a sequence number which tells whether it's ready to be written or read in the current lap,
+// so producers and consumers only contend on their own position counter.
+// Capacity is rounded up to a power of two.
+template <typename T>
+class MPMCRingBuffer
+{
+public:
+	MPMCRingBuffer()
+	{
+		reset(1);
+		assert(enqueue_pos.is_lock_free());
+		assert(dequeue_pos.is_lock_free());
+	}
+
+	// Not thread-safe.
+	void reset(size_t count)
+	{
+		size_t size = 1;
+		while (size < count)
+			size <<= 1;
+
+		cells.reset(new Cell[size]);
+		mask = size - 1;
+		for (size_t i = 0; i < size; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		enqueue_pos.store(0, std::memory_order_relaxed);
+		dequeue_pos.store(0, std::memory_order_relaxed);
+	}
+
+	size_t capacity() const noexcept
+	{
+		return mask + 1;
+	}
+
+	// Only a snapshot when other threads are active.
+	size_t read_avail() const noexcept
+	{
+		size_t read = dequeue_pos.load(std::memory_order_relaxed);
+		size_t written = enqueue_pos.load(std::memory_order_relaxed);
+		return written > read ? written - read : 0;
+	}
+
+	bool write_and_move(T value) noexcept
+	{
+		return write_and_move(&value, 1) == 1;
+	}
+
+	bool read_and_move(T &value) noexcept
+	{
+		return read_and_move(&value, 1) == 1;
+	}
+
+	// Writes up to count values in one go, and returns how many were written.
+	// Values which were written are moved from.
+	size_t write_and_move(T *values, size_t count) noexcept
+	{
+		if (count == 0)
+			return 0;
+
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		size_t claimed;
+		for (;;)
+		{
+			// A free slot cannot become taken without the position moving, so whatever we see free here
+			// stays free until the CAS below either claims it or fails.
+			claimed = 0;
+			while (claimed < count && claimed <= mask &&
+			       cells[(pos + claimed) & mask].sequence.load(std::memory_order_acquire) == pos + claimed)
+			{
+				claimed++;
+			}
+
+			if (claimed == 0)
+			{
+				// Either full, or another writer moved on since we loaded the position.
+				size_t seq = cells[pos & mask].sequence.load(std::memory_order_acquire);
+				if (intptr_t(seq - pos) < 0)
+					return 0;
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+				continue;
+			}
+
+			if (enqueue_pos.compare_exchange_weak(pos, pos + claimed, std::memory_order_relaxed))
+				break;
+		}
+
+		for (size_t i = 0; i < claimed; i++)
+		{
+			auto &cell = cells[(pos + i) & mask];
+			cell.value = std::move(values[i]);
+			cell.sequence.store(pos + i + 1, std::memory_order_release);
+		}
+
+		return claimed;
+	}
+
+	// Reads up to count values in one go, and returns how many were read.
+	size_t read_and_move(T *values, size_t count) noexcept
+	{
+		if (count == 0)
+			return 0;
+
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		size_t claimed;
+		for (;;)
+		{
+			claimed = 0;
+			while (claimed < count && claimed <= mask &&
+			       cells[(pos + claimed) & mask].sequence.load(std::memory_order_acquire) == pos + claimed + 1)
+			{
+				claimed++;
+			}
+
+			if (claimed == 0)
+			{
+				size_t seq = cells[pos & mask].sequence.load(std::memory_order_acquire);
+				if (intptr_t(seq - (pos + 1)) < 0)
+					return 0;
+				pos = dequeue_pos.load(std::memory_order_relaxed);
+				continue;
+			}
+
+			if (dequeue_pos.compare_exchange_weak(pos, pos + claimed, std::memory_order_relaxed))
+				break;
+		}
+
+		for (size_t i = 0; i < claimed; i++)
+		{
+			auto &cell = cells[(pos + i) & mask];
+			values[i] = std::move(cell.value);
+			cell.sequence.store(pos + i + mask + 1, std::memory_order_release);
+		}
+
+		return claimed;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic_size_t sequence;
+		T value;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask = 0;
+
+	// Keep writers and readers off each other's cache lines.
+	alignas(64) std::atomic_size_t enqueue_pos;
+	alignas(64) std::atomic_size_t dequeue_pos;
+};
+
 struct MessageQueuePayloadDeleter
 {
 	void operator()(void *ptr);
@@ -215,7 +368,37 @@ private:
 	size_t payload_capacity[8] = {};
 };
 
-class MessageQueue final : private LockFreeMessageQueue, public MessageQueueInterface
+// Same interface as LockFreeMessageQueue, but any thread can write, read and recycle concurrently.
+// Payloads are recycled through one lock-free pool per size class, so steady-state traffic does not allocate.
+class LockFreeMPMCMessageQueue
+{
+public:
+	LockFreeMPMCMessageQueue();
+
+	MessageQueuePayload allocate_write_payload(size_t size) noexcept;
+	bool push_written_payload(MessageQueuePayload payload) noexcept;
+
+	size_t available_read_messages() const noexcept;
+	MessageQueuePayload read_message() noexcept;
+	void recycle_payload(MessageQueuePayload payload) noexcept;
+
+	// Batched variants, which claim all slots with a single atomic operation where possible.
+	// Return the number of payloads which were pushed or read.
+	// Unlike push_written_payload(), payloads which did not fit are left untouched, so they can be retried.
+	size_t push_written_payloads(MessageQueuePayload *payloads, size_t count) noexcept;
+	size_t read_messages(MessageQueuePayload *payloads, size_t count) noexcept;
+	void recycle_payloads(MessageQueuePayload *payloads, size_t count) noexcept;
+
+private:
+	enum { NumPayloadClasses = 8 };
+	MPMCRingBuffer<MessageQueuePayload> read_ring;
+	MPMCRingBuffer<MessageQueuePayload> write_ring[NumPayloadClasses];
+	size_t payload_capacity[NumPayloadClasses] = {};
+
+	int get_payload_class(size_t capacity) const noexcept;
+};
+
+class MessageQueue final : private LockFreeMPMCMessageQueue, public MessageQueueInterface
 {
 public:
 	MessageQueue();
@@ -232,8 +415,6 @@ public:
 	void recycle_payload(MessageQueuePayload payload) noexcept;
 
 private:
-	mutable std::mutex lock;
-	mutable std::condition_variable cond;
 	std::atomic_bool corked;
 
 	bool log(const char *tag, const char *fmt, va_list va) override;
@@ -25,6 +25,7 @@
 #include <memory>
 #include <mutex>
 #include <vector>
+#include <atomic>
 #include <algorithm>
 #include <stdlib.h>
 #include "aligned_alloc.hpp"
@@ -41,19 +42,8 @@ public:
 	T *allocate(P &&... p)
 	{
 #ifndef OBJECT_POOL_DEBUG
-		if (vacants.empty())
-		{
-			unsigned num_objects = 64u << memory.size();
-			T *ptr = static_cast<T *>(memalign_alloc(std::max<size_t>(64, alignof(T)),
-			                                         num_objects * sizeof(T)));
-			if (!ptr)
-				return nullptr;
-
-			for (unsigned i = 0; i < num_objects; i++)
-				vacants.push_back(&ptr[i]);
-
-			memory.emplace_back(ptr);
-		}
+		if (vacants.empty() && !allocate_block())
+			return nullptr;
 
 		T *ptr = vacants.back();
 		vacants.pop_back();
@@ -86,6 +76,21 @@ protected:
 #ifndef OBJECT_POOL_DEBUG
 	std::vector<T *> vacants;
 
+	bool allocate_block()
+	{
+		unsigned num_objects = 64u << memory.size();
+		T *ptr = static_cast<T *>(memalign_alloc(std::max<size_t>(64, alignof(T)),
+		                                         num_objects * sizeof(T)));
+		if (!ptr)
+			return false;
+
+		for (unsigned i = 0; i < num_objects; i++)
+			vacants.push_back(&ptr[i]);
+
+		memory.emplace_back(ptr);
+		return true;
+	}
+
 	struct MallocDeleter
 	{
 		void operator()(T *ptr)
@@ -129,4 +134,164 @@ public:
 private:
 	std::mutex lock;
 };
+
+// Same interface as ThreadSafeObjectPool, but every thread keeps a magazine of vacant objects.
+// The shared lock is only taken when a magazine runs empty or full, and then half a magazine is moved at once.
+// Objects may be freed on any thread, they simply end up in that thread's magazine.
+// Magazines are returned to the pool when their thread exits.
+// clear() must not race with allocate() or free() on any thread.
+template<typename T, unsigned MagazineSize = 64>
+class ThreadCachedObjectPool
+{
+	static_assert(MagazineSize >= 2, "MagazineSize must be at least 2.");
+
+public:
+	ThreadCachedObjectPool()
+		: shared(new Shared)
+	{
+		shared->id = allocate_pool_id();
+	}
+
+	ThreadCachedObjectPool(const ThreadCachedObjectPool &) = delete;
+	void operator=(const ThreadCachedObjectPool &) = delete;
+
+	template<typename... P>
+	T *allocate(P &&... p)
+	{
+#ifndef OBJECT_POOL_DEBUG
+		auto &magazine = get_magazine();
+		if (magazine.count == 0 && !refill(magazine))
+			return nullptr;
+
+		T *ptr = magazine.objects[--magazine.count];
+		new(ptr) T(std::forward<P>(p)...);
+		return ptr;
+#else
+		return new T(std::forward<P>(p)...);
+#endif
+	}
+
+	void free(T *ptr)
+	{
+#ifndef OBJECT_POOL_DEBUG
+		ptr->~T();
+		auto &magazine = get_magazine();
+		if (magazine.count == MagazineSize)
+			flush(magazine);
+		magazine.objects[magazine.count++] = ptr;
+#else
+		delete ptr;
+#endif
+	}
+
+	void clear()
+	{
+#ifndef OBJECT_POOL_DEBUG
+		std::lock_guard<std::mutex> holder{shared->lock};
+		shared->clear();
+		// Magazines which still point into the old memory are recognized by their stale ID and dropped.
+		shared->id = allocate_pool_id();
+#endif
+	}
+
+private:
+	struct Shared : ObjectPool<T>
+	{
+		std::mutex lock;
+		uint64_t id = 0;
+
+#ifndef OBJECT_POOL_DEBUG
+		using ObjectPool<T>::vacants;
+		using ObjectPool<T>::allocate_block;
+#endif
+	};
+	std::shared_ptr<Shared> shared;
+
+	static uint64_t allocate_pool_id()
+	{
+		static std::atomic<uint64_t> counter;
+		return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+	}
+
+#ifndef OBJECT_POOL_DEBUG
+	struct Magazine
+	{
+		T *objects[MagazineSize];
+		unsigned count = 0;
+	};
+
+	struct ThreadCacheEntry
+	{
+		uint64_t id;
+		std::weak_ptr<Shared> shared;
+		Magazine magazine;
+	};
+
+	struct ThreadCache
+	{
+		std::vector<ThreadCacheEntry> entries;
+
+		~ThreadCache()
+		{
+			for (auto &entry : entries)
+			{
+				auto pool = entry.shared.lock();
+				if (!pool)
+					continue;
+
+				std::lock_guard<std::mutex> holder{pool->lock};
+				if (pool->id == entry.id)
+				{
+					pool->vacants.insert(pool->vacants.end(), entry.magazine.objects,
+					                     entry.magazine.objects + entry.magazine.count);
+				}
+			}
+		}
+	};
+
+	Magazine &get_magazine()
+	{
+		static thread_local ThreadCache cache;
+		auto &entries = cache.entries;
+		uint64_t id = shared->id;
+
+		for (auto &entry : entries)
+			if (entry.id == id)
+				return entry.magazine;
+
+		// First use of this pool on this thread. Drop entries for pools which are gone or have been cleared.
+		entries.erase(std::remove_if(entries.begin(), entries.end(), [](const ThreadCacheEntry &entry) {
+			auto pool = entry.shared.lock();
+			return !pool || pool->id != entry.id;
+		}), entries.end());
+
+		entries.push_back({ id, shared, {} });
+		return entries.back().magazine;
+	}
+
+	bool refill(Magazine &magazine)
+	{
+		std::lock_guard<std::mutex> holder{shared->lock};
+		auto &vacants = shared->vacants;
+		if (vacants.empty() && !shared->allocate_block())
+			return false;
+
+		unsigned count = unsigned(std::min<size_t>(MagazineSize / 2, vacants.size()));
+		std::copy(vacants.end() - count, vacants.end(), magazine.objects);
+		vacants.resize(vacants.size() - count);
+		magazine.count = count;
+		return true;
+	}
+
+	void flush(Magazine &magazine)
+	{
+		// Keep the most recently freed objects, they are the most likely to still be in cache.
+		constexpr unsigned count = MagazineSize / 2;
+		std::lock_guard<std::mutex> holder{shared->lock};
+		shared->vacants.insert(shared->vacants.end(), magazine.objects, magazine.objects + count);
+		std::move(magazine.objects + count, magazine.objects + magazine.count, magazine.objects);
+		magazine.count -= count;
+	}
+#endif
+};
 }
@@ -70,4 +70,65 @@ std::string strip_whitespace(const std::string &str)
 	else
 		return ret;
 }
-}
\ No newline at end of file
+
+uint32_t decode_utf8(const char *&text)
+{
+	auto *str = reinterpret_cast<const uint8_t *>(text);
+	uint32_t c = str[0];
+	if (c == 0)
+		return 0;
+
+	if (c < 0x80)
+	{
+		text++;
+		return c;
+	}
+
+	unsigned count;
+	uint32_t min_value;
+	if ((c & 0xe0) == 0xc0)
+	{
+		count = 1;
+		min_value = 0x80;
+		c &= 0x1f;
+	}
+	else if ((c & 0xf0) == 0xe0)
+	{
+		count = 2;
+		min_value = 0x800;
+		c &= 0x0f;
+	}
+	else if ((c & 0xf8) == 0xf0)
+	{
+		count = 3;
+		min_value = 0x10000;
+		c &= 0x07;
+	}
+	else
+	{
+		text++;
+		return 0xfffd;
+	}
+
+	for (unsigned i = 1; i <= count; i++)
+	{
+		// Also stops at the terminator.
+		if ((str[i] & 0xc0) != 0x80)
+		{
+			text++;
+			return 0xfffd;
+		}
+		c = (c << 6) | (str[i] & 0x3f);
+	}
+
+	// Overlong encodings, surrogates and values past U+10FFFF.
+	if (c < min_value || (c >= 0xd800 && c < 0xe000) || c > 0x10ffff)
+	{
+		text++;
+		return 0xfffd;
+	}
+
+	text += count + 1;
+	return c;
+}
+}
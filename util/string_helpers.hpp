@@ -26,6 +26,7 @@
 #include <sstream>
 #include <vector>
 #include <type_traits>
+#include <stdint.h>
 
 namespace inner
 {
@@ -56,4 +57,8 @@ inline std::string join(Ts &&... ts)
 std::vector<std::string> split(const std::string &str, const char *delim);
 std::vector<std::string> split_no_empty(const std::string &str, const char *delim);
 std::string strip_whitespace(const std::string &str);
+
+// Decodes the code point at text and advances past it.
+// Returns 0 without advancing at the terminator. Malformed sequences decode to U+FFFD one byte at a time.
+uint32_t decode_utf8(const char *&text);
 }
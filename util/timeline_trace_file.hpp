@@ -77,7 +77,7 @@ private:
 	std::mutex lock;
 	std::condition_variable cond;
 
-	ThreadSafeObjectPool<Event> event_pool;
+	ThreadCachedObjectPool<Event> event_pool;
 	std::queue<Event *> queued_events;
 };
 
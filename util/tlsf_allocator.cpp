@@ -0,0 +1,271 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "tlsf_allocator.hpp"
+#include <algorithm>
+
+namespace Util
+{
+static inline void tlsf_mapping(uint32_t units, uint32_t &fl, uint32_t &sl)
+{
+	if (units < TLSFHeap::SecondLevelCount)
+	{
+		fl = 0;
+		sl = units;
+	}
+	else
+	{
+		uint32_t log2 = floor_log2(units);
+		fl = log2 - TLSFHeap::SecondLevelBits + 1;
+		sl = (units >> (log2 - TLSFHeap::SecondLevelBits)) - TLSFHeap::SecondLevelCount;
+	}
+}
+
+TLSFHeap::~TLSFHeap()
+{
+	if (num_allocations)
+		LOGE("Memory leak in TLSF heap detected.\n");
+
+	auto *block = first_block;
+	while (block)
+	{
+		auto *next = block->next_physical;
+		pool->free(block);
+		block = next;
+	}
+}
+
+bool TLSFHeap::init(ObjectPool<TLSFBlock> *pool_, uint32_t size_, uint32_t granularity)
+{
+	assert(!first_block);
+	assert(is_pow2(granularity));
+	assert(size_ && (size_ & (granularity - 1)) == 0);
+
+	pool = pool_;
+	size = size_;
+	granularity_log2 = floor_log2(granularity);
+
+	first_block = pool->allocate();
+	if (!first_block)
+		return false;
+
+	*first_block = {};
+	first_block->size = size;
+	insert_free(first_block);
+	return true;
+}
+
+void TLSFHeap::insert_free(TLSFBlock *block)
+{
+	uint32_t fl, sl;
+	tlsf_mapping(block->size >> granularity_log2, fl, sl);
+
+	auto &head = free_lists[fl][sl];
+	block->is_free = true;
+	block->prev_free = nullptr;
+	block->next_free = head;
+	if (head)
+		head->prev_free = block;
+	head = block;
+
+	first_level_mask |= 1u << fl;
+	second_level_masks[fl] |= 1u << sl;
+	num_free_blocks++;
+}
+
+void TLSFHeap::remove_free(TLSFBlock *block)
+{
+	uint32_t fl, sl;
+	tlsf_mapping(block->size >> granularity_log2, fl, sl);
+
+	if (block->prev_free)
+		block->prev_free->next_free = block->next_free;
+	else
+		free_lists[fl][sl] = block->next_free;
+
+	if (block->next_free)
+		block->next_free->prev_free = block->prev_free;
+
+	if (!free_lists[fl][sl])
+	{
+		second_level_masks[fl] &= ~(1u << sl);
+		if (!second_level_masks[fl])
+			first_level_mask &= ~(1u << fl);
+	}
+
+	block->is_free = false;
+	block->prev_free = nullptr;
+	block->next_free = nullptr;
+	num_free_blocks--;
+}
+
+TLSFBlock *TLSFHeap::find_free_block(uint64_t units) const
+{
+	// Round up to the next bin boundary, so that any block in the bin we land in is large enough.
+	if (units >= SecondLevelCount)
+		units += (uint64_t(1) << (floor_log2(uint32_t(units)) - SecondLevelBits)) - 1;
+	if (units > UINT32_MAX)
+		return nullptr;
+
+	uint32_t fl, sl;
+	tlsf_mapping(uint32_t(units), fl, sl);
+
+	uint32_t sl_mask = second_level_masks[fl] & (~0u << sl);
+	if (!sl_mask)
+	{
+		uint32_t fl_mask = fl + 1 < FirstLevelCount ? (first_level_mask & (~0u << (fl + 1))) : 0u;
+		if (!fl_mask)
+			return nullptr;
+
+		fl = trailing_zeroes(fl_mask);
+		sl_mask = second_level_masks[fl];
+	}
+
+	sl = trailing_zeroes(sl_mask);
+	return free_lists[fl][sl];
+}
+
+TLSFBlock *TLSFHeap::split(TLSFBlock *block, uint32_t new_size)
+{
+	auto *remainder = pool->allocate();
+	if (!remainder)
+		return nullptr;
+
+	*remainder = {};
+	remainder->offset = block->offset + new_size;
+	remainder->size = block->size - new_size;
+	remainder->prev_physical = block;
+	remainder->next_physical = block->next_physical;
+	if (block->next_physical)
+		block->next_physical->prev_physical = remainder;
+	block->next_physical = remainder;
+	block->size = new_size;
+	return remainder;
+}
+
+void TLSFHeap::merge_with_next(TLSFBlock *block)
+{
+	auto *next = block->next_physical;
+	block->size += next->size;
+	block->next_physical = next->next_physical;
+	if (next->next_physical)
+		next->next_physical->prev_physical = block;
+	pool->free(next);
+}
+
+TLSFBlock *TLSFHeap::allocate(uint32_t alloc_size, uint32_t alignment)
+{
+	assert(is_pow2(alignment));
+	uint32_t granularity = 1u << granularity_log2;
+	alignment = std::max(alignment, granularity);
+
+	uint64_t units = (uint64_t(alloc_size) + granularity - 1) >> granularity_log2;
+	units = std::max<uint64_t>(units, 1);
+
+	// Worst case padding needed to reach the alignment. Offsets are always multiples of the granularity.
+	uint64_t padding_units = (alignment - granularity) >> granularity_log2;
+
+	auto *block = find_free_block(units + padding_units);
+	if (!block)
+		return nullptr;
+
+	remove_free(block);
+
+	uint32_t padding = ((block->offset + alignment - 1) & ~(alignment - 1)) - block->offset;
+	if (padding)
+	{
+		// The padding stays behind as a free block of its own.
+		// The block before it cannot be free, since free neighbours are always merged.
+		auto *aligned = split(block, padding);
+		if (!aligned)
+		{
+			insert_free(block);
+			return nullptr;
+		}
+
+		insert_free(block);
+		block = aligned;
+	}
+
+	uint32_t block_size = uint32_t(units << granularity_log2);
+	if (block->size > block_size)
+	{
+		auto *remainder = split(block, block_size);
+		if (remainder)
+			insert_free(remainder);
+	}
+
+	block->is_free = false;
+	used_size += block->size;
+	num_allocations++;
+	return block;
+}
+
+void TLSFHeap::free(TLSFBlock *block)
+{
+	assert(!block->is_free);
+	used_size -= block->size;
+	num_allocations--;
+
+	if (block->next_physical && block->next_physical->is_free)
+	{
+		remove_free(block->next_physical);
+		merge_with_next(block);
+	}
+
+	if (block->prev_physical && block->prev_physical->is_free)
+	{
+		auto *prev = block->prev_physical;
+		remove_free(prev);
+		merge_with_next(prev);
+		block = prev;
+	}
+
+	insert_free(block);
+}
+
+uint32_t TLSFHeap::get_largest_free_block() const
+{
+	if (!first_level_mask)
+		return 0;
+
+	uint32_t fl = 31 - leading_zeroes(first_level_mask);
+	uint32_t sl = 31 - leading_zeroes(second_level_masks[fl]);
+
+	uint32_t largest = 0;
+	for (auto *block = free_lists[fl][sl]; block; block = block->next_free)
+		largest = std::max(largest, block->size);
+	return largest;
+}
+
+TLSFStatistics TLSFHeap::get_statistics() const
+{
+	TLSFStatistics stats;
+	stats.total_size = size;
+	stats.used_size = used_size;
+	stats.largest_free_block = get_largest_free_block();
+	stats.num_heaps = 1;
+	stats.num_allocations = num_allocations;
+	stats.num_free_blocks = num_free_blocks;
+	return stats;
+}
+}
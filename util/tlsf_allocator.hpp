@@ -0,0 +1,260 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include "intrusive_list.hpp"
+#include "logging.hpp"
+#include "object_pool.hpp"
+#include "bitops.hpp"
+
+namespace Util
+{
+struct TLSFBlock
+{
+	uint32_t offset;
+	uint32_t size;
+	TLSFBlock *prev_physical;
+	TLSFBlock *next_physical;
+	TLSFBlock *prev_free;
+	TLSFBlock *next_free;
+	bool is_free;
+};
+
+struct TLSFStatistics
+{
+	uint64_t total_size = 0;
+	uint64_t used_size = 0;
+	uint64_t largest_free_block = 0;
+	uint32_t num_heaps = 0;
+	uint32_t num_allocations = 0;
+	uint32_t num_free_blocks = 0;
+
+	// 0 when all free space is in one block, approaching 1 as free space is split into small holes.
+	inline float get_fragmentation() const
+	{
+		uint64_t free_size = total_size - used_size;
+		if (free_size == 0)
+			return 0.0f;
+		return float(1.0 - double(largest_free_block) / double(free_size));
+	}
+
+	inline void accumulate(const TLSFStatistics &other)
+	{
+		total_size += other.total_size;
+		used_size += other.used_size;
+		if (other.largest_free_block > largest_free_block)
+			largest_free_block = other.largest_free_block;
+		num_heaps += other.num_heaps;
+		num_allocations += other.num_allocations;
+		num_free_blocks += other.num_free_blocks;
+	}
+};
+
+// Two-level segregated fit allocator.
+// Free blocks are binned by power of two, then linearly into SecondLevelCount bins,
+// so finding a fitting block and coalescing on free are both O(1).
+// Like LegionAllocator, this is logical and only hands out offsets.
+class TLSFHeap
+{
+public:
+	enum
+	{
+		SecondLevelBits = 4,
+		SecondLevelCount = 1u << SecondLevelBits,
+		FirstLevelCount = 32
+	};
+
+	TLSFHeap(const TLSFHeap &) = delete;
+	void operator=(const TLSFHeap &) = delete;
+
+	TLSFHeap() = default;
+	~TLSFHeap();
+
+	// granularity must be a power of two, and size a multiple of it.
+	// Every offset and size handed out is a multiple of granularity.
+	bool init(ObjectPool<TLSFBlock> *pool, uint32_t size, uint32_t granularity);
+
+	// alignment must be a power of two. Returns nullptr if no free block is large enough.
+	TLSFBlock *allocate(uint32_t size, uint32_t alignment);
+	void free(TLSFBlock *block);
+
+	inline bool empty() const
+	{
+		return num_allocations == 0;
+	}
+
+	inline uint32_t get_size() const
+	{
+		return size;
+	}
+
+	inline uint32_t get_used_size() const
+	{
+		return used_size;
+	}
+
+	inline uint32_t get_num_allocations() const
+	{
+		return num_allocations;
+	}
+
+	inline uint32_t get_num_free_blocks() const
+	{
+		return num_free_blocks;
+	}
+
+	// Only walks the highest non-empty bin.
+	uint32_t get_largest_free_block() const;
+
+	TLSFStatistics get_statistics() const;
+
+private:
+	ObjectPool<TLSFBlock> *pool = nullptr;
+	TLSFBlock *free_lists[FirstLevelCount][SecondLevelCount] = {};
+	uint32_t first_level_mask = 0;
+	uint32_t second_level_masks[FirstLevelCount] = {};
+	TLSFBlock *first_block = nullptr;
+
+	uint32_t size = 0;
+	uint32_t granularity_log2 = 0;
+	uint32_t used_size = 0;
+	uint32_t num_allocations = 0;
+	uint32_t num_free_blocks = 0;
+
+	void insert_free(TLSFBlock *block);
+	void remove_free(TLSFBlock *block);
+	TLSFBlock *find_free_block(uint64_t units) const;
+	TLSFBlock *split(TLSFBlock *block, uint32_t new_size);
+	void merge_with_next(TLSFBlock *block);
+};
+
+// Represents that a TLSF heap is backed by some kind of allocation.
+template <typename BackingAllocation>
+struct TLSFArenaHeap : Util::IntrusiveListEnabled<TLSFArenaHeap<BackingAllocation>>
+{
+	BackingAllocation allocation;
+	Util::TLSFHeap heap;
+};
+
+// Sub-allocates arbitrarily sized blocks out of large backing allocations of a fixed size.
+// The backing allocation is supplied through the same curious recurring template calls as ArenaAllocator:
+// allocate_backing_heap(), free_backing_heap() and prepare_allocation().
+template <typename DerivedAllocator, typename BackingAllocation>
+class TLSFArenaAllocator
+{
+public:
+	using Heap = TLSFArenaHeap<BackingAllocation>;
+
+	~TLSFArenaAllocator()
+	{
+		if (heaps.begin())
+			LOGE("Memory leaked in TLSF allocator!\n");
+	}
+
+	inline void set_heap_size(uint32_t size, uint32_t granularity)
+	{
+		assert(Util::is_pow2(granularity));
+		assert((size & (granularity - 1)) == 0);
+		heap_size = size;
+		heap_granularity = granularity;
+	}
+
+	inline uint32_t get_heap_size() const
+	{
+		return heap_size;
+	}
+
+	inline uint32_t get_granularity() const
+	{
+		return heap_granularity;
+	}
+
+	inline bool allocate(uint32_t size, uint32_t alignment, BackingAllocation *alloc)
+	{
+		if (size == 0 || size > heap_size)
+			return false;
+
+		// Older heaps are tried first so that newer ones get a chance to drain and be released.
+		for (auto itr = heaps.begin(); itr != heaps.end(); ++itr)
+		{
+			auto *block = itr->heap.allocate(size, alignment);
+			if (block)
+			{
+				static_cast<DerivedAllocator *>(this)->prepare_allocation(alloc, itr.get(), block);
+				return true;
+			}
+		}
+
+		auto *node = heap_pool.allocate();
+		if (!node)
+			return false;
+
+		if (!node->heap.init(&block_pool, heap_size, heap_granularity) ||
+		    !static_cast<DerivedAllocator *>(this)->allocate_backing_heap(&node->allocation))
+		{
+			heap_pool.free(node);
+			return false;
+		}
+
+		auto *block = node->heap.allocate(size, alignment);
+		if (!block)
+		{
+			static_cast<DerivedAllocator *>(this)->free_backing_heap(&node->allocation);
+			heap_pool.free(node);
+			return false;
+		}
+
+		heaps.insert_back(node);
+		static_cast<DerivedAllocator *>(this)->prepare_allocation(alloc, node, block);
+		return true;
+	}
+
+	inline void free(Heap *heap, TLSFBlock *block)
+	{
+		heap->heap.free(block);
+		if (heap->heap.empty())
+		{
+			static_cast<DerivedAllocator *>(this)->free_backing_heap(&heap->allocation);
+			heaps.erase(heap);
+			heap_pool.free(heap);
+		}
+	}
+
+	TLSFStatistics get_statistics() const
+	{
+		TLSFStatistics stats;
+		for (auto itr = heaps.begin(); itr != heaps.end(); ++itr)
+			stats.accumulate(itr->heap.get_statistics());
+		return stats;
+	}
+
+protected:
+	Util::IntrusiveList<Heap> heaps;
+	Util::ObjectPool<Heap> heap_pool;
+	Util::ObjectPool<TLSFBlock> block_pool;
+	uint32_t heap_size = 0;
+	uint32_t heap_granularity = 1;
+};
+}
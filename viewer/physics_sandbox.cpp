@@ -223,6 +223,7 @@ struct PhysicsSandboxApplication : Application, EventHandler
 				c.positions = collision_mesh.positions.front().data;
 				c.position_stride = sizeof(vec4);
 				c.aabb = mesh.static_aabb;
+				c.bvh_cache_directory = "cache://collision-bvh";
 				gltf_mesh_physics_index = GRANITE_PHYSICS()->register_collision_mesh(c);
 			}
 
@@ -3501,7 +3501,7 @@ DeviceAllocationOwnerHandle Device::take_device_allocation_ownership(Image &imag
 		return DeviceAllocationOwnerHandle{};
 	}
 
-	if (!image.get_allocation().alloc || !image.get_allocation().base)
+	if (image.get_allocation().allocation_is_global() || !image.get_allocation().base)
 		return DeviceAllocationOwnerHandle{};
 
 	return DeviceAllocationOwnerHandle(handle_pool.allocations.allocate(this, image.take_allocation_ownership()));
@@ -3531,6 +3531,12 @@ void Device::get_memory_budget(HeapBudget *budget)
 	managers.memory.get_memory_budget(budget);
 }
 
+Util::TLSFStatistics Device::get_large_allocation_statistics()
+{
+	LOCK_MEMORY();
+	return managers.memory.get_large_allocation_statistics();
+}
+
 ImageHandle Device::create_image(const ImageCreateInfo &create_info, const ImageInitialData *initial)
 {
 	if (initial)
@@ -431,6 +431,7 @@ public:
 	}
 
 	void get_memory_budget(HeapBudget *budget);
+	Util::TLSFStatistics get_large_allocation_statistics();
 
 	const Sampler &get_stock_sampler(StockSampler sampler) const;
 
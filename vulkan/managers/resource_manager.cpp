@@ -53,6 +53,8 @@ ResourceManager::~ResourceManager()
 	if (manager)
 		manager->set_asset_instantiator_interface(nullptr);
 
+	mesh_defragmentation_budget = 0;
+
 	// Ensure resource releases go through.
 	latch_handles();
 }
@@ -565,11 +567,14 @@ void ResourceManager::instantiate_asset_mesh(Granite::AssetManager &manager_,
 
 			Meshlet::decode_mesh(*cmd, info, view);
 
+			// defragment_mesh_buffers() copies latchable meshes on the graphics queue,
+			// so the copy stage must wait for the decode as well.
 			Semaphore sem;
 			device->submit(cmd, nullptr, 1, &sem);
 			device->add_wait_semaphore(CommandBuffer::Type::Generic, std::move(sem),
 			                           VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT |
-			                           VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, false);
+			                           VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT |
+			                           VK_PIPELINE_STAGE_2_COPY_BIT, false);
 		}
 	}
 
@@ -710,6 +715,139 @@ void ResourceManager::latch_handles()
 		}
 	}
 	updates.clear();
+
+	if (mesh_defragmentation_budget)
+	{
+		defragment_mesh_buffers(mesh_defragmentation_budget);
+		mesh_defragmentation_budget = 0;
+	}
+}
+
+void ResourceManager::request_mesh_defragmentation(VkDeviceSize max_copy_size)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	mesh_defragmentation_budget = max_copy_size;
+}
+
+ResourceManager::MeshBufferStatistics ResourceManager::get_mesh_buffer_statistics()
+{
+	std::lock_guard<std::mutex> holder{mesh_allocator_lock};
+	MeshBufferStatistics stats;
+
+	if (mesh_encoding == MeshEncoding::MeshletEncoded)
+	{
+		stats.index_or_payload = mesh_payload_allocator.get_statistics();
+		stats.attr_or_stream = mesh_stream_allocator.get_statistics();
+		stats.indirect_or_header = mesh_header_allocator.get_statistics();
+	}
+	else
+	{
+		stats.index_or_payload = index_buffer_allocator.get_statistics();
+		stats.attr_or_stream = attribute_buffer_allocator.get_statistics();
+		stats.indirect_or_header = indirect_buffer_allocator.get_statistics();
+	}
+
+	return stats;
+}
+
+void ResourceManager::defragment_mesh_buffers(VkDeviceSize max_copy_size)
+{
+	// The meshlet paths store absolute offsets in meshlet headers, streams and indirect draws,
+	// so moving their data would need a fixup pass on the GPU as well.
+	if (mesh_encoding != MeshEncoding::Classic)
+	{
+		LOGW("Mesh defragmentation is only supported with classic mesh encoding.\n");
+		return;
+	}
+
+	std::lock_guard<std::mutex> holder_alloc{mesh_allocator_lock};
+
+	// Meshes which are not latchable yet may still be uploading, so they stay in place.
+	// Latchable meshes have queued their decode semaphore with a wait at the copy stage,
+	// which the defragmentation submission below consumes.
+	std::vector<Util::AllocatedSlice *> index_slices;
+	std::vector<Util::AllocatedSlice *> attr_slices;
+	std::vector<uint32_t> mesh_ids;
+	for (uint32_t id = 0, n = uint32_t(assets.size()); id < n; id++)
+	{
+		auto &asset = assets[id];
+		if (asset.asset_class == Granite::AssetClass::Mesh && asset.latchable && asset.mesh.index_or_payload.alloc)
+		{
+			index_slices.push_back(&asset.mesh.index_or_payload);
+			attr_slices.push_back(&asset.mesh.attr_or_stream);
+			mesh_ids.push_back(id);
+		}
+	}
+
+	auto cmd = device->request_command_buffer();
+	Util::SliceDefragmentationPlan plan;
+	VkDeviceSize remaining = max_copy_size;
+	VkDeviceSize copied = 0;
+	uint32_t released_heaps = 0;
+	bool has_copies = false;
+
+	auto defragment = [&](MeshBufferAllocator &allocator, std::vector<Util::AllocatedSlice *> &slices) {
+		VkDeviceSize element_size = 0;
+		for (unsigned i = 0; i < allocator.get_soa_count(); i++)
+			element_size += allocator.get_element_size(i);
+
+		allocator.plan_defragmentation(slices.data(), slices.size(), plan, remaining / element_size);
+		remaining -= plan.moved_count * element_size;
+		copied += plan.moved_count * element_size;
+		released_heaps += plan.released_heaps;
+
+		allocator.apply_defragmentation(plan, [&](const Util::SliceMove *moves, size_t count) {
+			if (has_copies)
+			{
+				// A pass may copy into space which the previous pass vacated.
+				cmd->barrier(VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+				             VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT);
+			}
+			else
+			{
+				// Space freed since the last latch may still be read by draws and culling
+				// from earlier frames on this queue.
+				cmd->barrier(VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT |
+				             VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+				             VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+				             VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+			}
+			allocator.record_defragmentation_copies(*cmd, moves, count);
+			has_copies = true;
+		});
+	};
+
+	defragment(index_buffer_allocator, index_slices);
+	defragment(attribute_buffer_allocator, attr_slices);
+
+	if (!has_copies)
+	{
+		device->submit_discard(cmd);
+		return;
+	}
+
+	cmd->barrier(VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+	             VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT |
+	             VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+	             VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+
+	// New meshes are decoded on the async compute queue and may land in the regions we just vacated.
+	// This must be ordered before mesh_allocator_lock is released.
+	Semaphore sem;
+	device->submit(cmd, nullptr, 1, &sem);
+	device->add_wait_semaphore(CommandBuffer::Type::AsyncCompute, std::move(sem),
+	                           VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, false);
+
+	for (auto id : mesh_ids)
+	{
+		auto &asset = assets[id];
+		asset.mesh.draw.indexed.firstIndex = asset.mesh.index_or_payload.offset;
+		asset.mesh.draw.indexed.vertexOffset = int32_t(asset.mesh.attr_or_stream.offset);
+		draws[id] = asset.mesh.draw;
+	}
+
+	LOGI("Mesh defragmentation copied %llu KiB and released %u heaps.\n",
+	     static_cast<unsigned long long>(copied / 1024), released_heaps);
 }
 
 const Buffer *ResourceManager::get_index_buffer() const
@@ -772,6 +910,11 @@ void MeshBufferAllocator::set_soa_count(unsigned soa_count)
 	global_allocator.soa_count = soa_count;
 }
 
+unsigned MeshBufferAllocator::get_soa_count() const
+{
+	return global_allocator.soa_count;
+}
+
 void MeshBufferAllocator::set_element_size(unsigned soa_index, uint32_t element_size)
 {
 	VK_ASSERT(soa_index < global_allocator.soa_count);
@@ -798,6 +941,30 @@ const Buffer *MeshBufferAllocator::get_buffer(unsigned index, unsigned soa_index
 		return nullptr;
 }
 
+void MeshBufferAllocator::record_defragmentation_copies(CommandBuffer &cmd, const Util::SliceMove *moves,
+                                                       size_t count) const
+{
+	Util::SmallVector<VkBufferCopy> copies;
+	copies.reserve(count);
+
+	for (unsigned soa_index = 0; soa_index < global_allocator.soa_count; soa_index++)
+	{
+		VkDeviceSize element_size = global_allocator.element_size[soa_index];
+		for (size_t i = 0; i < count; i++)
+		{
+			// MeshGlobalAllocator only ever hands out one global buffer.
+			VK_ASSERT(moves[i].src.buffer_index == 0 && moves[i].dst.buffer_index == 0);
+			copies.push_back({ moves[i].src.offset * element_size,
+			                   moves[i].dst.offset * element_size,
+			                   moves[i].src.count * element_size });
+		}
+
+		auto *buffer = get_buffer(0, soa_index);
+		cmd.copy_buffer(*buffer, *buffer, copies.data(), copies.size());
+		copies.clear();
+	}
+}
+
 namespace Internal
 {
 uint32_t MeshGlobalAllocator::allocate(uint32_t count)
@@ -34,6 +34,7 @@
 namespace Vulkan
 {
 class MemoryMappedTexture;
+class CommandBuffer;
 
 namespace Internal
 {
@@ -67,10 +68,14 @@ class MeshBufferAllocator : public Util::SliceAllocator
 public:
 	MeshBufferAllocator(Device &device, uint32_t sub_block_size, uint32_t num_sub_blocks_in_arena_log2);
 	void set_soa_count(unsigned soa_count);
+	unsigned get_soa_count() const;
 	void set_element_size(unsigned soa_index, uint32_t element_size);
 	uint32_t get_element_size(unsigned soa_index) const;
 	const Buffer *get_buffer(unsigned index, unsigned soa_index) const;
 
+	// Copies every SoA buffer for one pass of a defragmentation plan.
+	void record_defragmentation_copies(CommandBuffer &cmd, const Util::SliceMove *moves, size_t count) const;
+
 private:
 	Internal::MeshGlobalAllocator global_allocator;
 };
@@ -138,6 +143,19 @@ public:
 
 	const Buffer *get_cluster_bounds_buffer() const;
 
+	struct MeshBufferStatistics
+	{
+		Util::SliceAllocatorStatistics index_or_payload;
+		Util::SliceAllocatorStatistics attr_or_stream;
+		Util::SliceAllocatorStatistics indirect_or_header;
+	};
+	MeshBufferStatistics get_mesh_buffer_statistics();
+
+	// Compacts the mesh buffers in the next latch_handles(), copying at most max_copy_size bytes.
+	// Draw ranges of moved meshes are patched before they are latched.
+	// Only MeshEncoding::Classic is supported, the other encodings bake buffer offsets into GPU data.
+	void request_mesh_defragmentation(VkDeviceSize max_copy_size);
+
 private:
 	Device *device;
 	Granite::AssetManager *manager = nullptr;
@@ -193,7 +211,9 @@ private:
 	MeshBufferAllocator mesh_payload_allocator;
 
 	MeshEncoding mesh_encoding = MeshEncoding::Classic;
+	VkDeviceSize mesh_defragmentation_budget = 0;
 
 	bool allocate_asset_mesh(Granite::AssetID id, const Meshlet::MeshView &view);
+	void defragment_mesh_buffers(VkDeviceSize max_copy_size);
 };
 }
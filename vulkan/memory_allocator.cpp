@@ -52,11 +52,17 @@ static bool allocation_mode_supports_bda(AllocationMode mode)
 
 void DeviceAllocation::free_immediate()
 {
-	if (!alloc)
+	if (alloc)
+		alloc->free(heap, mask);
+	else if (tlsf_alloc)
+		tlsf_alloc->free(tlsf_heap, tlsf_block);
+	else
 		return;
 
-	alloc->free(heap, mask);
 	alloc = nullptr;
+	tlsf_alloc = nullptr;
+	tlsf_heap = nullptr;
+	tlsf_block = nullptr;
 	base = VK_NULL_HANDLE;
 	mask = 0;
 	offset = 0;
@@ -103,7 +109,7 @@ ExternalHandle DeviceAllocation::export_handle(Device &device)
 
 void DeviceAllocation::free_immediate(DeviceAllocator &allocator)
 {
-	if (alloc)
+	if (alloc || tlsf_alloc)
 		free_immediate();
 	else if (base)
 	{
@@ -186,6 +192,50 @@ void ClassAllocator::free_backing_heap(DeviceAllocation *allocation)
 		allocation->free_global(*global_allocator, sub_block_size * Util::LegionAllocator::NumSubBlocks, memory_type);
 }
 
+bool TLSFAllocator::allocate_backing_heap(DeviceAllocation *alloc)
+{
+	alloc->offset = 0;
+	alloc->host_base = nullptr;
+	alloc->mode = global_allocator_mode;
+	alloc->memory_type = memory_type;
+
+	return global_allocator->internal_allocate(
+	    get_heap_size(), memory_type, global_allocator_mode, &alloc->base,
+	    mode_request_host_mapping(global_allocator_mode) ? &alloc->host_base : nullptr,
+	    VK_OBJECT_TYPE_DEVICE, 0, nullptr);
+}
+
+void TLSFAllocator::free_backing_heap(DeviceAllocation *allocation)
+{
+	assert(allocation->mode == global_allocator_mode);
+	assert(allocation->memory_type == memory_type);
+
+	// Goes back to the recycle list in DeviceAllocator, so a chunk which drains and refills is not reallocated.
+	allocation->free_global(*global_allocator, get_heap_size(), memory_type);
+}
+
+void TLSFAllocator::prepare_allocation(DeviceAllocation *alloc, Heap *heap, Util::TLSFBlock *block)
+{
+	alloc->tlsf_heap = heap;
+	alloc->tlsf_block = block;
+	alloc->base = heap->allocation.base;
+	alloc->offset = heap->allocation.offset + block->offset;
+	alloc->mask = 0;
+	alloc->size = block->size;
+	alloc->host_base = nullptr;
+
+	if (heap->allocation.host_base)
+		alloc->host_base = heap->allocation.host_base + block->offset;
+
+	VK_ASSERT(heap->allocation.mode == global_allocator_mode);
+	VK_ASSERT(heap->allocation.memory_type == memory_type);
+
+	alloc->mode = global_allocator_mode;
+	alloc->memory_type = memory_type;
+	alloc->alloc = nullptr;
+	alloc->tlsf_alloc = this;
+}
+
 bool Allocator::allocate_global(uint32_t size, AllocationMode mode, DeviceAllocation *alloc)
 {
 	// Fall back to global allocation, do not recycle.
@@ -243,6 +293,20 @@ DeviceAllocation DeviceAllocation::make_imported_allocation(VkDeviceMemory memor
 
 bool Allocator::allocate(uint32_t size, uint32_t alignment, AllocationMode mode, DeviceAllocation *alloc)
 {
+	auto &large_allocator = large[unsigned(mode)];
+	if (size > get_class_allocator(MemoryClass::Large, mode).get_max_allocation_size() &&
+	    size <= large_allocator.get_heap_size() / 4)
+	{
+		if (large_allocator.allocate(size, alignment, alloc))
+		{
+			VK_ASSERT(alloc->mode == mode);
+			VK_ASSERT(alloc->memory_type == memory_type);
+			return true;
+		}
+
+		// If a new chunk could not be allocated, the smaller paths below may still fit.
+	}
+
 	for (auto &c : classes)
 	{
 		auto &suballocator = c[unsigned(mode)];
@@ -312,6 +376,20 @@ Allocator::Allocator(Util::ObjectPool<MiniHeap> &object_pool)
 	}
 }
 
+void Allocator::set_large_heap_size(uint32_t heap_size)
+{
+	for (auto &l : large)
+		l.set_heap_size(heap_size, 4096);
+}
+
+Util::TLSFStatistics Allocator::get_large_allocation_statistics() const
+{
+	Util::TLSFStatistics stats;
+	for (auto &l : large)
+		stats.accumulate(l.get_statistics());
+	return stats;
+}
+
 void DeviceAllocator::init(Device *device_)
 {
 	device = device_;
@@ -378,6 +456,21 @@ void DeviceAllocator::init(Device *device_)
 			}
 		}
 	}
+
+	// Chunks for large allocations are at most 256 MiB and 1/8th of the heap.
+	// Budget critical heaps keep allocating exactly what is needed.
+	for (uint32_t i = 0; i < mem_props.memoryTypeCount; i++)
+	{
+		uint32_t heap_index = mem_props.memoryTypes[i].heapIndex;
+		VkDeviceSize heap_size = mem_props.memoryHeaps[heap_index].size;
+		uint32_t chunk_size = 256u * 1024u * 1024u;
+		while (chunk_size > heap_size / 8)
+			chunk_size >>= 1;
+
+		if (memory_heap_is_budget_critical[heap_index] || chunk_size < 64u * 1024u * 1024u)
+			chunk_size = 0;
+		allocators[i]->set_large_heap_size(chunk_size);
+	}
 }
 
 bool DeviceAllocator::allocate_generic_memory(uint32_t size, uint32_t alignment, AllocationMode mode,
@@ -573,6 +666,14 @@ void DeviceAllocator::get_memory_budget(HeapBudget *heap_budgets)
 	get_memory_budget_nolock(heap_budgets);
 }
 
+Util::TLSFStatistics DeviceAllocator::get_large_allocation_statistics() const
+{
+	Util::TLSFStatistics stats;
+	for (auto &allocator : allocators)
+		stats.accumulate(allocator->get_large_allocation_statistics());
+	return stats;
+}
+
 bool DeviceAllocator::internal_allocate(
 	uint32_t size, uint32_t memory_type, AllocationMode mode,
 	VkDeviceMemory *memory, uint8_t **host_memory,
@@ -31,6 +31,7 @@
 #include "enum_cast.hpp"
 #include "vulkan_common.hpp"
 #include "arena_allocator.hpp"
+#include "tlsf_allocator.hpp"
 #include <assert.h>
 #include <memory>
 #include <stddef.h>
@@ -73,16 +74,20 @@ struct DeviceAllocation;
 class DeviceAllocator;
 
 class ClassAllocator;
+class TLSFAllocator;
 class DeviceAllocator;
 class Allocator;
 class Device;
 
 using MiniHeap = Util::LegionHeap<DeviceAllocation>;
+using TLSFMiniHeap = Util::TLSFArenaHeap<DeviceAllocation>;
 
 struct DeviceAllocation
 {
 	friend class Util::ArenaAllocator<ClassAllocator, DeviceAllocation>;
+	friend class Util::TLSFArenaAllocator<TLSFAllocator, DeviceAllocation>;
 	friend class ClassAllocator;
+	friend class TLSFAllocator;
 	friend class Allocator;
 	friend class DeviceAllocator;
 	friend class Device;
@@ -96,7 +101,7 @@ public:
 
 	inline bool allocation_is_global() const
 	{
-		return !alloc && base;
+		return !alloc && !tlsf_alloc && base;
 	}
 
 	inline uint32_t get_offset() const
@@ -128,6 +133,9 @@ private:
 	uint8_t *host_base = nullptr;
 	ClassAllocator *alloc = nullptr;
 	Util::IntrusiveList<MiniHeap>::Iterator heap = {};
+	TLSFAllocator *tlsf_alloc = nullptr;
+	TLSFMiniHeap *tlsf_heap = nullptr;
+	Util::TLSFBlock *tlsf_block = nullptr;
 	uint32_t offset = 0;
 	uint32_t mask = 0;
 	uint32_t size = 0;
@@ -200,6 +208,31 @@ private:
 	                        const Util::SuballocationResult &suballoc);
 };
 
+// Sub-allocates blocks which are too large for the class allocators out of big VkDeviceMemory chunks.
+// Unlike the class allocators, sizes are not rounded to a power of two number of sub-blocks.
+class TLSFAllocator : public Util::TLSFArenaAllocator<TLSFAllocator, DeviceAllocation>
+{
+public:
+	friend class Util::TLSFArenaAllocator<TLSFAllocator, DeviceAllocation>;
+
+	inline void set_global_allocator(DeviceAllocator *allocator, AllocationMode mode, uint32_t memory_type_)
+	{
+		global_allocator = allocator;
+		global_allocator_mode = mode;
+		memory_type = memory_type_;
+	}
+
+private:
+	uint32_t memory_type = 0;
+	DeviceAllocator *global_allocator = nullptr;
+	AllocationMode global_allocator_mode = AllocationMode::Count;
+
+	// Implements curious recurring template pattern calls.
+	bool allocate_backing_heap(DeviceAllocation *allocation);
+	void free_backing_heap(DeviceAllocation *allocation);
+	void prepare_allocation(DeviceAllocation *allocation, Heap *heap, Util::TLSFBlock *block);
+};
+
 class Allocator
 {
 public:
@@ -228,11 +261,20 @@ public:
 		for (auto &sub : classes)
 			for (int i = 0; i < Util::ecast(AllocationMode::Count); i++)
 				sub[i].set_global_allocator(allocator, AllocationMode(i), memory_type);
+		for (int i = 0; i < Util::ecast(AllocationMode::Count); i++)
+			large[i].set_global_allocator(allocator, AllocationMode(i), memory_type);
 		global_allocator = allocator;
 	}
 
+	// Allocations larger than the Large class and up to a quarter of heap_size are carved out of
+	// heap_size chunks with a TLSF allocator. 0 disables this, and such allocations use the Huge class
+	// or vkAllocateMemory directly.
+	void set_large_heap_size(uint32_t heap_size);
+	Util::TLSFStatistics get_large_allocation_statistics() const;
+
 private:
 	ClassAllocator classes[Util::ecast(MemoryClass::Count)][Util::ecast(AllocationMode::Count)];
+	TLSFAllocator large[Util::ecast(AllocationMode::Count)];
 	DeviceAllocator *global_allocator = nullptr;
 	uint32_t memory_type = 0;
 };
@@ -265,6 +307,11 @@ public:
 
 	void get_memory_budget(HeapBudget *heaps);
 
+	// Summed over all memory types and allocation modes.
+	// Like allocation and freeing, this must be called with the device memory lock held,
+	// use Device::get_large_allocation_statistics() from outside the device.
+	Util::TLSFStatistics get_large_allocation_statistics() const;
+
 	bool internal_allocate(uint32_t size, uint32_t memory_type, AllocationMode mode,
 	                       VkDeviceMemory *memory, uint8_t **host_memory,
 	                       VkObjectType object_type, uint64_t dedicated_object, ExternalHandle *external);